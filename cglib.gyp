@@ -181,6 +181,10 @@
         'cglib/cg-glsl-shader-private.h',
         'cglib/cg-sub-texture.c',
         'cglib/cg-sampler-cache.c',
+        'cglib/cg-program-binary-cache.c',
+        'cglib/cg-program-binary-cache-private.h',
+        'cglib/cg-shader-manifest.c',
+        'cglib/cg-shader-manifest-private.h',
         'cglib/cg-texture-2d-gl.h',
         'cglib/cg-gles2-types.h',
         'cglib/cg-magazine.c',
@@ -198,6 +202,10 @@
         'cglib/cg-onscreen.c',
         'cglib/cg-meta-texture.h',
         'cglib/cg-primitive.c',
+        'cglib/cg-journal.c',
+        'cglib/cg-journal-private.h',
+        'cglib/cg-vertex-ring.c',
+        'cglib/cg-vertex-ring-private.h',
         'cglib/cg-meta-texture.c',
         'cglib/cg-debug-options.h',
         'cglib/cg-indices.c',
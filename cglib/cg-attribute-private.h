@@ -55,6 +55,10 @@ typedef struct _cg_attribute_name_state_t {
     int name_index;
     bool normalized_default;
     int layer_number;
+    /* The generic attribute location that gets bound to this name
+     * before linking any program, or -1 if the name doesn't have a
+     * fixed location */
+    int fixed_location;
 } cg_attribute_name_state_t;
 
 struct _cg_attribute_t {
@@ -79,11 +83,21 @@ struct _cg_attribute_t {
     int immutable_ref;
     int instance_stride;
 
+    /* Incremented whenever the attribute is modified so that any
+     * state derived from it, such as a cached vertex array object,
+     * can be validated */
+    unsigned int age;
+
     unsigned int normalized : 1;
     unsigned int is_buffered : 1;
+    /* Set for attributes initialized with _cg_attribute_init_from_desc()
+     * which are embedded in the caller's storage and can't be
+     * referenced */
+    unsigned int is_temporary : 1;
 };
 
 typedef enum {
+    CG_DRAW_SKIP_JOURNAL_FLUSH = 1 << 0,
     CG_DRAW_SKIP_FRAMEBUFFER_FLUSH = 1 << 1,
     /* This forcibly disables the debug option to divert all drawing to
      * wireframes */
@@ -103,15 +117,33 @@ cg_attribute_t *_cg_attribute_immutable_ref(cg_attribute_t *attribute);
 
 void _cg_attribute_immutable_unref(cg_attribute_t *attribute);
 
+/* Initializes a temporary attribute from a description so it can be
+ * passed to the internal drawing functions. The attribute doesn't
+ * hold any references and must not be referenced or unreferenced. */
+void _cg_attribute_init_from_desc(cg_attribute_t *attribute,
+                                  const cg_attribute_desc_t *desc);
+
+/* Convenience wrapper to initialize a temporary attribute with the
+ * same arguments as cg_attribute_new(). Returns @attribute or NULL if
+ * the arguments weren't valid. */
+cg_attribute_t *_cg_attribute_init_temporary(cg_attribute_t *attribute,
+                                             cg_attribute_buffer_t *buffer,
+                                             const char *name,
+                                             size_t stride,
+                                             size_t offset,
+                                             int n_components,
+                                             cg_attribute_type_t type);
+
 typedef struct {
     int unit;
     cg_pipeline_flush_options_t options;
     uint32_t fallback_layers;
 } cg_flush_layer_state_t;
 
-void _cg_flush_attributes_state(cg_framebuffer_t *framebuffer,
+bool _cg_flush_attributes_state(cg_framebuffer_t *framebuffer,
                                 cg_pipeline_t *pipeline,
                                 cg_draw_flags_t flags,
+                                cg_primitive_t *primitive,
                                 cg_attribute_t **attributes,
                                 int n_attributes);
 
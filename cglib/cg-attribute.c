@@ -60,8 +60,24 @@
 #endif
 
 static void _cg_attribute_free(cg_attribute_t *attribute);
+static void _cg_attribute_unref(void *object);
 
-CG_OBJECT_DEFINE(Attribute, attribute);
+CG_OBJECT_DEFINE_WITH_CODE(Attribute,
+                           attribute,
+                           _cg_attribute_class.virt_unref =
+                               _cg_attribute_unref);
+
+static void
+_cg_attribute_unref(void *object)
+{
+    cg_attribute_t *attribute = object;
+
+    /* A temporary attribute lives in storage owned by the caller so
+     * it can never be released */
+    c_return_if_fail(!attribute->is_temporary);
+
+    _cg_object_default_unref(object);
+}
 
 static bool
 validate_cg_attribute_name(const char *name,
@@ -106,6 +122,26 @@ validate_cg_attribute_name(const char *name,
     return true;
 }
 
+/* Some names such as "cg_tex_coord_in" are aliases for another GLSL
+ * name so they have to share the same fixed location */
+static int
+find_fixed_attribute_location(cg_device_t *dev, const char *real_name)
+{
+    int i;
+
+    for (i = 0; i < dev->n_attribute_names - 1; i++) {
+        cg_attribute_name_state_t *name_state =
+            c_array_index(dev->attribute_name_index_map,
+                          cg_attribute_name_state_t *,
+                          i);
+
+        if (strcmp(name_state->name, real_name) == 0)
+            return name_state->fixed_location;
+    }
+
+    return -1;
+}
+
 cg_attribute_name_state_t *
 _cg_attribute_register_attribute_name(cg_device_t *dev, const char *name)
 {
@@ -131,6 +167,18 @@ _cg_attribute_register_attribute_name(cg_device_t *dev, const char *name)
     if (name_state->name == NULL)
         name_state->name = name_copy;
 
+    /* GL requires the position to be bound to generic attribute 0 */
+    if (name_state->name_id == CG_ATTRIBUTE_NAME_ID_POSITION_ARRAY)
+        name_state->fixed_location = 0;
+    else {
+        name_state->fixed_location =
+            find_fixed_attribute_location(dev, name_state->name);
+
+        if (name_state->fixed_location == -1 &&
+            dev->next_fixed_attribute_location < dev->max_vertex_attribs)
+            name_state->fixed_location = dev->next_fixed_attribute_location++;
+    }
+
     c_hash_table_insert(dev->attribute_name_states_hash, name_copy,
                         name_state);
 
@@ -209,6 +257,7 @@ cg_attribute_new(cg_attribute_buffer_t *attribute_buffer,
     cg_device_t *dev = buffer->dev;
 
     attribute->is_buffered = true;
+    attribute->is_temporary = false;
 
     attribute->name_state =
         c_hash_table_lookup(dev->attribute_name_states_hash, name);
@@ -229,6 +278,7 @@ cg_attribute_new(cg_attribute_buffer_t *attribute_buffer,
     attribute->instance_stride = 0;
 
     attribute->immutable_ref = 0;
+    attribute->age = 0;
 
     if (attribute->name_state->name_id != CG_ATTRIBUTE_NAME_ID_CUSTOM_ARRAY) {
         if (!validate_n_components(attribute->name_state, n_components))
@@ -253,24 +303,31 @@ _cg_attribute_new_const(cg_device_t *dev,
                         const float *value)
 {
     cg_attribute_t *attribute = c_slice_new0(cg_attribute_t);
+    cg_attribute_name_state_t *name_state;
 
-    attribute->name_state =
-        c_hash_table_lookup(dev->attribute_name_states_hash, name);
-    if (!attribute->name_state) {
-        cg_attribute_name_state_t *name_state =
-            _cg_attribute_register_attribute_name(dev, name);
+    name_state = c_hash_table_lookup(dev->attribute_name_states_hash, name);
+    if (!name_state) {
+        name_state = _cg_attribute_register_attribute_name(dev, name);
         if (!name_state)
             goto error;
-        attribute->name_state = name_state;
     }
+    attribute->name_state = name_state;
 
     if (!validate_n_components(attribute->name_state, n_components))
         goto error;
 
+    /* A matrix attribute takes up a location for each column which
+     * would alias the fixed locations of the following names so its
+     * location will have to be queried from each program instead */
+    if (n_columns > 1)
+        name_state->fixed_location = -1;
+
     attribute->is_buffered = false;
     attribute->normalized = false;
     attribute->instance_stride = 0;
     attribute->immutable_ref = 0;
+    attribute->age = 0;
+    attribute->is_temporary = false;
 
     attribute->d.constant.dev = cg_object_ref(dev);
 
@@ -455,15 +512,17 @@ cg_attribute_get_normalized(cg_attribute_t *attribute)
     return attribute->normalized;
 }
 
+/* Attributes used by drawing that is batched in a journal are
+ * immutable until the journal has been flushed so we implicitly flush
+ * all journals before they are modified. */
 static void
-warn_about_midscene_changes(void)
+flush_journals(cg_attribute_t *attribute)
 {
-    static bool seen = false;
-    if (!seen) {
-        c_warning("Mid-scene modification of attributes has "
-                  "undefined results\n");
-        seen = true;
-    }
+    if (attribute->is_buffered) {
+        cg_buffer_t *buffer = CG_BUFFER(attribute->d.buffered.attribute_buffer);
+        _cg_flush(buffer->dev);
+    } else
+        _cg_flush(attribute->d.constant.dev);
 }
 
 void
@@ -472,9 +531,10 @@ cg_attribute_set_normalized(cg_attribute_t *attribute, bool normalized)
     c_return_if_fail(cg_is_attribute(attribute));
 
     if (C_UNLIKELY(attribute->immutable_ref))
-        warn_about_midscene_changes();
+        flush_journals(attribute);
 
     attribute->normalized = normalized;
+    attribute->age++;
 }
 
 void
@@ -483,9 +543,10 @@ cg_attribute_set_instance_stride(cg_attribute_t *attribute, int stride)
     c_return_if_fail(cg_is_attribute(attribute));
 
     if (C_UNLIKELY(attribute->immutable_ref))
-        warn_about_midscene_changes();
+        flush_journals(attribute);
 
     attribute->instance_stride = stride;
+    attribute->age++;
 }
 
 int
@@ -513,41 +574,148 @@ cg_attribute_set_buffer(cg_attribute_t *attribute,
     c_return_if_fail(attribute->is_buffered);
 
     if (C_UNLIKELY(attribute->immutable_ref))
-        warn_about_midscene_changes();
+        flush_journals(attribute);
 
     cg_object_ref(attribute_buffer);
 
     cg_object_unref(attribute->d.buffered.attribute_buffer);
     attribute->d.buffered.attribute_buffer = attribute_buffer;
+    attribute->age++;
+}
+
+bool
+cg_attribute_desc_init(cg_attribute_desc_t *desc,
+                       cg_attribute_buffer_t *attribute_buffer,
+                       const char *name,
+                       size_t stride,
+                       size_t offset,
+                       int n_components,
+                       cg_attribute_type_t type)
+{
+    cg_device_t *dev;
+    cg_attribute_name_state_t *name_state;
+
+    c_return_val_if_fail(cg_is_attribute_buffer(attribute_buffer), false);
+
+    dev = CG_BUFFER(attribute_buffer)->dev;
+
+    name_state = c_hash_table_lookup(dev->attribute_name_states_hash, name);
+    if (!name_state) {
+        name_state = _cg_attribute_register_attribute_name(dev, name);
+        if (!name_state)
+            return false;
+    }
+
+    if (!validate_n_components(name_state, n_components))
+        return false;
+
+    desc->buffer = attribute_buffer;
+    desc->name_state = name_state;
+    desc->stride = stride;
+    desc->offset = offset;
+    desc->n_components = n_components;
+    desc->type = type;
+    desc->normalized = name_state->normalized_default;
+    desc->instance_stride = 0;
+
+    return true;
+}
+
+void
+cg_attribute_desc_set_normalized(cg_attribute_desc_t *desc, bool normalized)
+{
+    desc->normalized = normalized;
+}
+
+void
+cg_attribute_desc_set_instance_stride(cg_attribute_desc_t *desc, int stride)
+{
+    desc->instance_stride = stride;
+}
+
+void
+_cg_attribute_init_from_desc(cg_attribute_t *attribute,
+                             const cg_attribute_desc_t *desc)
+{
+    cg_object_t *obj = &attribute->_parent;
+
+    /* The attribute is never freed so it only needs enough of an
+     * object header to pass the cg_is_attribute() checks */
+    obj->klass = &_cg_attribute_class;
+    obj->user_data_array = NULL;
+    obj->n_user_data_entries = 0;
+    obj->ref_count = 1;
+
+    attribute->name_state = desc->name_state;
+    attribute->d.buffered.attribute_buffer = desc->buffer;
+    attribute->d.buffered.stride = desc->stride;
+    attribute->d.buffered.offset = desc->offset;
+    attribute->d.buffered.n_components = desc->n_components;
+    attribute->d.buffered.type = desc->type;
+    attribute->immutable_ref = 0;
+    attribute->instance_stride = desc->instance_stride;
+    attribute->age = 0;
+    attribute->normalized = desc->normalized;
+    attribute->is_buffered = true;
+    attribute->is_temporary = true;
 }
 
 cg_attribute_t *
-_cg_attribute_immutable_ref(cg_attribute_t *attribute)
+_cg_attribute_init_temporary(cg_attribute_t *attribute,
+                             cg_attribute_buffer_t *attribute_buffer,
+                             const char *name,
+                             size_t stride,
+                             size_t offset,
+                             int n_components,
+                             cg_attribute_type_t type)
 {
-    cg_buffer_t *buffer = CG_BUFFER(attribute->d.buffered.attribute_buffer);
+    cg_attribute_desc_t desc;
+
+    if (!cg_attribute_desc_init(&desc,
+                                attribute_buffer,
+                                name,
+                                stride,
+                                offset,
+                                n_components,
+                                type))
+        return NULL;
+
+    _cg_attribute_init_from_desc(attribute, &desc);
 
+    return attribute;
+}
+
+cg_attribute_t *
+_cg_attribute_immutable_ref(cg_attribute_t *attribute)
+{
     c_return_val_if_fail(cg_is_attribute(attribute), NULL);
+    c_return_val_if_fail(!attribute->is_temporary, NULL);
 
     attribute->immutable_ref++;
-    _cg_buffer_immutable_ref(buffer);
+    if (attribute->is_buffered)
+        _cg_buffer_immutable_ref(
+            CG_BUFFER(attribute->d.buffered.attribute_buffer));
     return attribute;
 }
 
 void
 _cg_attribute_immutable_unref(cg_attribute_t *attribute)
 {
-    cg_buffer_t *buffer = CG_BUFFER(attribute->d.buffered.attribute_buffer);
-
     c_return_if_fail(cg_is_attribute(attribute));
+    c_return_if_fail(!attribute->is_temporary);
     c_return_if_fail(attribute->immutable_ref > 0);
 
     attribute->immutable_ref--;
-    _cg_buffer_immutable_unref(buffer);
+    if (attribute->is_buffered)
+        _cg_buffer_immutable_unref(
+            CG_BUFFER(attribute->d.buffered.attribute_buffer));
 }
 
 static void
 _cg_attribute_free(cg_attribute_t *attribute)
 {
+    c_return_if_fail(!attribute->is_temporary);
+
     if (attribute->is_buffered)
         cg_object_unref(attribute->d.buffered.attribute_buffer);
     else
@@ -584,16 +752,20 @@ done:
     return true;
 }
 
-void
+bool
 _cg_flush_attributes_state(cg_framebuffer_t *framebuffer,
                            cg_pipeline_t *pipeline,
                            cg_draw_flags_t flags,
+                           cg_primitive_t *primitive,
                            cg_attribute_t **attributes,
                            int n_attributes)
 {
     cg_device_t *dev = framebuffer->dev;
     cg_flush_layer_state_t layers_state;
 
+    if (!(flags & CG_DRAW_SKIP_JOURNAL_FLUSH))
+        _cg_framebuffer_flush(framebuffer);
+
     layers_state.unit = 0;
     layers_state.options.flags = 0;
     layers_state.fallback_layers = 0;
@@ -613,8 +785,9 @@ _cg_flush_attributes_state(cg_framebuffer_t *framebuffer,
     /* track when the framebuffer is drawn too */
     _cg_framebuffer_mark_mid_scene(framebuffer);
 
-    dev->driver_vtable->flush_attributes_state(
-        framebuffer, pipeline, &layers_state, flags, attributes, n_attributes);
+    return dev->driver_vtable->flush_attributes_state(
+        framebuffer, pipeline, &layers_state, flags, primitive,
+        attributes, n_attributes);
 }
 
 int
@@ -576,6 +576,98 @@ cg_attribute_buffer_t *cg_attribute_get_buffer(cg_attribute_t *attribute);
 void cg_attribute_set_buffer(cg_attribute_t *attribute,
                              cg_attribute_buffer_t *attribute_buffer);
 
+/**
+ * cg_attribute_desc_t:
+ *
+ * A lightweight description of a buffered attribute that can be
+ * declared on the stack and drawn with
+ * cg_framebuffer_draw_attribute_descs(). Unlike a #cg_attribute_t it
+ * isn't reference counted and it doesn't take a reference on its
+ * #cg_attribute_buffer_t so the buffer has to be kept alive for as
+ * long as the description is used.
+ *
+ * A description must be initialized with cg_attribute_desc_init()
+ * before it is used. The attribute name is only looked up once at
+ * that point so a description can be kept and reused for later draws.
+ *
+ * Stability: unstable
+ */
+typedef struct {
+    /*< private >*/
+    cg_attribute_buffer_t *CG_PRIVATE(buffer);
+    const void *CG_PRIVATE(name_state);
+    size_t CG_PRIVATE(stride);
+    size_t CG_PRIVATE(offset);
+    int CG_PRIVATE(n_components);
+    cg_attribute_type_t CG_PRIVATE(type);
+    bool CG_PRIVATE(normalized);
+    int CG_PRIVATE(instance_stride);
+} cg_attribute_desc_t;
+
+/**
+ * cg_attribute_desc_init:
+ * @desc: A #cg_attribute_desc_t struct
+ * @attribute_buffer: The #cg_attribute_buffer_t containing the actual
+ *                    attribute data
+ * @name: The name of the attribute (used to reference it from GLSL)
+ * @stride: The number of bytes to jump to get to the next attribute
+ *          value for the next vertex. (Usually
+ *          <literal>sizeof (MyVertex)</literal>)
+ * @offset: The byte offset from the start of @attribute_buffer for
+ *          the first attribute value. (Usually
+ *          <literal>offsetof (MyVertex, component0)</literal>
+ * @components: The number of components (e.g. 4 for an rgba color or
+ *              3 for and (x,y,z) position)
+ * @type: FIXME
+ *
+ * Initializes @desc to describe the same layout as a #cg_attribute_t
+ * created with cg_attribute_new() would, without allocating anything.
+ * The attribute is normalized according to the same defaults as
+ * cg_attribute_new().
+ *
+ * Return value: %true if @desc was initialized or %false if @name or
+ *               @components were not valid.
+ *
+ * Stability: unstable
+ */
+bool cg_attribute_desc_init(cg_attribute_desc_t *desc,
+                            cg_attribute_buffer_t *attribute_buffer,
+                            const char *name,
+                            size_t stride,
+                            size_t offset,
+                            int components,
+                            cg_attribute_type_t type);
+
+/**
+ * cg_attribute_desc_set_normalized:
+ * @desc: A #cg_attribute_desc_t initialized with
+ *        cg_attribute_desc_init()
+ * @normalized: The new value for the normalized property.
+ *
+ * Sets whether fixed point attribute types are mapped to the range
+ * 0→1 in the same way as cg_attribute_set_normalized().
+ *
+ * Stability: unstable
+ */
+void cg_attribute_desc_set_normalized(cg_attribute_desc_t *desc,
+                                      bool normalized);
+
+/**
+ * cg_attribute_desc_set_instance_stride:
+ * @desc: A #cg_attribute_desc_t initialized with
+ *        cg_attribute_desc_init()
+ * @stride: Number of instances the gpu should process before
+ *          progressing to the next value of the attribute, or %0 to
+ *          progress per vertex
+ *
+ * Sets how often the attribute advances when drawing multiple
+ * instances in the same way as cg_attribute_set_instance_stride().
+ *
+ * Stability: unstable
+ */
+void cg_attribute_desc_set_instance_stride(cg_attribute_desc_t *desc,
+                                           int stride);
+
 /**
  * cg_is_attribute:
  * @object: A #cg_object_t
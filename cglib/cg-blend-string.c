@@ -566,11 +566,11 @@ error: {
     }
 }
 
-bool
-_cg_blend_string_compile(cg_device_t *dev,
-                         const char *string,
-                         cg_blend_string_statement_t *statements,
-                         cg_error_t **error)
+static int
+compile_blend_string(cg_device_t *dev,
+                     const char *string,
+                     cg_blend_string_statement_t *statements,
+                     cg_error_t **error)
 {
     const char *p = string;
     const char *mark = NULL;
@@ -731,25 +731,79 @@ error: {
     }
 }
 
+/* The maximum number of compiled blend strings to keep in
+ * dev->blend_string_cache. Applications tend to use only a handful of
+ * blend strings so if this is reached the cache is simply emptied */
+#define BLEND_STRING_CACHE_SIZE 64
+
+typedef struct {
+    int count;
+    cg_blend_string_statement_t statements[2];
+} cg_blend_string_cache_entry_t;
+
+int
+_cg_blend_string_compile(cg_device_t *dev,
+                         const char *string,
+                         cg_blend_string_statement_t *statements,
+                         cg_error_t **error)
+{
+    cg_blend_string_cache_entry_t *entry;
+    int count;
+
+    /* The statements only refer to static data so a string that has
+     * been compiled before can just be copied out of the cache
+     * without being parsed and validated again */
+    entry = c_hash_table_lookup(dev->blend_string_cache, string);
+    if (entry) {
+        memcpy(statements,
+               entry->statements,
+               sizeof(cg_blend_string_statement_t) * entry->count);
+        return entry->count;
+    }
+
+    count = compile_blend_string(dev, string, statements, error);
+
+    /* Invalid strings aren't cached so that the error is reported
+     * every time */
+    if (!count)
+        return 0;
+
+    if (c_hash_table_size(dev->blend_string_cache) >= BLEND_STRING_CACHE_SIZE)
+        c_hash_table_remove_all(dev->blend_string_cache);
+
+    entry = c_new(cg_blend_string_cache_entry_t, 1);
+    entry->count = count;
+    memcpy(entry->statements,
+           statements,
+           sizeof(cg_blend_string_statement_t) * count);
+    c_hash_table_insert(dev->blend_string_cache, c_strdup(string), entry);
+
+    return count;
+}
+
 TEST(blend_string_parsing)
 {
     struct {
         const char *string;
         bool should_pass;
+        int n_statements;
     } tests[] =
     {
       { "RGBA = ADD(SRC_COLOR*(SRC_COLOR[A]), "
               "DST_COLOR*(1-SRC_COLOR[A]))",
-              true, },
+              true, 1, },
       { "RGBA = ADD(SRC_COLOR,\nDST_COLOR*(0))",
-              true, },
+              true, 1, },
       { "RGBA = ADD(SRC_COLOR, 0)",
-              true, },
+              true, 1, },
       { "RGBA = ADD()",
-              false, /* missing arguments */
+              false, 0, /* missing arguments */
       },
       { "RGBA = ADD(SRC_COLOR, DST_COLOR)",
-              true, },
+              true, 1, },
+      { "RGB = ADD(SRC_COLOR, DST_COLOR)\n"
+        "A = ADD(SRC_COLOR, 0)",
+              true, 2, },
       { NULL } };
     int i;
 
@@ -758,7 +812,10 @@ TEST(blend_string_parsing)
     cg_error_t *error = NULL;
     for (i = 0; tests[i].string; i++) {
         cg_blend_string_statement_t statements[2];
-        _cg_blend_string_compile(
+        cg_blend_string_statement_t cached_statements[2];
+        int count;
+
+        count = _cg_blend_string_compile(
             test_dev, tests[i].string, statements, &error);
         if (tests[i].should_pass) {
             if (error) {
@@ -766,7 +823,23 @@ TEST(blend_string_parsing)
                         tests[i].string);
                 c_assert_cmpstr("", ==, error->message);
             }
+
+            c_assert_cmpint(count, ==, tests[i].n_statements);
+
+            /* Compiling the same string again should give the same
+             * statements from the cache */
+            c_assert_cmpint(_cg_blend_string_compile(test_dev,
+                                                     tests[i].string,
+                                                     cached_statements,
+                                                     NULL),
+                            ==,
+                            count);
+            c_assert(memcmp(statements,
+                            cached_statements,
+                            sizeof(cg_blend_string_statement_t) * count) ==
+                     0);
         } else {
+            c_assert_cmpint(count, ==, 0);
             c_assert(error);
             cg_error_free(error);
             error = NULL;
@@ -94,10 +94,10 @@ typedef struct _cg_blend_string_statement_t {
     cg_blend_string_argument_t args[3];
 } cg_blend_string_statement_t;
 
-bool _cg_blend_string_compile(cg_device_t *dev,
-                              const char *string,
-                              cg_blend_string_statement_t *statements,
-                              cg_error_t **error);
+int _cg_blend_string_compile(cg_device_t *dev,
+                             const char *string,
+                             cg_blend_string_statement_t *statements,
+                             cg_error_t **error);
 
 void
 _cg_blend_string_split_rgba_statement(cg_blend_string_statement_t *statement,
@@ -47,6 +47,7 @@
 #include "cg-device-private.h"
 #include "cg-object-private.h"
 #include "cg-pixel-buffer-private.h"
+#include "cg-private.h"
 
 /* XXX:
  * The cg_object_t macros don't support any form of inheritance, so for
@@ -201,17 +202,6 @@ cg_buffer_get_update_hint(cg_buffer_t *buffer)
     return buffer->update_hint;
 }
 
-static void
-warn_about_midscene_changes(void)
-{
-    static bool seen = false;
-    if (!seen) {
-        c_warning("Mid-scene modification of buffers has "
-                  "undefined results\n");
-        seen = true;
-    }
-}
-
 void *
 cg_buffer_map(cg_buffer_t *buffer,
               cg_buffer_access_t access,
@@ -234,8 +224,12 @@ cg_buffer_map_range(cg_buffer_t *buffer,
     c_return_val_if_fail(cg_is_buffer(buffer), NULL);
     c_return_val_if_fail(!(buffer->flags & CG_BUFFER_FLAG_MAPPED), NULL);
 
+    /* Buffers used by drawing that is batched in a journal are
+     * immutable until the journal has been flushed. Rather than
+     * forcing applications to track this we implicitly flush all
+     * journals before the buffer is modified. */
     if (C_UNLIKELY(buffer->immutable_ref))
-        warn_about_midscene_changes();
+        _cg_flush(buffer->dev);
 
     buffer->data =
         buffer->vtable.map_range(buffer, offset, size, access, hints, error);
@@ -340,7 +334,7 @@ cg_buffer_set_data(cg_buffer_t *buffer,
     c_return_val_if_fail((offset + size) <= buffer->size, false);
 
     if (C_UNLIKELY(buffer->immutable_ref))
-        warn_about_midscene_changes();
+        _cg_flush(buffer->dev);
 
     return buffer->vtable.set_data(buffer, offset, data, size, error);
 }
@@ -190,6 +190,13 @@ typedef enum { /*< prefix=CG_BUFFER_ACCESS >*/
  *    replace all the contents of the mapped region. The contents of
  *    the region specified are undefined after this flag is used to
  *    map a buffer.
+ * @CG_BUFFER_MAP_HINT_UNSYNCHRONIZED: Tells CGlib that it doesn't
+ *    need to wait for the GPU to finish with any commands that are
+ *    still using the buffer before mapping it. It is the
+ *    application's responsibility to make sure it doesn't modify any
+ *    data that is still needed by pending commands, for example by
+ *    using a fence. This hint can't be used to map a buffer for
+ *    reading.
  *
  * Hints to CGlib about how you are planning to modify the data once it
  * is mapped.
@@ -198,7 +205,8 @@ typedef enum { /*< prefix=CG_BUFFER_ACCESS >*/
  */
 typedef enum { /*< prefix=CG_BUFFER_MAP_HINT >*/
     CG_BUFFER_MAP_HINT_DISCARD = 1 << 0,
-    CG_BUFFER_MAP_HINT_DISCARD_RANGE = 1 << 1
+    CG_BUFFER_MAP_HINT_DISCARD_RANGE = 1 << 1,
+    CG_BUFFER_MAP_HINT_UNSYNCHRONIZED = 1 << 2
 } cg_buffer_map_hint_t;
 
 /**
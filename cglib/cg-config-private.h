@@ -40,5 +40,6 @@ extern char *_cg_config_driver;
 extern char *_cg_config_renderer;
 extern char *_cg_config_disable_gl_extensions;
 extern char *_cg_config_override_gl_version;
+extern char *_cg_config_program_cache_dir;
 
 #endif /* __CG_CONFIG_PRIVATE_H */
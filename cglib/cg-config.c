@@ -43,6 +43,7 @@ char *_cg_config_driver;
 char *_cg_config_renderer;
 char *_cg_config_disable_gl_extensions;
 char *_cg_config_override_gl_version;
+char *_cg_config_program_cache_dir;
 
 #ifndef CG_HAS_GLIB_SUPPORT
 
@@ -61,7 +62,8 @@ static const struct {
     { "CG_DRIVER", &_cg_config_driver },
     { "CG_RENDERER", &_cg_config_renderer },
     { "CG_DISABLE_GL_EXTENSIONS", &_cg_config_disable_gl_extensions },
-    { "CG_OVERRIDE_GL_VERSION", &_cg_config_override_gl_version }
+    { "CG_OVERRIDE_GL_VERSION", &_cg_config_override_gl_version },
+    { "CG_PROGRAM_CACHE_DIR", &_cg_config_program_cache_dir }
 };
 
 static void
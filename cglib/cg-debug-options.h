@@ -59,6 +59,16 @@ OPT(DRAW,
     "draw",
     N_("Trace Misc Drawing"),
     N_("Trace some misc drawing operations"))
+OPT(JOURNAL,
+    N_("CGlib Tracing"),
+    "journal",
+    N_("Trace Journal"),
+    N_("View all the geometry passing through the journal"))
+OPT(BATCHING,
+    N_("CGlib Tracing"),
+    "batching",
+    N_("Trace Batching"),
+    N_("Show how geometry is being batched in the journal"))
 OPT(PANGO,
     N_("CGlib Tracing"),
     "pango",
@@ -168,6 +178,24 @@ OPT(DISABLE_FAST_READ_PIXEL,
     N_("Disable read pixel optimization"),
     N_("Disable optimization for reading 1px for simple "
        "scenes of opaque rectangles"))
+OPT(DISABLE_UNIFORM_BUFFERS,
+    N_("Root Cause"),
+    "disable-uniform-buffers",
+    N_("Disable uniform buffers"),
+    N_("Upload the builtin matrices with glUniform instead of "
+       "a shared uniform buffer object"))
+OPT(DISABLE_VERTEX_ARRAYS,
+    N_("Root Cause"),
+    "disable-vertex-arrays",
+    N_("Disable vertex array caching"),
+    N_("Set up the attribute arrays for every draw instead of "
+       "rebinding a vertex array object cached for the primitive"))
+OPT(DISABLE_TEXTURE_UNIT_REMAP,
+    N_("Root Cause"),
+    "disable-texture-unit-remap",
+    N_("Disable texture unit remapping"),
+    N_("Always flush layer N to texture unit N instead of reusing "
+       "texture units that already have the layer's texture bound"))
 OPT(CLIPPING,
     N_("CGlib Tracing"),
     "clipping",
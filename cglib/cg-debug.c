@@ -51,6 +51,8 @@ static const c_debug_key_t cg_log_debug_keys[] = {
     { "blend-strings", CG_DEBUG_BLEND_STRINGS },
     { "matrices", CG_DEBUG_MATRICES },
     { "draw", CG_DEBUG_DRAW },
+    { "journal", CG_DEBUG_JOURNAL },
+    { "batching", CG_DEBUG_BATCHING },
     { "opengl", CG_DEBUG_OPENGL },
     { "pango", CG_DEBUG_PANGO },
     { "show-source", CG_DEBUG_SHOW_SOURCE },
@@ -79,7 +81,10 @@ static const c_debug_key_t cg_behavioural_debug_keys[] = {
     { "wireframe", CG_DEBUG_WIREFRAME },
     { "disable-software-clip", CG_DEBUG_DISABLE_SOFTWARE_CLIP },
     { "disable-program-caches", CG_DEBUG_DISABLE_PROGRAM_CACHES },
-    { "disable-fast-read-pixel", CG_DEBUG_DISABLE_FAST_READ_PIXEL }
+    { "disable-fast-read-pixel", CG_DEBUG_DISABLE_FAST_READ_PIXEL },
+    { "disable-uniform-buffers", CG_DEBUG_DISABLE_UNIFORM_BUFFERS },
+    { "disable-vertex-arrays", CG_DEBUG_DISABLE_VERTEX_ARRAYS },
+    { "disable-texture-unit-remap", CG_DEBUG_DISABLE_TEXTURE_UNIT_REMAP }
 };
 static const int n_cg_behavioural_debug_keys =
     C_N_ELEMENTS(cg_behavioural_debug_keys);
@@ -70,6 +70,9 @@ typedef enum {
     CG_DEBUG_DISABLE_SOFTWARE_CLIP,
     CG_DEBUG_DISABLE_PROGRAM_CACHES,
     CG_DEBUG_DISABLE_FAST_READ_PIXEL,
+    CG_DEBUG_DISABLE_UNIFORM_BUFFERS,
+    CG_DEBUG_DISABLE_VERTEX_ARRAYS,
+    CG_DEBUG_DISABLE_TEXTURE_UNIT_REMAP,
     CG_DEBUG_CLIPPING,
     CG_DEBUG_WINSYS,
     CG_DEBUG_PERFORMANCE,
@@ -56,12 +56,16 @@
 #include "cg-texture-2d.h"
 #include "cg-texture-3d.h"
 #include "cg-sampler-cache-private.h"
+#include "cg-program-binary-cache-private.h"
+#include "cg-shader-manifest-private.h"
 #include "cg-gpu-info-private.h"
 #include "cg-gl-header.h"
 #include "cg-framebuffer-private.h"
 #include "cg-onscreen-private.h"
 #include "cg-fence-private.h"
+#include "cg-vertex-ring-private.h"
 #include "cg-loop-private.h"
+#include "cg-magazine-private.h"
 #include "cg-private.h"
 
 typedef struct {
@@ -126,13 +130,30 @@ struct _cg_device_t {
     c_array_t *attribute_name_index_map;
     int n_attribute_names;
 
+    /* Attribute names are assigned fixed generic attribute locations
+     * as they are registered until there are no more left */
+    int max_vertex_attribs;
+    int next_fixed_attribute_location;
+
     CGlibBitmask enabled_custom_attributes;
+    /* The attribute locations that currently have a non-zero vertex
+     * attrib divisor */
+    CGlibBitmask instanced_custom_attributes;
 
     /* A temporary bitmask that is used when enabling/disabling
      * custom attribute arrays */
     CGlibBitmask enable_custom_attributes_tmp;
     CGlibBitmask changed_bits_tmp;
 
+    /* The vertex array object used when drawing attributes that
+     * don't have a cached vertex array. The attribute bitmasks above
+     * track the state of this object. */
+    GLuint default_vertex_array;
+    GLuint current_vertex_array;
+    /* The index buffer captured in the element array binding of the
+     * current vertex array or NULL if it doesn't have one */
+    cg_buffer_t *current_vertex_array_index_buffer;
+
     /* A few handy matrix constants */
     c_matrix_t identity_matrix;
     c_matrix_t y_flip_matrix;
@@ -144,20 +165,76 @@ struct _cg_device_t {
 
     cg_matrix_entry_t identity_entry;
 
+    /* Allocators for the matrix stack entries created against this
+     * device and the matrices they own. Only the thread that created
+     * the device (identified by matrix_magazine_owner) touches the
+     * magazines or the entries' reference counts. References released
+     * on any other thread are queued in matrix_entry_returns and
+     * released by the owner on its next allocation */
+    cg_magazine_t *matrix_entry_magazine;
+    cg_magazine_t *matrix_magazine;
+    void *matrix_magazine_owner;
+    c_mutex_t matrix_entry_returns_mutex;
+    c_llist_t *matrix_entry_returns;
+
     /* A cache of the last (immutable) matrix stack entries that were
      * flushed to the GL matrix builtins */
     cg_matrix_entry_cache_t builtin_flushed_projection;
     cg_matrix_entry_cache_t builtin_flushed_modelview;
 
+    /* When uniform buffer objects are available the builtin matrices
+     * are written to successive slots of this buffer which is bound
+     * to a uniform block shared by all of the programs. The flushed
+     * entry caches above track what was written to the current slot */
+    GLuint builtin_uniform_buffer;
+    GLintptr builtin_uniform_buffer_offset;
+    GLsizeiptr builtin_uniform_buffer_stride;
+    int builtin_flushed_flip;
+
     c_array_t *texture_units;
     int active_texture_unit;
 
+    /* The texture unit that each layer of the last flushed pipeline
+     * was assigned to, indexed by the layer's position. Texture units
+     * are picked by how recently they were used so that layers can
+     * reuse a unit that already has their texture bound */
+    c_array_t *texture_unit_map;
+    unsigned int texture_unit_age;
+    cg_texture_unit_stats_t texture_unit_stats;
+
     /* Pipelines */
     cg_pipeline_t *opaque_color_pipeline; /* to check for simple pipelines */
     c_string_t *codegen_header_buffer;
     c_string_t *codegen_source_buffer;
 
     cg_pipeline_cache_t *pipeline_cache;
+    int pipeline_cache_capacities[CG_PIPELINE_CACHE_N_TABLES];
+
+    /* Copies of pipelines deeper than this are parented on a flattened
+     * copy of the source pipeline instead. 0 disables flattening */
+    int pipeline_max_ancestry_depth;
+
+    /* Linked programs persisted between runs. This is NULL if no cache
+     * directory has been configured or the driver can't retrieve
+     * program binaries */
+    char *program_cache_directory;
+    size_t program_cache_max_size;
+    cg_program_binary_cache_t *program_binary_cache;
+
+    /* Programs that were submitted for compiling without waiting for
+     * the result. See cg_device_set_async_shader_compile() */
+    bool async_shader_compile;
+    cg_pipeline_t *async_shader_fallback_pipeline;
+    c_list_t pending_programs;
+    cg_poll_source_t *pending_programs_poll_source;
+    c_list_t program_ready_closures;
+
+    /* See cg_device_set_shader_manifest_recording() and
+     * cg_device_prewarm_from_manifest() */
+    bool record_shader_manifest;
+    cg_shader_manifest_t *recorded_shader_manifest;
+    char *prewarm_shader_manifest_filename;
+    cg_shader_manifest_t *prewarm_shader_manifest;
 
     /* Textures */
     cg_texture_2d_t *default_gl_texture_2d_tex;
@@ -208,6 +285,14 @@ struct _cg_device_t {
     cg_indices_t *rectangle_short_indices;
     int rectangle_short_indices_len;
 
+    /* Streaming buffer used to upload transient vertex data */
+    cg_vertex_ring_t *vertex_ring;
+
+    /* State for cg_framebuffer_draw_rectangles_instanced() */
+    cg_attribute_buffer_t *unit_quad_buffer;
+    cg_snippet_t *instanced_rect_snippet;
+    cg_snippet_t *instanced_rect_tex_snippet;
+
     cg_pipeline_t *texture_download_pipeline;
     cg_pipeline_t *blit_texture_pipeline;
 
@@ -280,6 +365,11 @@ struct _cg_device_t {
     c_hash_table_t *uniform_name_hash;
     int n_uniform_names;
 
+    /* Compiled blend strings keyed by the string so that pipelines
+     * repeatedly created with the same blend string don't have to
+     * parse it each time. See _cg_blend_string_compile() */
+    c_hash_table_t *blend_string_cache;
+
     cg_poll_source_t *fences_poll_source;
     c_list_t fences;
 
@@ -354,6 +444,11 @@ char **_cg_device_get_gl_extensions(cg_device_t *dev);
 
 const char *_cg_device_get_gl_version(cg_device_t *dev);
 
+/* Whether GPU programs should actually be compiled asynchronously.
+ * This is only done when the driver can report when a link has
+ * finished without blocking. See cg_device_set_async_shader_compile() */
+bool _cg_device_use_async_shader_compile(cg_device_t *dev);
+
 cg_atlas_set_t *_cg_get_atlas_set(cg_device_t *dev);
 
 #endif /* __CG_DEVICE_PRIVATE_H */
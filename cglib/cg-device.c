@@ -47,6 +47,9 @@
 #include "cg-atlas-texture-private.h"
 #include "cg-pipeline-private.h"
 #include "cg-pipeline-opengl-private.h"
+#ifdef CG_PIPELINE_PROGEND_GLSL
+#include "cg-pipeline-progend-glsl-private.h"
+#endif
 #include "cg-framebuffer-private.h"
 #include "cg-onscreen-private.h"
 #include "cg-attribute-private.h"
@@ -120,6 +123,7 @@ cg_device_t *
 cg_device_new(void)
 {
     cg_device_t *dev;
+    int i;
 
     _cg_init();
 
@@ -157,6 +161,18 @@ cg_device_new(void)
 
     dev->rectangle_state = CG_WINSYS_RECTANGLE_STATE_UNKNOWN;
 
+    dev->program_cache_max_size = CG_PROGRAM_BINARY_CACHE_DEFAULT_MAX_SIZE;
+
+    for (i = 0; i < CG_PIPELINE_CACHE_N_TABLES; i++)
+        dev->pipeline_cache_capacities[i] = CG_PIPELINE_CACHE_DEFAULT_CAPACITY;
+
+    dev->pipeline_max_ancestry_depth = CG_PIPELINE_DEFAULT_MAX_ANCESTRY_DEPTH;
+
+    _cg_matrix_stack_init_magazines(dev);
+
+    c_list_init(&dev->pending_programs);
+    c_list_init(&dev->program_ready_closures);
+
     memset(dev->winsys_features, 0, sizeof(dev->winsys_features));
 
     return dev;
@@ -174,6 +190,167 @@ cg_device_set_renderer(cg_device_t *dev, cg_renderer_t *renderer)
     dev->renderer = renderer;
 }
 
+void
+cg_device_set_program_cache_directory(cg_device_t *dev, const char *directory)
+{
+    c_return_if_fail(!dev->connected);
+
+    c_free(dev->program_cache_directory);
+    dev->program_cache_directory = c_strdup(directory);
+}
+
+void
+cg_device_set_program_cache_max_size(cg_device_t *dev, size_t max_size)
+{
+    c_return_if_fail(!dev->connected);
+
+    dev->program_cache_max_size = max_size;
+}
+
+void
+cg_device_set_async_shader_compile(cg_device_t *dev, bool enable)
+{
+    dev->async_shader_compile = enable;
+}
+
+bool
+cg_device_get_async_shader_compile(cg_device_t *dev)
+{
+    return dev->async_shader_compile;
+}
+
+bool
+_cg_device_use_async_shader_compile(cg_device_t *dev)
+{
+    /* Without GL_KHR_parallel_shader_compile there's no way to find
+     * out whether a link has finished without waiting for it so
+     * skipping the first draw wouldn't save anything */
+    return dev->async_shader_compile && dev->glMaxShaderCompilerThreads;
+}
+
+void
+cg_device_set_async_shader_fallback_pipeline(cg_device_t *dev,
+                                             cg_pipeline_t *pipeline)
+{
+    if (pipeline)
+        cg_object_ref(pipeline);
+
+    if (dev->async_shader_fallback_pipeline)
+        cg_object_unref(dev->async_shader_fallback_pipeline);
+
+    dev->async_shader_fallback_pipeline = pipeline;
+}
+
+cg_program_ready_closure_t *
+cg_device_add_program_ready_callback(cg_device_t *dev,
+                                     cg_program_ready_callback_t callback,
+                                     void *user_data,
+                                     cg_user_data_destroy_callback_t destroy)
+{
+    return _cg_closure_list_add(
+        &dev->program_ready_closures, callback, user_data, destroy);
+}
+
+void
+cg_device_remove_program_ready_callback(cg_device_t *dev,
+                                        cg_program_ready_closure_t *closure)
+{
+    c_return_if_fail(closure);
+
+    _cg_closure_disconnect(closure);
+}
+
+void
+cg_device_set_shader_manifest_recording(cg_device_t *dev, bool enable)
+{
+    dev->record_shader_manifest = enable;
+
+    if (enable && dev->recorded_shader_manifest == NULL)
+        dev->recorded_shader_manifest = _cg_shader_manifest_new(dev);
+}
+
+bool
+cg_device_save_shader_manifest(cg_device_t *dev,
+                               const char *filename,
+                               cg_error_t **error)
+{
+    /* Saving without recording anything gives an empty manifest */
+    if (dev->recorded_shader_manifest == NULL)
+        dev->recorded_shader_manifest = _cg_shader_manifest_new(dev);
+
+    return _cg_shader_manifest_save(dev->recorded_shader_manifest,
+                                    filename,
+                                    error);
+}
+
+int
+cg_device_prewarm_from_manifest(cg_device_t *dev,
+                                const char *filename,
+                                int64_t budget,
+                                cg_error_t **error)
+{
+    c_return_val_if_fail(dev->connected, -1);
+
+    /* Continue with the same manifest if this is a subsequent call
+     * to spread the work across frames */
+    if (dev->prewarm_shader_manifest == NULL ||
+        strcmp(dev->prewarm_shader_manifest_filename, filename)) {
+        cg_shader_manifest_t *manifest =
+            _cg_shader_manifest_load(dev, filename, error);
+
+        if (manifest == NULL)
+            return -1;
+
+        if (dev->prewarm_shader_manifest)
+            _cg_shader_manifest_free(dev->prewarm_shader_manifest);
+        c_free(dev->prewarm_shader_manifest_filename);
+
+        dev->prewarm_shader_manifest = manifest;
+        dev->prewarm_shader_manifest_filename = c_strdup(filename);
+    }
+
+    return _cg_shader_manifest_prewarm(dev->prewarm_shader_manifest, budget);
+}
+
+void
+cg_device_set_pipeline_cache_capacity(cg_device_t *dev,
+                                      cg_pipeline_cache_table_t table,
+                                      int capacity)
+{
+    c_return_if_fail(table >= 0 && table < CG_PIPELINE_CACHE_N_TABLES);
+    c_return_if_fail(capacity >= 0);
+
+    dev->pipeline_cache_capacities[table] = capacity;
+
+    if (dev->pipeline_cache)
+        _cg_pipeline_cache_set_capacity(dev->pipeline_cache, table, capacity);
+}
+
+void
+cg_device_set_pipeline_max_ancestry_depth(cg_device_t *dev, int depth)
+{
+    c_return_if_fail(depth == 0 || depth >= 2);
+
+    dev->pipeline_max_ancestry_depth = depth;
+}
+
+void
+cg_device_get_pipeline_cache_stats(cg_device_t *dev,
+                                   cg_pipeline_cache_stats_t *stats)
+{
+    if (dev->pipeline_cache)
+        _cg_pipeline_cache_get_stats(dev->pipeline_cache, stats);
+    else
+        memset(stats, 0, sizeof(*stats));
+}
+
+void
+cg_device_get_texture_unit_stats(cg_device_t *dev,
+                                 cg_texture_unit_stats_t *stats)
+{
+    *stats = dev->texture_unit_stats;
+}
+
 void
 cg_device_set_display(cg_device_t *dev, cg_display_t *display)
 {
@@ -186,6 +363,25 @@ cg_device_set_display(cg_device_t *dev, cg_display_t *display)
     dev->display = display;
 }
 
+static void
+init_program_binary_cache(cg_device_t *dev)
+{
+    const char *directory = dev->program_cache_directory;
+
+    /* An explicitly configured directory takes priority over the
+     * environment and then the config file */
+    if (directory == NULL)
+        directory = c_getenv("CG_PROGRAM_CACHE_DIR");
+    if (directory == NULL)
+        directory = _cg_config_program_cache_dir;
+
+    if (directory && !CG_DEBUG_ENABLED(CG_DEBUG_DISABLE_PROGRAM_CACHES))
+        dev->program_binary_cache =
+            _cg_program_binary_cache_new(dev,
+                                         directory,
+                                         dev->program_cache_max_size);
+}
+
 bool
 cg_device_connect(cg_device_t *dev, cg_error_t **error)
 {
@@ -244,6 +440,8 @@ cg_device_connect(cg_device_t *dev, cg_error_t **error)
         c_hash_table_new_full(c_str_hash, c_str_equal, c_free, c_free);
     dev->attribute_name_index_map = NULL;
     dev->n_attribute_names = 0;
+    /* Location 0 is reserved for cg_position_in */
+    dev->next_fixed_attribute_location = 1;
 
     /* The "cg_color_in" attribute needs a deterministic name_index
      * so we make sure it's the first attribute name we register */
@@ -254,6 +452,9 @@ cg_device_connect(cg_device_t *dev, cg_error_t **error)
     dev->uniform_name_hash = c_hash_table_new(c_str_hash, c_str_equal);
     dev->n_uniform_names = 0;
 
+    dev->blend_string_cache =
+        c_hash_table_new_full(c_str_hash, c_str_equal, c_free, c_free);
+
     /* Initialise the driver specific state */
     _cg_init_feature_overrides(dev);
 
@@ -275,6 +476,14 @@ cg_device_connect(cg_device_t *dev, cg_error_t **error)
 
     dev->sampler_cache = _cg_sampler_cache_new(dev);
 
+    init_program_binary_cache(dev);
+
+    /* Let the driver use as many threads as it wants for compiling
+     * programs in the background. See
+     * cg_device_set_async_shader_compile() */
+    if (dev->glMaxShaderCompilerThreads)
+        GE(dev, glMaxShaderCompilerThreads(0xffffffff));
+
     _cg_pipeline_init_default_pipeline(dev);
     _cg_pipeline_init_default_layers(dev);
     _cg_pipeline_init_state_hash_functions();
@@ -289,6 +498,7 @@ cg_device_connect(cg_device_t *dev, cg_error_t **error)
 
     dev->texture_units =
         c_array_new(false, false, sizeof(cg_texture_unit_t));
+    dev->texture_unit_map = c_array_new(false, false, sizeof(int));
 
     if (_cg_has_private_feature(dev, CG_PRIVATE_FEATURE_ANY_GL)) {
         /* See cg-pipeline.c for more details about why we leave texture unit
@@ -318,6 +528,7 @@ cg_device_connect(cg_device_t *dev, cg_error_t **error)
     dev->current_pipeline_with_color_attrib = false;
 
     _cg_bitmask_init(&dev->enabled_custom_attributes);
+    _cg_bitmask_init(&dev->instanced_custom_attributes);
     _cg_bitmask_init(&dev->enable_custom_attributes_tmp);
     _cg_bitmask_init(&dev->changed_bits_tmp);
 
@@ -351,26 +562,35 @@ cg_device_connect(cg_device_t *dev, cg_error_t **error)
     dev->texture_download_pipeline = NULL;
     dev->blit_texture_pipeline = NULL;
 
+    dev->default_vertex_array = 0;
+    dev->current_vertex_array = 0;
+    dev->current_vertex_array_index_buffer = NULL;
+
 #if defined(CG_HAS_GL_SUPPORT)
     if ((dev->driver == CG_DRIVER_GL3)) {
         GLuint vertex_array;
 
         /* In a forward compatible context, GL 3 doesn't support rendering
-         * using the default vertex array object. CGlib doesn't use vertex
-         * array objects yet so for now we just create a dummy array
-         * object that we will use as our own default object. Eventually
-         * it could be good to attach the vertex array objects to
-         * cg_primitive_ts */
+         * using the default vertex array object so we create a dummy
+         * array object that we will use as our own default object for
+         * attributes that don't have a vertex array cached on their
+         * cg_primitive_t */
         dev->glGenVertexArrays(1, &vertex_array);
         dev->glBindVertexArray(vertex_array);
+        dev->default_vertex_array = vertex_array;
+        dev->current_vertex_array = vertex_array;
     }
 #endif
 
     dev->current_modelview_entry = NULL;
     dev->current_projection_entry = NULL;
-    _cg_matrix_entry_identity_init(&dev->identity_entry);
+    _cg_matrix_entry_identity_init(dev, &dev->identity_entry);
     _cg_matrix_entry_cache_init(&dev->builtin_flushed_projection);
     _cg_matrix_entry_cache_init(&dev->builtin_flushed_modelview);
+    dev->builtin_uniform_buffer = 0;
+    dev->builtin_uniform_buffer_offset = 0;
+    dev->builtin_uniform_buffer_stride = 0;
+    dev->builtin_flushed_flip = -1;
 
     /* Create default textures used for fall backs */
     dev->default_gl_texture_2d_tex =
@@ -401,6 +621,8 @@ cg_device_connect(cg_device_t *dev, cg_error_t **error)
     dev->buffer_map_fallback_array = c_byte_array_new();
     dev->buffer_map_fallback_in_use = false;
 
+    dev->vertex_ring = _cg_vertex_ring_new(dev);
+
     c_list_init(&dev->fences);
 
     dev->atlas_set = cg_atlas_set_new(dev);
@@ -419,6 +641,10 @@ _cg_device_free(cg_device_t *dev)
 {
     const cg_winsys_vtable_t *winsys = _cg_device_get_winsys(dev);
 
+    /* Framebuffers that the application has already unref'd may still
+     * be kept alive by their pending journal entries */
+    _cg_flush(dev);
+
     winsys->device_deinit(dev);
 
     if (dev->atlas_set)
@@ -442,6 +668,16 @@ _cg_device_free(cg_device_t *dev)
     if (dev->rectangle_short_indices)
         cg_object_unref(dev->rectangle_short_indices);
 
+    if (dev->vertex_ring)
+        _cg_vertex_ring_free(dev->vertex_ring);
+
+    if (dev->unit_quad_buffer)
+        cg_object_unref(dev->unit_quad_buffer);
+    if (dev->instanced_rect_snippet)
+        cg_object_unref(dev->instanced_rect_snippet);
+    if (dev->instanced_rect_tex_snippet)
+        cg_object_unref(dev->instanced_rect_tex_snippet);
+
     if (dev->default_pipeline)
         cg_object_unref(dev->default_pipeline);
 
@@ -456,6 +692,7 @@ _cg_device_free(cg_device_t *dev)
         _cg_clip_stack_unref(dev->current_clip_stack);
 
     _cg_bitmask_destroy(&dev->enabled_custom_attributes);
+    _cg_bitmask_destroy(&dev->instanced_custom_attributes);
     _cg_bitmask_destroy(&dev->enable_custom_attributes_tmp);
     _cg_bitmask_destroy(&dev->changed_bits_tmp);
 
@@ -470,10 +707,29 @@ _cg_device_free(cg_device_t *dev)
 
     _cg_sampler_cache_free(dev->sampler_cache);
 
+    if (dev->program_binary_cache)
+        _cg_program_binary_cache_free(dev->program_binary_cache);
+    c_free(dev->program_cache_directory);
+
+    if (dev->recorded_shader_manifest)
+        _cg_shader_manifest_free(dev->recorded_shader_manifest);
+    if (dev->prewarm_shader_manifest)
+        _cg_shader_manifest_free(dev->prewarm_shader_manifest);
+    c_free(dev->prewarm_shader_manifest_filename);
+
+#ifdef CG_PIPELINE_PROGEND_GLSL
+    _cg_pipeline_progend_glsl_cancel_pending_programs(dev);
+    _cg_pipeline_progend_glsl_free_builtin_uniform_buffer(dev);
+#endif
+    if (dev->async_shader_fallback_pipeline)
+        cg_object_unref(dev->async_shader_fallback_pipeline);
+    _cg_closure_list_disconnect_all(&dev->program_ready_closures);
+
     _cg_destroy_texture_units(dev);
 
     c_ptr_array_free(dev->uniform_names, true);
     c_hash_table_destroy(dev->uniform_name_hash);
+    c_hash_table_destroy(dev->blend_string_cache);
 
     c_hash_table_destroy(dev->attribute_name_states_hash);
     c_array_free(dev->attribute_name_index_map, true);
@@ -487,6 +743,8 @@ _cg_device_free(cg_device_t *dev)
     cg_object_unref(dev->display);
     cg_object_unref(dev->renderer);
 
+    _cg_matrix_stack_destroy_magazines(dev);
+
     c_free(dev);
 }
 
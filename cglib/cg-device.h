@@ -45,6 +45,8 @@ typedef struct _cg_device_t cg_device_t;
 #include <cglib/cg-defines.h>
 #include <cglib/cg-display.h>
 #include <cglib/cg-primitive.h>
+#include <cglib/cg-pipeline.h>
+#include <cglib/cg-object.h>
 #ifdef CG_HAS_EGL_PLATFORM_ANDROID_SUPPORT
 #include <android/native_window.h>
 #endif
@@ -134,6 +136,47 @@ cg_device_set_renderer(cg_device_t *dev, cg_renderer_t *renderer);
 void
 cg_device_set_display(cg_device_t *dev, cg_display_t *display);
 
+/**
+ * cg_device_set_program_cache_directory:
+ * @dev: A #cg_device_t pointer
+ * @directory: (allow-none): The directory to store program binaries in
+ *
+ * Specifies a directory where CGlib can store the GPU programs it
+ * generates for pipelines so that later runs of the application can
+ * load them instead of compiling and linking them again. This only has
+ * an effect if the driver supports retrieving program binaries. If the
+ * driver rejects a stored binary, for example after a driver update,
+ * then the program is transparently rebuilt from source.
+ *
+ * If no directory is set then the CG_PROGRAM_CACHE_DIR environment
+ * variable or configuration option is used instead. If none of these
+ * are set then programs are not cached on disk.
+ *
+ * This must be called before the device is connected.
+ *
+ * Stability: unstable
+ */
+void
+cg_device_set_program_cache_directory(cg_device_t *dev,
+                                      const char *directory);
+
+/**
+ * cg_device_set_program_cache_max_size:
+ * @dev: A #cg_device_t pointer
+ * @max_size: The maximum number of bytes to use
+ *
+ * Sets an upper bound on the amount of disk space used by the program
+ * cache directory configured with
+ * cg_device_set_program_cache_directory(). When the limit is exceeded
+ * the oldest entries are deleted. The default is 16 megabytes.
+ *
+ * This must be called before the device is connected.
+ *
+ * Stability: unstable
+ */
+void
+cg_device_set_program_cache_max_size(cg_device_t *dev, size_t max_size);
+
 /**
  * cg_device_connect:
  * @dev: A #cg_device_t pointer
@@ -384,6 +427,366 @@ void cg_foreach_feature(cg_device_t *dev,
  */
 int64_t cg_get_clock_time(cg_device_t *dev);
 
+/**
+ * cg_device_set_async_shader_compile:
+ * @dev: A #cg_device_t pointer
+ * @enable: Whether to compile GPU programs asynchronously
+ *
+ * Sets whether CGlib should avoid waiting for the driver to finish
+ * compiling and linking the GPU program for a pipeline the first time
+ * it is drawn with. Normally the first draw with a new combination of
+ * pipeline state blocks until the program is ready which can cause a
+ * noticeable stall.
+ *
+ * When enabled, the program is submitted to the driver and any draws
+ * with the pipeline are either skipped or drawn with the pipeline set
+ * with cg_device_set_async_shader_fallback_pipeline() until the
+ * program is ready. Callbacks registered with
+ * cg_device_add_program_ready_callback() are called once the program
+ * can be used so the application can redraw.
+ *
+ * This requires the GL_KHR_parallel_shader_compile extension so that
+ * the driver can compile the programs on background threads and
+ * report when they are finished. If the extension isn't available
+ * then programs are compiled and linked synchronously as if this
+ * were disabled, although cg_device_get_async_shader_compile() will
+ * still return the value that was set.
+ *
+ * Asynchronous compilation is disabled by default.
+ *
+ * Stability: unstable
+ */
+void cg_device_set_async_shader_compile(cg_device_t *dev, bool enable);
+
+/**
+ * cg_device_get_async_shader_compile:
+ * @dev: A #cg_device_t pointer
+ *
+ * Return value: whether GPU programs are compiled asynchronously, as
+ *   set with cg_device_set_async_shader_compile()
+ * Stability: unstable
+ */
+bool cg_device_get_async_shader_compile(cg_device_t *dev);
+
+/**
+ * cg_device_set_async_shader_fallback_pipeline:
+ * @dev: A #cg_device_t pointer
+ * @pipeline: (allow-none): A pipeline to draw with while a program is
+ *   being compiled or %NULL
+ *
+ * Sets a pipeline that will be used in place of any pipeline whose
+ * program is still being compiled when asynchronous compilation has
+ * been enabled with cg_device_set_async_shader_compile(). The
+ * vertices of the primitive will be drawn with the fallback pipeline
+ * so it should only depend on the position attribute and a uniform
+ * color for example.
+ *
+ * If the fallback pipeline is %NULL, or its own program isn't ready
+ * yet, then the draw is skipped.
+ *
+ * Stability: unstable
+ */
+void cg_device_set_async_shader_fallback_pipeline(cg_device_t *dev,
+                                                  cg_pipeline_t *pipeline);
+
+/**
+ * cg_program_ready_callback_t:
+ * @dev: The #cg_device_t that compiled the program
+ * @pipeline: The pipeline whose draw started compiling the program
+ * @user_data: The private data passed to
+ *   cg_device_add_program_ready_callback()
+ *
+ * A callback that can be registered with
+ * cg_device_add_program_ready_callback() to be notified when a program
+ * that was being compiled asynchronously has become ready. Any other
+ * pipelines that share the same program will also be ready at this
+ * point.
+ *
+ * Stability: unstable
+ */
+typedef void (*cg_program_ready_callback_t)(cg_device_t *dev,
+                                            cg_pipeline_t *pipeline,
+                                            void *user_data);
+
+/**
+ * cg_program_ready_closure_t:
+ *
+ * An opaque type that tracks a #cg_program_ready_callback_t and
+ * associated user data. A #cg_program_ready_closure_t pointer will be
+ * returned from cg_device_add_program_ready_callback() and it allows
+ * you to remove a callback later using
+ * cg_device_remove_program_ready_callback().
+ *
+ * Stability: unstable
+ */
+typedef struct _cg_closure_t cg_program_ready_closure_t;
+
+/**
+ * cg_device_add_program_ready_callback:
+ * @dev: A #cg_device_t pointer
+ * @callback: A callback function to call when a program is ready
+ * @user_data: A private pointer to be passed to @callback
+ * @destroy: An optional callback to destroy @user_data when the
+ *           @callback is removed or @dev is freed.
+ *
+ * Installs a @callback function that will be called whenever a program
+ * that was being compiled asynchronously becomes ready to draw with.
+ * Typically an application will use this to queue a redraw of the
+ * scene so that anything that was skipped or drawn with the fallback
+ * pipeline will be drawn correctly.
+ *
+ * <note>A program ready callback will only ever be called while
+ * dispatching CGlib events from the system mainloop; so for example
+ * during cg_loop_dispatch().</note>
+ *
+ * Return value: a #cg_program_ready_closure_t pointer that can be used
+ *               to remove the callback and associated @user_data later.
+ * Stability: unstable
+ */
+cg_program_ready_closure_t *
+cg_device_add_program_ready_callback(cg_device_t *dev,
+                                     cg_program_ready_callback_t callback,
+                                     void *user_data,
+                                     cg_user_data_destroy_callback_t destroy);
+
+/**
+ * cg_device_remove_program_ready_callback:
+ * @dev: A #cg_device_t pointer
+ * @closure: A #cg_program_ready_closure_t returned from
+ *           cg_device_add_program_ready_callback()
+ *
+ * Removes a callback and associated user data that were previously
+ * registered using cg_device_add_program_ready_callback().
+ *
+ * If a destroy callback was passed to
+ * cg_device_add_program_ready_callback() to destroy the user data
+ * then this will also get called.
+ *
+ * Stability: unstable
+ */
+void
+cg_device_remove_program_ready_callback(cg_device_t *dev,
+                                        cg_program_ready_closure_t *closure);
+
+/**
+ * cg_device_set_shader_manifest_recording:
+ * @dev: A #cg_device_t pointer
+ * @enable: Whether to record the GPU programs that are generated
+ *
+ * Sets whether CGlib should keep a record of every unique GPU program
+ * it generates for pipelines. The record can later be written to a
+ * manifest file with cg_device_save_shader_manifest() and loaded in a
+ * later run with cg_device_prewarm_from_manifest() to build the same
+ * programs before they are needed.
+ *
+ * Disabling recording doesn't discard the programs that have already
+ * been recorded.
+ *
+ * Recording is disabled by default.
+ *
+ * Stability: unstable
+ */
+void cg_device_set_shader_manifest_recording(cg_device_t *dev, bool enable);
+
+/**
+ * cg_device_save_shader_manifest:
+ * @dev: A #cg_device_t pointer
+ * @filename: The file to write the manifest to
+ * @error: A #cg_error_t return location
+ *
+ * Writes the GPU programs that have been recorded since recording was
+ * enabled with cg_device_set_shader_manifest_recording() to
+ * @filename. The manifest stores the generated source of each program
+ * so it is only useful for a device with the same GPU capabilities.
+ *
+ * Return value: %true if the manifest was written or %false if there
+ *               was an error.
+ * Stability: unstable
+ */
+bool cg_device_save_shader_manifest(cg_device_t *dev,
+                                    const char *filename,
+                                    cg_error_t **error);
+
+/**
+ * cg_device_prewarm_from_manifest:
+ * @dev: A #cg_device_t pointer
+ * @filename: A manifest written by cg_device_save_shader_manifest()
+ * @budget: The maximum time to spend in nanoseconds or 0 for no limit
+ * @error: A #cg_error_t return location
+ *
+ * Compiles and links the GPU programs listed in the manifest
+ * @filename so that the first draw with a pipeline that needs one of
+ * them doesn't have to wait for it to be built. This is intended to
+ * be called while showing a loading screen.
+ *
+ * The work can be spread across several frames by passing a non-zero
+ * @budget. In that case the function returns once the budget has been
+ * spent and it should be called again with the same @filename, for
+ * example once per frame, until it returns 0. Programs that are
+ * needed for drawing before they have been prewarmed are built as
+ * usual and skipped by later calls.
+ *
+ * Return value: The number of programs that still need to be
+ *               prewarmed or -1 if the manifest couldn't be loaded.
+ * Stability: unstable
+ */
+int cg_device_prewarm_from_manifest(cg_device_t *dev,
+                                    const char *filename,
+                                    int64_t budget,
+                                    cg_error_t **error);
+
+/**
+ * cg_pipeline_cache_table_t:
+ * @CG_PIPELINE_CACHE_TABLE_FRAGMENT: The cache of generated fragment
+ *   shaders
+ * @CG_PIPELINE_CACHE_TABLE_VERTEX: The cache of generated vertex
+ *   shaders
+ * @CG_PIPELINE_CACHE_TABLE_COMBINED: The cache of linked programs
+ *
+ * Identifies one of the caches that CGlib uses to share the GPU
+ * programs it generates between pipelines with equivalent state.
+ *
+ * Stability: unstable
+ */
+typedef enum {
+    CG_PIPELINE_CACHE_TABLE_FRAGMENT,
+    CG_PIPELINE_CACHE_TABLE_VERTEX,
+    CG_PIPELINE_CACHE_TABLE_COMBINED
+} cg_pipeline_cache_table_t;
+
+#define CG_PIPELINE_CACHE_N_TABLES 3
+
+/**
+ * cg_pipeline_cache_table_stats_t:
+ * @hits: The number of times an existing entry was found
+ * @misses: The number of times a new entry had to be added
+ * @evictions: The number of unused entries that were removed to keep
+ *   the cache within its capacity
+ * @compiles: The number of shaders compiled for the fragment and
+ *   vertex caches or the number of programs linked for the combined
+ *   cache
+ * @size: The number of entries currently in the cache
+ *
+ * Statistics about one of the pipeline caches. See
+ * cg_device_get_pipeline_cache_stats().
+ *
+ * Stability: unstable
+ */
+typedef struct {
+    unsigned int hits;
+    unsigned int misses;
+    unsigned int evictions;
+    unsigned int compiles;
+    unsigned int size;
+} cg_pipeline_cache_table_stats_t;
+
+/**
+ * cg_pipeline_cache_stats_t:
+ * @fragment: Statistics for %CG_PIPELINE_CACHE_TABLE_FRAGMENT
+ * @vertex: Statistics for %CG_PIPELINE_CACHE_TABLE_VERTEX
+ * @combined: Statistics for %CG_PIPELINE_CACHE_TABLE_COMBINED
+ *
+ * Stability: unstable
+ */
+typedef struct {
+    cg_pipeline_cache_table_stats_t fragment;
+    cg_pipeline_cache_table_stats_t vertex;
+    cg_pipeline_cache_table_stats_t combined;
+} cg_pipeline_cache_stats_t;
+
+/**
+ * cg_device_set_pipeline_cache_capacity:
+ * @dev: A #cg_device_t pointer
+ * @table: The cache to configure
+ * @capacity: The maximum number of entries to keep
+ *
+ * Sets the maximum number of entries to keep in one of the caches of
+ * generated GPU programs. When a new entry is needed and the cache is
+ * full then the least recently used entry that no pipeline is using
+ * any more is evicted. Entries that are in use are never evicted so
+ * the cache can grow beyond its capacity if the application uses more
+ * unique pipelines than that at the same time.
+ *
+ * An application that legitimately uses a large number of pipeline
+ * variants can raise the capacity to avoid regenerating programs.
+ * The default capacity is 512 for each cache.
+ *
+ * Stability: unstable
+ */
+void cg_device_set_pipeline_cache_capacity(cg_device_t *dev,
+                                           cg_pipeline_cache_table_t table,
+                                           int capacity);
+
+/**
+ * cg_device_set_pipeline_max_ancestry_depth:
+ * @dev: A #cg_device_t pointer
+ * @depth: The maximum number of ancestors a pipeline may have, or 0
+ *
+ * Every call to cg_pipeline_copy() creates a pipeline that only
+ * records how it differs from its source, so long chains of copies
+ * make every state lookup walk further up the chain. When a copy would
+ * have more than @depth ancestors it is instead based on a flattened
+ * pipeline holding all of the state resolved from the source. The
+ * flattened pipeline is shared by further copies of the same source
+ * until that source is modified.
+ *
+ * A value of 0 disables flattening. The default depth is 32.
+ *
+ * Stability: unstable
+ */
+void cg_device_set_pipeline_max_ancestry_depth(cg_device_t *dev, int depth);
+
+/**
+ * cg_device_get_pipeline_cache_stats:
+ * @dev: A #cg_device_t pointer
+ * @stats: (out): A location to store the statistics
+ *
+ * Retrieves statistics about how effectively the caches of generated
+ * GPU programs are being used since @dev was connected.
+ *
+ * Stability: unstable
+ */
+void cg_device_get_pipeline_cache_stats(cg_device_t *dev,
+                                        cg_pipeline_cache_stats_t *stats);
+
+/**
+ * cg_texture_unit_stats_t:
+ * @binds: The number of times a texture had to be bound to a texture
+ *   unit while flushing a pipeline
+ * @binds_saved: The number of times a layer was flushed to a texture
+ *   unit that already had its texture bound when the texture unit
+ *   matching the layer's position would have needed a bind
+ * @sampler_updates: The number of times the sampler uniform of a
+ *   program had to be updated because a layer was flushed to a
+ *   different texture unit
+ *
+ * Statistics about how CGlib assigns the layers of pipelines to
+ * texture units. See cg_device_get_texture_unit_stats().
+ *
+ * Stability: unstable
+ */
+typedef struct {
+    unsigned int binds;
+    unsigned int binds_saved;
+    unsigned int sampler_updates;
+} cg_texture_unit_stats_t;
+
+/**
+ * cg_device_get_texture_unit_stats:
+ * @dev: A #cg_device_t pointer
+ * @stats: (out): A location to store the statistics
+ *
+ * Retrieves statistics about how many texture binds have been needed
+ * to flush pipelines since @dev was connected. CGlib tries to flush
+ * each layer to a texture unit that already has the layer's texture
+ * bound so that drawing with pipelines that share textures in
+ * different layers doesn't have to keep rebinding them.
+ *
+ * Stability: unstable
+ */
+void cg_device_get_texture_unit_stats(cg_device_t *dev,
+                                      cg_texture_unit_stats_t *stats);
+
 CG_END_DECLS
 
 #endif /* __CG_DEVICE_H__ */
@@ -83,6 +83,7 @@ struct _cg_driver_vtable_t {
                                         cg_vertices_mode_t mode,
                                         int first_vertex,
                                         int n_vertices,
+                                        cg_primitive_t *primitive,
                                         cg_attribute_t **attributes,
                                         int n_attributes,
                                         int n_instances,
@@ -94,11 +95,28 @@ struct _cg_driver_vtable_t {
                                                 int first_vertex,
                                                 int n_vertices,
                                                 cg_indices_t *indices,
+                                                cg_primitive_t *primitive,
                                                 cg_attribute_t **attributes,
                                                 int n_attributes,
                                                 int n_instances,
                                                 cg_draw_flags_t flags);
 
+    /* Draws several ranges of the same set of attributes while only
+     * flushing the attribute state once. If @indices is NULL the
+     * ranges are drawn without indices, otherwise there is one
+     * cg_indices_t per range and they must all share the same buffer
+     * and index type. */
+    void (*framebuffer_multi_draw_attributes)(cg_framebuffer_t *framebuffer,
+                                              cg_pipeline_t *pipeline,
+                                              cg_vertices_mode_t mode,
+                                              const int *first_vertices,
+                                              const int *n_vertices,
+                                              cg_indices_t **indices,
+                                              int n_draws,
+                                              cg_attribute_t **attributes,
+                                              int n_attributes,
+                                              cg_draw_flags_t flags);
+
     bool (*framebuffer_read_pixels_into_bitmap)(cg_framebuffer_t *framebuffer,
                                                 int x,
                                                 int y,
@@ -180,12 +198,14 @@ struct _cg_driver_vtable_t {
                                 uint8_t *data);
 
     /* Prepares for drawing by flushing the framebuffer state,
-     * pipeline state and attribute state.
+     * pipeline state and attribute state. Returns false if nothing
+     * should be drawn because the pipeline's program isn't ready yet.
      */
-    void (*flush_attributes_state)(cg_framebuffer_t *framebuffer,
+    bool (*flush_attributes_state)(cg_framebuffer_t *framebuffer,
                                    cg_pipeline_t *pipeline,
                                    cg_flush_layer_state_t *layer_state,
                                    cg_draw_flags_t flags,
+                                   cg_primitive_t *primitive,
                                    cg_attribute_t **attributes,
                                    int n_attributes);
 
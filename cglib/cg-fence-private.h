@@ -56,8 +56,27 @@ struct _cg_fence_closure_t {
     void *user_data;
 };
 
+/* A bare fence for internal code that wants to synchronously poll
+ * whether the GPU has finished with some resource rather than being
+ * called back from the mainloop */
+typedef struct _cg_fence_sync_t {
+    cg_fence_type_t type;
+    void *fence_obj;
+} cg_fence_sync_t;
+
 void _cg_fence_submit(cg_fence_closure_t *fence);
 
+/* Inserts a fence into the command stream. If fences aren't
+ * supported then the fence will be left with a type of
+ * FENCE_TYPE_ERROR and will never be considered complete. */
+void _cg_fence_sync_insert(cg_device_t *dev, cg_fence_sync_t *sync);
+
+/* Returns whether all the commands issued before the fence have
+ * completed without blocking */
+bool _cg_fence_sync_is_complete(cg_device_t *dev, cg_fence_sync_t *sync);
+
+void _cg_fence_sync_destroy(cg_device_t *dev, cg_fence_sync_t *sync);
+
 void _cg_fence_cancel_fences_for_framebuffer(cg_framebuffer_t *framebuffer);
 
 #endif /* __CG_FENCE_PRIVATE_H__ */
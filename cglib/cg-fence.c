@@ -43,28 +43,79 @@ cg_fence_closure_get_user_data(cg_fence_closure_t *closure)
 }
 
 static void
-_cg_fence_check(cg_fence_closure_t *fence)
+fence_obj_create(cg_device_t *dev,
+                 cg_fence_type_t *type,
+                 void **fence_obj)
 {
-    cg_device_t *dev = fence->framebuffer->dev;
+    const cg_winsys_vtable_t *winsys = _cg_device_get_winsys(dev);
 
-    if (fence->type == FENCE_TYPE_WINSYS) {
-        const cg_winsys_vtable_t *winsys = _cg_device_get_winsys(dev);
-        bool ret;
+    *type = FENCE_TYPE_ERROR;
 
-        ret = winsys->fence_is_complete(dev, fence->fence_obj);
-        if (!ret)
+    if (winsys->fence_add) {
+        *fence_obj = winsys->fence_add(dev);
+        if (*fence_obj) {
+            *type = FENCE_TYPE_WINSYS;
             return;
+        }
     }
+
 #ifdef GL_ARB_sync
-    else if (fence->type == FENCE_TYPE_GL_ARB) {
+    if (dev->glFenceSync) {
+        *fence_obj = dev->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        if (*fence_obj) {
+            *type = FENCE_TYPE_GL_ARB;
+            return;
+        }
+    }
+#endif
+}
+
+static bool
+fence_obj_is_complete(cg_device_t *dev,
+                      cg_fence_type_t type,
+                      void *fence_obj)
+{
+    if (type == FENCE_TYPE_WINSYS) {
+        const cg_winsys_vtable_t *winsys = _cg_device_get_winsys(dev);
+
+        return winsys->fence_is_complete(dev, fence_obj);
+    }
+#ifdef GL_ARB_sync
+    else if (type == FENCE_TYPE_GL_ARB) {
         GLenum arb;
 
-        arb = dev->glClientWaitSync(
-            fence->fence_obj, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
-        if (arb != GL_ALREADY_SIGNALED && arb != GL_CONDITION_SATISFIED)
-            return;
+        arb = dev->glClientWaitSync(fence_obj, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        return arb == GL_ALREADY_SIGNALED || arb == GL_CONDITION_SATISFIED;
+    }
+#endif
+
+    return true;
+}
+
+static void
+fence_obj_destroy(cg_device_t *dev,
+                  cg_fence_type_t type,
+                  void *fence_obj)
+{
+    if (type == FENCE_TYPE_WINSYS) {
+        const cg_winsys_vtable_t *winsys = _cg_device_get_winsys(dev);
+
+        winsys->fence_destroy(dev, fence_obj);
+    }
+#ifdef GL_ARB_sync
+    else if (type == FENCE_TYPE_GL_ARB) {
+        dev->glDeleteSync(fence_obj);
     }
 #endif
+}
+
+static void
+_cg_fence_check(cg_fence_closure_t *fence)
+{
+    cg_device_t *dev = fence->framebuffer->dev;
+
+    if (!fence_obj_is_complete(dev, fence->type, fence->fence_obj))
+        return;
 
     fence->callback(NULL, /* dummy cg_fence_t object */
                     fence->user_data);
@@ -96,30 +147,9 @@ void
 _cg_fence_submit(cg_fence_closure_t *fence)
 {
     cg_device_t *dev = fence->framebuffer->dev;
-    const cg_winsys_vtable_t *winsys = _cg_device_get_winsys(dev);
 
-    fence->type = FENCE_TYPE_ERROR;
+    fence_obj_create(dev, &fence->type, &fence->fence_obj);
 
-    if (winsys->fence_add) {
-        fence->fence_obj = winsys->fence_add(dev);
-        if (fence->fence_obj) {
-            fence->type = FENCE_TYPE_WINSYS;
-            goto done;
-        }
-    }
-
-#ifdef GL_ARB_sync
-    if (dev->glFenceSync) {
-        fence->fence_obj =
-            dev->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
-        if (fence->fence_obj) {
-            fence->type = FENCE_TYPE_GL_ARB;
-            goto done;
-        }
-    }
-#endif
-
-done:
     c_list_insert(dev->fences.prev, &fence->link);
 
     if (!dev->fences_poll_source) {
@@ -164,16 +194,7 @@ cg_framebuffer_cancel_fence_callback(cg_framebuffer_t *framebuffer,
     } else {
         c_list_remove(&fence->link);
 
-        if (fence->type == FENCE_TYPE_WINSYS) {
-            const cg_winsys_vtable_t *winsys = _cg_device_get_winsys(dev);
-
-            winsys->fence_destroy(dev, fence->fence_obj);
-        }
-#ifdef GL_ARB_sync
-        else if (fence->type == FENCE_TYPE_GL_ARB) {
-            dev->glDeleteSync(fence->fence_obj);
-        }
-#endif
+        fence_obj_destroy(dev, fence->type, fence->fence_obj);
     }
 
     c_slice_free(cg_fence_closure_t, fence);
@@ -190,3 +211,27 @@ _cg_fence_cancel_fences_for_framebuffer(cg_framebuffer_t *framebuffer)
             cg_framebuffer_cancel_fence_callback(framebuffer, fence);
     }
 }
+
+void
+_cg_fence_sync_insert(cg_device_t *dev, cg_fence_sync_t *sync)
+{
+    sync->fence_obj = NULL;
+    fence_obj_create(dev, &sync->type, &sync->fence_obj);
+}
+
+bool
+_cg_fence_sync_is_complete(cg_device_t *dev, cg_fence_sync_t *sync)
+{
+    if (sync->type == FENCE_TYPE_ERROR)
+        return false;
+
+    return fence_obj_is_complete(dev, sync->type, sync->fence_obj);
+}
+
+void
+_cg_fence_sync_destroy(cg_device_t *dev, cg_fence_sync_t *sync)
+{
+    fence_obj_destroy(dev, sync->type, sync->fence_obj);
+    sync->type = FENCE_TYPE_ERROR;
+    sync->fence_obj = NULL;
+}
@@ -38,6 +38,7 @@
 #include "cg-offscreen.h"
 #include "cg-gl-header.h"
 #include "cg-clip-stack.h"
+#include "cg-journal-private.h"
 
 #ifdef CG_HAS_XLIB_SUPPORT
 #include <X11/Xlib.h>
@@ -143,6 +144,22 @@ struct _cg_framebuffer_t {
 
     cg_clip_stack_t *clip_stack;
 
+    /* A mask of the cg_framebuffer_state_t that has been modified by
+     * the setters since the framebuffer was last flushed. When the
+     * framebuffer is already current this lets a flush skip comparing
+     * every piece of state */
+    unsigned long changes_since_flush;
+
+    /* Rectangles are batched in the journal until something needs to
+     * see the results of drawing them */
+    cg_journal_t *journal;
+
+    /* Whether opaque drawing may be reordered in the journal to
+     * reduce the number of state changes and how many state changes
+     * have been avoided by doing so */
+    bool sort_opaque_draws;
+    int64_t n_state_changes_saved;
+
     bool dither_enabled;
     bool depth_writing_enabled;
     cg_color_mask_t color_mask;
@@ -373,6 +390,7 @@ void _cg_framebuffer_draw_attributes(cg_framebuffer_t *framebuffer,
                                      cg_vertices_mode_t mode,
                                      int first_vertex,
                                      int n_vertices,
+                                     cg_primitive_t *primitive,
                                      cg_attribute_t **attributes,
                                      int n_attributes,
                                      int n_instances,
@@ -384,6 +402,7 @@ void _cg_framebuffer_draw_indexed_attributes(cg_framebuffer_t *framebuffer,
                                              int first_vertex,
                                              int n_vertices,
                                              cg_indices_t *indices,
+                                             cg_primitive_t *primitive,
                                              cg_attribute_t **attributes,
                                              int n_attributes,
                                              int n_instances,
@@ -30,8 +30,11 @@
 
 #include <cglib-config.h>
 
+#include <stddef.h>
 #include <string.h>
 
+#include <test-fixtures/test-cg-fixtures.h>
+
 #include "cg-debug.h"
 #include "cg-device-private.h"
 #include "cg-display-private.h"
@@ -111,6 +114,8 @@ _cg_framebuffer_init(cg_framebuffer_t *framebuffer,
     framebuffer->viewport_age_for_scissor_workaround = -1;
     framebuffer->dither_enabled = true;
     framebuffer->depth_writing_enabled = true;
+    framebuffer->sort_opaque_draws = false;
+    framebuffer->n_state_changes_saved = 0;
 
     framebuffer->modelview_stack = cg_matrix_stack_new(dev);
     framebuffer->projection_stack = cg_matrix_stack_new(dev);
@@ -123,6 +128,10 @@ _cg_framebuffer_init(cg_framebuffer_t *framebuffer,
 
     framebuffer->clip_stack = NULL;
 
+    framebuffer->changes_since_flush = CG_FRAMEBUFFER_STATE_ALL;
+
+    framebuffer->journal = _cg_journal_new(framebuffer);
+
     dev->framebuffers = c_llist_prepend(dev->framebuffers, framebuffer);
 }
 
@@ -140,6 +149,13 @@ _cg_framebuffer_free(cg_framebuffer_t *framebuffer)
 
     _cg_fence_cancel_fences_for_framebuffer(framebuffer);
 
+    /* The journal holds a reference on the framebuffer while it has
+     * entries so by now it must have been flushed */
+    _cg_journal_free(framebuffer->journal);
+    framebuffer->journal = NULL;
+
+    _cg_framebuffer_remove_all_dependencies(framebuffer);
+
     _cg_clip_stack_unref(framebuffer->clip_stack);
 
     cg_object_unref(framebuffer->modelview_stack);
@@ -207,6 +223,8 @@ cg_framebuffer_clear4f(cg_framebuffer_t *framebuffer,
 {
     CG_NOTE(DRAW, "Clear begin");
 
+    _cg_framebuffer_flush(framebuffer);
+
     /* NB: _cg_framebuffer_flush_state may disrupt various state (such
      * as the pipeline state) when flushing the clip stack, so should
      * always be done first when preparing to draw. */
@@ -291,6 +309,8 @@ _cg_framebuffer_set_clip_stack(cg_framebuffer_t *framebuffer,
     _cg_clip_stack_ref(stack);
     _cg_clip_stack_unref(framebuffer->clip_stack);
     framebuffer->clip_stack = stack;
+
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_CLIP;
 }
 
 void
@@ -306,18 +326,18 @@ cg_framebuffer_set_viewport(
         framebuffer->viewport_height == height)
         return;
 
+    _cg_framebuffer_flush(framebuffer);
+
     framebuffer->viewport_x = x;
     framebuffer->viewport_y = y;
     framebuffer->viewport_width = width;
     framebuffer->viewport_height = height;
     framebuffer->viewport_age++;
 
-    if (dev->current_draw_buffer == framebuffer) {
-        dev->current_draw_buffer_changes |= CG_FRAMEBUFFER_STATE_VIEWPORT;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_VIEWPORT;
 
-        if (dev->needs_viewport_scissor_workaround)
-            dev->current_draw_buffer_changes |= CG_FRAMEBUFFER_STATE_CLIP;
-    }
+    if (dev->needs_viewport_scissor_workaround)
+        framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_CLIP;
 }
 
 float
@@ -399,10 +419,30 @@ _cg_framebuffer_remove_all_dependencies(cg_framebuffer_t *framebuffer)
     framebuffer->deps = NULL;
 }
 
+static void
+_cg_framebuffer_flush_dependency_journals(cg_framebuffer_t *framebuffer)
+{
+    c_llist_t *deps = framebuffer->deps;
+    c_llist_t *l;
+
+    /* Steal the list of dependencies since flushing them may end up
+     * re-entering this function */
+    framebuffer->deps = NULL;
+
+    for (l = deps; l; l = l->next) {
+        _cg_framebuffer_flush(l->data);
+        cg_object_unref(l->data);
+    }
+
+    c_llist_free(deps);
+}
+
 void
 _cg_framebuffer_flush(cg_framebuffer_t *framebuffer)
 {
-    /* Currently a NOP */
+    _cg_framebuffer_flush_dependency_journals(framebuffer);
+
+    _cg_journal_flush(framebuffer->journal);
 }
 
 cg_offscreen_t *
@@ -664,6 +704,7 @@ _offscreen_allocate(cg_framebuffer_t *framebuffer, cg_error_t **error)
 
     framebuffer->viewport_width = framebuffer->width;
     framebuffer->viewport_height = framebuffer->height;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_VIEWPORT;
 
     if (!dev->driver_vtable->offscreen_allocate(offscreen, error))
         goto error;
@@ -966,11 +1007,11 @@ cg_framebuffer_set_color_mask(cg_framebuffer_t *framebuffer,
     if (framebuffer->color_mask == color_mask)
         return;
 
+    _cg_framebuffer_flush(framebuffer);
+
     framebuffer->color_mask = color_mask;
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_COLOR_MASK;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_COLOR_MASK;
 }
 
 bool
@@ -986,11 +1027,11 @@ cg_framebuffer_set_depth_write_enabled(cg_framebuffer_t *framebuffer,
     if (framebuffer->depth_writing_enabled == depth_write_enabled)
         return;
 
+    _cg_framebuffer_flush(framebuffer);
+
     framebuffer->depth_writing_enabled = depth_write_enabled;
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_DEPTH_WRITE;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_DEPTH_WRITE;
 }
 
 bool
@@ -1006,11 +1047,35 @@ cg_framebuffer_set_dither_enabled(cg_framebuffer_t *framebuffer,
     if (framebuffer->dither_enabled == dither_enabled)
         return;
 
+    _cg_framebuffer_flush(framebuffer);
+
     framebuffer->dither_enabled = dither_enabled;
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_DITHER;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_DITHER;
+}
+
+bool
+cg_framebuffer_get_sort_opaque_draws(cg_framebuffer_t *framebuffer)
+{
+    return framebuffer->sort_opaque_draws;
+}
+
+void
+cg_framebuffer_set_sort_opaque_draws(cg_framebuffer_t *framebuffer,
+                                     bool sort_opaque_draws)
+{
+    if (framebuffer->sort_opaque_draws == sort_opaque_draws)
+        return;
+
+    _cg_framebuffer_flush(framebuffer);
+
+    framebuffer->sort_opaque_draws = sort_opaque_draws;
+}
+
+int64_t
+cg_framebuffer_get_n_state_changes_saved(cg_framebuffer_t *framebuffer)
+{
+    return framebuffer->n_state_changes_saved;
 }
 
 void
@@ -1181,6 +1246,12 @@ _cg_blit_framebuffer(cg_framebuffer_t *src,
     /* The buffers must be the same format */
     c_return_if_fail(src->internal_format == dest->internal_format);
 
+    /* Make sure any batched drawing to either framebuffer lands before
+     * the blit */
+    _cg_framebuffer_flush(src);
+    if (dest != src)
+        _cg_framebuffer_flush(dest);
+
     /* Make sure the current framebuffers are bound. We explicitly avoid
        flushing the clip state so we can bind our own empty state */
     _cg_framebuffer_flush_state(
@@ -1218,6 +1289,8 @@ cg_framebuffer_discard_buffers(cg_framebuffer_t *framebuffer,
 
     c_return_if_fail(buffers & CG_BUFFER_BIT_COLOR);
 
+    _cg_framebuffer_flush(framebuffer);
+
     dev->driver_vtable->framebuffer_discard_buffers(framebuffer, buffers);
 }
 
@@ -1238,9 +1311,7 @@ cg_framebuffer_push_matrix(cg_framebuffer_t *framebuffer)
         _cg_framebuffer_get_modelview_stack(framebuffer);
     cg_matrix_stack_push(modelview_stack);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_MODELVIEW;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_MODELVIEW;
 }
 
 void
@@ -1250,9 +1321,7 @@ cg_framebuffer_pop_matrix(cg_framebuffer_t *framebuffer)
         _cg_framebuffer_get_modelview_stack(framebuffer);
     cg_matrix_stack_pop(modelview_stack);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_MODELVIEW;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_MODELVIEW;
 }
 
 void
@@ -1262,9 +1331,7 @@ cg_framebuffer_identity_matrix(cg_framebuffer_t *framebuffer)
         _cg_framebuffer_get_modelview_stack(framebuffer);
     cg_matrix_stack_load_identity(modelview_stack);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_MODELVIEW;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_MODELVIEW;
 }
 
 void
@@ -1274,9 +1341,7 @@ cg_framebuffer_scale(cg_framebuffer_t *framebuffer, float x, float y, float z)
         _cg_framebuffer_get_modelview_stack(framebuffer);
     cg_matrix_stack_scale(modelview_stack, x, y, z);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_MODELVIEW;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_MODELVIEW;
 }
 
 void
@@ -1289,9 +1354,7 @@ cg_framebuffer_translate(cg_framebuffer_t *framebuffer,
         _cg_framebuffer_get_modelview_stack(framebuffer);
     cg_matrix_stack_translate(modelview_stack, x, y, z);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_MODELVIEW;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_MODELVIEW;
 }
 
 void
@@ -1302,9 +1365,7 @@ cg_framebuffer_rotate(
         _cg_framebuffer_get_modelview_stack(framebuffer);
     cg_matrix_stack_rotate(modelview_stack, angle, x, y, z);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_MODELVIEW;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_MODELVIEW;
 }
 
 void
@@ -1315,9 +1376,7 @@ cg_framebuffer_rotate_quaternion(cg_framebuffer_t *framebuffer,
         _cg_framebuffer_get_modelview_stack(framebuffer);
     cg_matrix_stack_rotate_quaternion(modelview_stack, quaternion);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_MODELVIEW;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_MODELVIEW;
 }
 
 void
@@ -1328,9 +1387,7 @@ cg_framebuffer_rotate_euler(cg_framebuffer_t *framebuffer,
         _cg_framebuffer_get_modelview_stack(framebuffer);
     cg_matrix_stack_rotate_euler(modelview_stack, euler);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_MODELVIEW;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_MODELVIEW;
 }
 
 void
@@ -1341,9 +1398,7 @@ cg_framebuffer_transform(cg_framebuffer_t *framebuffer,
         _cg_framebuffer_get_modelview_stack(framebuffer);
     cg_matrix_stack_multiply(modelview_stack, matrix);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_MODELVIEW;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_MODELVIEW;
 }
 
 void
@@ -1363,9 +1418,7 @@ cg_framebuffer_perspective(cg_framebuffer_t *framebuffer,
                            z_near,
                            z_far);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_PROJECTION;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_PROJECTION;
 }
 
 void
@@ -1385,9 +1438,7 @@ cg_framebuffer_frustum(cg_framebuffer_t *framebuffer,
     cg_matrix_stack_frustum(
         projection_stack, left, right, bottom, top, z_near, z_far);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_PROJECTION;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_PROJECTION;
 }
 
 void
@@ -1407,9 +1458,7 @@ cg_framebuffer_orthographic(cg_framebuffer_t *framebuffer,
     c_matrix_orthographic(&ortho, x_1, y_1, x_2, y_2, near, far);
     cg_matrix_stack_set(projection_stack, &ortho);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_PROJECTION;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_PROJECTION;
 }
 
 void
@@ -1419,9 +1468,7 @@ _cg_framebuffer_push_projection(cg_framebuffer_t *framebuffer)
         _cg_framebuffer_get_projection_stack(framebuffer);
     cg_matrix_stack_push(projection_stack);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_PROJECTION;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_PROJECTION;
 }
 
 void
@@ -1431,9 +1478,7 @@ _cg_framebuffer_pop_projection(cg_framebuffer_t *framebuffer)
         _cg_framebuffer_get_projection_stack(framebuffer);
     cg_matrix_stack_pop(projection_stack);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_PROJECTION;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_PROJECTION;
 }
 
 void
@@ -1454,9 +1499,7 @@ cg_framebuffer_set_modelview_matrix(cg_framebuffer_t *framebuffer,
         _cg_framebuffer_get_modelview_stack(framebuffer);
     cg_matrix_stack_set(modelview_stack, matrix);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_MODELVIEW;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_MODELVIEW;
 
     _MATRIX_DEBUG_PRINT(matrix);
 }
@@ -1480,9 +1523,7 @@ cg_framebuffer_set_projection_matrix(cg_framebuffer_t *framebuffer,
 
     cg_matrix_stack_set(projection_stack, matrix);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_PROJECTION;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_PROJECTION;
 
     _MATRIX_DEBUG_PRINT(matrix);
 }
@@ -1494,9 +1535,7 @@ cg_framebuffer_push_scissor_clip(
     framebuffer->clip_stack = _cg_clip_stack_push_window_rectangle(
         framebuffer->clip_stack, x, y, width, height);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_CLIP;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_CLIP;
 }
 
 void
@@ -1524,9 +1563,7 @@ cg_framebuffer_push_rectangle_clip(
                                       projection_entry,
                                       viewport);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_CLIP;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_CLIP;
 }
 
 void
@@ -1559,9 +1596,7 @@ cg_framebuffer_push_primitive_clip(cg_framebuffer_t *framebuffer,
                                       projection_entry,
                                       viewport);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_CLIP;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_CLIP;
 }
 
 void
@@ -1569,9 +1604,7 @@ cg_framebuffer_pop_clip(cg_framebuffer_t *framebuffer)
 {
     framebuffer->clip_stack = _cg_clip_stack_pop(framebuffer->clip_stack);
 
-    if (framebuffer->dev->current_draw_buffer == framebuffer)
-        framebuffer->dev->current_draw_buffer_changes |=
-            CG_FRAMEBUFFER_STATE_CLIP;
+    framebuffer->changes_since_flush |= CG_FRAMEBUFFER_STATE_CLIP;
 }
 
 void
@@ -1764,6 +1797,7 @@ draw_wireframe(cg_device_t *dev,
                                             0,
                                             n_indices,
                                             wire_indices,
+                                            NULL, /* primitive */
                                             attributes,
                                             n_attributes,
                                             1,
@@ -1782,6 +1816,7 @@ _cg_framebuffer_draw_attributes(cg_framebuffer_t *framebuffer,
                                 cg_vertices_mode_t mode,
                                 int first_vertex,
                                 int n_vertices,
+                                cg_primitive_t *primitive,
                                 cg_attribute_t **attributes,
                                 int n_attributes,
                                 int n_instances,
@@ -1812,6 +1847,7 @@ _cg_framebuffer_draw_attributes(cg_framebuffer_t *framebuffer,
                                                         mode,
                                                         first_vertex,
                                                         n_vertices,
+                                                        primitive,
                                                         attributes,
                                                         n_attributes,
                                                         n_instances,
@@ -1826,6 +1862,7 @@ _cg_framebuffer_draw_indexed_attributes(cg_framebuffer_t *framebuffer,
                                         int first_vertex,
                                         int n_vertices,
                                         cg_indices_t *indices,
+                                        cg_primitive_t *primitive,
                                         cg_attribute_t **attributes,
                                         int n_attributes,
                                         int n_instances,
@@ -1857,6 +1894,7 @@ _cg_framebuffer_draw_indexed_attributes(cg_framebuffer_t *framebuffer,
                                                                 first_vertex,
                                                                 n_vertices,
                                                                 indices,
+                                                                primitive,
                                                                 attributes,
                                                                 n_attributes,
                                                                 n_instances,
@@ -1864,11 +1902,9 @@ _cg_framebuffer_draw_indexed_attributes(cg_framebuffer_t *framebuffer,
     }
 }
 
-/* These rectangle drawing apis are horribly in-efficient but simple
- * and are only providing a stop-gap while we strip out the journal
- * from cg.
- */
-
+/* This api bypasses the journal and is used internally for drawing
+ * rectangles while flushing other state, such as when drawing to the
+ * stencil buffer to flush the clip stack. */
 void
 _cg_rectangle_immediate(cg_framebuffer_t *framebuffer,
                         cg_pipeline_t *pipeline,
@@ -1878,31 +1914,46 @@ _cg_rectangle_immediate(cg_framebuffer_t *framebuffer,
                         float y_2)
 {
     cg_device_t *dev = framebuffer->dev;
-    float vertices[8] = { x_1, y_1, x_1, y_2, x_2, y_1, x_2, y_2 };
     cg_attribute_buffer_t *attribute_buffer;
+    cg_attribute_t position_attribute;
     cg_attribute_t *attributes[1];
-
-    attribute_buffer = cg_attribute_buffer_new(dev, sizeof(vertices),
-                                               vertices);
-    attributes[0] = cg_attribute_new(attribute_buffer,
-                                     "cg_position_in",
-                                     sizeof(float) * 2, /* stride */
-                                     0, /* offset */
-                                     2, /* n_components */
-                                     CG_ATTRIBUTE_TYPE_FLOAT);
+    size_t offset;
+    float *v;
+
+    v = _cg_vertex_ring_map(dev->vertex_ring,
+                            sizeof(float) * 8,
+                            &attribute_buffer,
+                            &offset);
+    v[0] = x_1;
+    v[1] = y_1;
+    v[2] = x_1;
+    v[3] = y_2;
+    v[4] = x_2;
+    v[5] = y_1;
+    v[6] = x_2;
+    v[7] = y_2;
+    _cg_vertex_ring_unmap(dev->vertex_ring);
+
+    attributes[0] = _cg_attribute_init_temporary(&position_attribute,
+                                                 attribute_buffer,
+                                                 "cg_position_in",
+                                                 sizeof(float) * 2, /* stride */
+                                                 offset,
+                                                 2, /* n_components */
+                                                 CG_ATTRIBUTE_TYPE_FLOAT);
+    c_return_if_fail(attributes[0] != NULL);
 
     _cg_framebuffer_draw_attributes(framebuffer,
                                     pipeline,
                                     CG_VERTICES_MODE_TRIANGLE_STRIP,
                                     0, /* first_index */
                                     4, /* n_vertices */
+                                    NULL, /* primitive */
                                     attributes,
                                     1, /* n attributes */
                                     1, /* n instances */
+                                    CG_DRAW_SKIP_JOURNAL_FLUSH |
                                     CG_DRAW_SKIP_FRAMEBUFFER_FLUSH);
-
-    cg_object_unref(attributes[0]);
-    cg_object_unref(attribute_buffer);
 }
 
 void
@@ -1913,10 +1964,7 @@ cg_framebuffer_draw_rectangle(cg_framebuffer_t *fb,
                               float x_2,
                               float y_2)
 {
-    cg_device_t *dev = fb->dev;
-    float vertices[8] = { x_1, y_1, x_1, y_2, x_2, y_1, x_2, y_2 };
-    cg_attribute_buffer_t *attribute_buffer;
-    cg_attribute_t *attributes[1];
+    float position[4] = { x_1, y_1, x_2, y_2 };
 
     if (cg_pipeline_get_n_layers(pipeline)) {
         cg_framebuffer_draw_textured_rectangle(fb, pipeline,
@@ -1925,29 +1973,17 @@ cg_framebuffer_draw_rectangle(cg_framebuffer_t *fb,
         return;
     }
 
-    attribute_buffer = cg_attribute_buffer_new(dev, sizeof(vertices),
-                                               vertices);
-    attributes[0] = cg_attribute_new(attribute_buffer,
-                                     "cg_position_in",
-                                     sizeof(float) * 2, /* stride */
-                                     0, /* offset */
-                                     2, /* n_components */
-                                     CG_ATTRIBUTE_TYPE_FLOAT);
-
-    _cg_framebuffer_draw_attributes(fb,
-                                    pipeline,
-                                    CG_VERTICES_MODE_TRIANGLE_STRIP,
-                                    0, /* first_index */
-                                    4, /* n_vertices */
-                                    attributes,
-                                    1, /* n attributes */
-                                    1, /* n instances */
-                                    0); /* flags */
-
-    cg_object_unref(attributes[0]);
-    cg_object_unref(attribute_buffer);
+    _cg_journal_log_rectangle(fb->journal,
+                              pipeline,
+                              position,
+                              NULL, /* tex_coords */
+                              0); /* n_layers */
 }
 
+/* Logs a rectangle where layer 0 uses the given texture coordinates
+ * and any additional layers use default texture coordinates of
+ * (0,0) (1,1). All of the pipeline's textures must be primitive
+ * textures. */
 static void
 _cg_framebuffer_draw_textured_rectangle(cg_framebuffer_t *fb,
                                         cg_pipeline_t *pipeline,
@@ -1960,106 +1996,30 @@ _cg_framebuffer_draw_textured_rectangle(cg_framebuffer_t *fb,
                                         float tx2,
                                         float ty2)
 {
-    int n_layers = MAX(MIN(cg_pipeline_get_n_layers(pipeline), 8), 1);
-    const char *tex_attrib_names[] = {
-        "cg_tex_coord0_in",
-        "cg_tex_coord1_in",
-        "cg_tex_coord2_in",
-        "cg_tex_coord3_in",
-        "cg_tex_coord4_in",
-        "cg_tex_coord5_in",
-        "cg_tex_coord6_in",
-        "cg_tex_coord7_in",
-    };
-    int vert_n_floats = 2 + 2 * n_layers;
-    int rect_n_floats = vert_n_floats * 4;
-    float *rect = c_alloca(rect_n_floats * sizeof(float));
-    cg_attribute_buffer_t *attribute_buffer;
-    int n_attributes = n_layers + 1;
-    cg_attribute_t *attributes[n_attributes];
-    float *vert;
+    int n_layers = cg_pipeline_get_n_layers(pipeline);
+    float position[4] = { x1, y1, x2, y2 };
+    float tex_coords[4 * MAX(n_layers, 1)];
     int i;
 
-    vert = rect;
-    vert[0] = x1;
-    vert[1] = y1;
-    vert[2] = tx1;
-    vert[3] = ty1;
-
-    vert += vert_n_floats;
-    vert[0] = x1;
-    vert[1] = y2;
-    vert[2] = tx1;
-    vert[3] = ty2;
-
-    vert += vert_n_floats;
-    vert[0] = x2;
-    vert[1] = y2;
-    vert[2] = tx2;
-    vert[3] = ty2;
-
-    vert += vert_n_floats;
-    vert[0] = x2;
-    vert[1] = y1;
-    vert[2] = tx2;
-    vert[3] = ty1;
-
-    vert += vert_n_floats;
-    vert[0] = tx1;
-    vert[1] = ty1;
-    vert[2] = tx2;
-    vert[3] = ty2;
+    tex_coords[0] = tx1;
+    tex_coords[1] = ty1;
+    tex_coords[2] = tx2;
+    tex_coords[3] = ty2;
 
     for (i = 1; i < n_layers; i++) {
-        vert = rect + 4;
-
-        vert[0] = 0;
-        vert[1] = 0;
-        vert += vert_n_floats;
-        vert[0] = 0;
-        vert[1] = 1;
-        vert += vert_n_floats;
-        vert[0] = 1;
-        vert[1] = 1;
-        vert += vert_n_floats;
-        vert[0] = 1;
-        vert[1] = 0;
-    }
-
-    attribute_buffer = cg_attribute_buffer_new(fb->dev,
-                                               rect_n_floats * sizeof(float),
-                                               rect);
-
-    attributes[0] = cg_attribute_new(attribute_buffer,
-                                     "cg_position_in",
-                                     vert_n_floats * sizeof(float),
-                                     0, /* offset */
-                                     2, /* n components */
-                                     CG_ATTRIBUTE_TYPE_FLOAT);
+        float *t = tex_coords + 4 * i;
 
-    for (i = 0; i < n_layers; i++) {
-        attributes[i + 1] = cg_attribute_new(attribute_buffer,
-                                             tex_attrib_names[i],
-                                             vert_n_floats * sizeof(float),
-                                             sizeof(float) * 2 + sizeof(float) * 2 * i,
-                                             2, /* n components */
-                                             CG_ATTRIBUTE_TYPE_FLOAT);
+        t[0] = 0;
+        t[1] = 0;
+        t[2] = 1;
+        t[3] = 1;
     }
 
-    cg_object_unref(attribute_buffer);
-
-    _cg_framebuffer_draw_attributes(fb,
-                                    pipeline,
-                                    CG_VERTICES_MODE_TRIANGLE_FAN,
-                                    0, /* first_index */
-                                    4, /* n_vertices */
-                                    attributes,
-                                    n_attributes,
-                                    1, /* n instances */
-                                    0); /* flags */
-
-    for (i = 0; i < n_attributes; i++)
-        cg_object_unref(attributes[i]);
+    _cg_journal_log_rectangle(fb->journal,
+                              pipeline,
+                              position,
+                              tex_coords,
+                              n_layers);
 }
 
 struct foreach_state {
@@ -2263,38 +2223,14 @@ cg_framebuffer_draw_rectangles(cg_framebuffer_t *framebuffer,
                                const float *coordinates,
                                unsigned int n_rectangles)
 {
-    cg_vertex_p2_t *verts = c_alloca(n_rectangles * sizeof(cg_vertex_p2_t) * 4);
-
     c_warn_if_fail(cg_pipeline_get_n_layers(pipeline) == 0);
 
-    for (unsigned int i = 0; i < n_rectangles; i++) {
-        const float *pos = &coordinates[i * 4];
-        cg_vertex_p2_t *rect = verts + 4 * i;
-
-        rect[0].x = pos[0]; /* x1 */
-        rect[0].y = pos[1]; /* y1 */
-
-        rect[1].x = pos[0]; /* x1 */
-        rect[1].y = pos[3]; /* y2 */
-
-        rect[2].x = pos[2]; /* x2 */
-        rect[2].y = pos[3]; /* y2 */
-
-        rect[3].x = pos[2]; /* x2 */
-        rect[3].y = pos[1]; /* y1 */
-    }
-
-#warning "FIXME: cg_framebuffer_draw_rectangles shouldn't need to create a cg_primitive_t"
-    cg_primitive_t *prim = cg_primitive_new_p2(framebuffer->dev,
-                                               CG_VERTICES_MODE_TRIANGLES,
-                                               4 * n_rectangles,
-                                               verts);
-    cg_primitive_set_indices(prim,
-                             cg_get_rectangle_indices(framebuffer->dev,
-                                                      n_rectangles),
-                             n_rectangles * 6);
-    cg_primitive_draw(prim, framebuffer, pipeline);
-    cg_object_unref(prim);
+    for (unsigned int i = 0; i < n_rectangles; i++)
+        _cg_journal_log_rectangle(framebuffer->journal,
+                                  pipeline,
+                                  &coordinates[i * 4],
+                                  NULL, /* tex_coords */
+                                  0); /* n_layers */
 }
 
 void
@@ -2303,47 +2239,571 @@ cg_framebuffer_draw_textured_rectangles(cg_framebuffer_t *framebuffer,
                                         const float *coordinates,
                                         unsigned int n_rectangles)
 {
-    cg_vertex_p2t2_t *verts = c_alloca(n_rectangles * sizeof(cg_vertex_p2t2_t) * 4);
+    cg_texture_t *tex0;
 
     c_warn_if_fail(cg_pipeline_get_n_layers(pipeline) == 1);
 
+    /* Meta textures need to be mapped to their primitive textures
+     * one rectangle at a time */
+    tex0 = cg_pipeline_get_layer_texture(pipeline, 0);
+    if (tex0 && !cg_is_primitive_texture(tex0)) {
+        for (unsigned int i = 0; i < n_rectangles; i++) {
+            const float *pos = &coordinates[i * 8];
+            const float *tex_coords = &coordinates[i * 8 + 4];
+
+            cg_framebuffer_draw_textured_rectangle(framebuffer,
+                                                   pipeline,
+                                                   pos[0], pos[1],
+                                                   pos[2], pos[3],
+                                                   tex_coords[0],
+                                                   tex_coords[1],
+                                                   tex_coords[2],
+                                                   tex_coords[3]);
+        }
+        return;
+    }
+
     for (unsigned int i = 0; i < n_rectangles; i++) {
         const float *pos = &coordinates[i * 8];
         const float *tex_coords = &coordinates[i * 8 + 4];
-        cg_vertex_p2t2_t *rect = verts + 4 * i;
-
-        rect[0].x = pos[0];
-        rect[0].y = pos[1];
-        rect[0].s = tex_coords[0];
-        rect[0].t = tex_coords[1];
-
-        rect[1].x = pos[0];
-        rect[1].y = pos[3];
-        rect[1].s = tex_coords[0];
-        rect[1].t = tex_coords[3];
-
-        rect[2].x = pos[2];
-        rect[2].y = pos[3];
-        rect[2].s = tex_coords[2];
-        rect[2].t = tex_coords[3];
-
-        rect[3].x = pos[2];
-        rect[3].y = pos[1];
-        rect[3].s = tex_coords[2];
-        rect[3].t = tex_coords[1];
+
+        _cg_framebuffer_draw_textured_rectangle(framebuffer,
+                                                pipeline,
+                                                pos[0], pos[1],
+                                                pos[2], pos[3],
+                                                tex_coords[0],
+                                                tex_coords[1],
+                                                tex_coords[2],
+                                                tex_coords[3]);
     }
+}
+
+static void
+draw_rectangles_instanced_fallback(cg_framebuffer_t *framebuffer,
+                                   cg_pipeline_t *pipeline,
+                                   const float *coordinates,
+                                   const uint8_t *colors,
+                                   unsigned int n_rectangles)
+{
+    int n_layers = cg_pipeline_get_n_layers(pipeline);
+    int n_coords = n_layers ? 8 : 4;
+    unsigned int i;
+
+    for (i = 0; i < n_rectangles; i++) {
+        const float *pos = &coordinates[i * n_coords];
+        cg_pipeline_t *rect_pipeline = pipeline;
+
+        if (colors) {
+            const uint8_t *color = &colors[i * 4];
+
+            rect_pipeline = cg_pipeline_copy(pipeline);
+            cg_pipeline_set_color4ub(rect_pipeline,
+                                     color[0], color[1],
+                                     color[2], color[3]);
+        }
+
+        if (n_layers) {
+            cg_framebuffer_draw_textured_rectangle(framebuffer,
+                                                   rect_pipeline,
+                                                   pos[0], pos[1],
+                                                   pos[2], pos[3],
+                                                   pos[4], pos[5],
+                                                   pos[6], pos[7]);
+        } else {
+            cg_framebuffer_draw_rectangle(framebuffer,
+                                          rect_pipeline,
+                                          pos[0], pos[1],
+                                          pos[2], pos[3]);
+        }
 
-#warning "FIXME: cg_framebuffer_draw_textured_rectangles shouldn't need to create a cg_primitive_t"
-    cg_primitive_t *prim = cg_primitive_new_p2t2(framebuffer->dev,
-                                                 CG_VERTICES_MODE_TRIANGLES,
-                                                 4 * n_rectangles,
-                                                 verts);
-    cg_primitive_set_indices(prim,
-                             cg_get_rectangle_indices(framebuffer->dev,
-                                                      n_rectangles),
-                             n_rectangles * 6);
-    cg_primitive_draw(prim, framebuffer, pipeline);
-    cg_object_unref(prim);
+        if (rect_pipeline != pipeline)
+            cg_object_unref(rect_pipeline);
+    }
+}
+
+typedef struct _instanced_layer_state_t {
+    cg_attribute_buffer_t *quad_buffer;
+    cg_attribute_t *attribute_storage;
+    cg_attribute_t **attributes;
+    int n_attributes;
+    int first_layer;
+} instanced_layer_state_t;
+
+static bool
+add_instanced_tex_coord_attribute_cb(cg_pipeline_t *pipeline,
+                                     int layer_index,
+                                     void *user_data)
+{
+    instanced_layer_state_t *state = user_data;
+    char name[32];
+
+    if (state->first_layer == -1)
+        state->first_layer = layer_index;
+
+    /* Every layer reads the corner of the unit quad as its texture
+     * coordinate. The snippet on the first layer maps it into the
+     * texture rectangle of the instance. */
+    c_snprintf(name, sizeof(name), "cg_tex_coord%d_in", layer_index);
+
+    state->attributes[state->n_attributes] =
+        _cg_attribute_init_temporary(state->attribute_storage +
+                                     state->n_attributes,
+                                     state->quad_buffer,
+                                     name,
+                                     sizeof(float) * 2, /* stride */
+                                     0, /* offset */
+                                     2, /* n_components */
+                                     CG_ATTRIBUTE_TYPE_FLOAT);
+    /* The caller notices the missing attribute from the count */
+    if (state->attributes[state->n_attributes] == NULL)
+        return false;
+
+    state->n_attributes++;
+
+    return true;
+}
+
+/* Initializes a temporary attribute that advances once per
+ * rectangle. Returns NULL if the arguments weren't valid. */
+static cg_attribute_t *
+init_instance_attribute(cg_attribute_t *attribute,
+                        cg_attribute_buffer_t *attribute_buffer,
+                        const char *name,
+                        size_t stride,
+                        size_t offset,
+                        int n_components,
+                        cg_attribute_type_t type)
+{
+    cg_attribute_desc_t desc;
+
+    if (!cg_attribute_desc_init(&desc,
+                                attribute_buffer,
+                                name,
+                                stride,
+                                offset,
+                                n_components,
+                                type))
+        return NULL;
+
+    cg_attribute_desc_set_instance_stride(&desc, 1);
+    _cg_attribute_init_from_desc(attribute, &desc);
+
+    return attribute;
+}
+
+static cg_attribute_buffer_t *
+get_unit_quad_buffer(cg_device_t *dev)
+{
+    if (dev->unit_quad_buffer == NULL) {
+        static const float corners[] = { 0, 0, 0, 1, 1, 0, 1, 1 };
+
+        dev->unit_quad_buffer =
+            cg_attribute_buffer_new(dev, sizeof(corners), corners);
+    }
+
+    return dev->unit_quad_buffer;
+}
+
+static cg_snippet_t *
+get_instanced_rect_snippet(cg_device_t *dev)
+{
+    if (dev->instanced_rect_snippet == NULL) {
+        dev->instanced_rect_snippet =
+            cg_snippet_new(CG_SNIPPET_HOOK_VERTEX_TRANSFORM,
+                           "in vec4 _cg_instance_rect;\n",
+                           NULL);
+        cg_snippet_set_replace(dev->instanced_rect_snippet,
+                               "cg_position_out = "
+                               "cg_modelview_projection_matrix * "
+                               "vec4 (mix (_cg_instance_rect.xy, "
+                               "_cg_instance_rect.zw, "
+                               "cg_position_in.xy), 0.0, 1.0);\n");
+    }
+
+    return dev->instanced_rect_snippet;
+}
+
+static cg_snippet_t *
+get_instanced_rect_tex_snippet(cg_device_t *dev)
+{
+    if (dev->instanced_rect_tex_snippet == NULL) {
+        dev->instanced_rect_tex_snippet =
+            cg_snippet_new(CG_SNIPPET_HOOK_TEXTURE_COORD_TRANSFORM,
+                           "in vec4 _cg_instance_tex_rect;\n",
+                           NULL);
+        cg_snippet_set_replace(dev->instanced_rect_tex_snippet,
+                               "cg_tex_coord = "
+                               "vec4 (mix (_cg_instance_tex_rect.xy, "
+                               "_cg_instance_tex_rect.zw, "
+                               "cg_tex_coord.xy), 0.0, 1.0);\n");
+    }
+
+    return dev->instanced_rect_tex_snippet;
+}
+
+typedef struct {
+    cg_pipeline_t *pipeline;
+    unsigned int age;
+} cg_instanced_pipeline_t;
+
+static cg_user_data_key_t instanced_pipeline_key;
+
+static void
+destroy_instanced_pipeline(void *user_data, void *instance)
+{
+    cg_instanced_pipeline_t *instanced = user_data;
+
+    cg_object_unref(instanced->pipeline);
+    c_slice_free(cg_instanced_pipeline_t, instanced);
+}
+
+/* Returns the pipeline that is actually used to draw instanced
+ * rectangles with @pipeline. This is a deep copy of @pipeline with the
+ * instancing snippets added. It is cached on @pipeline until it is
+ * next modified so that repeated draws can reuse the same pipeline
+ * and its program. It isn't a child of @pipeline because otherwise
+ * the cache would keep @pipeline alive. */
+static cg_pipeline_t *
+get_instanced_pipeline(cg_device_t *dev,
+                       cg_pipeline_t *pipeline,
+                       int first_layer)
+{
+    cg_instanced_pipeline_t *instanced =
+        cg_object_get_user_data(CG_OBJECT(pipeline), &instanced_pipeline_key);
+
+    if (instanced && instanced->age == pipeline->age)
+        return instanced->pipeline;
+
+    if (instanced == NULL) {
+        instanced = c_slice_new(cg_instanced_pipeline_t);
+        _cg_object_set_user_data(CG_OBJECT(pipeline),
+                                 &instanced_pipeline_key,
+                                 instanced,
+                                 destroy_instanced_pipeline);
+    } else
+        cg_object_unref(instanced->pipeline);
+
+    instanced->pipeline =
+        _cg_pipeline_deep_copy(dev,
+                               pipeline,
+                               CG_PIPELINE_STATE_ALL_SPARSE &
+                               ~CG_PIPELINE_STATE_UNIFORMS,
+                               CG_PIPELINE_LAYER_STATE_ALL_SPARSE);
+    _cg_pipeline_copy_resolved_uniforms(instanced->pipeline, pipeline);
+    instanced->age = pipeline->age;
+
+    cg_pipeline_add_snippet(instanced->pipeline,
+                            get_instanced_rect_snippet(dev));
+
+    if (first_layer != -1) {
+        cg_pipeline_add_layer_snippet(instanced->pipeline,
+                                      first_layer,
+                                      get_instanced_rect_tex_snippet(dev));
+    }
+
+#ifdef CG_DEBUG_ENABLED
+    _cg_pipeline_set_static_breadcrumb(instanced->pipeline,
+                                       "instanced rectangles");
+#endif
+
+    return instanced->pipeline;
+}
+
+void
+cg_framebuffer_draw_rectangles_instanced(cg_framebuffer_t *framebuffer,
+                                         cg_pipeline_t *pipeline,
+                                         const float *coordinates,
+                                         const uint8_t *colors,
+                                         unsigned int n_rectangles)
+{
+    cg_device_t *dev = framebuffer->dev;
+    int n_layers = cg_pipeline_get_n_layers(pipeline);
+    int n_coords = n_layers ? 8 : 4;
+    size_t stride = n_coords * sizeof(float) + (colors ? 4 : 0);
+    cg_attribute_t *attribute_storage;
+    cg_attribute_t **attributes;
+    instanced_layer_state_t layer_state;
+    cg_attribute_buffer_t *instance_buffer;
+    cg_pipeline_t *draw_pipeline;
+    cg_texture_t *tex0;
+    size_t offset;
+    uint8_t *v;
+    int n_attributes = 0;
+    unsigned int r;
+
+    if (n_rectangles == 0)
+        return;
+
+    tex0 = n_layers ? cg_pipeline_get_layer_texture(pipeline, 0) : NULL;
+
+    if (!cg_has_feature(dev, CG_FEATURE_ID_INSTANCES) ||
+        (tex0 && !cg_is_primitive_texture(tex0))) {
+        draw_rectangles_instanced_fallback(framebuffer, pipeline,
+                                           coordinates, colors,
+                                           n_rectangles);
+        return;
+    }
+
+    /* Flushing the journal or the clip state may need to upload
+     * vertices into the vertex ring so it has to be done before we
+     * map the ring for the instance data */
+    _cg_framebuffer_flush(framebuffer);
+    _cg_framebuffer_flush_state(framebuffer,
+                                framebuffer,
+                                CG_FRAMEBUFFER_STATE_ALL);
+
+    v = _cg_vertex_ring_map(dev->vertex_ring,
+                            stride * n_rectangles,
+                            &instance_buffer,
+                            &offset);
+    for (r = 0; r < n_rectangles; r++) {
+        memcpy(v, coordinates + r * n_coords, n_coords * sizeof(float));
+        if (colors)
+            memcpy(v + n_coords * sizeof(float), colors + r * 4, 4);
+        v += stride;
+    }
+    _cg_vertex_ring_unmap(dev->vertex_ring);
+
+    attribute_storage = c_alloca(sizeof(cg_attribute_t) * (n_layers + 4));
+    attributes = c_alloca(sizeof(cg_attribute_t *) * (n_layers + 4));
+
+    layer_state.first_layer = -1;
+
+    attributes[n_attributes] =
+        _cg_attribute_init_temporary(attribute_storage + n_attributes,
+                                     get_unit_quad_buffer(dev),
+                                     "cg_position_in",
+                                     sizeof(float) * 2, /* stride */
+                                     0, /* offset */
+                                     2, /* n_components */
+                                     CG_ATTRIBUTE_TYPE_FLOAT);
+    c_return_if_fail(attributes[n_attributes] != NULL);
+    n_attributes++;
+
+    attributes[n_attributes] =
+        init_instance_attribute(attribute_storage + n_attributes,
+                                instance_buffer,
+                                "_cg_instance_rect",
+                                stride,
+                                offset,
+                                4, /* n_components */
+                                CG_ATTRIBUTE_TYPE_FLOAT);
+    c_return_if_fail(attributes[n_attributes] != NULL);
+    n_attributes++;
+
+    if (colors) {
+        attributes[n_attributes] =
+            init_instance_attribute(attribute_storage + n_attributes,
+                                    instance_buffer,
+                                    "cg_color_in",
+                                    stride,
+                                    offset + n_coords * sizeof(float),
+                                    4, /* n_components */
+                                    CG_ATTRIBUTE_TYPE_UNSIGNED_BYTE);
+        c_return_if_fail(attributes[n_attributes] != NULL);
+        n_attributes++;
+    }
+
+    if (n_layers) {
+        attributes[n_attributes] =
+            init_instance_attribute(attribute_storage + n_attributes,
+                                    instance_buffer,
+                                    "_cg_instance_tex_rect",
+                                    stride,
+                                    offset + 4 * sizeof(float),
+                                    4, /* n_components */
+                                    CG_ATTRIBUTE_TYPE_FLOAT);
+        c_return_if_fail(attributes[n_attributes] != NULL);
+        n_attributes++;
+
+        layer_state.quad_buffer = get_unit_quad_buffer(dev);
+        layer_state.attribute_storage = attribute_storage;
+        layer_state.attributes = attributes;
+        layer_state.n_attributes = n_attributes;
+        cg_pipeline_foreach_layer(pipeline,
+                                  add_instanced_tex_coord_attribute_cb,
+                                  &layer_state);
+        c_return_if_fail(layer_state.n_attributes == n_attributes + n_layers);
+        n_attributes = layer_state.n_attributes;
+    }
+
+    draw_pipeline = get_instanced_pipeline(dev,
+                                           pipeline,
+                                           layer_state.first_layer);
+
+    _cg_framebuffer_draw_attributes(framebuffer,
+                                    draw_pipeline,
+                                    CG_VERTICES_MODE_TRIANGLE_STRIP,
+                                    0, /* first_vertex */
+                                    4, /* n_vertices */
+                                    NULL, /* primitive */
+                                    attributes,
+                                    n_attributes,
+                                    n_rectangles,
+                                    CG_DRAW_SKIP_JOURNAL_FLUSH |
+                                    CG_DRAW_SKIP_FRAMEBUFFER_FLUSH);
+}
+
+static bool
+attributes_can_multi_draw(cg_attribute_t *attribute0,
+                          cg_attribute_t *attribute1)
+{
+    if (attribute0 == attribute1)
+        return true;
+
+    if (!attribute0->is_buffered || !attribute1->is_buffered)
+        return false;
+
+    return (attribute0->name_state == attribute1->name_state &&
+            attribute0->d.buffered.attribute_buffer ==
+            attribute1->d.buffered.attribute_buffer &&
+            attribute0->d.buffered.stride == attribute1->d.buffered.stride &&
+            attribute0->d.buffered.offset == attribute1->d.buffered.offset &&
+            attribute0->d.buffered.n_components ==
+            attribute1->d.buffered.n_components &&
+            attribute0->d.buffered.type == attribute1->d.buffered.type &&
+            attribute0->normalized == attribute1->normalized &&
+            attribute0->instance_stride == attribute1->instance_stride);
+}
+
+static bool
+primitives_can_multi_draw(cg_primitive_t *primitive0,
+                          cg_primitive_t *primitive1)
+{
+    int i;
+
+    if (primitive0->mode != primitive1->mode ||
+        primitive0->n_attributes != primitive1->n_attributes)
+        return false;
+
+    if (primitive0->indices != primitive1->indices) {
+        if (primitive0->indices == NULL || primitive1->indices == NULL)
+            return false;
+
+        if (cg_indices_get_buffer(primitive0->indices) !=
+            cg_indices_get_buffer(primitive1->indices) ||
+            cg_indices_get_type(primitive0->indices) !=
+            cg_indices_get_type(primitive1->indices))
+            return false;
+    }
+
+    for (i = 0; i < primitive0->n_attributes; i++)
+        if (!attributes_can_multi_draw(primitive0->attributes[i],
+                                       primitive1->attributes[i]))
+            return false;
+
+    return true;
+}
+
+void
+cg_framebuffer_draw_attribute_descs(cg_framebuffer_t *framebuffer,
+                                    cg_pipeline_t *pipeline,
+                                    cg_vertices_mode_t mode,
+                                    int first_vertex,
+                                    int n_vertices,
+                                    const cg_attribute_desc_t *descs,
+                                    int n_descs)
+{
+    cg_attribute_t *attribute_storage;
+    cg_attribute_t **attributes;
+    int i;
+
+    c_return_if_fail(n_descs >= 0);
+
+    attribute_storage = c_alloca(sizeof(cg_attribute_t) * n_descs);
+    attributes = c_alloca(sizeof(cg_attribute_t *) * n_descs);
+
+    for (i = 0; i < n_descs; i++) {
+        _cg_attribute_init_from_desc(attribute_storage + i, descs + i);
+        attributes[i] = attribute_storage + i;
+    }
+
+    _cg_framebuffer_draw_attributes(framebuffer,
+                                    pipeline,
+                                    mode,
+                                    first_vertex,
+                                    n_vertices,
+                                    NULL, /* primitive */
+                                    attributes,
+                                    n_descs,
+                                    1, /* n_instances */
+                                    0 /* flags */);
+}
+
+void
+cg_framebuffer_draw_primitives(cg_framebuffer_t *framebuffer,
+                               cg_pipeline_t *pipeline,
+                               cg_primitive_t **primitives,
+                               int n_primitives)
+{
+    cg_device_t *dev = framebuffer->dev;
+    cg_draw_flags_t flags = 0;
+    int *first_vertices;
+    int *n_vertices;
+    cg_indices_t **indices;
+    int start, end;
+
+    if (n_primitives <= 0)
+        return;
+
+#ifdef CG_ENABLE_DEBUG
+    if (C_UNLIKELY(CG_DEBUG_ENABLED(CG_DEBUG_WIREFRAME))) {
+        for (start = 0; start < n_primitives; start++)
+            _cg_primitive_draw(primitives[start], framebuffer, pipeline,
+                               1, /* n_instances */
+                               0 /* flags */);
+        return;
+    }
+#endif
+
+    first_vertices = c_new(int, n_primitives);
+    n_vertices = c_new(int, n_primitives);
+    indices = c_new(cg_indices_t *, n_primitives);
+
+    for (start = 0; start < n_primitives; start = end) {
+        cg_primitive_t *primitive = primitives[start];
+        int n_draws = 0;
+
+        for (end = start;
+             end < n_primitives &&
+             (end == start ||
+              primitives_can_multi_draw(primitive, primitives[end]));
+             end++) {
+            first_vertices[n_draws] = primitives[end]->first_vertex;
+            n_vertices[n_draws] = primitives[end]->n_vertices;
+            indices[n_draws] = primitives[end]->indices;
+            n_draws++;
+        }
+
+        if (n_draws == 1) {
+            _cg_primitive_draw(primitive, framebuffer, pipeline,
+                               1, /* n_instances */
+                               flags);
+        } else {
+            CG_NOTE(DRAW, "Multi-drawing %d primitives", n_draws);
+
+            dev->driver_vtable->framebuffer_multi_draw_attributes(
+                framebuffer,
+                pipeline,
+                primitive->mode,
+                first_vertices,
+                n_vertices,
+                primitive->indices ? indices : NULL,
+                n_draws,
+                primitive->attributes,
+                primitive->n_attributes,
+                flags);
+        }
+
+        /* Nothing we draw here can affect the journal or the
+         * framebuffer state so they only need to be flushed for the
+         * first draw */
+        flags = CG_DRAW_SKIP_JOURNAL_FLUSH | CG_DRAW_SKIP_FRAMEBUFFER_FLUSH;
+    }
+
+    c_free(indices);
+    c_free(n_vertices);
+    c_free(first_vertices);
 }
 
 cg_device_t *
@@ -2351,3 +2811,307 @@ cg_framebuffer_get_device(cg_framebuffer_t *fb)
 {
     return fb->dev;
 }
+
+#ifdef ENABLE_UNIT_TESTS
+
+/* The number of back-to-back flushes to time */
+#define N_FLUSH_ITERATIONS 100000
+
+static int64_t
+time_framebuffer_flushes(bool modify_modelview)
+{
+    int64_t start = c_get_monotonic_time();
+    int i;
+
+    for (i = 0; i < N_FLUSH_ITERATIONS; i++) {
+        if (modify_modelview)
+            cg_framebuffer_identity_matrix(test_fb);
+
+        _cg_framebuffer_flush_state(test_fb, test_fb, CG_FRAMEBUFFER_STATE_ALL);
+    }
+
+    return c_get_monotonic_time() - start;
+}
+
+TEST(check_framebuffer_flush_cost)
+{
+    cg_pipeline_t *red, *green;
+    int64_t unchanged_time, modified_time;
+    int fb_width, fb_height;
+
+    test_cg_init();
+
+    fb_width = cg_framebuffer_get_width(test_fb);
+    fb_height = cg_framebuffer_get_height(test_fb);
+
+    cg_framebuffer_orthographic(test_fb, 0, 0, fb_width, fb_height, -1, 100);
+
+    _cg_framebuffer_flush_state(test_fb, test_fb, CG_FRAMEBUFFER_STATE_ALL);
+
+    /* Nothing should be left to flush for the current framebuffer */
+    c_assert_cmpint(test_fb->changes_since_flush, ==, 0);
+    c_assert_cmpint(test_dev->current_draw_buffer_changes &
+                    CG_FRAMEBUFFER_STATE_ALL, ==, 0);
+
+    unchanged_time = time_framebuffer_flushes(false);
+    modified_time = time_framebuffer_flushes(true);
+
+    if (test_verbose())
+        c_print("%i back-to-back framebuffer flushes: %" C_INT64_FORMAT
+                "us unchanged, %" C_INT64_FORMAT "us with the modelview "
+                "modified before each flush\n",
+                N_FLUSH_ITERATIONS,
+                unchanged_time,
+                modified_time);
+
+    /* Changes made with the setters between flushes of the current
+     * framebuffer must still be flushed */
+    red = cg_pipeline_new(test_dev);
+    cg_pipeline_set_color4f(red, 1, 0, 0, 1);
+    green = cg_pipeline_new(test_dev);
+    cg_pipeline_set_color4f(green, 0, 1, 0, 1);
+
+    cg_framebuffer_draw_rectangle(test_fb, red, 0, 0, 1, 1);
+    cg_framebuffer_finish(test_fb);
+
+    cg_framebuffer_push_matrix(test_fb);
+    cg_framebuffer_translate(test_fb, 1, 0, 0);
+    cg_framebuffer_push_scissor_clip(test_fb, 1, 0, 1, 1);
+    cg_framebuffer_draw_rectangle(test_fb, green, 0, 0, 2, 1);
+    cg_framebuffer_pop_clip(test_fb);
+    cg_framebuffer_pop_matrix(test_fb);
+
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0xff, 0, 0);
+    test_cg_check_pixel_rgb(test_fb, 1, 0, 0, 0xff, 0);
+    test_cg_check_pixel_rgb(test_fb, 2, 0, 0, 0, 0);
+
+    cg_object_unref(green);
+    cg_object_unref(red);
+
+    test_cg_fini();
+}
+
+TEST(check_draw_rectangles_instanced)
+{
+    static const float coords[] = {
+        0, 0, 1, 1,
+        1, 0, 2, 1,
+        2, 0, 3, 1
+    };
+    static const uint8_t colors[] = {
+        0xff, 0x00, 0x00, 0xff,
+        0x00, 0xff, 0x00, 0xff,
+        0x00, 0x00, 0xff, 0xff
+    };
+    cg_instanced_pipeline_t *instanced;
+    cg_pipeline_t *pipeline, *draw_pipeline;
+    int fb_width, fb_height;
+
+    test_cg_init();
+
+    fb_width = cg_framebuffer_get_width(test_fb);
+    fb_height = cg_framebuffer_get_height(test_fb);
+
+    cg_framebuffer_orthographic(test_fb, 0, 0, fb_width, fb_height, -1, 100);
+
+    pipeline = cg_pipeline_new(test_dev);
+    cg_pipeline_set_color4f(pipeline, 1, 1, 0, 1);
+
+    cg_framebuffer_draw_rectangles_instanced(test_fb, pipeline,
+                                             coords, colors, 3);
+
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0xff, 0, 0);
+    test_cg_check_pixel_rgb(test_fb, 1, 0, 0, 0xff, 0);
+    test_cg_check_pixel_rgb(test_fb, 2, 0, 0, 0, 0xff);
+    test_cg_check_pixel_rgb(test_fb, 3, 0, 0, 0, 0);
+
+    if (!cg_has_feature(test_dev, CG_FEATURE_ID_INSTANCES))
+        goto done;
+
+    /* Drawing again with the unmodified pipeline should reuse the
+     * derived pipeline */
+    instanced = cg_object_get_user_data(CG_OBJECT(pipeline),
+                                        &instanced_pipeline_key);
+    c_assert(instanced != NULL);
+    draw_pipeline = instanced->pipeline;
+
+    cg_framebuffer_draw_rectangles_instanced(test_fb, pipeline,
+                                             coords, NULL, 1);
+    c_assert(instanced->pipeline == draw_pipeline);
+
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0xff, 0xff, 0);
+
+    /* Modifying the pipeline must replace the derived pipeline so the
+     * new state is used */
+    cg_pipeline_set_color4f(pipeline, 0, 1, 1, 1);
+
+    cg_framebuffer_draw_rectangles_instanced(test_fb, pipeline,
+                                             coords, NULL, 1);
+    c_assert(instanced->age == pipeline->age);
+
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0, 0xff, 0xff);
+
+done:
+    cg_object_unref(pipeline);
+
+    test_cg_fini();
+}
+
+typedef struct {
+    float x, y;
+    uint8_t color[4];
+    uint8_t blue;
+    uint8_t padding[3];
+} test_desc_vertex_t;
+
+TEST(check_draw_attribute_descs)
+{
+    static const test_desc_vertex_t verts[] = {
+        { 0, 0, { 0xff, 0, 0, 0xff }, 0x80 },
+        { 0, 1, { 0xff, 0, 0, 0xff }, 0x80 },
+        { 1, 0, { 0xff, 0, 0, 0xff }, 0x80 },
+        { 1, 1, { 0xff, 0, 0, 0xff }, 0x80 }
+    };
+    cg_attribute_desc_t descs[3];
+    cg_attribute_buffer_t *buffer;
+    cg_pipeline_t *pipeline;
+    cg_snippet_t *snippet;
+    int fb_width, fb_height;
+
+    test_cg_init();
+
+    fb_width = cg_framebuffer_get_width(test_fb);
+    fb_height = cg_framebuffer_get_height(test_fb);
+
+    cg_framebuffer_orthographic(test_fb, 0, 0, fb_width, fb_height, -1, 100);
+
+    pipeline = cg_pipeline_new(test_dev);
+    snippet = cg_snippet_new(CG_SNIPPET_HOOK_VERTEX,
+                             "in float desc_test_blue;\n",
+                             "cg_color_out.b = desc_test_blue;\n");
+    cg_pipeline_add_snippet(pipeline, snippet);
+    cg_object_unref(snippet);
+
+    buffer = cg_attribute_buffer_new(test_dev, sizeof(verts), verts);
+
+    c_assert(cg_attribute_desc_init(&descs[0],
+                                    buffer,
+                                    "cg_position_in",
+                                    sizeof(test_desc_vertex_t),
+                                    offsetof(test_desc_vertex_t, x),
+                                    2, /* n_components */
+                                    CG_ATTRIBUTE_TYPE_FLOAT));
+    c_assert(cg_attribute_desc_init(&descs[1],
+                                    buffer,
+                                    "cg_color_in",
+                                    sizeof(test_desc_vertex_t),
+                                    offsetof(test_desc_vertex_t, color),
+                                    4, /* n_components */
+                                    CG_ATTRIBUTE_TYPE_UNSIGNED_BYTE));
+    c_assert(cg_attribute_desc_init(&descs[2],
+                                    buffer,
+                                    "desc_test_blue",
+                                    sizeof(test_desc_vertex_t),
+                                    offsetof(test_desc_vertex_t, blue),
+                                    1, /* n_components */
+                                    CG_ATTRIBUTE_TYPE_UNSIGNED_BYTE));
+
+    /* Custom attributes aren't normalized by default */
+    cg_attribute_desc_set_normalized(&descs[2], true);
+
+    cg_framebuffer_draw_attribute_descs(test_fb,
+                                        pipeline,
+                                        CG_VERTICES_MODE_TRIANGLE_STRIP,
+                                        0, /* first_vertex */
+                                        4, /* n_vertices */
+                                        descs,
+                                        C_N_ELEMENTS(descs));
+
+    /* The same descriptions can be reused for later draws */
+    cg_framebuffer_push_matrix(test_fb);
+    cg_framebuffer_translate(test_fb, 1, 0, 0);
+    cg_framebuffer_draw_attribute_descs(test_fb,
+                                        pipeline,
+                                        CG_VERTICES_MODE_TRIANGLE_STRIP,
+                                        0, /* first_vertex */
+                                        4, /* n_vertices */
+                                        descs,
+                                        C_N_ELEMENTS(descs));
+
+    /* Without normalization the blue value is far out of range */
+    cg_attribute_desc_set_normalized(&descs[2], false);
+    cg_framebuffer_translate(test_fb, 1, 0, 0);
+    cg_framebuffer_draw_attribute_descs(test_fb,
+                                        pipeline,
+                                        CG_VERTICES_MODE_TRIANGLE_STRIP,
+                                        0, /* first_vertex */
+                                        4, /* n_vertices */
+                                        descs,
+                                        C_N_ELEMENTS(descs));
+    cg_framebuffer_pop_matrix(test_fb);
+
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0xff, 0, 0x80);
+    test_cg_check_pixel_rgb(test_fb, 1, 0, 0xff, 0, 0x80);
+    test_cg_check_pixel_rgb(test_fb, 2, 0, 0xff, 0, 0xff);
+    test_cg_check_pixel_rgb(test_fb, 3, 0, 0, 0, 0);
+
+    cg_object_unref(buffer);
+    cg_object_unref(pipeline);
+
+    test_cg_fini();
+}
+
+TEST(check_offscreen_unref_flushes_journal)
+{
+    cg_texture_2d_t *tex;
+    cg_offscreen_t *offscreen;
+    cg_framebuffer_t *fb;
+    cg_pipeline_t *pipeline;
+    int n_framebuffers;
+    uint8_t data[2 * 2 * 4];
+    int i;
+
+    test_cg_init();
+
+    n_framebuffers = c_llist_length(test_dev->framebuffers);
+
+    tex = cg_texture_2d_new_with_size(test_dev, 2, 2);
+    offscreen = cg_offscreen_new_with_texture(CG_TEXTURE(tex));
+    fb = CG_FRAMEBUFFER(offscreen);
+
+    cg_framebuffer_orthographic(fb, 0, 0, 2, 2, -1, 100);
+
+    pipeline = cg_pipeline_new(test_dev);
+    cg_pipeline_set_color4f(pipeline, 0, 1, 0, 1);
+    cg_framebuffer_draw_rectangle(fb, pipeline, 0, 0, 2, 2);
+    cg_object_unref(pipeline);
+
+    /* The rectangle is still only logged in the journal so the journal
+     * should keep the framebuffer alive */
+    c_assert(!_cg_journal_is_empty(fb->journal));
+    cg_object_unref(offscreen);
+    c_assert_cmpint(c_llist_length(test_dev->framebuffers),
+                    ==,
+                    n_framebuffers + 1);
+
+    /* Reading back the texture flushes the journal which should both
+     * land the drawing and release the framebuffer */
+    cg_texture_get_data(CG_TEXTURE(tex), CG_PIXEL_FORMAT_RGBA_8888_PRE,
+                        2 * 4, data);
+    c_assert_cmpint(c_llist_length(test_dev->framebuffers),
+                    ==,
+                    n_framebuffers);
+
+    for (i = 0; i < 2 * 2; i++) {
+        c_assert_cmpint(data[i * 4 + 0], ==, 0x00);
+        c_assert_cmpint(data[i * 4 + 1], ==, 0xff);
+        c_assert_cmpint(data[i * 4 + 2], ==, 0x00);
+        c_assert_cmpint(data[i * 4 + 3], ==, 0xff);
+    }
+
+    cg_object_unref(tex);
+
+    test_cg_fini();
+}
+
+#endif /* ENABLE_UNIT_TESTS */
@@ -55,6 +55,7 @@ typedef struct _cg_framebuffer_t cg_framebuffer_t;
 
 #include <cglib/cg-pipeline.h>
 #include <cglib/cg-indices.h>
+#include <cglib/cg-attribute.h>
 #include <cglib/cg-bitmap.h>
 #include <cglib/cg-texture.h>
 
@@ -706,6 +707,66 @@ bool cg_framebuffer_get_depth_write_enabled(cg_framebuffer_t *framebuffer);
 void cg_framebuffer_set_depth_write_enabled(cg_framebuffer_t *framebuffer,
                                             bool depth_write_enabled);
 
+/**
+ * cg_framebuffer_get_sort_opaque_draws:
+ * @framebuffer: a pointer to a #cg_framebuffer_t
+ *
+ * Queries whether opaque drawing to @framebuffer may be reordered to
+ * reduce the number of state changes. This can be controlled via
+ * cg_framebuffer_set_sort_opaque_draws().
+ *
+ * Return value: %true if opaque drawing may be reordered or %false if
+ *               not.
+ * Stability: unstable
+ */
+bool cg_framebuffer_get_sort_opaque_draws(cg_framebuffer_t *framebuffer);
+
+/**
+ * cg_framebuffer_set_sort_opaque_draws:
+ * @framebuffer: a pointer to a #cg_framebuffer_t
+ * @sort_opaque_draws: %true to allow opaque drawing to be reordered
+ *
+ * Allows CGlib to change the order that opaque geometry drawn to
+ * @framebuffer is submitted to the GPU so that geometry drawn with the
+ * same program and then with the same textures is drawn together.
+ *
+ * Drawing is only considered opaque if depth writing is enabled for
+ * @framebuffer and the pipeline enables depth testing and depth
+ * writing with a %CG_DEPTH_TEST_FUNCTION_LESS or
+ * %CG_DEPTH_TEST_FUNCTION_GREATER test function and doesn't need
+ * blending. Opaque geometry is never moved past other drawing or past
+ * geometry using a different depth test function. Drawing with
+ * %CG_DEPTH_TEST_FUNCTION_LEQUAL or %CG_DEPTH_TEST_FUNCTION_GEQUAL is
+ * never reordered so it can be used to layer coplanar geometry.
+ *
+ * Overlapping opaque geometry with exactly the same depth values isn't
+ * supported while sorting is enabled: which of the draws ends up
+ * visible may change when they are reordered.
+ *
+ * Sorting is disabled by default.
+ *
+ * Stability: unstable
+ */
+void cg_framebuffer_set_sort_opaque_draws(cg_framebuffer_t *framebuffer,
+                                          bool sort_opaque_draws);
+
+/**
+ * cg_framebuffer_get_n_state_changes_saved:
+ * @framebuffer: a pointer to a #cg_framebuffer_t
+ *
+ * Queries how many program or texture changes have been avoided by
+ * sorting opaque drawing to @framebuffer since it was created. To
+ * find the number saved for a single frame the value can be sampled
+ * after each call to cg_onscreen_swap_buffers().
+ *
+ * See cg_framebuffer_set_sort_opaque_draws().
+ *
+ * Return value: The total number of state changes saved
+ * Stability: unstable
+ */
+int64_t
+cg_framebuffer_get_n_state_changes_saved(cg_framebuffer_t *framebuffer);
+
 /**
  * cg_framebuffer_get_color_mask:
  * @framebuffer: a pointer to a #cg_framebuffer_t
@@ -1236,6 +1297,98 @@ void cg_framebuffer_draw_textured_rectangles(cg_framebuffer_t *framebuffer,
                                              const float *coordinates,
                                              unsigned int n_rectangles);
 
+/**
+ * cg_framebuffer_draw_rectangles_instanced:
+ * @framebuffer: A destination #cg_framebuffer_t
+ * @pipeline: A #cg_pipeline_t state object
+ * @coordinates: (in) (array) (transfer none): an array of coordinates
+ *   for each rectangle. If @pipeline has no layers then each rectangle
+ *   is described by 4 floats: [x_1, y_1, x_2, y_2]. Otherwise each
+ *   rectangle is described by 8 floats: [x_1, y_1, x_2, y_2, s_1, t_1,
+ *   s_2, t_2] in the same way as for
+ *   cg_framebuffer_draw_textured_rectangles().
+ * @colors: (allow-none) (in) (array) (transfer none): an optional array
+ *   of 4 unsigned bytes per rectangle giving a red, green, blue and
+ *   alpha color that will be used instead of the color of @pipeline
+ * @n_rectangles: number of rectangles to draw
+ *
+ * Draws a series of rectangles to @framebuffer with the given
+ * @pipeline state in the same way as cg_framebuffer_draw_rectangles()
+ * or cg_framebuffer_draw_textured_rectangles() but using a single
+ * instanced draw call. A unit quad is uploaded once and only one
+ * instance record per rectangle needs to be uploaded which makes
+ * this well suited for drawing very large numbers of rectangles such
+ * as particles or tiles.
+ *
+ * The texture coordinates are only used for the first layer of
+ * @pipeline. Any other layers are given the default texture
+ * coordinates of (0, 0) to (1, 1). The first layer must be a low
+ * level texture such as a #cg_texture_2d_t and @pipeline should not
+ * have any snippets that replace the vertex transform.
+ *
+ * If the %CG_FEATURE_ID_INSTANCES feature isn't available then the
+ * rectangles will be drawn separately instead.
+ *
+ * Stability: unstable
+ */
+void cg_framebuffer_draw_rectangles_instanced(cg_framebuffer_t *framebuffer,
+                                              cg_pipeline_t *pipeline,
+                                              const float *coordinates,
+                                              const uint8_t *colors,
+                                              unsigned int n_rectangles);
+
+/**
+ * cg_framebuffer_draw_primitives:
+ * @framebuffer: A destination #cg_framebuffer_t
+ * @pipeline: A #cg_pipeline_t state object
+ * @primitives: (in) (array length=n_primitives) (transfer none): an
+ *   array of #cg_primitive_t<!-- -->s to draw
+ * @n_primitives: The number of primitives in @primitives
+ *
+ * Draws each of the given @primitives to @framebuffer with the given
+ * @pipeline state. The result is the same as calling
+ * cg_primitive_draw() for each primitive in turn but the pipeline and
+ * framebuffer state only need to be flushed once. Consecutive
+ * primitives that have the same vertex mode, use the same attribute
+ * layout with the same buffers and, if indexed, use the same index
+ * buffer are submitted together with a single multi-draw call where
+ * the GPU supports it.
+ *
+ * Stability: unstable
+ */
+void cg_framebuffer_draw_primitives(cg_framebuffer_t *framebuffer,
+                                    cg_pipeline_t *pipeline,
+                                    cg_primitive_t **primitives,
+                                    int n_primitives);
+
+/**
+ * cg_framebuffer_draw_attribute_descs:
+ * @framebuffer: A destination #cg_framebuffer_t
+ * @pipeline: A #cg_pipeline_t state object
+ * @mode: The #cg_vertices_mode_t defining the topology of vertices
+ * @first_vertex: The vertex offset within the attribute buffers
+ * @n_vertices: The number of vertices to draw
+ * @descs: (in) (array length=n_descs) (transfer none): an array of
+ *   #cg_attribute_desc_t<!-- -->s initialized with
+ *   cg_attribute_desc_init()
+ * @n_descs: The number of descriptions in @descs
+ *
+ * Draws the vertices described by @descs to @framebuffer with the
+ * given @pipeline state. This is intended for transient geometry that
+ * is only drawn once. Unlike building a #cg_primitive_t out of
+ * #cg_attribute_t<!-- -->s nothing needs to be allocated so the
+ * descriptions can simply live on the stack.
+ *
+ * Stability: unstable
+ */
+void cg_framebuffer_draw_attribute_descs(cg_framebuffer_t *framebuffer,
+                                         cg_pipeline_t *pipeline,
+                                         cg_vertices_mode_t mode,
+                                         int first_vertex,
+                                         int n_vertices,
+                                         const cg_attribute_desc_t *descs,
+                                         int n_descs);
+
 /* XXX: Should we take an n_buffers + buffer id array instead of using
  * the cg_buffer_bit_ts type which doesn't seem future proof? */
 /**
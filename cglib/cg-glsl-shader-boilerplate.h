@@ -35,18 +35,32 @@
 
 #define _CG_COMMON_SHADER_BOILERPLATE                                          \
     "#define CG_VERSION 100\n"                                                 \
-    "\n"                                                                       \
+    "\n"
+
+#define _CG_BUILTIN_UNIFORMS_BOILERPLATE                                       \
     "uniform mat4 cg_modelview_matrix;\n"                                      \
     "uniform mat4 cg_modelview_projection_matrix;\n"                           \
     "uniform mat4 cg_projection_matrix;\n"
 
+/* When uniform buffer objects are available the builtin matrices are
+ * declared in a block instead so that a single buffer can be shared
+ * between all of the programs. The layout must match
+ * cg_builtin_uniform_block_t in cg-pipeline-progend-glsl.c */
+#define _CG_BUILTIN_UNIFORM_BLOCK_BOILERPLATE                                  \
+    "layout(std140) uniform cg_builtin_uniforms {\n"                           \
+    "  mat4 cg_modelview_matrix;\n"                                            \
+    "  mat4 cg_projection_matrix;\n"                                           \
+    "  mat4 cg_modelview_projection_matrix;\n"                                 \
+    "};\n"
+
 /* This declares all of the variables that we might need. This is
  * working on the assumption that the compiler will optimise them out
  * if they are not actually used. The GLSL spec at least implies that
  * this will happen for varyings but it doesn't explicitly so for
  * attributes */
-#define _CG_VERTEX_SHADER_BOILERPLATE                                          \
+#define _CG_VERTEX_SHADER_BOILERPLATE_FOR(builtin_uniforms)                    \
     _CG_COMMON_SHADER_BOILERPLATE                                              \
+    builtin_uniforms                                                           \
     "#define cg_color_out _cg_color\n"                                     \
     "out vec4 _cg_color;\n"                                                \
     "#define cg_position_out gl_Position\n"                                \
@@ -57,10 +71,11 @@
     "#define cg_tex_coord_in cg_tex_coord0_in;\n"                          \
     "in vec3 cg_normal_in;\n"
 
-#define _CG_FRAGMENT_SHADER_BOILERPLATE                                        \
+#define _CG_FRAGMENT_SHADER_BOILERPLATE_FOR(builtin_uniforms)                  \
     "#ifdef GL_ES\n"                                                           \
     "precision highp float;\n"                                                 \
-    "#endif\n" _CG_COMMON_SHADER_BOILERPLATE "\n"                              \
+    "#endif\n" _CG_COMMON_SHADER_BOILERPLATE                                   \
+    builtin_uniforms "\n"                                                      \
     "in vec4 _cg_color;\n"                                                     \
     "\n"                                                                       \
     "#define cg_color_in _cg_color\n"                                          \
@@ -68,6 +83,17 @@
     "#define cg_front_facing gl_FrontFacing\n"                                 \
     "\n"                                                                       \
     "#define cg_point_coord gl_PointCoord\n"
+
+#define _CG_VERTEX_SHADER_BOILERPLATE                                          \
+    _CG_VERTEX_SHADER_BOILERPLATE_FOR(_CG_BUILTIN_UNIFORMS_BOILERPLATE)
+#define _CG_FRAGMENT_SHADER_BOILERPLATE                                        \
+    _CG_FRAGMENT_SHADER_BOILERPLATE_FOR(_CG_BUILTIN_UNIFORMS_BOILERPLATE)
+
+#define _CG_VERTEX_SHADER_UBO_BOILERPLATE                                      \
+    _CG_VERTEX_SHADER_BOILERPLATE_FOR(_CG_BUILTIN_UNIFORM_BLOCK_BOILERPLATE)
+#define _CG_FRAGMENT_SHADER_UBO_BOILERPLATE                                    \
+    _CG_FRAGMENT_SHADER_BOILERPLATE_FOR(_CG_BUILTIN_UNIFORM_BLOCK_BOILERPLATE)
+
 #if 0
 /* GLSL 1.2 has a bottom left origin, though later versions
  * allow use of an origin_upper_left keyword which would be
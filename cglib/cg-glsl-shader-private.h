@@ -29,11 +29,17 @@
 #ifndef _CG_GLSL_SHADER_PRIVATE_H_
 #define _CG_GLSL_SHADER_PRIVATE_H_
 
-void _cg_glsl_shader_set_source_with_boilerplate(cg_device_t *dev,
-                                                 GLuint shader_gl_handle,
-                                                 GLenum shader_gl_type,
-                                                 GLsizei count_in,
-                                                 const char **strings_in,
-                                                 const GLint *lengths_in);
+/* Returns a hash of the complete source given to GL */
+uint64_t _cg_glsl_shader_set_source_with_boilerplate(cg_device_t *dev,
+                                                     GLuint shader_gl_handle,
+                                                     GLenum shader_gl_type,
+                                                     GLsizei count_in,
+                                                     const char **strings_in,
+                                                     const GLint *lengths_in);
+
+bool _cg_glsl_shader_compile(cg_device_t *dev, GLuint shader_gl_handle);
+
+/* Returns a newly allocated copy of the complete source given to GL */
+char *_cg_glsl_shader_get_source(cg_device_t *dev, GLuint shader_gl_handle);
 
 #endif /* _CG_GLSL_SHADER_PRIVATE_H_ */
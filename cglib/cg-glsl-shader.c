@@ -38,12 +38,13 @@
 #include "cg-util-gl-private.h"
 #include "cg-glsl-shader-private.h"
 #include "cg-glsl-shader-boilerplate.h"
+#include "cg-util.h"
 
 #include <string.h>
 
 #include <clib.h>
 
-void
+uint64_t
 _cg_glsl_shader_set_source_with_boilerplate(cg_device_t *dev,
                                             GLuint shader_gl_handle,
                                             GLenum shader_gl_type,
@@ -58,9 +59,17 @@ _cg_glsl_shader_set_source_with_boilerplate(cg_device_t *dev,
     GLint *lengths = c_alloca(sizeof(GLint) * (count_in + 6));
     char *version_string;
     int count = 0;
-
-    vertex_boilerplate = _CG_VERTEX_SHADER_BOILERPLATE;
-    fragment_boilerplate = _CG_FRAGMENT_SHADER_BOILERPLATE;
+    uint64_t hash = CG_UTIL_FNV1A_64_INIT;
+    int i;
+
+    if (_cg_has_private_feature(dev,
+                                CG_PRIVATE_FEATURE_UNIFORM_BUFFER_OBJECTS)) {
+        vertex_boilerplate = _CG_VERTEX_SHADER_UBO_BOILERPLATE;
+        fragment_boilerplate = _CG_FRAGMENT_SHADER_UBO_BOILERPLATE;
+    } else {
+        vertex_boilerplate = _CG_VERTEX_SHADER_BOILERPLATE;
+        fragment_boilerplate = _CG_FRAGMENT_SHADER_BOILERPLATE;
+    }
 
     version_string =
         c_strdup_printf("#version %i\n\n", dev->glsl_version_to_use);
@@ -134,16 +143,20 @@ _cg_glsl_shader_set_source_with_boilerplate(cg_device_t *dev,
     if (lengths_in)
         memcpy(lengths + count, lengths_in, sizeof(GLint) * count_in);
     else {
-        int i;
-
         for (i = 0; i < count_in; i++)
             lengths[count + i] = -1; /* null terminated */
     }
     count += count_in;
 
+    /* The hash of the complete source can be used to identify the
+     * shader between runs, eg. for the program binary cache */
+    for (i = 0; i < count; i++) {
+        size_t len = lengths[i] != -1 ? lengths[i] : strlen(strings[i]);
+        hash = _cg_util_fnv1a_hash_64(hash, strings[i], len);
+    }
+
     if (C_UNLIKELY(CG_DEBUG_ENABLED(CG_DEBUG_SHOW_SOURCE))) {
         c_string_t *buf = c_string_new(NULL);
-        int i;
 
         c_string_append_printf(buf,
                                "%s shader:\n",
@@ -165,4 +178,55 @@ _cg_glsl_shader_set_source_with_boilerplate(cg_device_t *dev,
            shader_gl_handle, count, (const char **)strings, lengths));
 
     c_free(version_string);
+
+    return hash;
+}
+
+bool
+_cg_glsl_shader_compile(cg_device_t *dev, GLuint shader_gl_handle)
+{
+    GLint compile_status;
+
+    GE(dev, glCompileShader(shader_gl_handle));
+
+    /* Querying the status would wait for the compile to finish. When
+     * compiling asynchronously any errors are reported when the
+     * program fails to link instead */
+    if (_cg_device_use_async_shader_compile(dev))
+        return true;
+
+    GE(dev,
+       glGetShaderiv(shader_gl_handle, GL_COMPILE_STATUS, &compile_status));
+
+    if (!compile_status) {
+        GLint len = 0;
+        char *shader_log;
+
+        GE(dev, glGetShaderiv(shader_gl_handle, GL_INFO_LOG_LENGTH, &len));
+        shader_log = c_alloca(len);
+        GE(dev, glGetShaderInfoLog(shader_gl_handle, len, &len, shader_log));
+        c_warning("Shader compilation failed:\n%s", shader_log);
+
+        return false;
+    }
+
+    return true;
+}
+
+char *
+_cg_glsl_shader_get_source(cg_device_t *dev, GLuint shader_gl_handle)
+{
+    GLint length = 0;
+    char *source;
+
+    GE(dev,
+       glGetShaderiv(shader_gl_handle, GL_SHADER_SOURCE_LENGTH, &length));
+
+    /* The length includes the terminator */
+    source = c_malloc(length + 1);
+    source[0] = '\0';
+
+    GE(dev, glGetShaderSource(shader_gl_handle, length + 1, NULL, source));
+
+    return source;
 }
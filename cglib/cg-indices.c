@@ -40,6 +40,8 @@
 #include "cg-indices.h"
 #include "cg-indices-private.h"
 #include "cg-index-buffer.h"
+#include "cg-buffer-private.h"
+#include "cg-private.h"
 
 #include <stdarg.h>
 
@@ -126,15 +128,13 @@ cg_indices_get_offset(cg_indices_t *indices)
     return indices->offset;
 }
 
+/* Indices used by drawing that is batched in a journal are immutable
+ * until the journal has been flushed so we implicitly flush all
+ * journals before they are modified. */
 static void
-warn_about_midscene_changes(void)
+flush_journals(cg_indices_t *indices)
 {
-    static bool seen = false;
-    if (!seen) {
-        c_warning("Mid-scene modification of indices has "
-                  "undefined results\n");
-        seen = true;
-    }
+    _cg_flush(CG_BUFFER(indices->buffer)->dev);
 }
 
 void
@@ -143,7 +143,7 @@ cg_indices_set_offset(cg_indices_t *indices, size_t offset)
     c_return_if_fail(cg_is_indices(indices));
 
     if (C_UNLIKELY(indices->immutable_ref))
-        warn_about_midscene_changes();
+        flush_journals(indices);
 
     indices->offset = offset;
 }
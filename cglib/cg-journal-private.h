@@ -0,0 +1,145 @@
+/*
+ * CGlib
+ *
+ * A Low-Level GPU Graphics and Utilities API
+ *
+ * Copyright (C) 2007,2008,2009 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+
+#ifndef __CG_JOURNAL_PRIVATE_H
+#define __CG_JOURNAL_PRIVATE_H
+
+#include <clib.h>
+
+#include "cg-framebuffer.h"
+#include "cg-pipeline.h"
+#include "cg-matrix-stack.h"
+#include "cg-clip-stack.h"
+#include "cg-primitive.h"
+
+/* The journal lets us defer drawing rectangles so that consecutive
+ * rectangles drawn with equivalent state can be uploaded into a
+ * single vertex buffer and submitted with a single indexed draw call.
+ *
+ * Each framebuffer has its own journal which is flushed whenever
+ * something needs to see the results of the queued drawing, such as
+ * reading back pixels, swapping buffers, drawing a non-rectangle
+ * primitive, changing framebuffer state that isn't tracked per-entry
+ * or modifying a pipeline or texture that is referenced by the
+ * journal.
+ *
+ * If a framebuffer has opted in to sorting opaque draws then
+ * primitives that can't be affected by the order they are drawn in
+ * are also logged and consecutive runs of such entries are sorted by
+ * their state when the journal is flushed.
+ */
+
+/* Maximum number of rectangles we can submit with a single draw call
+ * while still using 16-bit indices */
+#define CG_JOURNAL_MAX_BATCH_RECTANGLES (65536 / 4)
+
+typedef struct _cg_journal_entry_t {
+    cg_pipeline_t *pipeline;
+    cg_matrix_entry_t *modelview_entry;
+    cg_matrix_entry_t *projection_entry;
+    cg_clip_stack_t *clip_stack;
+    int n_layers;
+    /* Offset into journal->data of the rectangle's coordinates which
+     * are stored as x1,y1,x2,y2 followed by s1,t1,s2,t2 for each
+     * layer */
+    unsigned int data_offset;
+    /* If not NULL then this entry draws a primitive instead of a
+     * rectangle */
+    cg_primitive_t *primitive;
+    int n_instances;
+    /* Whether the entry may be reordered with neighbouring opaque
+     * entries when the journal is flushed */
+    bool opaque;
+} cg_journal_entry_t;
+
+typedef struct _cg_journal_t {
+    cg_framebuffer_t *framebuffer;
+
+    c_array_t *entries;
+    c_array_t *data;
+
+    /* The arrays are swapped out while flushing so that any re-entrant
+     * flushes will see an empty journal. The spare arrays are kept to
+     * avoid re-allocating them for each flush. */
+    c_array_t *spare_entries;
+    c_array_t *spare_data;
+} cg_journal_t;
+
+cg_journal_t *_cg_journal_new(cg_framebuffer_t *framebuffer);
+
+void _cg_journal_free(cg_journal_t *journal);
+
+/*
+ * _cg_journal_log_rectangle:
+ * @journal: A #cg_journal_t
+ * @pipeline: The pipeline to draw the rectangle with
+ * @position: The x1,y1,x2,y2 corners of the rectangle
+ * @tex_coords: An s1,t1,s2,t2 set of texture coordinates for each
+ *              layer of @pipeline
+ * @n_layers: The number of sets of texture coordinates in @tex_coords
+ *
+ * Queues a rectangle to be drawn with the current modelview,
+ * projection and clip state of the journal's framebuffer. The textures
+ * referenced by @pipeline are expected to be primitive textures.
+ */
+void _cg_journal_log_rectangle(cg_journal_t *journal,
+                               cg_pipeline_t *pipeline,
+                               const float *position,
+                               const float *tex_coords,
+                               int n_layers);
+
+/*
+ * _cg_journal_log_primitive:
+ * @journal: A #cg_journal_t
+ * @pipeline: The pipeline to draw the primitive with
+ * @primitive: The primitive to draw
+ * @n_instances: The number of instances to draw
+ *
+ * Queues a primitive to be drawn with the current modelview,
+ * projection and clip state of the journal's framebuffer so that it
+ * can be sorted with other opaque drawing. This only succeeds if the
+ * framebuffer has enabled sorting of opaque draws and the result of
+ * drawing the primitive doesn't depend on the order it is drawn in.
+ *
+ * Return value: %true if the primitive was logged or %false if it
+ *               should be drawn immediately instead.
+ */
+bool _cg_journal_log_primitive(cg_journal_t *journal,
+                               cg_pipeline_t *pipeline,
+                               cg_primitive_t *primitive,
+                               int n_instances);
+
+void _cg_journal_flush(cg_journal_t *journal);
+
+void _cg_journal_discard(cg_journal_t *journal);
+
+bool _cg_journal_is_empty(cg_journal_t *journal);
+
+#endif /* __CG_JOURNAL_PRIVATE_H */
@@ -0,0 +1,1158 @@
+/*
+ * CGlib
+ *
+ * A Low-Level GPU Graphics and Utilities API
+ *
+ * Copyright (C) 2007,2008,2009 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+
+#include <cglib-config.h>
+
+#include <test-fixtures/test-cg-fixtures.h>
+
+#include "cg-debug.h"
+#include "cg-device-private.h"
+#include "cg-journal-private.h"
+#include "cg-framebuffer-private.h"
+#include "cg-pipeline-private.h"
+#include "cg-pipeline-state-private.h"
+#include "cg-texture-private.h"
+#include "cg-attribute-private.h"
+#include "cg-attribute-buffer.h"
+#include "cg-vertex-ring-private.h"
+#include "cg-indices-private.h"
+#include "cg-primitive-private.h"
+#include "cg-matrix-stack-private.h"
+#include "cg-clip-stack.h"
+
+/* Each logged vertex has a 3 component position (we need a z
+ * component if the position has been transformed in software)
+ * followed by a 2 component texture coordinate for each layer */
+#define POS_STRIDE 3
+#define TEX_STRIDE 2
+#define GET_JOURNAL_VB_STRIDE_FOR_N_LAYERS(N_LAYERS)                           \
+    (POS_STRIDE + TEX_STRIDE * (N_LAYERS))
+
+typedef struct _cg_journal_flush_state_t {
+    cg_device_t *dev;
+    cg_framebuffer_t *framebuffer;
+    c_array_t *data;
+
+    /* We cache the last resolved modelview matrix since consecutive
+     * entries very often share the same modelview */
+    cg_matrix_entry_t *cached_modelview_entry;
+    c_matrix_t cached_modelview;
+    bool cached_modelview_is_affine;
+} cg_journal_flush_state_t;
+
+/* A run of consecutive entries that can be drawn with one draw call */
+typedef struct _cg_journal_batch_t {
+    cg_journal_entry_t *entry;
+    cg_matrix_entry_t *modelview_entry;
+    bool software_transform;
+    int n_rectangles;
+} cg_journal_batch_t;
+
+typedef struct _cg_journal_attributes_state_t {
+    cg_attribute_buffer_t *attribute_buffer;
+    size_t offset;
+    int stride;
+    int n_layers;
+    int n_attributes;
+    cg_attribute_t *attribute_storage;
+    cg_attribute_t **attributes;
+} cg_journal_attributes_state_t;
+
+cg_journal_t *
+_cg_journal_new(cg_framebuffer_t *framebuffer)
+{
+    cg_journal_t *journal = c_slice_new0(cg_journal_t);
+
+    /* NB: we don't take a reference on the framebuffer here since the
+     * journal is owned by the framebuffer. Instead a reference is held
+     * for as long as the journal has entries so that any pending
+     * drawing still lands if the application unrefs the framebuffer
+     * before it is flushed. */
+    journal->framebuffer = framebuffer;
+
+    journal->entries = c_array_new(false, false, sizeof(cg_journal_entry_t));
+    journal->data = c_array_new(false, false, sizeof(float));
+    journal->spare_entries =
+        c_array_new(false, false, sizeof(cg_journal_entry_t));
+    journal->spare_data = c_array_new(false, false, sizeof(float));
+
+    return journal;
+}
+
+static bool
+unref_layer_texture_cb(cg_pipeline_t *pipeline,
+                       int layer_index,
+                       void *user_data)
+{
+    cg_texture_t *texture =
+        cg_pipeline_get_layer_texture(pipeline, layer_index);
+
+    if (texture)
+        texture->journal_ref_count--;
+
+    return true;
+}
+
+static void
+_cg_journal_release_entries(c_array_t *entries)
+{
+    int i;
+
+    for (i = 0; i < entries->len; i++) {
+        cg_journal_entry_t *entry =
+            &c_array_index(entries, cg_journal_entry_t, i);
+
+        /* NB: the pipeline can't have been modified while it was
+         * referenced by the journal so it still has the same layers
+         * that we referenced when logging */
+        cg_pipeline_foreach_layer(entry->pipeline,
+                                  unref_layer_texture_cb,
+                                  NULL);
+        _cg_pipeline_journal_unref(entry->pipeline);
+        if (entry->primitive) {
+            _cg_primitive_immutable_unref(entry->primitive);
+            cg_object_unref(entry->primitive);
+        }
+        cg_matrix_entry_unref(entry->modelview_entry);
+        cg_matrix_entry_unref(entry->projection_entry);
+        _cg_clip_stack_unref(entry->clip_stack);
+    }
+
+    c_array_set_size(entries, 0);
+}
+
+void
+_cg_journal_discard(cg_journal_t *journal)
+{
+    if (journal->entries->len == 0)
+        return;
+
+    _cg_journal_release_entries(journal->entries);
+    c_array_set_size(journal->data, 0);
+
+    /* This may free the framebuffer so it must be done last */
+    cg_object_unref(journal->framebuffer);
+}
+
+void
+_cg_journal_free(cg_journal_t *journal)
+{
+    _cg_journal_discard(journal);
+
+    c_array_free(journal->entries, true);
+    c_array_free(journal->data, true);
+    if (journal->spare_entries)
+        c_array_free(journal->spare_entries, true);
+    if (journal->spare_data)
+        c_array_free(journal->spare_data, true);
+
+    c_slice_free(cg_journal_t, journal);
+}
+
+bool
+_cg_journal_is_empty(cg_journal_t *journal)
+{
+    return journal->entries->len == 0;
+}
+
+static bool
+ref_layer_texture_cb(cg_pipeline_t *pipeline,
+                     int layer_index,
+                     void *user_data)
+{
+    cg_framebuffer_t *framebuffer = user_data;
+    cg_texture_t *texture =
+        cg_pipeline_get_layer_texture(pipeline, layer_index);
+    const c_llist_t *l;
+
+    if (!texture)
+        return true;
+
+    texture->journal_ref_count++;
+
+    /* If the texture is being rendered to by another framebuffer then
+     * that framebuffer's journal must be flushed before ours */
+    for (l = _cg_texture_get_associated_framebuffers(texture); l; l = l->next)
+        if (l->data != framebuffer)
+            _cg_framebuffer_add_dependency(framebuffer, l->data);
+
+    return true;
+}
+
+static bool
+pipeline_is_opaque(cg_framebuffer_t *framebuffer,
+                   cg_pipeline_t *pipeline,
+                   bool unknown_color_alpha)
+{
+    cg_depth_state_t depth_state;
+
+    /* Drawing can only be reordered without changing the results if
+     * the depth test is what decides which fragments are visible. That
+     * means we need depth writes and a strict depth test function
+     * without any blending. With LEQUAL or GEQUAL the last of several
+     * coplanar draws wins so their order always matters. */
+    if (!framebuffer->depth_writing_enabled)
+        return false;
+
+    cg_pipeline_get_depth_state(pipeline, &depth_state);
+
+    if (!cg_depth_state_get_test_enabled(&depth_state) ||
+        !cg_depth_state_get_write_enabled(&depth_state))
+        return false;
+
+    switch (cg_depth_state_get_test_function(&depth_state)) {
+    case CG_DEPTH_TEST_FUNCTION_LESS:
+    case CG_DEPTH_TEST_FUNCTION_GREATER:
+        break;
+    default:
+        return false;
+    }
+
+    _cg_pipeline_update_real_blend_enable(pipeline, unknown_color_alpha);
+
+    return !pipeline->real_blend_enable;
+}
+
+static cg_journal_entry_t *
+log_entry(cg_journal_t *journal, cg_pipeline_t *pipeline)
+{
+    cg_framebuffer_t *framebuffer = journal->framebuffer;
+    cg_journal_entry_t *entry;
+
+    /* The framebuffer is kept alive until the journal is next flushed
+     * or discarded */
+    if (journal->entries->len == 0)
+        cg_object_ref(framebuffer);
+
+    c_array_set_size(journal->entries, journal->entries->len + 1);
+    entry = &c_array_index(
+        journal->entries, cg_journal_entry_t, journal->entries->len - 1);
+
+    entry->pipeline = _cg_pipeline_journal_ref(pipeline);
+    entry->modelview_entry =
+        cg_matrix_entry_ref(_cg_framebuffer_get_modelview_entry(framebuffer));
+    entry->projection_entry =
+        cg_matrix_entry_ref(_cg_framebuffer_get_projection_entry(framebuffer));
+    entry->clip_stack =
+        _cg_clip_stack_ref(_cg_framebuffer_get_clip_stack(framebuffer));
+    entry->n_layers = 0;
+    entry->data_offset = 0;
+    entry->primitive = NULL;
+    entry->n_instances = 0;
+    entry->opaque = false;
+
+    cg_pipeline_foreach_layer(pipeline, ref_layer_texture_cb, framebuffer);
+
+    return entry;
+}
+
+void
+_cg_journal_log_rectangle(cg_journal_t *journal,
+                          cg_pipeline_t *pipeline,
+                          const float *position,
+                          const float *tex_coords,
+                          int n_layers)
+{
+    cg_framebuffer_t *framebuffer = journal->framebuffer;
+    cg_journal_entry_t *entry;
+    unsigned int data_offset = journal->data->len;
+
+    CG_STATIC_TIMER(log_timer,
+                    "Mainloop", /* parent */
+                    "Journal Log",
+                    "The time spent logging in the CGlib journal",
+                    0 /* no application private data */);
+
+    CG_TIMER_START(_cg_uprof_context, log_timer);
+
+    c_array_append_vals(journal->data, position, 4);
+    if (n_layers)
+        c_array_append_vals(journal->data, tex_coords, 4 * n_layers);
+
+    entry = log_entry(journal, pipeline);
+    entry->n_layers = n_layers;
+    entry->data_offset = data_offset;
+
+    if (framebuffer->sort_opaque_draws)
+        entry->opaque = pipeline_is_opaque(framebuffer, pipeline, false);
+
+    CG_NOTE(JOURNAL,
+            "Logged rectangle (%f, %f, %f, %f) with %d layers",
+            position[0], position[1], position[2], position[3],
+            n_layers);
+
+    if (C_UNLIKELY(CG_DEBUG_ENABLED(CG_DEBUG_DISABLE_BATCHING)))
+        _cg_framebuffer_flush(framebuffer);
+
+    CG_TIMER_STOP(_cg_uprof_context, log_timer);
+}
+
+bool
+_cg_journal_log_primitive(cg_journal_t *journal,
+                          cg_pipeline_t *pipeline,
+                          cg_primitive_t *primitive,
+                          int n_instances)
+{
+    cg_framebuffer_t *framebuffer = journal->framebuffer;
+    cg_journal_entry_t *entry;
+    bool unknown_color_alpha = false;
+    int i;
+
+    if (!framebuffer->sort_opaque_draws ||
+        C_UNLIKELY(CG_DEBUG_ENABLED(CG_DEBUG_DISABLE_BATCHING)))
+        return false;
+
+    /* A color attribute might have any alpha value which may require
+     * blending */
+    for (i = 0; i < primitive->n_attributes; i++) {
+        cg_attribute_t *attribute = primitive->attributes[i];
+
+        if (attribute->name_state->name_id ==
+            CG_ATTRIBUTE_NAME_ID_COLOR_ARRAY &&
+            _cg_attribute_get_n_components(attribute) == 4)
+            unknown_color_alpha = true;
+    }
+
+    if (!pipeline_is_opaque(framebuffer, pipeline, unknown_color_alpha))
+        return false;
+
+    entry = log_entry(journal, pipeline);
+
+    /* The primitive and its attributes and buffers can't be modified
+     * while referenced by the journal. Any attempt to do so will
+     * implicitly flush the journal first */
+    entry->primitive = _cg_primitive_immutable_ref(cg_object_ref(primitive));
+    entry->n_instances = n_instances;
+    entry->opaque = true;
+
+    CG_NOTE(JOURNAL,
+            "Logged primitive %p with %d vertices",
+            primitive,
+            primitive->n_vertices);
+
+    return true;
+}
+
+/* Returns the modelview that should be flushed when drawing @entry.
+ * If we can transform the vertices of the entry in software then the
+ * identity matrix is returned and @matrix is set to the modelview
+ * that should be applied to the vertices. */
+static cg_matrix_entry_t *
+get_effective_modelview(cg_journal_flush_state_t *state,
+                        cg_journal_entry_t *entry,
+                        bool software_transform,
+                        const c_matrix_t **matrix)
+{
+    if (!software_transform)
+        return entry->modelview_entry;
+
+    if (state->cached_modelview_entry != entry->modelview_entry) {
+        c_matrix_t *m = cg_matrix_entry_get(entry->modelview_entry,
+                                            &state->cached_modelview);
+        if (m)
+            state->cached_modelview = *m;
+
+        m = &state->cached_modelview;
+
+        /* We only transform into 3 component positions so we can't
+         * handle projective modelview matrices in software */
+        state->cached_modelview_is_affine =
+            (m->wx == 0 && m->wy == 0 && m->wz == 0 && m->ww == 1);
+
+        state->cached_modelview_entry = entry->modelview_entry;
+    }
+
+    if (!state->cached_modelview_is_affine)
+        return entry->modelview_entry;
+
+    *matrix = &state->cached_modelview;
+
+    return &state->dev->identity_entry;
+}
+
+static bool
+entries_can_batch(cg_journal_entry_t *entry0,
+                  cg_journal_entry_t *entry1)
+{
+    /* Each primitive is drawn with its own draw call */
+    if (entry0->primitive || entry1->primitive)
+        return false;
+
+    if (entry0->n_layers != entry1->n_layers)
+        return false;
+
+    if (entry0->clip_stack != entry1->clip_stack)
+        return false;
+
+    if (entry0->projection_entry != entry1->projection_entry &&
+        !cg_matrix_entry_equal(entry0->projection_entry,
+                               entry1->projection_entry))
+        return false;
+
+    /* NB: _cg_pipeline_equal() compares layer textures by their GL
+     * texture handle so rectangles that reference different
+     * sub-textures of the same atlas can share a batch */
+    if (entry0->pipeline != entry1->pipeline &&
+        !_cg_pipeline_equal(entry0->pipeline,
+                            entry1->pipeline,
+                            CG_PIPELINE_STATE_ALL,
+                            CG_PIPELINE_LAYER_STATE_ALL,
+                            CG_PIPELINE_EVAL_FLAG_NONE))
+        return false;
+
+    return true;
+}
+
+static void
+write_entry_vertices(float *v,
+                     int stride,
+                     const float *data,
+                     int n_layers,
+                     const c_matrix_t *modelview)
+{
+    float positions[8] = {
+        data[0], data[1], /* x1, y1 */
+        data[0], data[3], /* x1, y2 */
+        data[2], data[3], /* x2, y2 */
+        data[2], data[1]  /* x2, y1 */
+    };
+    int i;
+
+    if (modelview)
+        c_matrix_transform_points(modelview,
+                                  2, /* n_components */
+                                  sizeof(float) * 2, /* stride_in */
+                                  positions, /* points_in */
+                                  stride * sizeof(float), /* stride_out */
+                                  v, /* points_out */
+                                  4 /* n_points */);
+    else {
+        for (i = 0; i < 4; i++) {
+            v[i * stride + 0] = positions[i * 2];
+            v[i * stride + 1] = positions[i * 2 + 1];
+            v[i * stride + 2] = 0;
+        }
+    }
+
+    for (i = 0; i < n_layers; i++) {
+        const float *tex = data + 4 + i * 4;
+        float *t = v + POS_STRIDE + i * TEX_STRIDE;
+
+        t[0] = tex[0];
+        t[1] = tex[1];
+        t += stride;
+        t[0] = tex[0];
+        t[1] = tex[3];
+        t += stride;
+        t[0] = tex[2];
+        t[1] = tex[3];
+        t += stride;
+        t[0] = tex[2];
+        t[1] = tex[1];
+    }
+}
+
+static bool
+create_tex_coord_attribute_cb(cg_pipeline_t *pipeline,
+                              int layer_index,
+                              void *user_data)
+{
+    cg_journal_attributes_state_t *state = user_data;
+    int unit = state->n_attributes - 1;
+    char name[32];
+
+    /* We only have texture coordinates for the number of layers that
+     * were logged */
+    if (unit >= state->n_layers)
+        return false;
+
+    /* The texture coordinate attributes are named after the layer
+     * index whereas the logged coordinates are in layer order */
+    c_snprintf(name, sizeof(name), "cg_tex_coord%d_in", layer_index);
+
+    state->attributes[state->n_attributes] =
+        _cg_attribute_init_temporary(state->attribute_storage +
+                                     state->n_attributes,
+                                     state->attribute_buffer,
+                                     name,
+                                     state->stride * sizeof(float),
+                                     state->offset +
+                                     sizeof(float) * (POS_STRIDE +
+                                                      TEX_STRIDE * unit),
+                                     2, /* n_components */
+                                     CG_ATTRIBUTE_TYPE_FLOAT);
+    /* The remaining layers will just have to do without texture
+     * coordinates */
+    if (state->attributes[state->n_attributes] == NULL)
+        return false;
+
+    state->n_attributes++;
+
+    return true;
+}
+
+static void
+draw_batch(cg_journal_flush_state_t *state, cg_journal_batch_t *batch)
+{
+    cg_framebuffer_t *framebuffer = state->framebuffer;
+    cg_device_t *dev = state->dev;
+    cg_journal_entry_t *entry = batch->entry;
+    int n_layers = entry->n_layers;
+    int stride = GET_JOURNAL_VB_STRIDE_FOR_N_LAYERS(n_layers);
+    cg_attribute_t *attribute_storage;
+    cg_attribute_t **attributes;
+    cg_journal_attributes_state_t attributes_state;
+    cg_attribute_buffer_t *attribute_buffer;
+    size_t offset;
+    float *v;
+    int i;
+
+    /* NB: Flushing the clip stack may draw to the stencil buffer
+     * which will disrupt the current modelview and projection so we
+     * always need to flush those afterwards. It may also upload
+     * vertices into the vertex ring so we can't map the ring for this
+     * batch until afterwards. */
+    _cg_clip_stack_flush(entry->clip_stack, framebuffer);
+
+    _cg_device_set_current_projection_entry(dev, entry->projection_entry);
+    _cg_device_set_current_modelview_entry(dev, batch->modelview_entry);
+
+    if (entry->primitive) {
+        CG_NOTE(BATCHING,
+                "Drawing primitive %p with pipeline %p",
+                entry->primitive,
+                entry->pipeline);
+
+        _cg_primitive_draw(entry->primitive,
+                           framebuffer,
+                           entry->pipeline,
+                           entry->n_instances,
+                           CG_DRAW_SKIP_JOURNAL_FLUSH |
+                           CG_DRAW_SKIP_FRAMEBUFFER_FLUSH);
+        return;
+    }
+
+    CG_NOTE(BATCHING,
+            "Drawing batch of %d rectangles with pipeline %p",
+            batch->n_rectangles,
+            entry->pipeline);
+
+    v = _cg_vertex_ring_map(dev->vertex_ring,
+                            batch->n_rectangles * stride * 4 * sizeof(float),
+                            &attribute_buffer,
+                            &offset);
+
+    for (i = 0; i < batch->n_rectangles; i++) {
+        const c_matrix_t *modelview = NULL;
+
+        get_effective_modelview(state,
+                                entry + i,
+                                batch->software_transform,
+                                &modelview);
+
+        write_entry_vertices(v,
+                             stride,
+                             &c_array_index(state->data, float,
+                                            entry[i].data_offset),
+                             n_layers,
+                             modelview);
+        v += stride * 4;
+    }
+
+    _cg_vertex_ring_unmap(dev->vertex_ring);
+
+    attribute_storage = c_alloca(sizeof(cg_attribute_t) * (n_layers + 1));
+    attributes = c_alloca(sizeof(cg_attribute_t *) * (n_layers + 1));
+
+    attributes_state.attribute_buffer = attribute_buffer;
+    attributes_state.offset = offset;
+    attributes_state.stride = stride;
+    attributes_state.n_layers = n_layers;
+    attributes_state.attribute_storage = attribute_storage;
+    attributes_state.attributes = attributes;
+
+    attributes[0] = _cg_attribute_init_temporary(attribute_storage,
+                                                 attribute_buffer,
+                                                 "cg_position_in",
+                                                 stride * sizeof(float),
+                                                 offset,
+                                                 POS_STRIDE,
+                                                 CG_ATTRIBUTE_TYPE_FLOAT);
+    c_return_if_fail(attributes[0] != NULL);
+    attributes_state.n_attributes = 1;
+
+    cg_pipeline_foreach_layer(entry->pipeline,
+                              create_tex_coord_attribute_cb,
+                              &attributes_state);
+
+    _cg_framebuffer_draw_indexed_attributes(
+        framebuffer,
+        entry->pipeline,
+        CG_VERTICES_MODE_TRIANGLES,
+        0, /* first_vertex */
+        batch->n_rectangles * 6,
+        cg_get_rectangle_indices(dev, batch->n_rectangles),
+        NULL, /* primitive */
+        attributes,
+        attributes_state.n_attributes,
+        1, /* n_instances */
+        CG_DRAW_SKIP_JOURNAL_FLUSH | CG_DRAW_SKIP_FRAMEBUFFER_FLUSH);
+}
+
+typedef struct _cg_journal_sort_key_t {
+    unsigned int program_hash;
+    unsigned int textures_hash;
+    unsigned int state_hash;
+    cg_depth_test_function_t depth_function;
+    int index;
+} cg_journal_sort_key_t;
+
+static int
+compare_sort_keys(const void *a, const void *b)
+{
+    const cg_journal_sort_key_t *key0 = a;
+    const cg_journal_sort_key_t *key1 = b;
+
+    if (key0->program_hash != key1->program_hash)
+        return key0->program_hash < key1->program_hash ? -1 : 1;
+    if (key0->textures_hash != key1->textures_hash)
+        return key0->textures_hash < key1->textures_hash ? -1 : 1;
+    if (key0->state_hash != key1->state_hash)
+        return key0->state_hash < key1->state_hash ? -1 : 1;
+
+    /* Keep the sort stable so that equivalent entries can still be
+     * batched in the order they were logged */
+    return key0->index - key1->index;
+}
+
+static int
+count_state_changes(const cg_journal_sort_key_t *keys, int n_keys)
+{
+    int n_changes = 0;
+    int i;
+
+    for (i = 1; i < n_keys; i++) {
+        if (keys[i].program_hash != keys[i - 1].program_hash)
+            n_changes++;
+        if (keys[i].textures_hash != keys[i - 1].textures_hash)
+            n_changes++;
+    }
+
+    return n_changes;
+}
+
+/* Sorts the entries from @run_start up to @run_end and returns the
+ * number of state changes that were saved. @run is scratch space big
+ * enough to hold all of the entries which is allocated on demand */
+static int
+sort_opaque_run(c_array_t *entries,
+                cg_journal_sort_key_t *keys,
+                int run_start,
+                int run_end,
+                cg_journal_entry_t **run)
+{
+    int n_run_entries = run_end - run_start;
+    int n_changes;
+    int i;
+
+    if (n_run_entries < 2)
+        return 0;
+
+    n_changes = count_state_changes(keys + run_start, n_run_entries);
+
+    qsort(keys + run_start,
+          n_run_entries,
+          sizeof(cg_journal_sort_key_t),
+          compare_sort_keys);
+
+    if (*run == NULL)
+        *run = c_new(cg_journal_entry_t, entries->len);
+
+    memcpy(*run,
+           &c_array_index(entries, cg_journal_entry_t, run_start),
+           n_run_entries * sizeof(cg_journal_entry_t));
+
+    for (i = 0; i < n_run_entries; i++)
+        c_array_index(entries, cg_journal_entry_t, run_start + i) =
+            (*run)[keys[run_start + i].index - run_start];
+
+    return n_changes - count_state_changes(keys + run_start, n_run_entries);
+}
+
+/* Sorts each run of consecutive opaque entries so that entries using
+ * the same program are drawn together, then entries using the same
+ * textures and finally entries with the same remaining state. Any
+ * entry that isn't opaque acts as a barrier that nothing can be moved
+ * across. A run also ends wherever the depth test function changes
+ * because geometry drawn with LESS and GREATER doesn't resolve to the
+ * same result in a different order. */
+static void
+sort_opaque_entries(cg_framebuffer_t *framebuffer, c_array_t *entries)
+{
+    cg_device_t *dev = framebuffer->dev;
+    unsigned int program_state =
+        (_cg_pipeline_get_state_for_vertex_codegen(dev) |
+         _cg_pipeline_get_state_for_fragment_codegen(dev));
+    unsigned long program_layer_state =
+        (CG_PIPELINE_LAYER_STATE_AFFECTS_VERTEX_CODEGEN |
+         _cg_pipeline_get_layer_state_for_fragment_codegen(dev));
+    cg_journal_sort_key_t *keys = c_new(cg_journal_sort_key_t, entries->len);
+    cg_journal_entry_t *run = NULL;
+    cg_pipeline_t *last_pipeline = NULL;
+    int run_start = -1;
+    int n_saved = 0;
+    int i;
+
+    for (i = 0; i < entries->len; i++) {
+        cg_journal_entry_t *entry =
+            &c_array_index(entries, cg_journal_entry_t, i);
+        cg_journal_sort_key_t *key = &keys[i];
+
+        if (!entry->opaque) {
+            if (run_start != -1)
+                n_saved += sort_opaque_run(entries, keys, run_start, i, &run);
+            run_start = -1;
+            last_pipeline = NULL;
+            continue;
+        }
+
+        /* Consecutive entries very often share a pipeline */
+        if (entry->pipeline == last_pipeline)
+            *key = keys[i - 1];
+        else {
+            cg_depth_state_t depth_state;
+
+            key->program_hash = _cg_pipeline_hash(entry->pipeline,
+                                                  program_state,
+                                                  program_layer_state,
+                                                  CG_PIPELINE_EVAL_FLAG_NONE);
+            key->textures_hash =
+                _cg_pipeline_hash(entry->pipeline,
+                                  CG_PIPELINE_STATE_LAYERS,
+                                  CG_PIPELINE_LAYER_STATE_TEXTURE_DATA,
+                                  CG_PIPELINE_EVAL_FLAG_NONE);
+            key->state_hash = _cg_pipeline_hash(entry->pipeline,
+                                                CG_PIPELINE_STATE_ALL,
+                                                CG_PIPELINE_LAYER_STATE_ALL,
+                                                CG_PIPELINE_EVAL_FLAG_NONE);
+
+            cg_pipeline_get_depth_state(entry->pipeline, &depth_state);
+            key->depth_function =
+                cg_depth_state_get_test_function(&depth_state);
+
+            last_pipeline = entry->pipeline;
+        }
+        key->index = i;
+
+        if (run_start != -1 &&
+            key->depth_function != keys[run_start].depth_function) {
+            n_saved += sort_opaque_run(entries, keys, run_start, i, &run);
+            run_start = -1;
+        }
+
+        if (run_start == -1)
+            run_start = i;
+    }
+
+    if (run_start != -1)
+        n_saved +=
+            sort_opaque_run(entries, keys, run_start, entries->len, &run);
+
+    c_free(run);
+    c_free(keys);
+
+    CG_NOTE(BATCHING, "Sorting opaque entries saved %d state changes", n_saved);
+
+    framebuffer->n_state_changes_saved += n_saved;
+}
+
+void
+_cg_journal_flush(cg_journal_t *journal)
+{
+    cg_framebuffer_t *framebuffer = journal->framebuffer;
+    cg_device_t *dev = framebuffer->dev;
+    cg_journal_flush_state_t state;
+    c_array_t *entries;
+    c_array_t *data;
+    c_array_t *batches;
+    cg_journal_batch_t *batch = NULL;
+    cg_journal_entry_t *batch_start = NULL;
+    bool software_transform = false;
+    int i;
+
+    CG_STATIC_TIMER(flush_timer,
+                    "Mainloop", /* parent */
+                    "Journal Flush",
+                    "The time spent flushing the CGlib journal",
+                    0 /* no application private data */);
+
+    if (journal->entries->len == 0)
+        return;
+
+    CG_TIMER_START(_cg_uprof_context, flush_timer);
+
+    /* Steal the logged entries so that anything we do while flushing
+     * that results in a re-entrant flush of this journal will simply
+     * see an empty journal */
+    entries = journal->entries;
+    data = journal->data;
+    if (journal->spare_entries) {
+        journal->entries = journal->spare_entries;
+        journal->data = journal->spare_data;
+        journal->spare_entries = NULL;
+        journal->spare_data = NULL;
+    } else {
+        journal->entries =
+            c_array_new(false, false, sizeof(cg_journal_entry_t));
+        journal->data = c_array_new(false, false, sizeof(float));
+    }
+
+    CG_NOTE(JOURNAL, "Flushing journal with %d entries", entries->len);
+
+    if (framebuffer->sort_opaque_draws)
+        sort_opaque_entries(framebuffer, entries);
+
+    state.dev = dev;
+    state.framebuffer = framebuffer;
+    state.data = data;
+    state.cached_modelview_entry = NULL;
+
+    batches = c_array_new(false, false, sizeof(cg_journal_batch_t));
+
+    /* Split the entries into batches that can each be drawn with a
+     * single draw call. The vertices are written out per batch when
+     * it is drawn. */
+    for (i = 0; i < entries->len; i++) {
+        cg_journal_entry_t *entry =
+            &c_array_index(entries, cg_journal_entry_t, i);
+        const c_matrix_t *modelview = NULL;
+        cg_matrix_entry_t *modelview_entry;
+        bool new_batch = false;
+
+        if (batch_start == NULL || !entries_can_batch(batch_start, entry)) {
+            batch_start = entry;
+            software_transform =
+                (!entry->primitive &&
+                 !CG_DEBUG_ENABLED(CG_DEBUG_DISABLE_SOFTWARE_TRANSFORM) &&
+                 !_cg_pipeline_has_vertex_snippets(entry->pipeline));
+            new_batch = true;
+        }
+
+        modelview_entry = get_effective_modelview(&state,
+                                                  entry,
+                                                  software_transform,
+                                                  &modelview);
+
+        /* Even compatible entries need a separate draw call if we
+         * couldn't transform their vertices in software or if we can't
+         * index any more rectangles with 16-bit indices */
+        if (!new_batch &&
+            (batch->n_rectangles == CG_JOURNAL_MAX_BATCH_RECTANGLES ||
+             (modelview_entry != batch->modelview_entry &&
+              !cg_matrix_entry_equal(modelview_entry,
+                                     batch->modelview_entry))))
+            new_batch = true;
+
+        if (new_batch) {
+            c_array_set_size(batches, batches->len + 1);
+            batch = &c_array_index(batches, cg_journal_batch_t,
+                                   batches->len - 1);
+            batch->entry = entry;
+            batch->modelview_entry = modelview_entry;
+            batch->software_transform = software_transform;
+            batch->n_rectangles = 0;
+        }
+
+        batch->n_rectangles++;
+    }
+
+    /* NB: _cg_framebuffer_flush_state may disrupt various state (such
+     * as the pipeline state) when flushing the clip stack, so should
+     * always be done first when preparing to draw. We flush the clip,
+     * modelview and projection state ourselves for each batch. */
+    _cg_framebuffer_flush_state(framebuffer,
+                                framebuffer,
+                                CG_FRAMEBUFFER_STATE_ALL &
+                                ~(CG_FRAMEBUFFER_STATE_CLIP |
+                                  CG_FRAMEBUFFER_STATE_MODELVIEW |
+                                  CG_FRAMEBUFFER_STATE_PROJECTION));
+
+    CG_NOTE(BATCHING,
+            "Drawing %d journal entries with %d batches",
+            entries->len,
+            batches->len);
+
+    for (i = 0; i < batches->len; i++)
+        draw_batch(&state, &c_array_index(batches, cg_journal_batch_t, i));
+
+    c_array_free(batches, true);
+
+    /* We've been flushing the clip, modelview and projection state
+     * directly so make sure they get flushed again the next time the
+     * framebuffer state is flushed */
+    dev->current_draw_buffer_changes |= (CG_FRAMEBUFFER_STATE_CLIP |
+                                         CG_FRAMEBUFFER_STATE_MODELVIEW |
+                                         CG_FRAMEBUFFER_STATE_PROJECTION);
+
+    _cg_journal_release_entries(entries);
+    c_array_set_size(data, 0);
+
+    /* Keep hold of the arrays for the next flush unless a re-entrant
+     * flush has already provided a spare set */
+    if (journal->spare_entries == NULL) {
+        journal->spare_entries = entries;
+        journal->spare_data = data;
+    } else {
+        c_array_free(entries, true);
+        c_array_free(data, true);
+    }
+
+    CG_TIMER_STOP(_cg_uprof_context, flush_timer);
+
+    /* Drop the reference taken when the first entry was logged. This
+     * may free the framebuffer so it must be done last */
+    cg_object_unref(framebuffer);
+}
+
+#ifdef ENABLE_UNIT_TESTS
+
+TEST(check_journal_batching)
+{
+    cg_pipeline_t *red, *red_copy;
+    int fb_width, fb_height;
+
+    test_cg_init();
+
+    fb_width = cg_framebuffer_get_width(test_fb);
+    fb_height = cg_framebuffer_get_height(test_fb);
+
+    cg_framebuffer_orthographic(test_fb, 0, 0, fb_width, fb_height, -1, 100);
+
+    red = cg_pipeline_new(test_dev);
+    cg_pipeline_set_color4f(red, 1, 0, 0, 1);
+    red_copy = cg_pipeline_copy(red);
+
+    cg_framebuffer_draw_rectangle(test_fb, red, 0, 0, 1, 1);
+    cg_framebuffer_translate(test_fb, 1, 0, 0);
+    cg_framebuffer_draw_rectangle(test_fb, red_copy, 0, 0, 1, 1);
+
+    /* Neither rectangle should have been drawn yet */
+    if (!CG_DEBUG_ENABLED(CG_DEBUG_DISABLE_BATCHING))
+        c_assert_cmpint(test_fb->journal->entries->len, ==, 2);
+
+    /* Modifying a pipeline referenced by the journal should implicitly
+     * flush the journal before the change */
+    cg_pipeline_set_color4f(red_copy, 0, 1, 0, 1);
+    c_assert(_cg_journal_is_empty(test_fb->journal));
+
+    cg_framebuffer_draw_rectangle(test_fb, red_copy, 1, 0, 2, 1);
+
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0xff, 0, 0);
+    test_cg_check_pixel_rgb(test_fb, 1, 0, 0xff, 0, 0);
+    test_cg_check_pixel_rgb(test_fb, 2, 0, 0, 0xff, 0);
+
+    cg_object_unref(red_copy);
+    cg_object_unref(red);
+
+    test_cg_fini();
+}
+
+TEST(check_journal_opaque_sorting)
+{
+    cg_pipeline_t *red, *green;
+    cg_depth_state_t depth_state;
+    cg_snippet_t *snippet;
+    int fb_width, fb_height;
+    int64_t n_saved;
+
+    test_cg_init();
+
+    fb_width = cg_framebuffer_get_width(test_fb);
+    fb_height = cg_framebuffer_get_height(test_fb);
+
+    cg_framebuffer_orthographic(test_fb, 0, 0, fb_width, fb_height, -1, 100);
+    cg_framebuffer_set_sort_opaque_draws(test_fb, true);
+
+    cg_depth_state_init(&depth_state);
+    cg_depth_state_set_test_enabled(&depth_state, true);
+
+    red = cg_pipeline_new(test_dev);
+    cg_pipeline_set_color4f(red, 1, 0, 0, 1);
+    cg_pipeline_set_depth_state(red, &depth_state, NULL);
+
+    /* Use a snippet so that the two pipelines need different programs */
+    green = cg_pipeline_new(test_dev);
+    cg_pipeline_set_depth_state(green, &depth_state, NULL);
+    snippet = cg_snippet_new(CG_SNIPPET_HOOK_FRAGMENT,
+                             NULL,
+                             "cg_color_out = vec4(0.0, 1.0, 0.0, 1.0);");
+    cg_pipeline_add_snippet(green, snippet);
+    cg_object_unref(snippet);
+
+    n_saved = cg_framebuffer_get_n_state_changes_saved(test_fb);
+
+    cg_framebuffer_draw_rectangle(test_fb, red, 0, 0, 1, 1);
+    cg_framebuffer_draw_rectangle(test_fb, green, 1, 0, 2, 1);
+    cg_framebuffer_draw_rectangle(test_fb, red, 2, 0, 3, 1);
+    cg_framebuffer_draw_rectangle(test_fb, green, 3, 0, 4, 1);
+
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0xff, 0, 0);
+    test_cg_check_pixel_rgb(test_fb, 1, 0, 0, 0xff, 0);
+    test_cg_check_pixel_rgb(test_fb, 2, 0, 0xff, 0, 0);
+    test_cg_check_pixel_rgb(test_fb, 3, 0, 0, 0xff, 0);
+
+    /* Three program changes should have been reduced to one */
+    if (!CG_DEBUG_ENABLED(CG_DEBUG_DISABLE_BATCHING))
+        c_assert_cmpint(cg_framebuffer_get_n_state_changes_saved(test_fb) -
+                        n_saved, ==, 2);
+
+    cg_framebuffer_set_sort_opaque_draws(test_fb, false);
+
+    cg_object_unref(green);
+    cg_object_unref(red);
+
+    test_cg_fini();
+}
+
+static void
+read_test_row(uint8_t *pixels)
+{
+    cg_framebuffer_read_pixels(test_fb, 0, 0, 4, 1,
+                               CG_PIXEL_FORMAT_RGBA_8888_PRE,
+                               pixels);
+}
+
+static void
+draw_coplanar_rectangles(cg_pipeline_t *red, cg_pipeline_t *green)
+{
+    cg_framebuffer_clear4f(test_fb,
+                           CG_BUFFER_BIT_COLOR | CG_BUFFER_BIT_DEPTH,
+                           0, 0, 0, 1);
+
+    /* Each rectangle overlaps the previous one at the same depth so
+     * moving the greens together would change the middle pixel */
+    cg_framebuffer_draw_rectangle(test_fb, green, 0, 0, 2, 1);
+    cg_framebuffer_draw_rectangle(test_fb, red, 1, 0, 3, 1);
+    cg_framebuffer_draw_rectangle(test_fb, green, 2, 0, 4, 1);
+}
+
+TEST(check_journal_opaque_sorting_coplanar)
+{
+    cg_pipeline_t *red, *green, *green_greater;
+    cg_depth_state_t depth_state;
+    cg_snippet_t *snippet;
+    uint8_t unsorted[4 * 4], sorted[4 * 4];
+    int fb_width, fb_height;
+    int64_t n_saved;
+
+    test_cg_init();
+
+    fb_width = cg_framebuffer_get_width(test_fb);
+    fb_height = cg_framebuffer_get_height(test_fb);
+
+    cg_framebuffer_orthographic(test_fb, 0, 0, fb_width, fb_height, -1, 100);
+
+    cg_depth_state_init(&depth_state);
+    cg_depth_state_set_test_enabled(&depth_state, true);
+    cg_depth_state_set_test_function(&depth_state,
+                                     CG_DEPTH_TEST_FUNCTION_LEQUAL);
+
+    red = cg_pipeline_new(test_dev);
+    cg_pipeline_set_color4f(red, 1, 0, 0, 1);
+    cg_pipeline_set_depth_state(red, &depth_state, NULL);
+
+    green = cg_pipeline_new(test_dev);
+    cg_pipeline_set_depth_state(green, &depth_state, NULL);
+    snippet = cg_snippet_new(CG_SNIPPET_HOOK_FRAGMENT,
+                             NULL,
+                             "cg_color_out = vec4(0.0, 1.0, 0.0, 1.0);");
+    cg_pipeline_add_snippet(green, snippet);
+    cg_object_unref(snippet);
+
+    draw_coplanar_rectangles(red, green);
+    read_test_row(unsorted);
+
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0, 0xff, 0);
+    test_cg_check_pixel_rgb(test_fb, 1, 0, 0xff, 0, 0);
+    test_cg_check_pixel_rgb(test_fb, 2, 0, 0, 0xff, 0);
+    test_cg_check_pixel_rgb(test_fb, 3, 0, 0, 0xff, 0);
+
+    cg_framebuffer_set_sort_opaque_draws(test_fb, true);
+    n_saved = cg_framebuffer_get_n_state_changes_saved(test_fb);
+
+    draw_coplanar_rectangles(red, green);
+    read_test_row(sorted);
+
+    /* LEQUAL drawing must not be reordered */
+    c_assert(memcmp(unsorted, sorted, sizeof(sorted)) == 0);
+    c_assert_cmpint(cg_framebuffer_get_n_state_changes_saved(test_fb) -
+                    n_saved, ==, 0);
+
+    /* Switching between LESS and GREATER must also end a sorted run.
+     * The red rectangle is closer so with LESS it hides the green one
+     * behind it but the GREATER green rectangle drawn further away
+     * afterwards still replaces it. Sorting across the change in
+     * function would draw the two greens first leaving the red on
+     * top. */
+    cg_depth_state_set_test_function(&depth_state,
+                                     CG_DEPTH_TEST_FUNCTION_LESS);
+    cg_pipeline_set_depth_state(red, &depth_state, NULL);
+    cg_pipeline_set_depth_state(green, &depth_state, NULL);
+
+    cg_depth_state_set_test_function(&depth_state,
+                                     CG_DEPTH_TEST_FUNCTION_GREATER);
+    green_greater = cg_pipeline_copy(green);
+    cg_pipeline_set_depth_state(green_greater, &depth_state, NULL);
+
+    cg_framebuffer_clear4f(test_fb,
+                           CG_BUFFER_BIT_COLOR | CG_BUFFER_BIT_DEPTH,
+                           0, 0, 0, 1);
+
+    cg_framebuffer_push_matrix(test_fb);
+    cg_framebuffer_translate(test_fb, 0, 0, -20);
+    cg_framebuffer_draw_rectangle(test_fb, green, 0, 0, 1, 1);
+    cg_framebuffer_translate(test_fb, 0, 0, 10);
+    cg_framebuffer_draw_rectangle(test_fb, red, 0, 0, 1, 1);
+    cg_framebuffer_translate(test_fb, 0, 0, -20);
+    cg_framebuffer_draw_rectangle(test_fb, green_greater, 0, 0, 1, 1);
+    cg_framebuffer_pop_matrix(test_fb);
+
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0, 0xff, 0);
+
+    cg_framebuffer_set_sort_opaque_draws(test_fb, false);
+
+    cg_object_unref(green_greater);
+    cg_object_unref(green);
+    cg_object_unref(red);
+
+    test_cg_fini();
+}
+
+#endif /* ENABLE_UNIT_TESTS */
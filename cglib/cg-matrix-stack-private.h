@@ -52,15 +52,33 @@ typedef enum _cg_matrix_op_t {
     CG_MATRIX_OP_SAVE,
 } cg_matrix_op_t;
 
+/* An entry's composite matrix is cached once it has been composed
+ * more than this many times... */
+#define CG_MATRIX_ENTRY_COMPOSITE_CACHE_GETS 2
+/* ...or as soon as composing it needs more than this many operations
+ * to be replayed on top of the nearest cached ancestor */
+#define CG_MATRIX_ENTRY_COMPOSITE_CACHE_DEPTH 8
+
 struct _cg_matrix_entry_t {
     cg_matrix_entry_t *parent;
+
+    /* The device whose magazines the entry and its matrices were
+     * allocated from. They are returned there when the entry is
+     * freed, via the device's return queue if the last reference is
+     * released on another thread */
+    cg_device_t *dev;
+
     cg_matrix_op_t op;
     unsigned int ref_count;
 
-#ifdef CG_DEBUG_ENABLED
-    /* used for performance tracing */
+    /* The number of times the matrix for this entry has been composed
+     * by replaying the operations of its ancestors */
     int composite_gets;
-#endif
+
+    /* Memoized result of composing this entry or NULL. This is
+     * allocated from the matrices magazine and freed along with the
+     * entry */
+    c_matrix_t *composite;
 };
 
 typedef struct _cg_matrix_entry_translate_t {
@@ -156,7 +174,14 @@ typedef struct _cg_matrix_entry_cache_t {
     bool flushed_identity;
 } cg_matrix_entry_cache_t;
 
-void _cg_matrix_entry_identity_init(cg_matrix_entry_t *entry);
+void _cg_matrix_entry_identity_init(cg_device_t *dev,
+                                    cg_matrix_entry_t *entry);
+
+void _cg_matrix_stack_init_thread_tls(void);
+
+void _cg_matrix_stack_init_magazines(cg_device_t *dev);
+
+void _cg_matrix_stack_destroy_magazines(cg_device_t *dev);
 
 void _cg_matrix_entry_cache_init(cg_matrix_entry_cache_t *cache);
 
@@ -33,6 +33,8 @@
 
 #include <cglib-config.h>
 
+#include <test-fixtures/test-cg-fixtures.h>
+
 #include "cg-device-private.h"
 #include "cg-util-gl-private.h"
 #include "cg-matrix-stack.h"
@@ -45,22 +47,98 @@ static void _cg_matrix_stack_free(cg_matrix_stack_t *stack);
 
 CG_OBJECT_DEFINE(MatrixStack, matrix_stack);
 
-static cg_magazine_t *cg_matrix_stack_magazine;
-static cg_magazine_t *cg_matrix_stack_matrices_magazine;
+static void _cg_matrix_entry_release(cg_matrix_entry_t *entry);
+
+/* Each thread gets a unique token the first time it releases or
+ * allocates an entry so that we can tell whether it is the thread
+ * that owns a device's magazines */
+static c_tls_t thread_token_tls;
+
+void
+_cg_matrix_stack_init_thread_tls(void)
+{
+    c_tls_init(&thread_token_tls, c_free);
+}
+
+static void *
+_cg_matrix_stack_get_thread_token(void)
+{
+    void *token = c_tls_get(&thread_token_tls);
+
+    if (C_UNLIKELY(token == NULL)) {
+        token = c_new0(char, 1);
+        c_tls_set(&thread_token_tls, token);
+    }
+
+    return token;
+}
+
+void
+_cg_matrix_stack_init_magazines(cg_device_t *dev)
+{
+    dev->matrix_entry_magazine =
+        _cg_magazine_new(sizeof(cg_matrix_entry_full_t), 20);
+    dev->matrix_magazine = _cg_magazine_new(sizeof(c_matrix_t), 20);
+    dev->matrix_magazine_owner = _cg_matrix_stack_get_thread_token();
+    c_mutex_init(&dev->matrix_entry_returns_mutex);
+    dev->matrix_entry_returns = NULL;
+}
+
+/* Releases the references that other threads have handed back to the
+ * device. This must only be called on the device's own thread */
+static void
+_cg_matrix_stack_drain_returns(cg_device_t *dev)
+{
+    c_llist_t *returns, *l;
+
+    c_mutex_lock(&dev->matrix_entry_returns_mutex);
+    returns = dev->matrix_entry_returns;
+    dev->matrix_entry_returns = NULL;
+    c_mutex_unlock(&dev->matrix_entry_returns_mutex);
+
+    for (l = returns; l; l = l->next)
+        _cg_matrix_entry_release(l->data);
+
+    c_llist_free(returns);
+}
+
+void
+_cg_matrix_stack_destroy_magazines(cg_device_t *dev)
+{
+    _cg_matrix_stack_drain_returns(dev);
+    c_mutex_destroy(&dev->matrix_entry_returns_mutex);
+
+    _cg_magazine_free(dev->matrix_magazine);
+    _cg_magazine_free(dev->matrix_entry_magazine);
+}
+
+static c_matrix_t *
+_cg_matrix_entry_alloc_matrix(cg_matrix_entry_t *entry)
+{
+    return _cg_magazine_chunk_alloc(entry->dev->matrix_magazine);
+}
+
+static void
+_cg_matrix_entry_free_matrix(cg_matrix_entry_t *entry, c_matrix_t *matrix)
+{
+    _cg_magazine_chunk_free(entry->dev->matrix_magazine, matrix);
+}
 
 /* XXX: Note: this leaves entry->parent uninitialized! */
 static cg_matrix_entry_t *
-_cg_matrix_entry_new(cg_matrix_op_t operation)
+_cg_matrix_entry_new(cg_device_t *dev, cg_matrix_op_t operation)
 {
-    cg_matrix_entry_t *entry =
-        _cg_magazine_chunk_alloc(cg_matrix_stack_magazine);
+    cg_matrix_entry_t *entry;
 
+    _cg_matrix_stack_drain_returns(dev);
+
+    entry = _cg_magazine_chunk_alloc(dev->matrix_entry_magazine);
+
+    entry->dev = dev;
     entry->ref_count = 1;
     entry->op = operation;
-
-#ifdef CG_DEBUG_ENABLED
     entry->composite_gets = 0;
-#endif
+    entry->composite = NULL;
 
     return entry;
 }
@@ -90,7 +168,7 @@ static void *
 _cg_matrix_stack_push_operation(cg_matrix_stack_t *stack,
                                 cg_matrix_op_t operation)
 {
-    cg_matrix_entry_t *entry = _cg_matrix_entry_new(operation);
+    cg_matrix_entry_t *entry = _cg_matrix_entry_new(stack->dev, operation);
 
     _cg_matrix_stack_push_entry(stack, entry);
 
@@ -124,14 +202,14 @@ _cg_matrix_stack_push_replacement_entry(cg_matrix_stack_t *stack,
 }
 
 void
-_cg_matrix_entry_identity_init(cg_matrix_entry_t *entry)
+_cg_matrix_entry_identity_init(cg_device_t *dev, cg_matrix_entry_t *entry)
 {
+    entry->dev = dev;
     entry->ref_count = 1;
     entry->op = CG_MATRIX_OP_LOAD_IDENTITY;
     entry->parent = NULL;
-#ifdef CG_DEBUG_ENABLED
     entry->composite_gets = 0;
-#endif
+    entry->composite = NULL;
 }
 
 void
@@ -214,7 +292,7 @@ cg_matrix_stack_multiply(cg_matrix_stack_t *stack,
 
     entry = _cg_matrix_stack_push_operation(stack, CG_MATRIX_OP_MULTIPLY);
 
-    entry->matrix = _cg_magazine_chunk_alloc(cg_matrix_stack_matrices_magazine);
+    entry->matrix = _cg_matrix_entry_alloc_matrix(&entry->_parent_data);
 
     c_matrix_init_from_array(entry->matrix, (float *)matrix);
 }
@@ -226,7 +304,7 @@ cg_matrix_stack_set(cg_matrix_stack_t *stack, const c_matrix_t *matrix)
 
     entry = _cg_matrix_stack_push_replacement_entry(stack, CG_MATRIX_OP_LOAD);
 
-    entry->matrix = _cg_magazine_chunk_alloc(cg_matrix_stack_matrices_magazine);
+    entry->matrix = _cg_matrix_entry_alloc_matrix(&entry->_parent_data);
 
     c_matrix_init_from_array(entry->matrix, (float *)matrix);
 }
@@ -244,7 +322,7 @@ cg_matrix_stack_frustum(cg_matrix_stack_t *stack,
 
     entry = _cg_matrix_stack_push_replacement_entry(stack, CG_MATRIX_OP_LOAD);
 
-    entry->matrix = _cg_magazine_chunk_alloc(cg_matrix_stack_matrices_magazine);
+    entry->matrix = _cg_matrix_entry_alloc_matrix(&entry->_parent_data);
 
     c_matrix_init_identity(entry->matrix);
     c_matrix_frustum(entry->matrix, left, right, bottom, top, z_near, z_far);
@@ -261,7 +339,7 @@ cg_matrix_stack_perspective(cg_matrix_stack_t *stack,
 
     entry = _cg_matrix_stack_push_replacement_entry(stack, CG_MATRIX_OP_LOAD);
 
-    entry->matrix = _cg_magazine_chunk_alloc(cg_matrix_stack_matrices_magazine);
+    entry->matrix = _cg_matrix_entry_alloc_matrix(&entry->_parent_data);
 
     c_matrix_init_identity(entry->matrix);
     c_matrix_perspective(entry->matrix, fov_y, aspect, z_near, z_far);
@@ -280,7 +358,7 @@ cg_matrix_stack_orthographic(cg_matrix_stack_t *stack,
 
     entry = _cg_matrix_stack_push_replacement_entry(stack, CG_MATRIX_OP_LOAD);
 
-    entry->matrix = _cg_magazine_chunk_alloc(cg_matrix_stack_matrices_magazine);
+    entry->matrix = _cg_matrix_entry_alloc_matrix(&entry->_parent_data);
 
     c_matrix_init_identity(entry->matrix);
     c_matrix_orthographic(entry->matrix, x_1, y_1, x_2, y_2, near, far);
@@ -307,14 +385,17 @@ cg_matrix_entry_ref(cg_matrix_entry_t *entry)
     return entry;
 }
 
-void
-cg_matrix_entry_unref(cg_matrix_entry_t *entry)
+static void
+_cg_matrix_entry_release(cg_matrix_entry_t *entry)
 {
     cg_matrix_entry_t *parent;
 
     for (; entry && --entry->ref_count <= 0; entry = parent) {
         parent = entry->parent;
 
+        if (entry->composite)
+            _cg_matrix_entry_free_matrix(entry, entry->composite);
+
         switch (entry->op) {
         case CG_MATRIX_OP_LOAD_IDENTITY:
         case CG_MATRIX_OP_TRANSLATE:
@@ -326,29 +407,51 @@ cg_matrix_entry_unref(cg_matrix_entry_t *entry)
         case CG_MATRIX_OP_MULTIPLY: {
             cg_matrix_entry_multiply_t *multiply =
                 (cg_matrix_entry_multiply_t *)entry;
-            _cg_magazine_chunk_free(cg_matrix_stack_matrices_magazine,
-                                    multiply->matrix);
+            _cg_matrix_entry_free_matrix(entry, multiply->matrix);
             break;
         }
         case CG_MATRIX_OP_LOAD: {
             cg_matrix_entry_load_t *load = (cg_matrix_entry_load_t *)entry;
-            _cg_magazine_chunk_free(cg_matrix_stack_matrices_magazine,
-                                    load->matrix);
+            _cg_matrix_entry_free_matrix(entry, load->matrix);
             break;
         }
         case CG_MATRIX_OP_SAVE: {
             cg_matrix_entry_save_t *save = (cg_matrix_entry_save_t *)entry;
             if (save->cache_valid)
-                _cg_magazine_chunk_free(cg_matrix_stack_matrices_magazine,
-                                        save->cache);
+                _cg_matrix_entry_free_matrix(entry, save->cache);
             break;
         }
         }
 
-        _cg_magazine_chunk_free(cg_matrix_stack_magazine, entry);
+        _cg_magazine_chunk_free(entry->dev->matrix_entry_magazine, entry);
     }
 }
 
+void
+cg_matrix_entry_unref(cg_matrix_entry_t *entry)
+{
+    cg_device_t *dev;
+
+    if (entry == NULL)
+        return;
+
+    dev = entry->dev;
+
+    /* Reference counts aren't atomic so another thread can't release
+     * the reference itself. Instead it is handed back to the device's
+     * thread which may be concurrently using the entry's ancestors */
+    if (C_UNLIKELY(_cg_matrix_stack_get_thread_token() !=
+                   dev->matrix_magazine_owner)) {
+        c_mutex_lock(&dev->matrix_entry_returns_mutex);
+        dev->matrix_entry_returns =
+            c_llist_prepend(dev->matrix_entry_returns, entry);
+        c_mutex_unlock(&dev->matrix_entry_returns_mutex);
+        return;
+    }
+
+    _cg_matrix_entry_release(entry);
+}
+
 void
 cg_matrix_stack_pop(cg_matrix_stack_t *stack)
 {
@@ -412,6 +515,11 @@ cg_matrix_entry_get(cg_matrix_entry_t *entry, c_matrix_t *matrix)
 
     for (depth = 0, current = entry; current;
          current = current->parent, depth++) {
+        if (current->composite) {
+            *matrix = *current->composite;
+            goto initialized;
+        }
+
         switch (current->op) {
         case CG_MATRIX_OP_LOAD_IDENTITY:
             c_matrix_init_identity(matrix);
@@ -424,9 +532,7 @@ cg_matrix_entry_get(cg_matrix_entry_t *entry, c_matrix_t *matrix)
         case CG_MATRIX_OP_SAVE: {
             cg_matrix_entry_save_t *save = (cg_matrix_entry_save_t *)current;
             if (!save->cache_valid) {
-                cg_magazine_t *matrices_magazine =
-                    cg_matrix_stack_matrices_magazine;
-                save->cache = _cg_magazine_chunk_alloc(matrices_magazine);
+                save->cache = _cg_matrix_entry_alloc_matrix(current);
                 cg_matrix_entry_get(current->parent, save->cache);
                 save->cache_valid = true;
             }
@@ -441,6 +547,9 @@ cg_matrix_entry_get(cg_matrix_entry_t *entry, c_matrix_t *matrix)
 initialized:
 
     if (depth == 0) {
+        if (entry->composite)
+            return entry->composite;
+
         switch (entry->op) {
         case CG_MATRIX_OP_LOAD_IDENTITY:
         case CG_MATRIX_OP_TRANSLATE:
@@ -469,9 +578,9 @@ initialized:
         c_warning("Inconsistent matrix stack");
         return NULL;
     }
+#endif
 
     entry->composite_gets++;
-#endif
 
     children = c_alloca(sizeof(cg_matrix_entry_t) * depth);
 
@@ -544,9 +653,126 @@ initialized:
         }
     }
 
+    /* Entries are immutable so if this one is likely to be composed
+     * again, or would be expensive to compose again, then keep the
+     * result. Descendants will also start replaying from here */
+    if (entry->composite_gets > CG_MATRIX_ENTRY_COMPOSITE_CACHE_GETS ||
+        depth > CG_MATRIX_ENTRY_COMPOSITE_CACHE_DEPTH) {
+        entry->composite = _cg_matrix_entry_alloc_matrix(entry);
+        *entry->composite = *matrix;
+    }
+
     return NULL;
 }
 
+/* Whether the matrix for an entry is available without replaying any
+ * operations */
+static bool
+_cg_matrix_entry_has_matrix(cg_matrix_entry_t *entry)
+{
+    if (entry->composite)
+        return true;
+
+    switch (entry->op) {
+    case CG_MATRIX_OP_LOAD_IDENTITY:
+    case CG_MATRIX_OP_LOAD:
+        return true;
+    case CG_MATRIX_OP_SAVE:
+        return ((cg_matrix_entry_save_t *)entry)->cache_valid;
+    default:
+        return false;
+    }
+}
+
+typedef enum {
+    ENTRY_VISITED = 1,
+    ENTRY_SHARED
+} entry_visit_state_t;
+
+static void
+_cg_matrix_entry_compose_shared(cg_matrix_entry_t *entry)
+{
+    c_matrix_t matrix;
+
+    /* A save entry caches its matrix as a side effect of getting it */
+    cg_matrix_entry_get(entry, &matrix);
+
+    if (entry->op != CG_MATRIX_OP_SAVE && entry->composite == NULL) {
+        entry->composite = _cg_matrix_entry_alloc_matrix(entry);
+        *entry->composite = matrix;
+    }
+}
+
+void
+cg_matrix_entries_get_many(cg_matrix_entry_t **entries,
+                           int n_entries,
+                           c_matrix_t *matrices)
+{
+    c_hash_table_t *visited;
+    c_ptr_array_t *shared;
+    c_ptr_array_t *chain;
+    cg_matrix_entry_t *current;
+    int i, j;
+
+    visited = c_hash_table_new(c_direct_hash, c_direct_equal);
+    shared = c_ptr_array_new();
+    chain = c_ptr_array_new();
+
+    /* Walk up from each entry marking the ancestors that haven't been
+     * seen yet. The first already visited ancestor that a walk reaches
+     * is where the path from this entry joins the path from an earlier
+     * one so it is a shared prefix. Everything above it has already
+     * been handled by the earlier walk. */
+    for (i = 0; i < n_entries; i++) {
+        for (current = entries[i];
+             current && !_cg_matrix_entry_has_matrix(current);
+             current = current->parent) {
+            int state = C_POINTER_TO_INT(c_hash_table_lookup(visited, current));
+
+            if (state) {
+                if (state != ENTRY_SHARED) {
+                    c_hash_table_insert(
+                        visited, current, C_INT_TO_POINTER(ENTRY_SHARED));
+                    c_ptr_array_add(shared, current);
+                }
+                break;
+            }
+
+            c_hash_table_insert(
+                visited, current, C_INT_TO_POINTER(ENTRY_VISITED));
+        }
+    }
+
+    /* Compose the shared prefixes from the top down so that each one
+     * only replays the operations below the nearest shared prefix
+     * above it */
+    for (i = 0; i < shared->len; i++) {
+        c_ptr_array_set_size(chain, 0);
+
+        for (current = c_ptr_array_index(shared, i);
+             current && !_cg_matrix_entry_has_matrix(current);
+             current = current->parent) {
+            if (c_hash_table_lookup(visited, current) ==
+                C_INT_TO_POINTER(ENTRY_SHARED))
+                c_ptr_array_add(chain, current);
+        }
+
+        for (j = chain->len - 1; j >= 0; j--)
+            _cg_matrix_entry_compose_shared(c_ptr_array_index(chain, j));
+    }
+
+    for (i = 0; i < n_entries; i++) {
+        c_matrix_t *internal = cg_matrix_entry_get(entries[i], &matrices[i]);
+
+        if (internal)
+            matrices[i] = *internal;
+    }
+
+    c_ptr_array_free(chain, true);
+    c_ptr_array_free(shared, true);
+    c_hash_table_destroy(visited);
+}
+
 cg_matrix_entry_t *
 cg_matrix_stack_get_entry(cg_matrix_stack_t *stack)
 {
@@ -576,13 +802,6 @@ cg_matrix_stack_new(cg_device_t *dev)
 {
     cg_matrix_stack_t *stack = c_slice_new(cg_matrix_stack_t);
 
-    if (C_UNLIKELY(cg_matrix_stack_magazine == NULL)) {
-        cg_matrix_stack_magazine =
-            _cg_magazine_new(sizeof(cg_matrix_entry_full_t), 20);
-        cg_matrix_stack_matrices_magazine =
-            _cg_magazine_new(sizeof(c_matrix_t), 20);
-    }
-
     stack->dev = dev;
     stack->last_entry = NULL;
 
@@ -604,12 +823,12 @@ _cg_matrix_entry_skip_saves(cg_matrix_entry_t *entry)
     return entry;
 }
 
-bool
-cg_matrix_entry_calculate_translation(cg_matrix_entry_t *entry0,
-                                      cg_matrix_entry_t *entry1,
-                                      float *x,
-                                      float *y,
-                                      float *z)
+static bool
+calculate_translation_from_ops(cg_matrix_entry_t *entry0,
+                               cg_matrix_entry_t *entry1,
+                               float *x,
+                               float *y,
+                               float *z)
 {
     c_sllist_t *head0 = NULL;
     c_sllist_t *head1 = NULL;
@@ -726,6 +945,65 @@ cg_matrix_entry_calculate_translation(cg_matrix_entry_t *entry0,
     return true;
 }
 
+/* If both transforms only affect x and y and they have the same
+ * linear part then they can only differ by a translation. In that case
+ * we have M1 = M0 * T(t) where the translation t is found by solving
+ * the 2x2 linear part of M0 against the difference between the
+ * translation columns. This catches transforms that end up only
+ * translated from each other even though they were built with
+ * different operations, which is common for 2D user interfaces. */
+static bool
+calculate_2d_translation(cg_matrix_entry_t *entry0,
+                         cg_matrix_entry_t *entry1,
+                         float *x,
+                         float *y,
+                         float *z)
+{
+    c_matrix_t storage0, storage1;
+    c_matrix_t *m0, *m1;
+    float det, dx, dy;
+
+    m0 = cg_matrix_entry_get(entry0, &storage0);
+    if (m0 == NULL)
+        m0 = &storage0;
+    m1 = cg_matrix_entry_get(entry1, &storage1);
+    if (m1 == NULL)
+        m1 = &storage1;
+
+    if (!c_matrix_is_2d_affine(m0) || !c_matrix_is_2d_affine(m1))
+        return false;
+
+    if (m0->xx != m1->xx || m0->yx != m1->yx ||
+        m0->xy != m1->xy || m0->yy != m1->yy)
+        return false;
+
+    det = m0->xx * m0->yy - m0->xy * m0->yx;
+    if (det == 0.0f)
+        return false;
+
+    dx = m1->xw - m0->xw;
+    dy = m1->yw - m0->yw;
+
+    *x = (m0->yy * dx - m0->xy * dy) / det;
+    *y = (m0->xx * dy - m0->yx * dx) / det;
+    *z = 0;
+
+    return true;
+}
+
+bool
+cg_matrix_entry_calculate_translation(cg_matrix_entry_t *entry0,
+                                      cg_matrix_entry_t *entry1,
+                                      float *x,
+                                      float *y,
+                                      float *z)
+{
+    if (calculate_translation_from_ops(entry0, entry1, x, y, z))
+        return true;
+
+    return calculate_2d_translation(entry0, entry1, x, y, z);
+}
+
 bool
 cg_matrix_entry_is_identity(cg_matrix_entry_t *entry)
 {
@@ -956,3 +1234,256 @@ _cg_matrix_entry_cache_destroy(cg_matrix_entry_cache_t *cache)
     if (cache->entry)
         cg_matrix_entry_unref(cache->entry);
 }
+
+static void
+check_matrices_equal(const c_matrix_t *matrix_a, const c_matrix_t *matrix_b)
+{
+    const float *a = c_matrix_get_array(matrix_a);
+    const float *b = c_matrix_get_array(matrix_b);
+    int i;
+
+    for (i = 0; i < 16; i++)
+        c_assert(fabsf(a[i] - b[i]) < 0.0001f);
+}
+
+static void
+get_test_entry_matrix(cg_matrix_entry_t *entry, c_matrix_t *matrix)
+{
+    c_matrix_t *internal = cg_matrix_entry_get(entry, matrix);
+
+    if (internal)
+        *matrix = *internal;
+}
+
+#define N_TEST_HIERARCHY_ENTRIES 4
+
+/* Builds a hierarchy where the first three entries are pushed on top
+ * of the same ancestor and the second and third entries share one
+ * more operation. The expected matrices are calculated directly. */
+static void
+build_test_hierarchy(cg_matrix_stack_t *stack,
+                     cg_matrix_entry_t **entries,
+                     c_matrix_t *expected)
+{
+    c_matrix_t base;
+
+    c_matrix_init_identity(&base);
+
+    cg_matrix_stack_translate(stack, 1, 2, 3);
+    c_matrix_translate(&base, 1, 2, 3);
+    cg_matrix_stack_rotate(stack, 30, 0, 0, 1);
+    c_matrix_rotate(&base, 30, 0, 0, 1);
+
+    cg_matrix_stack_push(stack);
+    cg_matrix_stack_translate(stack, 4, 0, 0);
+    expected[0] = base;
+    c_matrix_translate(&expected[0], 4, 0, 0);
+    entries[0] = cg_matrix_entry_ref(cg_matrix_stack_get_entry(stack));
+    cg_matrix_stack_pop(stack);
+
+    cg_matrix_stack_push(stack);
+    cg_matrix_stack_scale(stack, 2, 3, 4);
+    expected[1] = base;
+    c_matrix_scale(&expected[1], 2, 3, 4);
+    entries[1] = cg_matrix_entry_ref(cg_matrix_stack_get_entry(stack));
+    cg_matrix_stack_rotate(stack, 45, 1, 0, 0);
+    expected[2] = expected[1];
+    c_matrix_rotate(&expected[2], 45, 1, 0, 0);
+    entries[2] = cg_matrix_entry_ref(cg_matrix_stack_get_entry(stack));
+    cg_matrix_stack_pop(stack);
+
+    cg_matrix_stack_translate(stack, 0, 5, 0);
+    expected[3] = base;
+    c_matrix_translate(&expected[3], 0, 5, 0);
+    entries[3] = cg_matrix_entry_ref(cg_matrix_stack_get_entry(stack));
+}
+
+TEST(check_matrix_entries_get_many)
+{
+    cg_matrix_entry_t *entries[N_TEST_HIERARCHY_ENTRIES + 1];
+    cg_matrix_entry_t *single_entries[N_TEST_HIERARCHY_ENTRIES];
+    c_matrix_t expected[N_TEST_HIERARCHY_ENTRIES];
+    c_matrix_t matrices[N_TEST_HIERARCHY_ENTRIES + 1];
+    cg_matrix_stack_t *stack, *single_stack;
+    int i;
+
+    test_cg_init();
+
+    /* The same hierarchy is built twice so that the entries resolved
+     * one at a time don't benefit from anything memoized by
+     * cg_matrix_entries_get_many() */
+    stack = cg_matrix_stack_new(test_dev);
+    build_test_hierarchy(stack, entries, expected);
+    single_stack = cg_matrix_stack_new(test_dev);
+    build_test_hierarchy(single_stack, single_entries, expected);
+
+    /* Resolving the same entry twice should be harmless */
+    entries[N_TEST_HIERARCHY_ENTRIES] = entries[1];
+
+    cg_matrix_entries_get_many(entries, C_N_ELEMENTS(entries), matrices);
+
+    for (i = 0; i < N_TEST_HIERARCHY_ENTRIES; i++) {
+        c_matrix_t single;
+
+        get_test_entry_matrix(single_entries[i], &single);
+
+        /* Nothing should have been memoized from a single get */
+        c_assert(single_entries[i]->composite == NULL);
+
+        check_matrices_equal(&matrices[i], &expected[i]);
+        check_matrices_equal(&matrices[i], &single);
+    }
+    check_matrices_equal(&matrices[N_TEST_HIERARCHY_ENTRIES], &expected[1]);
+
+    /* The operation that all of the entries are built on should only
+     * have been composed once */
+    c_assert(entries[3]->parent->composite != NULL);
+    c_assert_cmpint(entries[3]->parent->composite_gets, ==, 1);
+
+    /* Getting the entries again individually should give the same
+     * results from the memoized ancestors */
+    for (i = 0; i < N_TEST_HIERARCHY_ENTRIES; i++) {
+        c_matrix_t matrix;
+
+        get_test_entry_matrix(entries[i], &matrix);
+        check_matrices_equal(&matrix, &expected[i]);
+    }
+
+    for (i = 0; i < N_TEST_HIERARCHY_ENTRIES; i++) {
+        cg_matrix_entry_unref(single_entries[i]);
+        cg_matrix_entry_unref(entries[i]);
+    }
+
+    cg_object_unref(single_stack);
+    cg_object_unref(stack);
+
+    test_cg_fini();
+}
+
+TEST(check_matrix_entry_composite_memo)
+{
+    cg_matrix_entry_t *entry, *child;
+    c_matrix_t expected, matrix, first;
+    c_matrix_t *internal;
+    cg_matrix_stack_t *stack;
+    int i;
+
+    test_cg_init();
+
+    /* A shallow entry is only memoized once it has been composed more
+     * than CG_MATRIX_ENTRY_COMPOSITE_CACHE_GETS times */
+    stack = cg_matrix_stack_new(test_dev);
+    c_matrix_init_identity(&expected);
+    cg_matrix_stack_translate(stack, 1, 2, 3);
+    c_matrix_translate(&expected, 1, 2, 3);
+    cg_matrix_stack_rotate(stack, 60, 0, 1, 0);
+    c_matrix_rotate(&expected, 60, 0, 1, 0);
+    entry = cg_matrix_stack_get_entry(stack);
+
+    for (i = 1; i <= CG_MATRIX_ENTRY_COMPOSITE_CACHE_GETS + 1; i++) {
+        internal = cg_matrix_entry_get(entry, &matrix);
+        c_assert(internal == NULL);
+        check_matrices_equal(&matrix, &expected);
+
+        if (i <= CG_MATRIX_ENTRY_COMPOSITE_CACHE_GETS)
+            c_assert(entry->composite == NULL);
+        else
+            c_assert(entry->composite != NULL);
+    }
+
+    /* From now on the memoized matrix is returned directly */
+    internal = cg_matrix_entry_get(entry, &matrix);
+    c_assert(internal == entry->composite);
+    check_matrices_equal(internal, &expected);
+
+    cg_object_unref(stack);
+
+    /* A deep entry is memoized the first time it is composed */
+    stack = cg_matrix_stack_new(test_dev);
+    c_matrix_init_identity(&expected);
+    for (i = 0; i <= CG_MATRIX_ENTRY_COMPOSITE_CACHE_DEPTH; i++) {
+        if (i & 1) {
+            cg_matrix_stack_rotate(stack, 10 * i, 0, 0, 1);
+            c_matrix_rotate(&expected, 10 * i, 0, 0, 1);
+        } else {
+            cg_matrix_stack_translate(stack, i, -i, 1);
+            c_matrix_translate(&expected, i, -i, 1);
+        }
+    }
+    entry = cg_matrix_stack_get_entry(stack);
+
+    internal = cg_matrix_entry_get(entry, &first);
+    c_assert(internal == NULL);
+    c_assert(entry->composite != NULL);
+    check_matrices_equal(&first, &expected);
+
+    internal = cg_matrix_entry_get(entry, &matrix);
+    c_assert(internal == entry->composite);
+    check_matrices_equal(internal, &first);
+
+    /* Descendants replay their operations on top of the memoized
+     * matrix */
+    cg_matrix_stack_scale(stack, 2, 2, 2);
+    c_matrix_scale(&expected, 2, 2, 2);
+    child = cg_matrix_stack_get_entry(stack);
+
+    internal = cg_matrix_entry_get(child, &matrix);
+    c_assert(internal == NULL);
+    c_assert(child->composite == NULL);
+    check_matrices_equal(&matrix, &expected);
+
+    cg_object_unref(stack);
+
+    test_cg_fini();
+}
+
+#ifdef USE_UV
+
+static void
+unref_entry_thread_cb(void *user_data)
+{
+    cg_matrix_entry_unref(user_data);
+}
+
+static void
+unref_entry_on_thread(cg_matrix_entry_t *entry)
+{
+    uv_thread_t thread;
+
+    c_assert(uv_thread_create(&thread, unref_entry_thread_cb, entry) == 0);
+    uv_thread_join(&thread);
+}
+
+TEST(check_matrix_entry_cross_thread_unref)
+{
+    cg_matrix_stack_t *stack;
+    cg_matrix_entry_t *entry;
+
+    test_cg_init();
+
+    stack = cg_matrix_stack_new(test_dev);
+    cg_matrix_stack_translate(stack, 1, 2, 3);
+    entry = cg_matrix_entry_ref(cg_matrix_stack_get_entry(stack));
+    c_assert_cmpint(entry->ref_count, ==, 2);
+
+    /* Releasing a reference on another thread only queues it... */
+    unref_entry_on_thread(entry);
+    c_assert_cmpint(entry->ref_count, ==, 2);
+    c_assert_cmpint(c_llist_length(test_dev->matrix_entry_returns), ==, 1);
+
+    /* ...until the device's thread next allocates an entry */
+    cg_matrix_stack_translate(stack, 0, 0, 1);
+    c_assert(test_dev->matrix_entry_returns == NULL);
+    c_assert_cmpint(entry->ref_count, ==, 1);
+
+    /* The last reference to a whole hierarchy can also be handed back,
+     * in which case it is released when the device is destroyed */
+    entry = cg_matrix_entry_ref(cg_matrix_stack_get_entry(stack));
+    cg_object_unref(stack);
+    unref_entry_on_thread(entry);
+    c_assert_cmpint(c_llist_length(test_dev->matrix_entry_returns), ==, 1);
+
+    test_cg_fini();
+}
+
+#endif /* USE_UV */
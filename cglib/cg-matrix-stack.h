@@ -471,6 +471,31 @@ c_matrix_t *cg_matrix_stack_get(cg_matrix_stack_t *stack, c_matrix_t *matrix);
  */
 c_matrix_t *cg_matrix_entry_get(cg_matrix_entry_t *entry, c_matrix_t *matrix);
 
+/**
+ * cg_matrix_entries_get_many:
+ * @entries: (array length=n_entries): The entries to resolve
+ * @n_entries: The number of entries in @entries
+ * @matrices: (out) (array length=n_entries): An array of @n_entries
+ *            matrices to store the results in
+ *
+ * Resolves the transform of every entry in @entries into the matrix
+ * at the same index in @matrices. Unlike cg_matrix_entry_get() the
+ * results are always written to @matrices.
+ *
+ * This gives the same results as calling cg_matrix_entry_get() for
+ * each entry but when entries share ancestors, for example because
+ * they were pushed on top of the same cg_matrix_stack_push() point,
+ * the transform of each shared ancestor is only composed once and the
+ * remaining operations of each entry are applied on top of that. This
+ * is much cheaper when resolving the transforms of a large hierarchy
+ * at once.
+ *
+ * Stability: unstable
+ */
+void cg_matrix_entries_get_many(cg_matrix_entry_t **entries,
+                                int n_entries,
+                                c_matrix_t *matrices);
+
 /**
  * cg_matrix_stack_set:
  * @stack: A #cg_matrix_stack_t
@@ -509,6 +534,11 @@ bool cg_is_matrix_stack(void *object);
  * If the difference between the two translations involves anything
  * other than a translation then the function returns %false.
  *
+ * The two transforms don't need to have been built with the same
+ * operations if they both only affect the x and y axes, as is
+ * typical for 2D user interfaces. In that case it is enough that
+ * their rotation, scale and shear are identical.
+ *
  * Return value: %true if the only difference between the transform of
  *                @entry0 and the transform of @entry1 is a translation,
  *                otherwise %false.
@@ -582,6 +612,14 @@ cg_matrix_entry_t *cg_matrix_entry_ref(cg_matrix_entry_t *entry);
  * Releases a reference on @entry either taken by calling
  * cg_matrix_entry_unref() or to release the reference given when
  * calling cg_matrix_stack_get_entry().
+ *
+ * The reference may be released on a different thread to the one
+ * that created the #cg_device_t that @entry belongs to. In that case
+ * the reference is handed back to the device and actually released
+ * the next time the device's thread allocates an entry, or when the
+ * device is destroyed. Apart from releasing a reference, entries must
+ * only be used from the device's thread. All entries must be released
+ * before the #cg_device_t they were created with is destroyed.
  */
 void cg_matrix_entry_unref(cg_matrix_entry_t *entry);
 
@@ -52,6 +52,7 @@ _cg_pipeline_cache_new(cg_device_t *dev)
     unsigned long layer_vertex_state;
     unsigned int fragment_state;
     unsigned int layer_fragment_state;
+    int *capacities = dev->pipeline_cache_capacities;
 
     cache->dev = dev;
 
@@ -65,16 +66,19 @@ _cg_pipeline_cache_new(cg_device_t *dev)
                                  dev,
                                  vertex_state,
                                  layer_vertex_state,
+                                 capacities[CG_PIPELINE_CACHE_TABLE_VERTEX],
                                  "vertex shaders");
     _cg_pipeline_hash_table_init(&cache->fragment_hash,
                                  dev,
                                  fragment_state,
                                  layer_fragment_state,
+                                 capacities[CG_PIPELINE_CACHE_TABLE_FRAGMENT],
                                  "fragment shaders");
     _cg_pipeline_hash_table_init(&cache->combined_hash,
                                  dev,
                                  vertex_state | fragment_state,
                                  layer_vertex_state | layer_fragment_state,
+                                 capacities[CG_PIPELINE_CACHE_TABLE_COMBINED],
                                  "programs");
 
     return cache;
@@ -110,6 +114,66 @@ _cg_pipeline_cache_get_combined_template(cg_pipeline_cache_t *cache,
     return _cg_pipeline_hash_table_get(&cache->combined_hash, key_pipeline);
 }
 
+void
+_cg_pipeline_cache_entry_add_usage(cg_pipeline_cache_entry_t *entry)
+{
+    _cg_pipeline_hash_table_add_usage(entry);
+}
+
+void
+_cg_pipeline_cache_entry_remove_usage(cg_pipeline_cache_entry_t *entry)
+{
+    _cg_pipeline_hash_table_remove_usage(entry);
+}
+
+static cg_pipeline_hash_table_t *
+get_hash_table(cg_pipeline_cache_t *cache, cg_pipeline_cache_table_t table)
+{
+    switch (table) {
+    case CG_PIPELINE_CACHE_TABLE_FRAGMENT:
+        return &cache->fragment_hash;
+    case CG_PIPELINE_CACHE_TABLE_VERTEX:
+        return &cache->vertex_hash;
+    case CG_PIPELINE_CACHE_TABLE_COMBINED:
+        return &cache->combined_hash;
+    }
+
+    c_return_val_if_reached(NULL);
+}
+
+void
+_cg_pipeline_cache_set_capacity(cg_pipeline_cache_t *cache,
+                                cg_pipeline_cache_table_t table,
+                                int capacity)
+{
+    _cg_pipeline_hash_table_set_capacity(get_hash_table(cache, table),
+                                         capacity);
+}
+
+void
+_cg_pipeline_cache_count_compile(cg_pipeline_cache_t *cache,
+                                 cg_pipeline_cache_table_t table)
+{
+    get_hash_table(cache, table)->stats.compiles++;
+}
+
+static void
+get_table_stats(cg_pipeline_hash_table_t *hash,
+                cg_pipeline_cache_table_stats_t *stats)
+{
+    *stats = hash->stats;
+    stats->size = c_hash_table_size(hash->table);
+}
+
+void
+_cg_pipeline_cache_get_stats(cg_pipeline_cache_t *cache,
+                             cg_pipeline_cache_stats_t *stats)
+{
+    get_table_stats(&cache->fragment_hash, &stats->fragment);
+    get_table_stats(&cache->vertex_hash, &stats->vertex);
+    get_table_stats(&cache->combined_hash, &stats->combined);
+}
+
 #ifdef ENABLE_UNIT_TESTS
 
 static void
@@ -144,50 +208,51 @@ TEST(check_pipeline_pruning)
 {
     cg_pipeline_t *pipelines[18];
     int fb_width, fb_height;
-    cg_pipeline_hash_table_t *fragment_hash;
-    cg_pipeline_hash_table_t *combined_hash;
+    cg_pipeline_cache_stats_t stats;
     int i;
 
     test_cg_init();
 
-    fragment_hash = &test_dev->pipeline_cache->fragment_hash;
-    combined_hash = &test_dev->pipeline_cache->combined_hash;
+    cg_device_set_pipeline_cache_capacity(
+        test_dev, CG_PIPELINE_CACHE_TABLE_FRAGMENT, 16);
+    cg_device_set_pipeline_cache_capacity(
+        test_dev, CG_PIPELINE_CACHE_TABLE_COMBINED, 16);
 
     fb_width = cg_framebuffer_get_width(test_fb);
     fb_height = cg_framebuffer_get_height(test_fb);
 
     cg_framebuffer_orthographic(test_fb, 0, 0, fb_width, fb_height, -1, 100);
 
-    /* Create 18 unique pipelines. This should end up being more than
-     * the initial expected minimum size so it will trigger the garbage
-     * collection. However all of the pipelines will be in use so they
-     * won't be collected */
+    /* Create 18 unique pipelines. This is more than the capacity of
+     * the caches but all of the pipelines will be in use so none of
+     * them can be evicted */
     create_pipelines(pipelines, 18);
 
-    /* These pipelines should all have unique entries in the cache. We
-     * should have run the garbage collection once and at that point the
-     * expected minimum size would have been 17 */
-    c_assert_cmpint(c_hash_table_size(fragment_hash->table), ==, 18);
-    c_assert_cmpint(c_hash_table_size(combined_hash->table), ==, 18);
-    c_assert_cmpint(fragment_hash->expected_min_size, ==, 17);
-    c_assert_cmpint(combined_hash->expected_min_size, ==, 17);
-
-    /* Destroy the original pipelines and create some new ones. This
-     * should run the garbage collector again but this time the
-     * pipelines won't be in use so it should free some of them */
+    cg_device_get_pipeline_cache_stats(test_dev, &stats);
+    c_assert_cmpint(stats.fragment.size, ==, 18);
+    c_assert_cmpint(stats.combined.size, ==, 18);
+    c_assert_cmpint(stats.fragment.evictions, ==, 0);
+    c_assert_cmpint(stats.combined.evictions, ==, 0);
+
+    /* Destroy the original pipelines and create some new ones. The
+     * original pipelines are no longer in use so each new pipeline
+     * should evict the least recently used of them until the cache is
+     * back within its capacity */
     for (i = 0; i < 18; i++)
         cg_object_unref(pipelines[i]);
 
     create_pipelines(pipelines, 18);
 
-    /* The garbage collection should have freed half of the original 18
-     * pipelines which means there should now be 18*1.5 = 27 */
-    c_assert_cmpint(c_hash_table_size(fragment_hash->table), ==, 27);
-    c_assert_cmpint(c_hash_table_size(combined_hash->table), ==, 27);
-    /* The 35th pipeline would have caused the garbage collection. At
-     * that point there would be 35-18=17 used unique pipelines. */
-    c_assert_cmpint(fragment_hash->expected_min_size, ==, 17);
-    c_assert_cmpint(combined_hash->expected_min_size, ==, 17);
+    /* All of the original pipelines should have been evicted to make
+     * room and the cache now only contains the new pipelines which
+     * are all in use */
+    cg_device_get_pipeline_cache_stats(test_dev, &stats);
+    c_assert_cmpint(stats.fragment.size, ==, 18);
+    c_assert_cmpint(stats.combined.size, ==, 18);
+    c_assert_cmpint(stats.fragment.evictions, ==, 18);
+    c_assert_cmpint(stats.combined.evictions, ==, 18);
+    c_assert_cmpint(stats.fragment.misses, ==, 36);
+    c_assert_cmpint(stats.combined.misses, ==, 36);
 
     for (i = 0; i < 18; i++)
         cg_object_unref(pipelines[i]);
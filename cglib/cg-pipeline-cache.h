@@ -32,6 +32,7 @@
 #define __CG_PIPELINE_CACHE_H__
 
 #include "cg-pipeline.h"
+#include "cg-device.h"
 
 typedef struct _cg_pipeline_cache_t cg_pipeline_cache_t;
 
@@ -43,6 +44,10 @@ typedef struct {
     int usage_count;
 } cg_pipeline_cache_entry_t;
 
+/* The default maximum number of templates kept in each of the
+ * caches. See cg_device_set_pipeline_cache_capacity() */
+#define CG_PIPELINE_CACHE_DEFAULT_CAPACITY 512
+
 cg_pipeline_cache_t *_cg_pipeline_cache_new(cg_device_t *dev);
 
 void _cg_pipeline_cache_free(cg_pipeline_cache_t *cache);
@@ -87,4 +92,25 @@ cg_pipeline_cache_entry_t *
 _cg_pipeline_cache_get_combined_template(cg_pipeline_cache_t *cache,
                                          cg_pipeline_t *key_pipeline);
 
+/*
+ * Records that a pipeline is using the template of @entry so that it
+ * won't be evicted from the cache. Every usage should be removed with
+ * _cg_pipeline_cache_entry_remove_usage() when it is no longer needed.
+ */
+void _cg_pipeline_cache_entry_add_usage(cg_pipeline_cache_entry_t *entry);
+
+void _cg_pipeline_cache_entry_remove_usage(cg_pipeline_cache_entry_t *entry);
+
+void _cg_pipeline_cache_set_capacity(cg_pipeline_cache_t *cache,
+                                     cg_pipeline_cache_table_t table,
+                                     int capacity);
+
+/* Counts a shader compiled or program linked for the given table in
+ * the cache statistics */
+void _cg_pipeline_cache_count_compile(cg_pipeline_cache_t *cache,
+                                      cg_pipeline_cache_table_t table);
+
+void _cg_pipeline_cache_get_stats(cg_pipeline_cache_t *cache,
+                                  cg_pipeline_cache_stats_t *stats);
+
 #endif /* __CG_PIPELINE_CACHE_H__ */
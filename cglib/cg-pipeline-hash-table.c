@@ -33,6 +33,8 @@
 
 #include <cglib-config.h>
 
+#include <string.h>
+
 #include "cg-device-private.h"
 #include "cg-pipeline-private.h"
 #include "cg-pipeline-hash-table.h"
@@ -53,9 +55,9 @@ typedef struct {
      * entry as both the key and the value */
     cg_pipeline_hash_table_t *hash;
 
-    /* The number of unique pipelines that had been created when this
-     * pipeline was last accessed */
-    int age;
+    /* Link in hash->unused_entries. This is only valid while the usage
+     * count is zero */
+    c_list_t unused_link;
 } cg_pipeline_hash_table_entry_t;
 
 static void
@@ -83,6 +85,11 @@ entry_equal(const void *a, const void *b)
     const cg_pipeline_hash_table_entry_t *entry_b = b;
     const cg_pipeline_hash_table_t *hash = entry_a->hash;
 
+    /* Entries with different hashes can't be equal so avoid the more
+     * expensive comparison */
+    if (entry_a->hash_value != entry_b->hash_value)
+        return false;
+
     return _cg_pipeline_equal(entry_a->parent.pipeline,
                               entry_b->parent.pipeline,
                               hash->main_state,
@@ -95,15 +102,16 @@ _cg_pipeline_hash_table_init(cg_pipeline_hash_table_t *hash,
                              cg_device_t *dev,
                              unsigned int main_state,
                              unsigned int layer_state,
+                             int capacity,
                              const char *debug_string)
 {
     hash->dev = dev;
-    hash->n_unique_pipelines = 0;
+    hash->capacity = capacity;
     hash->debug_string = debug_string;
     hash->main_state = main_state;
     hash->layer_state = layer_state;
-    /* We'll only start pruning once we get to 16 unique pipelines */
-    hash->expected_min_size = 8;
+    c_list_init(&hash->unused_entries);
+    memset(&hash->stats, 0, sizeof(hash->stats));
     hash->table = c_hash_table_new_full(entry_hash,
                                         entry_equal,
                                         NULL, /* key destroy */
@@ -116,54 +124,52 @@ _cg_pipeline_hash_table_destroy(cg_pipeline_hash_table_t *hash)
     c_hash_table_destroy(hash->table);
 }
 
+/* Evicts the least recently used pipelines that aren't in use until
+ * there are fewer than @max_size pipelines in the hash */
 static void
-collect_prunable_entries_cb(void *key, void *value, void *user_data)
+evict_unused_pipelines(cg_pipeline_hash_table_t *hash, int max_size)
 {
-    c_queue_t *entries = user_data;
-    cg_pipeline_cache_entry_t *entry = value;
+    while (c_hash_table_size(hash->table) > max_size &&
+           !c_list_empty(&hash->unused_entries)) {
+        cg_pipeline_hash_table_entry_t *entry =
+            c_list_last(&hash->unused_entries,
+                        cg_pipeline_hash_table_entry_t,
+                        unused_link);
+
+        c_list_remove(&entry->unused_link);
+        c_hash_table_remove(hash->table, entry);
 
-    if (entry->usage_count == 0)
-        c_queue_push_tail(entries, entry);
+        hash->stats.evictions++;
+    }
 }
 
-static int
-compare_pipeline_age_cb(const void *a, const void *b)
+void
+_cg_pipeline_hash_table_set_capacity(cg_pipeline_hash_table_t *hash,
+                                     int capacity)
 {
-    const cg_pipeline_hash_table_entry_t *ae = a;
-    const cg_pipeline_hash_table_entry_t *be = b;
+    hash->capacity = capacity;
 
-    return be->age - ae->age;
+    evict_unused_pipelines(hash, capacity);
 }
 
-static void
-prune_old_pipelines(cg_pipeline_hash_table_t *hash)
+void
+_cg_pipeline_hash_table_add_usage(cg_pipeline_cache_entry_t *cache_entry)
 {
-    c_queue_t entries;
-    c_llist_t *l;
-    int i;
-
-    /* Collect all of the prunable entries into a c_queue_t */
-    c_queue_init(&entries);
-    c_hash_table_foreach(hash->table, collect_prunable_entries_cb, &entries);
-
-    /* Sort the entries by increasing order of age */
-    entries.head = c_llist_sort(entries.head, compare_pipeline_age_cb);
+    cg_pipeline_hash_table_entry_t *entry =
+        (cg_pipeline_hash_table_entry_t *)cache_entry;
 
-    /* The +1 is to include the pipeline that we're about to add */
-    hash->expected_min_size =
-        (c_hash_table_size(hash->table) - entries.length + 1);
-
-    /* Remove oldest half of the prunable pipelines. We still want to
-     * keep some of the prunable entries that are recently used because
-     * it's not unlikely that the application will recreate the same
-     * pipeline */
-    for (l = entries.head, i = 0; i < entries.length / 2; l = l->next, i++) {
-        cg_pipeline_cache_entry_t *entry = l->data;
+    if (cache_entry->usage_count++ == 0)
+        c_list_remove(&entry->unused_link);
+}
 
-        c_hash_table_remove(hash->table, entry);
-    }
+void
+_cg_pipeline_hash_table_remove_usage(cg_pipeline_cache_entry_t *cache_entry)
+{
+    cg_pipeline_hash_table_entry_t *entry =
+        (cg_pipeline_hash_table_entry_t *)cache_entry;
 
-    c_llist_free(entries.head);
+    if (--cache_entry->usage_count == 0)
+        c_list_insert(&entry->hash->unused_entries, &entry->unused_link);
 }
 
 cg_pipeline_cache_entry_t *
@@ -181,26 +187,33 @@ _cg_pipeline_hash_table_get(cg_pipeline_hash_table_t *hash,
     entry = c_hash_table_lookup(hash->table, &dummy_entry);
 
     if (entry) {
-        entry->age = hash->n_unique_pipelines;
+        /* Move it to the front of the eviction order */
+        if (entry->parent.usage_count == 0) {
+            c_list_remove(&entry->unused_link);
+            c_list_insert(&hash->unused_entries, &entry->unused_link);
+        }
+
+        hash->stats.hits++;
+
         return &entry->parent;
     }
 
-    if (hash->n_unique_pipelines == 50)
-        c_warning("Over 50 separate %s have been generated which is very "
-                  "unusual, so something is probably wrong!\n",
-                  hash->debug_string);
+    hash->stats.misses++;
+
+    /* Make room for the new pipeline */
+    evict_unused_pipelines(hash, hash->capacity - 1);
 
-    /* If we are going to have more than twice the expected minimum
-     * number of pipelines in the hash then we'll try pruning and update
-     * the minimum */
-    if (c_hash_table_size(hash->table) >= hash->expected_min_size * 2)
-        prune_old_pipelines(hash);
+    if (c_hash_table_size(hash->table) == hash->capacity)
+        CG_NOTE(PERFORMANCE,
+                "All %i cached %s are in use so the cache is growing "
+                "beyond its capacity",
+                c_hash_table_size(hash->table),
+                hash->debug_string);
 
     entry = c_slice_new(cg_pipeline_hash_table_entry_t);
     entry->parent.usage_count = 0;
     entry->hash = hash;
     entry->hash_value = dummy_entry.hash_value;
-    entry->age = hash->n_unique_pipelines;
 
     copy_state = hash->main_state;
     if (hash->layer_state)
@@ -216,7 +229,7 @@ _cg_pipeline_hash_table_get(cg_pipeline_hash_table_t *hash,
 
     c_hash_table_insert(hash->table, entry, entry);
 
-    hash->n_unique_pipelines++;
+    c_list_insert(&hash->unused_entries, &entry->unused_link);
 
     return &entry->parent;
 }
@@ -36,32 +36,35 @@
 typedef struct {
     cg_device_t *dev;
 
-    /* Total number of pipelines that were ever added to the hash. This
-     * is not decremented when a pipeline is removed. It is only used to
-     * generate a warning if an unusually high number of pipelines are
-     * generated */
-    int n_unique_pipelines;
+    /* The maximum number of pipelines to keep in the hash. Only
+     * pipelines that aren't in use can be evicted so the hash can grow
+     * beyond this if they are all in use */
+    int capacity;
 
-    /* This is the expected minimum size we could prune the hash table
-     * to if we were to remove all pipelines that are not in use. This
-     * is only updated after we prune the table */
-    int expected_min_size;
+    /* Entries whose usage count is zero ordered from the most recently
+     * used at the head to the least recently used at the tail. These
+     * are the candidates for eviction */
+    c_list_t unused_entries;
 
     /* String that will be used to describe the usage of this hash table
-     * in the debug warning when too many pipelines are generated. This
-     * must be a static string because it won't be copied or freed */
+     * in debug notes. This must be a static string because it won't be
+     * copied or freed */
     const char *debug_string;
 
     unsigned int main_state;
     unsigned int layer_state;
 
     c_hash_table_t *table;
+
+    /* Statistics reported by cg_device_get_pipeline_cache_stats() */
+    cg_pipeline_cache_table_stats_t stats;
 } cg_pipeline_hash_table_t;
 
 void _cg_pipeline_hash_table_init(cg_pipeline_hash_table_t *hash,
                                   cg_device_t *device,
                                   unsigned int main_state,
                                   unsigned int layer_state,
+                                  int capacity,
                                   const char *debug_string);
 
 void _cg_pipeline_hash_table_destroy(cg_pipeline_hash_table_t *hash);
@@ -78,4 +81,13 @@ cg_pipeline_cache_entry_t *
 _cg_pipeline_hash_table_get(cg_pipeline_hash_table_t *hash,
                             cg_pipeline_t *key_pipeline);
 
+/* Sets the capacity and evicts any unused pipelines that no longer
+ * fit */
+void _cg_pipeline_hash_table_set_capacity(cg_pipeline_hash_table_t *hash,
+                                          int capacity);
+
+void _cg_pipeline_hash_table_add_usage(cg_pipeline_cache_entry_t *entry);
+
+void _cg_pipeline_hash_table_remove_usage(cg_pipeline_cache_entry_t *entry);
+
 #endif /* __CG_PIPELINE_HASH_H__ */
@@ -225,7 +225,7 @@ _cg_pipeline_layer_pre_change_notify(cg_pipeline_t *required_owner,
                                      cg_pipeline_layer_t *layer,
                                      cg_pipeline_layer_state_t change)
 {
-    cg_texture_unit_t *unit;
+    int i;
 
     _CG_GET_DEVICE(dev, NULL);
 
@@ -287,13 +287,18 @@ _cg_pipeline_layer_pre_change_notify(cg_pipeline_t *required_owner,
     }
 
     /* If the layer being changed is the same as the last layer we
-     * flushed to the corresponding texture unit then we keep a track of
-     * the changes so we can try to minimize redundant OpenGL calls if
-     * the same layer is flushed again.
+     * flushed to a texture unit then we keep a track of the changes so
+     * we can try to minimize redundant OpenGL calls if the same layer
+     * is flushed again. Layers aren't always flushed to the texture
+     * unit matching their position so we have to check them all.
      */
-    unit = _cg_get_texture_unit(dev, _cg_pipeline_layer_get_unit_index(layer));
-    if (unit->layer == layer)
-        unit->layer_changes_since_flush |= change;
+    for (i = 0; i < dev->texture_units->len; i++) {
+        cg_texture_unit_t *unit =
+            &c_array_index(dev->texture_units, cg_texture_unit_t, i);
+
+        if (unit->layer == layer)
+            unit->layer_changes_since_flush |= change;
+    }
 
 init_layer_state:
 
@@ -196,6 +196,10 @@ typedef struct {
        in override_mask have a corresponding value here. The uniform's
        location is implicit from the order in this array */
     cg_boxed_value_t *override_values;
+    /* The number of values that override_values has room for. The
+       array grows geometrically so that adding overrides one at a
+       time doesn't reallocate it every time */
+    int override_values_size;
 
     /* Uniforms that have been modified since this pipeline was last
        flushed */
@@ -227,6 +231,26 @@ typedef struct _cg_pipeline_hash_state_t {
     unsigned int hash;
 } cg_pipeline_hash_state_t;
 
+/* The number of hash values that are memoized per pipeline. This is
+ * enough for the fragment, vertex and combined program caches to
+ * each find their hash without recalculating it */
+#define CG_PIPELINE_N_CACHED_HASHES 3
+
+typedef struct {
+    unsigned int differences;
+    unsigned long layer_differences;
+    cg_pipeline_eval_flags_t flags;
+    /* The pipeline's age when the hash was calculated */
+    unsigned int age;
+    unsigned int hash;
+} cg_pipeline_cached_hash_t;
+
+typedef struct {
+    cg_pipeline_cached_hash_t hashes[CG_PIPELINE_N_CACHED_HASHES];
+    /* The slot to replace next when all of them are in use */
+    int next_slot;
+} cg_pipeline_hash_cache_t;
+
 struct _cg_pipeline_t {
     /* XXX: Please think twice about adding members that *have* be
      * initialized during a cg_pipeline_copy. We are aiming to have
@@ -259,6 +283,12 @@ struct _cg_pipeline_t {
      * depends on the old state. */
     unsigned int age;
 
+    /* The number of journal entries referencing this pipeline. While
+     * this is non-zero any modification of the pipeline will first
+     * flush the journals so that the logged drawing still sees the
+     * old state. */
+    unsigned int journal_ref_count;
+
     /* This is the primary color of the pipeline.
      *
      * This is a sparse property, ref CG_PIPELINE_STATE_COLOR */
@@ -293,6 +323,11 @@ struct _cg_pipeline_t {
      * pipelines with only a few layers... */
     cg_pipeline_layer_t *short_layers_cache[3];
 
+    /* Memoized results of _cg_pipeline_hash(). This is allocated the
+     * first time the pipeline is hashed and the entries are invalidated
+     * by comparing against ->age */
+    cg_pipeline_hash_cache_t *hash_cache;
+
     /* XXX: consider adding an authorities cache to speed up sparse
      * property value lookups:
      * cg_pipeline_t *authorities_cache[CG_PIPELINE_N_SPARSE_PROPERTIES];
@@ -347,6 +382,10 @@ struct _cg_pipeline_t {
      * copy-on-write complexity. For now this is just used
      * for debugging... */
     unsigned int immutable : 1;
+
+    /* Set by cg_pipeline_freeze() to let the driver record the state
+     * that the pipeline resolves to so it can be re-flushed cheaply */
+    unsigned int frozen : 1;
 };
 
 typedef struct _cg_pipeline_fragend_t {
@@ -398,8 +437,12 @@ typedef struct {
     int vertend;
     int fragend;
     bool (*start)(cg_device_t *dev, cg_pipeline_t *pipeline);
-    void (*end)(cg_device_t *dev, cg_pipeline_t *pipeline,
-                unsigned long pipelines_difference);
+    /* If @allow_async is true then this may return false to report
+       that the program for the pipeline is still being built and so
+       the pipeline can't be drawn with yet */
+    bool (*end)(cg_device_t *dev, cg_pipeline_t *pipeline,
+                unsigned long pipelines_difference,
+                bool allow_async);
     void (*pipeline_pre_change_notify)(cg_device_t *dev,
                                        cg_pipeline_t *pipeline,
                                        cg_pipeline_state_t change,
@@ -558,6 +601,9 @@ unsigned int _cg_pipeline_hash(cg_pipeline_t *pipeline,
                                unsigned long layer_differences,
                                cg_pipeline_eval_flags_t flags);
 
+/* The default for cg_device_set_pipeline_max_ancestry_depth() */
+#define CG_PIPELINE_DEFAULT_MAX_ANCESTRY_DEPTH 32
+
 /* Makes a copy of the given pipeline that is a child of the root
  * pipeline rather than a child of the source pipeline. That way the
  * new pipeline won't hold a reference to the source pipeline. The
@@ -587,6 +633,10 @@ void _cg_pipeline_set_static_breadcrumb(cg_pipeline_t *pipeline,
 
 unsigned long _cg_pipeline_get_age(cg_pipeline_t *pipeline);
 
+cg_pipeline_t *_cg_pipeline_journal_ref(cg_pipeline_t *pipeline);
+
+void _cg_pipeline_journal_unref(cg_pipeline_t *pipeline);
+
 cg_pipeline_t *_cg_pipeline_get_authority(cg_pipeline_t *pipeline,
                                           unsigned long difference);
 
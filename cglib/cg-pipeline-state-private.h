@@ -140,4 +140,9 @@ void _cg_pipeline_compare_uniform_differences(unsigned long *differences,
                                               cg_pipeline_t *pipeline0,
                                               cg_pipeline_t *pipeline1);
 
+/* Sets overrides on @dest for every uniform value that @src resolves
+ * from its ancestry */
+void _cg_pipeline_copy_resolved_uniforms(cg_pipeline_t *dest,
+                                         cg_pipeline_t *src);
+
 #endif /* __CG_PIPELINE_STATE_PRIVATE_H */
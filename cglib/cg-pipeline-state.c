@@ -1001,19 +1001,10 @@ cg_pipeline_get_per_vertex_point_size(cg_pipeline_t *pipeline)
     return authority->big_state->per_vertex_point_size;
 }
 
-static cg_boxed_value_t *
-_cg_pipeline_override_uniform(cg_pipeline_t *pipeline,
-                              int location)
+static cg_pipeline_uniforms_state_t *
+_cg_pipeline_begin_uniform_overrides(cg_pipeline_t *pipeline)
 {
     cg_pipeline_state_t state = CG_PIPELINE_STATE_UNIFORMS;
-    cg_pipeline_uniforms_state_t *uniforms_state;
-    int override_index;
-
-    _CG_GET_DEVICE(dev, NULL);
-
-    c_return_val_if_fail(cg_is_pipeline(pipeline), NULL);
-    c_return_val_if_fail(location >= 0, NULL);
-    c_return_val_if_fail(location < dev->n_uniform_names, NULL);
 
     /* - Make sure the pipeline has no dependants so it may be modified.
      * - If the pipeline isn't currently an authority for the state being
@@ -1021,7 +1012,15 @@ _cg_pipeline_override_uniform(cg_pipeline_t *pipeline,
      */
     _cg_pipeline_pre_change_notify(pipeline, state, NULL, false);
 
-    uniforms_state = &pipeline->big_state->uniforms_state;
+    return &pipeline->big_state->uniforms_state;
+}
+
+static cg_boxed_value_t *
+_cg_pipeline_get_uniform_override(cg_pipeline_uniforms_state_t *uniforms_state,
+                                  int location)
+{
+    int override_index;
+    int n_overrides;
 
     /* Count the number of bits that are set below this location. That
        should give us the position where our new value should lie */
@@ -1036,32 +1035,27 @@ _cg_pipeline_override_uniform(cg_pipeline_t *pipeline,
         return uniforms_state->override_values + override_index;
 
     /* We need to create a new override value in the right position
-       within the array. This is pretty inefficient but the hope is that
-       it will be much more common to modify an existing uniform rather
-       than modify a new one so it is more important to optimise the
-       former case. */
-
-    if (uniforms_state->override_values == NULL) {
-        c_assert(override_index == 0);
-        uniforms_state->override_values = c_new(cg_boxed_value_t, 1);
-    } else {
-        /* We need to grow the array and copy in the old values */
-        cg_boxed_value_t *old_values = uniforms_state->override_values;
-        int old_size = _cg_bitmask_popcount(&uniforms_state->override_mask);
-
-        uniforms_state->override_values = c_new(cg_boxed_value_t, old_size + 1);
-
-        /* Copy in the old values leaving a gap for the new value */
-        memcpy(uniforms_state->override_values,
-               old_values,
-               sizeof(cg_boxed_value_t) * override_index);
-        memcpy(uniforms_state->override_values + override_index + 1,
-               old_values + override_index,
-               sizeof(cg_boxed_value_t) * (old_size - override_index));
-
-        c_free(old_values);
+       within the array. The hope is that it will be much more common
+       to modify an existing uniform rather than add a new one but the
+       array grows geometrically so that a pipeline setting up lots of
+       uniforms doesn't reallocate it for each one. */
+
+    n_overrides = _cg_bitmask_popcount(&uniforms_state->override_mask);
+
+    if (n_overrides >= uniforms_state->override_values_size) {
+        uniforms_state->override_values_size =
+            MAX(4, uniforms_state->override_values_size * 2);
+        uniforms_state->override_values =
+            c_realloc(uniforms_state->override_values,
+                      sizeof(cg_boxed_value_t) *
+                      uniforms_state->override_values_size);
     }
 
+    /* Move the later values up to leave a gap for the new value */
+    memmove(uniforms_state->override_values + override_index + 1,
+            uniforms_state->override_values + override_index,
+            sizeof(cg_boxed_value_t) * (n_overrides - override_index));
+
     _cg_boxed_value_init(uniforms_state->override_values + override_index);
 
     _cg_bitmask_set(&uniforms_state->override_mask, location, true);
@@ -1069,6 +1063,53 @@ _cg_pipeline_override_uniform(cg_pipeline_t *pipeline,
     return uniforms_state->override_values + override_index;
 }
 
+static cg_boxed_value_t *
+_cg_pipeline_override_uniform(cg_pipeline_t *pipeline,
+                              int location)
+{
+    cg_pipeline_uniforms_state_t *uniforms_state;
+
+    _CG_GET_DEVICE(dev, NULL);
+
+    c_return_val_if_fail(cg_is_pipeline(pipeline), NULL);
+    c_return_val_if_fail(location >= 0, NULL);
+    c_return_val_if_fail(location < dev->n_uniform_names, NULL);
+
+    uniforms_state = _cg_pipeline_begin_uniform_overrides(pipeline);
+
+    return _cg_pipeline_get_uniform_override(uniforms_state, location);
+}
+
+void
+_cg_pipeline_copy_resolved_uniforms(cg_pipeline_t *dest, cg_pipeline_t *src)
+{
+    cg_pipeline_uniforms_state_t *uniforms_state = NULL;
+    const cg_boxed_value_t **values;
+    int i;
+
+    _CG_GET_DEVICE(dev, NO_RETVAL);
+
+    /* Uniform overrides are accumulated over the whole ancestry of a
+     * pipeline so unlike the other sparse state it isn't enough to
+     * just copy the state of the nearest authority */
+    values = c_alloca(sizeof(const cg_boxed_value_t *) * dev->n_uniform_names);
+    _cg_pipeline_get_all_uniform_values(src, values);
+
+    for (i = 0; i < dev->n_uniform_names; i++) {
+        cg_boxed_value_t *override;
+
+        if (values[i] == NULL)
+            continue;
+
+        if (uniforms_state == NULL)
+            uniforms_state = _cg_pipeline_begin_uniform_overrides(dest);
+
+        override = _cg_pipeline_get_uniform_override(uniforms_state, i);
+        _cg_boxed_value_destroy(override);
+        _cg_boxed_value_copy(override, values[i]);
+    }
+}
+
 void
 cg_pipeline_set_uniform_1f(cg_pipeline_t *pipeline,
                            int uniform_location,
@@ -1137,6 +1178,41 @@ cg_pipeline_set_uniform_matrix(cg_pipeline_t *pipeline,
         boxed_value, dimensions, count, transpose, value);
 }
 
+void
+cg_pipeline_set_uniforms(cg_pipeline_t *pipeline,
+                         const int *uniform_locations,
+                         int n_components,
+                         const float *values,
+                         int n_uniforms)
+{
+    cg_pipeline_uniforms_state_t *uniforms_state;
+    int i;
+
+    _CG_GET_DEVICE(dev, NO_RETVAL);
+
+    c_return_if_fail(cg_is_pipeline(pipeline));
+    c_return_if_fail(n_components >= 1 && n_components <= 4);
+
+    for (i = 0; i < n_uniforms; i++) {
+        c_return_if_fail(uniform_locations[i] >= 0);
+        c_return_if_fail(uniform_locations[i] < dev->n_uniform_names);
+    }
+
+    /* The pipeline only needs to be notified once for the whole batch */
+    uniforms_state = _cg_pipeline_begin_uniform_overrides(pipeline);
+
+    for (i = 0; i < n_uniforms; i++) {
+        cg_boxed_value_t *boxed_value =
+            _cg_pipeline_get_uniform_override(uniforms_state,
+                                              uniform_locations[i]);
+
+        _cg_boxed_value_set_float(boxed_value,
+                                  n_components,
+                                  1, /* count */
+                                  values + i * n_components);
+    }
+}
+
 static void
 _cg_pipeline_add_vertex_snippet(cg_pipeline_t *pipeline,
                                 cg_snippet_t *snippet)
@@ -1605,3 +1681,183 @@ TEST(check_uniform_ancestry)
 
     test_cg_fini();
 }
+
+static void
+check_batch_uniform_values(cg_pipeline_t *pipeline,
+                           const int *locations,
+                           const float *expected,
+                           int n_locations)
+{
+    const cg_boxed_value_t **values;
+    int i;
+
+    values = c_alloca(sizeof(const cg_boxed_value_t *) *
+                      test_dev->n_uniform_names);
+    _cg_pipeline_get_all_uniform_values(pipeline, values);
+
+    for (i = 0; i < n_locations; i++) {
+        const cg_boxed_value_t *value = values[locations[i]];
+
+        c_assert(value != NULL);
+        c_assert_cmpint(value->type, ==, CG_BOXED_FLOAT);
+        c_assert_cmpint(value->size, ==, 2);
+        c_assert_cmpint(value->count, ==, 1);
+        c_assert_cmpfloat(value->v.float_value[0], ==, expected[i * 2]);
+        c_assert_cmpfloat(value->v.float_value[1], ==, expected[i * 2 + 1]);
+    }
+}
+
+TEST(check_uniform_batch)
+{
+    /* The uniforms are set out of order so that later overrides have
+     * to be inserted in between the existing ones and so that there
+     * are more than fit in the initial allocation */
+    static const int first_order[] = { 5, 3 };
+    static const float first_values[] = { 1, 0, 0, 1 };
+    static const int second_order[] = { 4, 0, 2, 1 };
+    static const float second_values[] = { 1, 1, 0, 1, 0, 0, 1, 0 };
+    static const float third_values[] = { 0, 0 };
+    cg_pipeline_t *pipeline;
+    cg_snippet_t *snippet;
+    int locations[6];
+    int batch_locations[4];
+    float expected[C_N_ELEMENTS(locations) * 2];
+    int fb_width, fb_height;
+    int i;
+
+    test_cg_init();
+
+    fb_width = cg_framebuffer_get_width(test_fb);
+    fb_height = cg_framebuffer_get_height(test_fb);
+
+    cg_framebuffer_orthographic(test_fb, 0, 0, fb_width, fb_height, -1, 100);
+
+    pipeline = cg_pipeline_new(test_dev);
+
+    for (i = 0; i < C_N_ELEMENTS(locations); i++) {
+        char *name = c_strdup_printf("batch_uniform_%i", i);
+        locations[i] = cg_pipeline_get_uniform_location(pipeline, name);
+        c_free(name);
+    }
+
+    snippet = cg_snippet_new(CG_SNIPPET_HOOK_FRAGMENT,
+                             "uniform vec2 batch_uniform_0;\n"
+                             "uniform vec2 batch_uniform_5;\n",
+                             "cg_color_out = vec4(batch_uniform_0, "
+                             "batch_uniform_5.x, 1.0);\n");
+    cg_pipeline_add_snippet(pipeline, snippet);
+    cg_object_unref(snippet);
+
+    for (i = 0; i < C_N_ELEMENTS(first_order); i++) {
+        batch_locations[i] = locations[first_order[i]];
+        expected[first_order[i] * 2] = first_values[i * 2];
+        expected[first_order[i] * 2 + 1] = first_values[i * 2 + 1];
+    }
+    cg_pipeline_set_uniforms(pipeline,
+                             batch_locations,
+                             2, /* n_components */
+                             first_values,
+                             C_N_ELEMENTS(first_order));
+
+    cg_framebuffer_draw_rectangle(test_fb, pipeline, 0, 0, 1, 1);
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0, 0, 0xff);
+
+    for (i = 0; i < C_N_ELEMENTS(second_order); i++) {
+        batch_locations[i] = locations[second_order[i]];
+        expected[second_order[i] * 2] = second_values[i * 2];
+        expected[second_order[i] * 2 + 1] = second_values[i * 2 + 1];
+    }
+    cg_pipeline_set_uniforms(pipeline,
+                             batch_locations,
+                             2, /* n_components */
+                             second_values,
+                             C_N_ELEMENTS(second_order));
+
+    check_batch_uniform_values(pipeline,
+                               locations,
+                               expected,
+                               C_N_ELEMENTS(locations));
+
+    /* Redrawing with the same pipeline only flushes the uniforms that
+     * have changed since the last draw */
+    cg_framebuffer_draw_rectangle(test_fb, pipeline, 1, 0, 2, 1);
+    test_cg_check_pixel_rgb(test_fb, 1, 0, 0, 0xff, 0xff);
+
+    batch_locations[0] = locations[5];
+    cg_pipeline_set_uniforms(pipeline,
+                             batch_locations,
+                             2, /* n_components */
+                             third_values,
+                             1);
+
+    cg_framebuffer_draw_rectangle(test_fb, pipeline, 2, 0, 3, 1);
+    test_cg_check_pixel_rgb(test_fb, 2, 0, 0, 0xff, 0);
+
+    expected[5 * 2] = 0;
+    check_batch_uniform_values(pipeline,
+                               locations,
+                               expected,
+                               C_N_ELEMENTS(locations));
+
+    cg_object_unref(pipeline);
+
+    test_cg_fini();
+}
+
+TEST(check_ancestry_flattening)
+{
+    cg_pipeline_t *pipeline;
+    const cg_boxed_value_t **values;
+    cg_color_t color = { 1.0f, 0.0f, 0.0f, 1.0f };
+    cg_color_t result;
+    cg_node_t *node;
+    int locations[50];
+    int pipeline_length = 0;
+    int i;
+
+    test_cg_init();
+
+    cg_device_set_pipeline_max_ancestry_depth(test_dev, 8);
+
+    pipeline = cg_pipeline_new(test_dev);
+    cg_pipeline_set_color(pipeline, &color);
+
+    /* Setting a different uniform on each copy means none of the
+     * ancestry is redundant so it can only be kept short by flattening
+     * it */
+
+    for (i = 0; i < C_N_ELEMENTS(locations); i++) {
+        cg_pipeline_t *tmp_pipeline;
+        char *name = c_strdup_printf("flatten_uniform_%i", i);
+
+        tmp_pipeline = cg_pipeline_copy(pipeline);
+        cg_object_unref(pipeline);
+        pipeline = tmp_pipeline;
+
+        locations[i] = cg_pipeline_get_uniform_location(pipeline, name);
+        cg_pipeline_set_uniform_1i(pipeline, locations[i], i);
+
+        c_free(name);
+    }
+
+    for (node = (cg_node_t *)pipeline; node; node = node->parent)
+        pipeline_length++;
+
+    c_assert_cmpint(pipeline_length, <=, 9);
+
+    cg_pipeline_get_color(pipeline, &result);
+    c_assert(cg_color_equal(&color, &result));
+
+    values = c_alloca(sizeof(const cg_boxed_value_t *) *
+                      test_dev->n_uniform_names);
+    _cg_pipeline_get_all_uniform_values(pipeline, values);
+
+    for (i = 0; i < C_N_ELEMENTS(locations); i++) {
+        c_assert(values[locations[i]] != NULL);
+        c_assert_cmpint(values[locations[i]]->v.int_value[0], ==, i);
+    }
+
+    cg_object_unref(pipeline);
+
+    test_cg_fini();
+}
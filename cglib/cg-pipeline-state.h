@@ -655,6 +655,33 @@ void cg_pipeline_set_uniform_matrix(cg_pipeline_t *pipeline,
                                     bool transpose,
                                     const float *value);
 
+/**
+ * cg_pipeline_set_uniforms:
+ * @pipeline: A #cg_pipeline_t object
+ * @uniform_locations: The location identifiers of the uniforms to set
+ * @n_components: The number of components in each uniform's type
+ * @values: Pointer to @n_components * @n_uniforms new values
+ * @n_uniforms: The number of uniforms to set
+ *
+ * Sets new values for several float uniforms at once. The value for
+ * the uniform at @uniform_locations[i] is taken from the
+ * @n_components floats starting at @values + i * @n_components. For
+ * example to set three vec4 uniforms you would use 4 for
+ * @n_components and pass 12 floats in @values.
+ *
+ * This is equivalent to calling cg_pipeline_set_uniform_float() for
+ * each uniform with a @count of 1 but it only needs to prepare the
+ * pipeline for modification once which is cheaper when animating lots
+ * of uniforms every frame.
+ *
+ * Stability: Unstable
+ */
+void cg_pipeline_set_uniforms(cg_pipeline_t *pipeline,
+                              const int *uniform_locations,
+                              int n_components,
+                              const float *values,
+                              int n_uniforms);
+
 /**
  * cg_pipeline_add_snippet:
  * @pipeline: A #cg_pipeline_t
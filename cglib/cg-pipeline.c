@@ -136,6 +136,7 @@ _cg_pipeline_init_default_pipeline(cg_device_t *dev)
     _cg_pipeline_node_init(CG_NODE(pipeline));
 
     pipeline->immutable = false;
+    pipeline->frozen = false;
     pipeline->progend = CG_PIPELINE_PROGEND_UNDEFINED;
     pipeline->differences = CG_PIPELINE_STATE_ALL_SPARSE;
 
@@ -152,6 +153,9 @@ _cg_pipeline_init_default_pipeline(cg_device_t *dev)
     pipeline->has_static_breadcrumb = true;
 
     pipeline->age = 0;
+    pipeline->hash_cache = NULL;
+
+    pipeline->journal_ref_count = 0;
 
     /* Use the same defaults as the GL spec... */
     cg_color_init_from_4ub(&pipeline->color, 0xff, 0xff, 0xff, 0xff);
@@ -184,6 +188,7 @@ _cg_pipeline_init_default_pipeline(cg_device_t *dev)
     _cg_bitmask_init(&uniforms_state->override_mask);
     _cg_bitmask_init(&uniforms_state->changed_mask);
     uniforms_state->override_values = NULL;
+    uniforms_state->override_values_size = 0;
 
     dev->default_pipeline = _cg_pipeline_object_new(pipeline);
 }
@@ -240,16 +245,96 @@ _cg_pipeline_set_parent(cg_pipeline_t *pipeline,
         recursively_free_layer_caches(pipeline);
 }
 
+typedef struct {
+    cg_pipeline_t *pipeline;
+    unsigned int age;
+} cg_pipeline_flattened_t;
+
+static cg_user_data_key_t flattened_ancestry_key;
+
+static void
+destroy_flattened_ancestry(void *user_data, void *instance)
+{
+    cg_pipeline_flattened_t *flattened = user_data;
+
+    cg_object_unref(flattened->pipeline);
+    c_slice_free(cg_pipeline_flattened_t, flattened);
+}
+
+/* Returns the pipeline that a copy of @src should be parented on.
+ * This is normally just @src but if the copy would be deeper than the
+ * device's ancestry limit then it is parented on a flattened
+ * pipeline instead. The flattened pipeline is a direct child of the
+ * root pipeline with all of the state that @src resolves from its
+ * ancestry copied into it so that authority lookups on the copy stay
+ * bounded. It is cached on @src so that repeated copies share it until
+ * @src is next modified. */
+static cg_pipeline_t *
+get_copy_parent(cg_pipeline_t *src)
+{
+    cg_pipeline_flattened_t *flattened;
+    cg_pipeline_t *node;
+    int depth = 1;
+
+    _CG_GET_DEVICE(dev, src);
+
+    if (dev->pipeline_max_ancestry_depth <= 0)
+        return src;
+
+    for (node = src;
+         node && node != dev->default_pipeline;
+         node = _cg_pipeline_get_parent(node)) {
+        if (++depth > dev->pipeline_max_ancestry_depth)
+            break;
+    }
+
+    if (depth <= dev->pipeline_max_ancestry_depth)
+        return src;
+
+    flattened =
+        cg_object_get_user_data(CG_OBJECT(src), &flattened_ancestry_key);
+
+    if (flattened && flattened->age == src->age)
+        return flattened->pipeline;
+
+    if (flattened == NULL) {
+        flattened = c_slice_new(cg_pipeline_flattened_t);
+        _cg_object_set_user_data(CG_OBJECT(src),
+                                 &flattened_ancestry_key,
+                                 flattened,
+                                 destroy_flattened_ancestry);
+    } else
+        cg_object_unref(flattened->pipeline);
+
+    flattened->pipeline =
+        _cg_pipeline_deep_copy(dev,
+                               src,
+                               CG_PIPELINE_STATE_ALL_SPARSE &
+                               ~CG_PIPELINE_STATE_UNIFORMS,
+                               CG_PIPELINE_LAYER_STATE_ALL_SPARSE);
+    _cg_pipeline_copy_resolved_uniforms(flattened->pipeline, src);
+    flattened->age = src->age;
+
+#ifdef CG_DEBUG_ENABLED
+    _cg_pipeline_set_static_breadcrumb(flattened->pipeline,
+                                       "flattened ancestry");
+#endif
+
+    return flattened->pipeline;
+}
+
 /* XXX: Always have an eye out for opportunities to lower the cost of
  * cg_pipeline_copy. */
 cg_pipeline_t *
 cg_pipeline_copy(cg_pipeline_t *src)
 {
     cg_pipeline_t *pipeline = c_slice_new(cg_pipeline_t);
+    cg_pipeline_t *parent = get_copy_parent(src);
 
     _cg_pipeline_node_init(CG_NODE(pipeline));
 
     pipeline->immutable = false;
+    pipeline->frozen = false;
     src->immutable = true;
 
     pipeline->differences = 0;
@@ -276,8 +361,11 @@ cg_pipeline_copy(cg_pipeline_t *src)
     pipeline->has_static_breadcrumb = false;
 
     pipeline->age = 0;
+    pipeline->hash_cache = NULL;
 
-    _cg_pipeline_set_parent(pipeline, src);
+    pipeline->journal_ref_count = 0;
+
+    _cg_pipeline_set_parent(pipeline, parent);
 
     return _cg_pipeline_object_new(pipeline);
 }
@@ -296,6 +384,15 @@ cg_pipeline_new(cg_device_t *dev)
     return new;
 }
 
+void
+cg_pipeline_freeze(cg_pipeline_t *pipeline)
+{
+    c_return_if_fail(cg_is_pipeline(pipeline));
+
+    pipeline->immutable = true;
+    pipeline->frozen = true;
+}
+
 static void
 _cg_pipeline_free(cg_pipeline_t *pipeline)
 {
@@ -331,6 +428,9 @@ _cg_pipeline_free(cg_pipeline_t *pipeline)
 
     recursively_free_layer_caches(pipeline);
 
+    if (pipeline->hash_cache)
+        c_slice_free(cg_pipeline_hash_cache_t, pipeline->hash_cache);
+
     if (pipeline->differences & CG_PIPELINE_STATE_NEEDS_BIG_STATE)
         c_slice_free(cg_pipeline_big_state_t, pipeline->big_state);
 
@@ -784,6 +884,7 @@ _cg_pipeline_copy_differences(cg_pipeline_t *dest,
 
         big_state->uniforms_state.override_values =
             c_malloc(n_overrides * sizeof(cg_boxed_value_t));
+        big_state->uniforms_state.override_values_size = n_overrides;
 
         for (i = 0; i < n_overrides; i++) {
             cg_boxed_value_t *dst_bv =
@@ -881,6 +982,7 @@ _cg_pipeline_init_multi_property_sparse_state(cg_pipeline_t *pipeline,
         _cg_bitmask_init(&uniforms_state->override_mask);
         _cg_bitmask_init(&uniforms_state->changed_mask);
         uniforms_state->override_values = NULL;
+        uniforms_state->override_values_size = 0;
         break;
     }
     case CG_PIPELINE_STATE_VERTEX_SNIPPETS:
@@ -915,6 +1017,15 @@ _cg_pipeline_pre_change_notify(cg_pipeline_t *pipeline,
 {
     _CG_GET_DEVICE(dev, NO_RETVAL);
 
+    /* XXX:
+     * To simplify things for the journal we consider any pipeline
+     * being referenced by a journal entry as immutable until the
+     * journal has been flushed. Rather than forcing applications to
+     * track this we implicitly flush all journals before the pipeline
+     * is modified. */
+    if (pipeline->journal_ref_count)
+        _cg_flush(dev);
+
     /* XXX:
      * To simplify things for the vertex, fragment and program backends
      * we are careful about how we report STATE_LAYERS changes.
@@ -1751,6 +1862,85 @@ _cg_pipeline_resolve_authorities(cg_pipeline_t *pipeline,
     c_assert(remaining == 0);
 }
 
+/* The hash can only be memoized if it is derived entirely from state
+ * that can't change without going through
+ * _cg_pipeline_pre_change_notify(). The real blend enable state is
+ * derived lazily and the GL handle of a texture can change if it is
+ * migrated out of an atlas. */
+static bool
+can_cache_hash(unsigned int differences, unsigned long layer_differences)
+{
+    return (!(differences & CG_PIPELINE_STATE_REAL_BLEND_ENABLE) &&
+            !(layer_differences & CG_PIPELINE_LAYER_STATE_TEXTURE_DATA));
+}
+
+static cg_pipeline_cached_hash_t *
+find_cached_hash(cg_pipeline_t *pipeline,
+                 unsigned int differences,
+                 unsigned long layer_differences,
+                 cg_pipeline_eval_flags_t flags)
+{
+    int i;
+
+    if (pipeline->hash_cache == NULL)
+        return NULL;
+
+    for (i = 0; i < CG_PIPELINE_N_CACHED_HASHES; i++) {
+        cg_pipeline_cached_hash_t *cached = pipeline->hash_cache->hashes + i;
+
+        if (cached->differences == differences &&
+            cached->layer_differences == layer_differences &&
+            cached->flags == flags &&
+            cached->age == pipeline->age)
+            return cached;
+    }
+
+    return NULL;
+}
+
+static void
+cache_hash(cg_pipeline_t *pipeline,
+           unsigned int differences,
+           unsigned long layer_differences,
+           cg_pipeline_eval_flags_t flags,
+           unsigned int hash)
+{
+    cg_pipeline_hash_cache_t *hash_cache = pipeline->hash_cache;
+    cg_pipeline_cached_hash_t *cached = NULL;
+    int i;
+
+    if (hash_cache == NULL)
+        hash_cache = pipeline->hash_cache =
+            c_slice_new0(cg_pipeline_hash_cache_t);
+
+    /* Prefer replacing a slot for the same state or one that is stale
+     * before evicting a valid hash */
+    for (i = 0; i < CG_PIPELINE_N_CACHED_HASHES; i++) {
+        cg_pipeline_cached_hash_t *slot = hash_cache->hashes + i;
+
+        if ((slot->differences == differences &&
+             slot->layer_differences == layer_differences &&
+             slot->flags == flags) ||
+            slot->differences == 0 ||
+            slot->age != pipeline->age) {
+            cached = slot;
+            break;
+        }
+    }
+
+    if (cached == NULL) {
+        cached = hash_cache->hashes + hash_cache->next_slot;
+        hash_cache->next_slot =
+            (hash_cache->next_slot + 1) % CG_PIPELINE_N_CACHED_HASHES;
+    }
+
+    cached->differences = differences;
+    cached->layer_differences = layer_differences;
+    cached->flags = flags;
+    cached->age = pipeline->age;
+    cached->hash = hash;
+}
+
 /* Comparison of two arbitrary pipelines is done by:
  * 1) walking up the parents of each pipeline until a common
  *    ancestor is found, and at each step ORing together the
@@ -1798,6 +1988,21 @@ _cg_pipeline_equal(cg_pipeline_t *pipeline0,
 
     ret = false;
 
+    /* If both pipelines have already been hashed for this state then
+     * differing hashes mean they can't be equal. The blend state is
+     * excluded because it is hashed even though it isn't compared when
+     * blending is disabled */
+    if (can_cache_hash(differences, layer_differences) &&
+        !(differences & CG_PIPELINE_STATE_BLEND)) {
+        cg_pipeline_cached_hash_t *cached0 =
+            find_cached_hash(pipeline0, differences, layer_differences, flags);
+        cg_pipeline_cached_hash_t *cached1 =
+            find_cached_hash(pipeline1, differences, layer_differences, flags);
+
+        if (cached0 && cached1 && cached0->hash != cached1->hash)
+            goto done;
+    }
+
     _cg_pipeline_update_real_blend_enable(pipeline0, false);
     _cg_pipeline_update_real_blend_enable(pipeline1, false);
 
@@ -1822,6 +2027,11 @@ _cg_pipeline_equal(cg_pipeline_t *pipeline0,
 
     CG_FLAGS_FOREACH_START(&pipelines_difference, 1, bit)
     {
+        /* State from a shared authority is trivially equal. This is
+         * common for pipelines that were copied from the same parent */
+        if (authorities0[bit] == authorities1[bit])
+            continue;
+
         /* XXX: We considered having an array of callbacks for each state index
          * that we'd call here but decided that this way the compiler is more
          * likely going to be able to in-line the comparison functions and use
@@ -1988,6 +2198,20 @@ _cg_pipeline_get_age(cg_pipeline_t *pipeline)
     return pipeline->age;
 }
 
+cg_pipeline_t *
+_cg_pipeline_journal_ref(cg_pipeline_t *pipeline)
+{
+    pipeline->journal_ref_count++;
+    return cg_object_ref(pipeline);
+}
+
+void
+_cg_pipeline_journal_unref(cg_pipeline_t *pipeline)
+{
+    pipeline->journal_ref_count--;
+    cg_object_unref(pipeline);
+}
+
 void
 cg_pipeline_remove_layer(cg_pipeline_t *pipeline, int layer_index)
 {
@@ -2218,11 +2442,23 @@ _cg_pipeline_hash(cg_pipeline_t *pipeline,
                   cg_pipeline_eval_flags_t flags)
 {
     cg_pipeline_t *authorities[CG_PIPELINE_STATE_SPARSE_COUNT];
+    cg_pipeline_cached_hash_t *cached;
+    bool cacheable = (differences &&
+                      can_cache_hash(differences, layer_differences));
     unsigned int mask;
     int i;
     cg_pipeline_hash_state_t state;
     unsigned int final_hash = 0;
 
+    if (cacheable) {
+        cached = find_cached_hash(pipeline,
+                                  differences,
+                                  layer_differences,
+                                  flags);
+        if (cached)
+            return cached->hash;
+    }
+
     state.hash = 0;
     state.layer_differences = layer_differences;
     state.flags = flags;
@@ -2260,7 +2496,12 @@ _cg_pipeline_hash(cg_pipeline_t *pipeline,
             break;
     }
 
-    return _cg_util_one_at_a_time_mix(final_hash);
+    final_hash = _cg_util_one_at_a_time_mix(final_hash);
+
+    if (cacheable)
+        cache_hash(pipeline, differences, layer_differences, flags, final_hash);
+
+    return final_hash;
 }
 
 typedef struct {
@@ -160,6 +160,24 @@ void cg_pipeline_foreach_layer(cg_pipeline_t *pipeline,
 int cg_pipeline_get_uniform_location(cg_pipeline_t *pipeline,
                                      const char *uniform_name);
 
+/**
+ * cg_pipeline_freeze:
+ * @pipeline: A #cg_pipeline_t object
+ *
+ * Declares that @pipeline isn't going to be modified any more. The
+ * first time a frozen pipeline is drawn with, CGlib records the GL
+ * state that it resolves to so that subsequent draws can flush that
+ * state directly instead of deriving it from the pipeline's ancestry
+ * again.
+ *
+ * It is still possible to modify a frozen pipeline but doing so
+ * throws away the recorded state so it will have to be recorded
+ * again the next time the pipeline is used.
+ *
+ * Stability: Unstable
+ */
+void cg_pipeline_freeze(cg_pipeline_t *pipeline);
+
 CG_END_DECLS
 
 #endif /* __CG_PIPELINE_H__ */
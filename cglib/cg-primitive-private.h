@@ -49,6 +49,9 @@ struct _cg_primitive_t {
 
     int immutable_ref;
 
+    /* Incremented whenever the set of attributes changes */
+    unsigned int age;
+
     cg_attribute_t **attributes;
     int n_attributes;
 
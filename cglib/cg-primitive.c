@@ -38,7 +38,11 @@
 #include "cg-primitive.h"
 #include "cg-primitive-private.h"
 #include "cg-attribute-private.h"
+#include "cg-indices-private.h"
 #include "cg-framebuffer-private.h"
+#include "cg-device-private.h"
+#include "cg-journal-private.h"
+#include "cg-private.h"
 
 #include <stdarg.h>
 #include <string.h>
@@ -63,15 +67,18 @@ cg_primitive_new_with_attributes(cg_vertices_mode_t mode,
     primitive->n_vertices = n_vertices;
     primitive->indices = NULL;
     primitive->immutable_ref = 0;
+    primitive->age = 0;
 
     primitive->n_attributes = n_attributes;
     primitive->n_embedded_attributes = n_attributes;
     primitive->attributes = &primitive->embedded_attribute;
     for (i = 0; i < n_attributes; i++) {
         cg_attribute_t *attribute = attributes[i];
-        cg_object_ref(attribute);
 
         c_return_val_if_fail(cg_is_attribute(attribute), NULL);
+        c_return_val_if_fail(!attribute->is_temporary, NULL);
+
+        cg_object_ref(attribute);
 
         primitive->attributes[i] = attribute;
     }
@@ -385,15 +392,15 @@ _cg_primitive_free(cg_primitive_t *primitive)
                   primitive);
 }
 
+/* Primitives used by drawing that is batched in a journal are
+ * immutable until the journal has been flushed so we implicitly flush
+ * all journals before they are modified. */
 static void
-warn_about_midscene_changes(void)
+flush_journals(void)
 {
-    static bool seen = false;
-    if (!seen) {
-        c_warning("Mid-scene modification of primitives has "
-                  "undefined results\n");
-        seen = true;
-    }
+    _CG_GET_DEVICE(dev, NO_RETVAL);
+
+    _cg_flush(dev);
 }
 
 void
@@ -405,16 +412,15 @@ cg_primitive_set_attributes(cg_primitive_t *primitive,
 
     c_return_if_fail(cg_is_primitive(primitive));
 
-    if (C_UNLIKELY(primitive->immutable_ref)) {
-        warn_about_midscene_changes();
-        return;
-    }
+    if (C_UNLIKELY(primitive->immutable_ref))
+        flush_journals();
 
     /* NB: we don't unref the previous attributes before refing the new
      * in case we would end up releasing the last reference for an
      * attribute thats actually in the new list too. */
     for (i = 0; i < n_attributes; i++) {
         c_return_if_fail(cg_is_attribute(attributes[i]));
+        c_return_if_fail(!attributes[i]->is_temporary);
         cg_object_ref(attributes[i]);
     }
 
@@ -443,6 +449,7 @@ cg_primitive_set_attributes(cg_primitive_t *primitive,
            sizeof(cg_attribute_t *) * n_attributes);
 
     primitive->n_attributes = n_attributes;
+    primitive->age++;
 }
 
 int
@@ -458,10 +465,8 @@ cg_primitive_set_first_vertex(cg_primitive_t *primitive, int first_vertex)
 {
     c_return_if_fail(cg_is_primitive(primitive));
 
-    if (C_UNLIKELY(primitive->immutable_ref)) {
-        warn_about_midscene_changes();
-        return;
-    }
+    if (C_UNLIKELY(primitive->immutable_ref))
+        flush_journals();
 
     primitive->first_vertex = first_vertex;
 }
@@ -479,6 +484,9 @@ cg_primitive_set_n_vertices(cg_primitive_t *primitive, int n_vertices)
 {
     c_return_if_fail(cg_is_primitive(primitive));
 
+    if (C_UNLIKELY(primitive->immutable_ref))
+        flush_journals();
+
     primitive->n_vertices = n_vertices;
 }
 
@@ -495,10 +503,8 @@ cg_primitive_set_mode(cg_primitive_t *primitive, cg_vertices_mode_t mode)
 {
     c_return_if_fail(cg_is_primitive(primitive));
 
-    if (C_UNLIKELY(primitive->immutable_ref)) {
-        warn_about_midscene_changes();
-        return;
-    }
+    if (C_UNLIKELY(primitive->immutable_ref))
+        flush_journals();
 
     primitive->mode = mode;
 }
@@ -510,10 +516,8 @@ cg_primitive_set_indices(cg_primitive_t *primitive,
 {
     c_return_if_fail(cg_is_primitive(primitive));
 
-    if (C_UNLIKELY(primitive->immutable_ref)) {
-        warn_about_midscene_changes();
-        return;
-    }
+    if (C_UNLIKELY(primitive->immutable_ref))
+        flush_journals();
 
     if (indices)
         cg_object_ref(indices);
@@ -521,6 +525,7 @@ cg_primitive_set_indices(cg_primitive_t *primitive,
         cg_object_unref(primitive->indices);
     primitive->indices = indices;
     primitive->n_vertices = n_indices;
+    primitive->age++;
 }
 
 cg_indices_t *
@@ -557,6 +562,9 @@ _cg_primitive_immutable_ref(cg_primitive_t *primitive)
     for (i = 0; i < primitive->n_attributes; i++)
         _cg_attribute_immutable_ref(primitive->attributes[i]);
 
+    if (primitive->indices)
+        _cg_indices_immutable_ref(primitive->indices);
+
     return primitive;
 }
 
@@ -572,6 +580,9 @@ _cg_primitive_immutable_unref(cg_primitive_t *primitive)
 
     for (i = 0; i < primitive->n_attributes; i++)
         _cg_attribute_immutable_unref(primitive->attributes[i]);
+
+    if (primitive->indices)
+        _cg_indices_immutable_unref(primitive->indices);
 }
 
 void
@@ -600,6 +611,7 @@ _cg_primitive_draw(cg_primitive_t *primitive,
                                                 primitive->first_vertex,
                                                 primitive->n_vertices,
                                                 primitive->indices,
+                                                primitive,
                                                 primitive->attributes,
                                                 primitive->n_attributes,
                                                 n_instances,
@@ -610,6 +622,7 @@ _cg_primitive_draw(cg_primitive_t *primitive,
                                         primitive->mode,
                                         primitive->first_vertex,
                                         primitive->n_vertices,
+                                        primitive,
                                         primitive->attributes,
                                         primitive->n_attributes,
                                         n_instances,
@@ -621,6 +634,13 @@ cg_primitive_draw(cg_primitive_t *primitive,
                   cg_framebuffer_t *framebuffer,
                   cg_pipeline_t *pipeline)
 {
+    /* Opaque primitives may be deferred so they can be sorted */
+    if (_cg_journal_log_primitive(framebuffer->journal,
+                                  pipeline,
+                                  primitive,
+                                  1 /* n_instances */))
+        return;
+
     _cg_primitive_draw(primitive, framebuffer, pipeline, 1, 0 /* flags */);
 }
 
@@ -630,6 +650,12 @@ cg_primitive_draw_instances(cg_primitive_t *primitive,
                             cg_pipeline_t *pipeline,
                             int n_instances)
 {
+    if (_cg_journal_log_primitive(framebuffer->journal,
+                                  pipeline,
+                                  primitive,
+                                  n_instances))
+        return;
+
     _cg_primitive_draw(primitive, framebuffer, pipeline,
                        n_instances, 0 /* flags */);
 }
@@ -65,6 +65,8 @@ typedef enum {
      * is first allocated or when it is shown or resized */
     CG_PRIVATE_FEATURE_DIRTY_EVENTS,
     CG_PRIVATE_FEATURE_ENABLE_PROGRAM_POINT_SIZE,
+    CG_PRIVATE_FEATURE_UNIFORM_BUFFER_OBJECTS,
+    CG_PRIVATE_FEATURE_VERTEX_ARRAY_OBJECTS,
     /* These features let us avoid conditioning code based on the exact
      * driver being used and instead check for broad opengl feature
      * sets that can be shared by several GL apis */
@@ -0,0 +1,103 @@
+/*
+ * CGlib
+ *
+ * A Low-Level GPU Graphics and Utilities API
+ *
+ * Copyright (C) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+
+#ifndef __CG_PROGRAM_BINARY_CACHE_PRIVATE_H
+#define __CG_PROGRAM_BINARY_CACHE_PRIVATE_H
+
+#include "cg-device.h"
+#include "cg-gl-header.h"
+
+/* The program binary cache stores linked GL programs on disk so that
+ * later runs can skip compiling and linking the GLSL generated for a
+ * pipeline. Entries are keyed by the hashes of the vertex and fragment
+ * shader sources combined with the driver's vendor, renderer and
+ * version strings so binaries are never handed to a different driver.
+ *
+ * The cache is bounded in size by evicting the least recently used
+ * entries. The driver is free to reject a binary (for example after a
+ * driver update that didn't change the version string) in which case
+ * the entry is deleted and the caller falls back to linking from
+ * source.
+ */
+
+/* The default upper bound for the total size of the cache directory */
+#define CG_PROGRAM_BINARY_CACHE_DEFAULT_MAX_SIZE (16 * 1024 * 1024)
+
+typedef struct _cg_program_binary_cache_t cg_program_binary_cache_t;
+
+/*
+ * _cg_program_binary_cache_new:
+ * @dev: A #cg_device_t
+ * @directory: The directory to store binaries in
+ * @max_size: The maximum number of bytes to store in @directory
+ *
+ * Return value: A new cache or %NULL if the driver doesn't support
+ *               retrieving program binaries or @directory can't be
+ *               created.
+ */
+cg_program_binary_cache_t *
+_cg_program_binary_cache_new(cg_device_t *dev,
+                             const char *directory,
+                             size_t max_size);
+
+void _cg_program_binary_cache_free(cg_program_binary_cache_t *cache);
+
+uint64_t _cg_program_binary_cache_get_key(cg_program_binary_cache_t *cache,
+                                          uint64_t vertex_source_hash,
+                                          uint64_t fragment_source_hash);
+
+/* Hints to the driver that the binary of @gl_program will be
+ * retrieved. This should be called before linking a program that is
+ * going to be stored */
+void _cg_program_binary_cache_set_retrievable(cg_program_binary_cache_t *cache,
+                                              GLuint gl_program);
+
+/*
+ * _cg_program_binary_cache_load:
+ * @cache: A #cg_program_binary_cache_t
+ * @key: A key returned by _cg_program_binary_cache_get_key()
+ * @gl_program: A newly created GL program object
+ *
+ * Tries to load a previously stored binary for @key into @gl_program.
+ *
+ * Return value: %true if @gl_program was successfully linked from the
+ *               cached binary or %false if it still needs to be linked
+ *               from source.
+ */
+bool _cg_program_binary_cache_load(cg_program_binary_cache_t *cache,
+                                   uint64_t key,
+                                   GLuint gl_program);
+
+/* Stores the binary of a successfully linked @gl_program for @key */
+void _cg_program_binary_cache_store(cg_program_binary_cache_t *cache,
+                                    uint64_t key,
+                                    GLuint gl_program);
+
+#endif /* __CG_PROGRAM_BINARY_CACHE_PRIVATE_H */
@@ -0,0 +1,624 @@
+/*
+ * CGlib
+ *
+ * A Low-Level GPU Graphics and Utilities API
+ *
+ * Copyright (C) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+
+#include <cglib-config.h>
+
+#include <test-fixtures/test-cg-fixtures.h>
+
+#include <string.h>
+#include <sys/stat.h>
+#ifdef C_PLATFORM_UNIX
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#include "cg-debug.h"
+#include "cg-device-private.h"
+#include "cg-util.h"
+#include "cg-util-gl-private.h"
+#include "cg-program-binary-cache-private.h"
+
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+
+#define CG_PROGRAM_BINARY_MAGIC 0x42504743 /* "CGPB" */
+#define CG_PROGRAM_BINARY_VERSION 1
+
+#define CG_PROGRAM_BINARY_PREFIX "cg-program-"
+#define CG_PROGRAM_BINARY_SUFFIX ".bin"
+
+struct _cg_program_binary_cache_t {
+    cg_device_t *dev;
+
+    char *directory;
+    size_t max_size;
+
+    /* Hash of the driver identification strings which gets mixed into
+     * every key */
+    uint64_t driver_hash;
+
+    /* The total size and number of the entries in the directory. These
+     * are only found by scanning the directory the first time an entry
+     * is stored and after that are kept up to date as entries are
+     * added and removed so that the directory only needs to be scanned
+     * again when it gets too big. The size is -1 before the first
+     * scan. */
+    int64_t total_size;
+    int n_entries;
+};
+
+/* Each cache file starts with this header followed by the binary */
+typedef struct _cg_program_binary_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+} cg_program_binary_header_t;
+
+typedef struct _cg_program_binary_file_t {
+    char *filename;
+    size_t size;
+    time_t mtime;
+} cg_program_binary_file_t;
+
+static uint64_t
+hash_string(uint64_t hash, const char *str)
+{
+    /* Include the terminator so that adjacent strings can't be
+     * ambiguous */
+    if (str == NULL)
+        str = "";
+
+    return _cg_util_fnv1a_hash_64(hash, str, strlen(str) + 1);
+}
+
+static cg_program_binary_cache_t *
+create_cache(cg_device_t *dev,
+             const char *directory,
+             size_t max_size,
+             uint64_t driver_hash)
+{
+    cg_program_binary_cache_t *cache = c_slice_new0(cg_program_binary_cache_t);
+
+    cache->dev = dev;
+    cache->directory = c_strdup(directory);
+    cache->max_size = max_size;
+    cache->driver_hash = driver_hash;
+    cache->total_size = -1;
+
+    return cache;
+}
+
+cg_program_binary_cache_t *
+_cg_program_binary_cache_new(cg_device_t *dev,
+                             const char *directory,
+                             size_t max_size)
+{
+    GLint n_formats = 0;
+    uint64_t hash = CG_UTIL_FNV1A_64_INIT;
+
+    if (dev->glGetProgramBinary == NULL || dev->glProgramBinary == NULL)
+        return NULL;
+
+    /* Some drivers advertise the extension without actually supporting
+     * any binary formats */
+    GE(dev, glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &n_formats));
+    if (n_formats < 1)
+        return NULL;
+
+    if (c_mkdir_with_parents(directory, 0700) != 0) {
+        c_warning("Failed to create program binary cache directory %s",
+                  directory);
+        return NULL;
+    }
+
+    hash = hash_string(hash, (const char *)dev->glGetString(GL_VENDOR));
+    hash = hash_string(hash, (const char *)dev->glGetString(GL_RENDERER));
+    hash = hash_string(hash, _cg_device_get_gl_version(dev));
+    hash = _cg_util_fnv1a_hash_64(hash,
+                                  &dev->glsl_version_to_use,
+                                  sizeof(dev->glsl_version_to_use));
+
+    return create_cache(dev, directory, max_size, hash);
+}
+
+void
+_cg_program_binary_cache_free(cg_program_binary_cache_t *cache)
+{
+    c_free(cache->directory);
+    c_slice_free(cg_program_binary_cache_t, cache);
+}
+
+uint64_t
+_cg_program_binary_cache_get_key(cg_program_binary_cache_t *cache,
+                                 uint64_t vertex_source_hash,
+                                 uint64_t fragment_source_hash)
+{
+    uint64_t key = cache->driver_hash;
+
+    key = _cg_util_fnv1a_hash_64(key,
+                                 &vertex_source_hash,
+                                 sizeof(vertex_source_hash));
+    key = _cg_util_fnv1a_hash_64(key,
+                                 &fragment_source_hash,
+                                 sizeof(fragment_source_hash));
+
+    return key;
+}
+
+void
+_cg_program_binary_cache_set_retrievable(cg_program_binary_cache_t *cache,
+                                         GLuint gl_program)
+{
+    cg_device_t *dev = cache->dev;
+
+    if (dev->glProgramParameteri)
+        GE(dev, glProgramParameteri(gl_program,
+                                    GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                    GL_TRUE));
+}
+
+static char *
+get_filename(cg_program_binary_cache_t *cache, uint64_t key)
+{
+    char name[64];
+
+    c_snprintf(name,
+               sizeof(name),
+               CG_PROGRAM_BINARY_PREFIX "%016" PRIx64 CG_PROGRAM_BINARY_SUFFIX,
+               key);
+
+    return c_build_filename(cache->directory, name, NULL);
+}
+
+static void
+remove_entry(cg_program_binary_cache_t *cache,
+             const char *filename,
+             size_t size)
+{
+    /* Remove the entry so we don't keep trying to use it. The program
+     * will be linked from source and stored again */
+    CG_NOTE(SHOW_SOURCE, "Discarding unusable program binary %s", filename);
+
+    if (c_unlink(filename) == 0 && cache->total_size >= 0) {
+        cache->total_size = MAX(cache->total_size - (int64_t)size, 0);
+        cache->n_entries = MAX(cache->n_entries - 1, 0);
+    }
+}
+
+static void
+touch_entry(const char *filename)
+{
+#ifdef C_PLATFORM_UNIX
+    /* Entries are evicted in order of their modification time so it
+     * is updated on every hit. Otherwise the most used programs would
+     * be the first to go because they were the first to be written */
+    utime(filename, NULL);
+#endif
+}
+
+/* Returns the contents of the file for @key with the binary following
+ * the header or %NULL if there is no usable entry */
+static char *
+read_entry(cg_program_binary_cache_t *cache,
+           uint64_t key,
+           cg_program_binary_header_t *header)
+{
+    char *filename = get_filename(cache, key);
+    char *contents;
+    size_t length;
+
+    if (!c_file_get_contents(filename, &contents, &length, NULL)) {
+        c_free(filename);
+        return NULL;
+    }
+
+    if (length < sizeof(*header))
+        goto corrupt;
+
+    memcpy(header, contents, sizeof(*header));
+
+    if (header->magic != CG_PROGRAM_BINARY_MAGIC ||
+        header->version != CG_PROGRAM_BINARY_VERSION ||
+        header->key != key ||
+        header->length != length - sizeof(*header))
+        goto corrupt;
+
+    touch_entry(filename);
+
+    c_free(filename);
+
+    return contents;
+
+corrupt:
+    remove_entry(cache, filename, length);
+
+    c_free(contents);
+    c_free(filename);
+
+    return NULL;
+}
+
+bool
+_cg_program_binary_cache_load(cg_program_binary_cache_t *cache,
+                              uint64_t key,
+                              GLuint gl_program)
+{
+    cg_device_t *dev = cache->dev;
+    cg_program_binary_header_t header;
+    char *contents;
+    GLint link_status = 0;
+
+    CG_STATIC_COUNTER(program_binary_reject_counter,
+                      "program binary reject counter",
+                      "Increments each time the driver rejects a "
+                      "cached program binary",
+                      0 /* no application private data */);
+
+    contents = read_entry(cache, key, &header);
+    if (contents == NULL)
+        return false;
+
+    GE(dev, glProgramBinary(gl_program,
+                            header.format,
+                            contents + sizeof(header),
+                            header.length));
+    GE(dev, glGetProgramiv(gl_program, GL_LINK_STATUS, &link_status));
+
+    c_free(contents);
+
+    if (!link_status) {
+        char *filename = get_filename(cache, key);
+
+        CG_COUNTER_INC(_cg_uprof_context, program_binary_reject_counter);
+
+        remove_entry(cache, filename, sizeof(header) + header.length);
+        c_free(filename);
+
+        return false;
+    }
+
+    CG_NOTE(SHOW_SOURCE, "Loaded program binary %016" PRIx64, key);
+
+    return true;
+}
+
+static int
+compare_file_age(const void *a, const void *b)
+{
+    const cg_program_binary_file_t *file_a = a;
+    const cg_program_binary_file_t *file_b = b;
+
+    if (file_a->mtime == file_b->mtime)
+        return 0;
+
+    return file_a->mtime < file_b->mtime ? -1 : 1;
+}
+
+static bool
+is_cache_filename(const char *name)
+{
+    size_t len = strlen(name);
+    size_t prefix_len = sizeof(CG_PROGRAM_BINARY_PREFIX) - 1;
+    size_t suffix_len = sizeof(CG_PROGRAM_BINARY_SUFFIX) - 1;
+
+    return (len > prefix_len + suffix_len &&
+            strncmp(name, CG_PROGRAM_BINARY_PREFIX, prefix_len) == 0 &&
+            strcmp(name + len - suffix_len, CG_PROGRAM_BINARY_SUFFIX) == 0);
+}
+
+/* Scans the directory to find the real size of the cache and then
+ * deletes the least recently used entries until it fits within its
+ * size limit */
+static void
+evict_old_entries(cg_program_binary_cache_t *cache)
+{
+    c_array_t *files;
+    c_dir_t *dir;
+    const char *name;
+    int64_t total_size = 0;
+    int n_entries = 0;
+    int i;
+
+    dir = c_dir_open(cache->directory, 0, NULL);
+    if (dir == NULL)
+        return;
+
+    files = c_array_new(false, false, sizeof(cg_program_binary_file_t));
+
+    while ((name = c_dir_read_name(dir))) {
+        cg_program_binary_file_t file;
+        struct stat buf;
+
+        if (!is_cache_filename(name))
+            continue;
+
+        file.filename = c_build_filename(cache->directory, name, NULL);
+
+        if (c_stat(file.filename, &buf) != 0) {
+            c_free(file.filename);
+            continue;
+        }
+
+        file.size = buf.st_size;
+        file.mtime = buf.st_mtime;
+        total_size += file.size;
+        n_entries++;
+
+        c_array_append_val(files, file);
+    }
+
+    c_dir_close(dir);
+
+    if (total_size > cache->max_size) {
+        c_array_sort(files, compare_file_age);
+
+        for (i = 0; i < files->len && total_size > cache->max_size; i++) {
+            cg_program_binary_file_t *file =
+                &c_array_index(files, cg_program_binary_file_t, i);
+
+            if (c_unlink(file->filename) == 0) {
+                total_size -= file->size;
+                n_entries--;
+            }
+        }
+
+        CG_NOTE(SHOW_SOURCE,
+                "Evicted %i program binaries, %i left",
+                (int)files->len - n_entries,
+                n_entries);
+    }
+
+    for (i = 0; i < files->len; i++)
+        c_free(c_array_index(files, cg_program_binary_file_t, i).filename);
+
+    c_array_free(files, true);
+
+    cache->total_size = total_size;
+    cache->n_entries = n_entries;
+}
+
+static void
+write_entry(cg_program_binary_cache_t *cache,
+            uint64_t key,
+            uint32_t format,
+            char *contents,
+            size_t length)
+{
+    cg_program_binary_header_t header;
+    char *filename;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = CG_PROGRAM_BINARY_MAGIC;
+    header.version = CG_PROGRAM_BINARY_VERSION;
+    header.key = key;
+    header.format = format;
+    header.length = length;
+    memcpy(contents, &header, sizeof(header));
+
+    filename = get_filename(cache, key);
+
+    if (c_file_set_contents(filename,
+                            contents,
+                            sizeof(header) + length,
+                            NULL)) {
+        CG_NOTE(SHOW_SOURCE, "Stored program binary %s", filename);
+
+        /* If this replaced an existing file then the total will be
+         * overestimated but that will only cause an early rescan */
+        if (cache->total_size >= 0) {
+            cache->total_size += sizeof(header) + length;
+            cache->n_entries++;
+        }
+
+        if (cache->total_size < 0 || cache->total_size > cache->max_size)
+            evict_old_entries(cache);
+    }
+
+    c_free(filename);
+}
+
+void
+_cg_program_binary_cache_store(cg_program_binary_cache_t *cache,
+                               uint64_t key,
+                               GLuint gl_program)
+{
+    cg_device_t *dev = cache->dev;
+    GLint binary_length = 0;
+    GLsizei length = 0;
+    GLenum format = 0;
+    char *contents;
+
+    GE(dev, glGetProgramiv(gl_program, GL_PROGRAM_BINARY_LENGTH,
+                           &binary_length));
+
+    /* Don't let a single program evict the entire cache */
+    if (binary_length <= 0 ||
+        binary_length + sizeof(cg_program_binary_header_t) > cache->max_size)
+        return;
+
+    contents = c_malloc(sizeof(cg_program_binary_header_t) + binary_length);
+
+    GE(dev, glGetProgramBinary(gl_program,
+                               binary_length,
+                               &length,
+                               &format,
+                               contents + sizeof(cg_program_binary_header_t)));
+
+    if (length > 0)
+        write_entry(cache, key, format, contents, length);
+
+    c_free(contents);
+}
+
+#if defined(ENABLE_UNIT_TESTS) && defined(C_PLATFORM_UNIX)
+
+static void
+test_write_entry(cg_program_binary_cache_t *cache,
+                 uint64_t key,
+                 const char *binary)
+{
+    size_t length = strlen(binary);
+    char *contents = c_malloc(sizeof(cg_program_binary_header_t) + length);
+
+    memcpy(contents + sizeof(cg_program_binary_header_t), binary, length);
+    write_entry(cache, key, 0x1234, contents, length);
+    c_free(contents);
+}
+
+static bool
+test_entry_exists(cg_program_binary_cache_t *cache, uint64_t key)
+{
+    char *filename = get_filename(cache, key);
+    bool exists = c_file_test(filename, C_FILE_TEST_EXISTS);
+
+    c_free(filename);
+
+    return exists;
+}
+
+static void
+test_set_entry_mtime(cg_program_binary_cache_t *cache,
+                     uint64_t key,
+                     time_t mtime)
+{
+    char *filename = get_filename(cache, key);
+    struct utimbuf times = { mtime, mtime };
+
+    c_assert_cmpint(utime(filename, &times), ==, 0);
+    c_free(filename);
+}
+
+TEST(check_program_binary_cache)
+{
+    static const char binary[] = "0123456789abcdef";
+    size_t entry_size = sizeof(cg_program_binary_header_t) + strlen(binary);
+    cg_program_binary_cache_t *cache, *other_cache;
+    cg_program_binary_header_t header;
+    char template[] = "/tmp/cg-program-binary-cache-XXXXXX";
+    char *contents;
+    char *filename;
+    const char *name;
+    c_dir_t *dir;
+    uint64_t key;
+
+    c_assert(mkdtemp(template) != NULL);
+
+    cache = create_cache(NULL, template, entry_size * 3, 1);
+    other_cache = create_cache(NULL, template, entry_size * 3, 2);
+
+    /* The key depends on both of the sources, which one is which and
+     * the driver */
+    key = _cg_program_binary_cache_get_key(cache, 1, 2);
+    c_assert(key == _cg_program_binary_cache_get_key(cache, 1, 2));
+    c_assert(key != _cg_program_binary_cache_get_key(cache, 2, 1));
+    c_assert(key != _cg_program_binary_cache_get_key(cache, 1, 3));
+    c_assert(key != _cg_program_binary_cache_get_key(other_cache, 1, 2));
+
+    /* Round trip */
+    c_assert(read_entry(cache, 1, &header) == NULL);
+    test_write_entry(cache, 1, binary);
+    contents = read_entry(cache, 1, &header);
+    c_assert(contents != NULL);
+    c_assert_cmpint(header.format, ==, 0x1234);
+    c_assert_cmpint(header.length, ==, strlen(binary));
+    c_assert(!memcmp(contents + sizeof(header), binary, strlen(binary)));
+    c_free(contents);
+
+    /* The first store scans the directory and after that the size is
+     * tracked without scanning */
+    c_assert_cmpint(cache->total_size, ==, entry_size);
+    c_assert_cmpint(cache->n_entries, ==, 1);
+
+    /* A file with the wrong key in its header is rejected and
+     * deleted. This uses the other cache so that the files written
+     * behind the first cache's back don't affect its tracked size */
+    filename = get_filename(cache, 1);
+    c_assert(c_file_get_contents(filename, &contents, NULL, NULL));
+    c_free(filename);
+    filename = get_filename(other_cache, 2);
+    c_assert(c_file_set_contents(filename, contents, entry_size, NULL));
+    c_free(contents);
+    c_assert(read_entry(other_cache, 2, &header) == NULL);
+    c_assert(!c_file_test(filename, C_FILE_TEST_EXISTS));
+
+    /* So is a truncated file */
+    c_assert(c_file_set_contents(filename, "CGPB", 4, NULL));
+    c_assert(read_entry(other_cache, 2, &header) == NULL);
+    c_assert(!c_file_test(filename, C_FILE_TEST_EXISTS));
+    c_free(filename);
+
+    /* Eviction removes the least recently used entry rather than the
+     * least recently written */
+    test_write_entry(cache, 2, binary);
+    test_write_entry(cache, 3, binary);
+    c_assert_cmpint(cache->total_size, ==, entry_size * 3);
+    c_assert_cmpint(cache->n_entries, ==, 3);
+
+    test_set_entry_mtime(cache, 1, 1000);
+    test_set_entry_mtime(cache, 2, 2000);
+    test_set_entry_mtime(cache, 3, 3000);
+
+    contents = read_entry(cache, 1, &header);
+    c_assert(contents != NULL);
+    c_free(contents);
+
+    test_write_entry(cache, 4, binary);
+
+    c_assert(test_entry_exists(cache, 1));
+    c_assert(!test_entry_exists(cache, 2));
+    c_assert(test_entry_exists(cache, 3));
+    c_assert(test_entry_exists(cache, 4));
+    c_assert_cmpint(cache->total_size, ==, entry_size * 3);
+    c_assert_cmpint(cache->n_entries, ==, 3);
+
+    dir = c_dir_open(template, 0, NULL);
+    c_assert(dir != NULL);
+    while ((name = c_dir_read_name(dir))) {
+        filename = c_build_filename(template, name, NULL);
+        c_unlink(filename);
+        c_free(filename);
+    }
+    c_dir_close(dir);
+    c_rmdir(template);
+
+    _cg_program_binary_cache_free(other_cache);
+    _cg_program_binary_cache_free(cache);
+}
+
+#endif /* ENABLE_UNIT_TESTS && C_PLATFORM_UNIX */
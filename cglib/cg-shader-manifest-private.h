@@ -0,0 +1,119 @@
+/*
+ * CGlib
+ *
+ * A Low-Level GPU Graphics and Utilities API
+ *
+ * Copyright (C) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+
+#ifndef __CG_SHADER_MANIFEST_PRIVATE_H
+#define __CG_SHADER_MANIFEST_PRIVATE_H
+
+#include "cg-device.h"
+#include "cg-gl-header.h"
+
+/* A shader manifest is a list of the programs that were generated for
+ * pipelines during a run. Every pipeline that reaches
+ * _cg_pipeline_cache_get_combined_template() ends up as a vertex and
+ * fragment shader pair so the manifest stores the complete GLSL source
+ * of those instead of the pipeline state itself. Each unique shader
+ * source is only stored once.
+ *
+ * A manifest recorded during one run can be loaded in a later run to
+ * link the same programs up front, for example while showing a loading
+ * screen. The GLSL progend then adopts these prewarmed programs instead
+ * of compiling and linking them the first time a pipeline needs them.
+ */
+
+typedef struct _cg_shader_manifest_t cg_shader_manifest_t;
+
+cg_shader_manifest_t *_cg_shader_manifest_new(cg_device_t *dev);
+
+/* Frees the manifest along with any prewarmed programs that were
+ * never taken */
+void _cg_shader_manifest_free(cg_shader_manifest_t *manifest);
+
+bool _cg_shader_manifest_has_program(cg_shader_manifest_t *manifest,
+                                     uint64_t vertex_source_hash,
+                                     uint64_t fragment_source_hash);
+
+/*
+ * _cg_shader_manifest_add_program:
+ * @manifest: A #cg_shader_manifest_t
+ * @vertex_source_hash: The hash of the complete vertex shader source
+ * @vertex_source: The complete vertex shader source
+ * @fragment_source_hash: The hash of the complete fragment shader source
+ * @fragment_source: The complete fragment shader source
+ *
+ * Records a program in the manifest unless it has already been
+ * recorded.
+ */
+void _cg_shader_manifest_add_program(cg_shader_manifest_t *manifest,
+                                     uint64_t vertex_source_hash,
+                                     const char *vertex_source,
+                                     uint64_t fragment_source_hash,
+                                     const char *fragment_source);
+
+bool _cg_shader_manifest_save(cg_shader_manifest_t *manifest,
+                              const char *filename,
+                              cg_error_t **error);
+
+cg_shader_manifest_t *_cg_shader_manifest_load(cg_device_t *dev,
+                                               const char *filename,
+                                               cg_error_t **error);
+
+/*
+ * _cg_shader_manifest_prewarm:
+ * @manifest: A loaded #cg_shader_manifest_t
+ * @budget: The maximum time to spend in nanoseconds or 0 for no limit
+ *
+ * Compiles and links the programs of @manifest that haven't been
+ * linked yet until @budget has been spent. At least one program is
+ * always linked if there are any remaining.
+ *
+ * Return value: The number of programs that still need to be linked.
+ */
+int _cg_shader_manifest_prewarm(cg_shader_manifest_t *manifest,
+                                int64_t budget);
+
+/*
+ * _cg_shader_manifest_take_program:
+ * @manifest: A loaded #cg_shader_manifest_t
+ * @vertex_source_hash: The hash of the vertex shader source
+ * @fragment_source_hash: The hash of the fragment shader source
+ *
+ * Looks for a prewarmed program matching the given shader sources.
+ * If one is found then ownership of the GL program is transferred to
+ * the caller. If the program hasn't been prewarmed yet then it is
+ * removed from the list of programs to prewarm because the caller is
+ * going to link it itself.
+ *
+ * Return value: A linked GL program or 0 if there is none
+ */
+GLuint _cg_shader_manifest_take_program(cg_shader_manifest_t *manifest,
+                                        uint64_t vertex_source_hash,
+                                        uint64_t fragment_source_hash);
+
+#endif /* __CG_SHADER_MANIFEST_PRIVATE_H */
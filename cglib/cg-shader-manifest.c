@@ -0,0 +1,807 @@
+/*
+ * CGlib
+ *
+ * A Low-Level GPU Graphics and Utilities API
+ *
+ * Copyright (C) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+
+#include <cglib-config.h>
+
+#include <test-fixtures/test-cg-fixtures.h>
+
+#include <string.h>
+#ifdef C_PLATFORM_UNIX
+#include <unistd.h>
+#endif
+
+#include "cg-debug.h"
+#include "cg-device-private.h"
+#include "cg-error-private.h"
+#include "cg-util.h"
+#include "cg-util-gl-private.h"
+#include "cg-glsl-shader-private.h"
+#include "cg-program-binary-cache-private.h"
+#include "cg-shader-manifest-private.h"
+
+#define CG_SHADER_MANIFEST_MAGIC 0x4d534743 /* "CGSM" */
+#define CG_SHADER_MANIFEST_VERSION 1
+
+typedef struct _cg_manifest_shader_t {
+    uint64_t hash;
+    GLenum type;
+    char *source;
+    size_t length;
+
+    /* Position in the manifest's array of shaders */
+    int index;
+
+    /* Compiled while prewarming. This is shared between all of the
+     * programs using the shader */
+    GLuint gl_shader;
+} cg_manifest_shader_t;
+
+typedef enum {
+    CG_MANIFEST_PROGRAM_STATE_PENDING,
+    CG_MANIFEST_PROGRAM_STATE_LINKED,
+    CG_MANIFEST_PROGRAM_STATE_FAILED,
+    CG_MANIFEST_PROGRAM_STATE_TAKEN
+} cg_manifest_program_state_t;
+
+typedef struct _cg_manifest_program_t {
+    /* Combination of the two source hashes used to look up programs */
+    uint64_t key;
+
+    cg_manifest_shader_t *vertex_shader;
+    cg_manifest_shader_t *fragment_shader;
+
+    cg_manifest_program_state_t state;
+    GLuint gl_program;
+} cg_manifest_program_t;
+
+struct _cg_shader_manifest_t {
+    cg_device_t *dev;
+
+    /* Arrays of cg_manifest_shader_t and cg_manifest_program_t in the
+     * order they were recorded. The hash tables map from a pointer to
+     * the 64-bit hash or key to the same structs */
+    c_ptr_array_t *shaders;
+    c_hash_table_t *shader_table;
+    c_ptr_array_t *programs;
+    c_hash_table_t *program_table;
+
+    /* The index of the next program to consider when prewarming */
+    int next_prewarm;
+    int n_remaining;
+};
+
+/* On disk the manifest starts with this header. It is followed by
+ * n_shaders cg_manifest_shader_header_t structs each directly
+ * followed by the shader source. Finally there are n_programs pairs
+ * of 32-bit shader indices for the vertex and fragment shader. */
+typedef struct _cg_shader_manifest_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t n_shaders;
+    uint32_t n_programs;
+} cg_shader_manifest_header_t;
+
+typedef struct _cg_manifest_shader_header_t {
+    uint64_t hash;
+    uint32_t type;
+    uint32_t length;
+} cg_manifest_shader_header_t;
+
+static uint64_t
+get_program_key(uint64_t vertex_source_hash, uint64_t fragment_source_hash)
+{
+    uint64_t key = CG_UTIL_FNV1A_64_INIT;
+
+    key = _cg_util_fnv1a_hash_64(key,
+                                 &vertex_source_hash,
+                                 sizeof(vertex_source_hash));
+    key = _cg_util_fnv1a_hash_64(key,
+                                 &fragment_source_hash,
+                                 sizeof(fragment_source_hash));
+
+    return key;
+}
+
+static void
+free_shader(cg_shader_manifest_t *manifest, cg_manifest_shader_t *shader)
+{
+    if (shader->gl_shader)
+        GE(manifest->dev, glDeleteShader(shader->gl_shader));
+
+    c_free(shader->source);
+    c_slice_free(cg_manifest_shader_t, shader);
+}
+
+static void
+free_program(cg_shader_manifest_t *manifest, cg_manifest_program_t *program)
+{
+    if (program->gl_program)
+        GE(manifest->dev, glDeleteProgram(program->gl_program));
+
+    c_slice_free(cg_manifest_program_t, program);
+}
+
+cg_shader_manifest_t *
+_cg_shader_manifest_new(cg_device_t *dev)
+{
+    cg_shader_manifest_t *manifest = c_slice_new0(cg_shader_manifest_t);
+
+    manifest->dev = dev;
+    manifest->shaders = c_ptr_array_new();
+    manifest->shader_table = c_hash_table_new(c_int64_hash, c_int64_equal);
+    manifest->programs = c_ptr_array_new();
+    manifest->program_table = c_hash_table_new(c_int64_hash, c_int64_equal);
+
+    return manifest;
+}
+
+/* Deletes the compiled shaders once there is nothing left to link */
+static void
+free_gl_shaders(cg_shader_manifest_t *manifest)
+{
+    int i;
+
+    for (i = 0; i < manifest->shaders->len; i++) {
+        cg_manifest_shader_t *shader =
+            c_ptr_array_index(manifest->shaders, i);
+
+        if (shader->gl_shader) {
+            GE(manifest->dev, glDeleteShader(shader->gl_shader));
+            shader->gl_shader = 0;
+        }
+    }
+}
+
+void
+_cg_shader_manifest_free(cg_shader_manifest_t *manifest)
+{
+    int i;
+
+    for (i = 0; i < manifest->programs->len; i++)
+        free_program(manifest, c_ptr_array_index(manifest->programs, i));
+    for (i = 0; i < manifest->shaders->len; i++)
+        free_shader(manifest, c_ptr_array_index(manifest->shaders, i));
+
+    c_ptr_array_free(manifest->programs, true);
+    c_hash_table_destroy(manifest->program_table);
+    c_ptr_array_free(manifest->shaders, true);
+    c_hash_table_destroy(manifest->shader_table);
+
+    c_slice_free(cg_shader_manifest_t, manifest);
+}
+
+static cg_manifest_shader_t *
+add_shader(cg_shader_manifest_t *manifest,
+           uint64_t hash,
+           GLenum type,
+           const char *source,
+           size_t length)
+{
+    cg_manifest_shader_t *shader;
+
+    shader = c_hash_table_lookup(manifest->shader_table, &hash);
+    if (shader)
+        return shader;
+
+    shader = c_slice_new0(cg_manifest_shader_t);
+    shader->hash = hash;
+    shader->type = type;
+    shader->source = c_strndup(source, length);
+    shader->length = length;
+    shader->index = manifest->shaders->len;
+
+    c_ptr_array_add(manifest->shaders, shader);
+    c_hash_table_insert(manifest->shader_table, &shader->hash, shader);
+
+    return shader;
+}
+
+static void
+add_program(cg_shader_manifest_t *manifest,
+            cg_manifest_shader_t *vertex_shader,
+            cg_manifest_shader_t *fragment_shader)
+{
+    cg_manifest_program_t *program;
+    uint64_t key = get_program_key(vertex_shader->hash,
+                                   fragment_shader->hash);
+
+    if (c_hash_table_lookup(manifest->program_table, &key))
+        return;
+
+    program = c_slice_new0(cg_manifest_program_t);
+    program->key = key;
+    program->vertex_shader = vertex_shader;
+    program->fragment_shader = fragment_shader;
+    program->state = CG_MANIFEST_PROGRAM_STATE_PENDING;
+
+    c_ptr_array_add(manifest->programs, program);
+    c_hash_table_insert(manifest->program_table, &program->key, program);
+
+    manifest->n_remaining++;
+}
+
+bool
+_cg_shader_manifest_has_program(cg_shader_manifest_t *manifest,
+                                uint64_t vertex_source_hash,
+                                uint64_t fragment_source_hash)
+{
+    uint64_t key = get_program_key(vertex_source_hash, fragment_source_hash);
+
+    return c_hash_table_lookup(manifest->program_table, &key) != NULL;
+}
+
+void
+_cg_shader_manifest_add_program(cg_shader_manifest_t *manifest,
+                                uint64_t vertex_source_hash,
+                                const char *vertex_source,
+                                uint64_t fragment_source_hash,
+                                const char *fragment_source)
+{
+    cg_manifest_shader_t *vertex_shader;
+    cg_manifest_shader_t *fragment_shader;
+
+    vertex_shader = add_shader(manifest,
+                               vertex_source_hash,
+                               GL_VERTEX_SHADER,
+                               vertex_source,
+                               strlen(vertex_source));
+    fragment_shader = add_shader(manifest,
+                                 fragment_source_hash,
+                                 GL_FRAGMENT_SHADER,
+                                 fragment_source,
+                                 strlen(fragment_source));
+
+    add_program(manifest, vertex_shader, fragment_shader);
+}
+
+bool
+_cg_shader_manifest_save(cg_shader_manifest_t *manifest,
+                         const char *filename,
+                         cg_error_t **error)
+{
+    cg_shader_manifest_header_t header;
+    c_string_t *buf = c_string_new(NULL);
+    c_error_t *file_error = NULL;
+    bool ret = true;
+    int i;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = CG_SHADER_MANIFEST_MAGIC;
+    header.version = CG_SHADER_MANIFEST_VERSION;
+    header.n_shaders = manifest->shaders->len;
+    header.n_programs = manifest->programs->len;
+    c_string_append_len(buf, (const char *)&header, sizeof(header));
+
+    for (i = 0; i < manifest->shaders->len; i++) {
+        cg_manifest_shader_t *shader =
+            c_ptr_array_index(manifest->shaders, i);
+        cg_manifest_shader_header_t shader_header;
+
+        memset(&shader_header, 0, sizeof(shader_header));
+        shader_header.hash = shader->hash;
+        shader_header.type = shader->type;
+        shader_header.length = shader->length;
+        c_string_append_len(buf,
+                            (const char *)&shader_header,
+                            sizeof(shader_header));
+        c_string_append_len(buf, shader->source, shader->length);
+    }
+
+    for (i = 0; i < manifest->programs->len; i++) {
+        cg_manifest_program_t *program =
+            c_ptr_array_index(manifest->programs, i);
+        uint32_t indices[2] = { program->vertex_shader->index,
+                                program->fragment_shader->index };
+
+        c_string_append_len(buf, (const char *)indices, sizeof(indices));
+    }
+
+    if (!c_file_set_contents(filename, buf->str, buf->len, &file_error)) {
+        _cg_set_error(error,
+                      CG_SYSTEM_ERROR,
+                      CG_SYSTEM_ERROR_UNSUPPORTED,
+                      "Failed to write shader manifest %s: %s",
+                      filename,
+                      file_error->message);
+        c_error_free(file_error);
+        ret = false;
+    }
+
+    c_string_free(buf, true);
+
+    return ret;
+}
+
+cg_shader_manifest_t *
+_cg_shader_manifest_load(cg_device_t *dev,
+                         const char *filename,
+                         cg_error_t **error)
+{
+    cg_shader_manifest_t *manifest;
+    cg_shader_manifest_header_t header;
+    cg_manifest_shader_t **shaders = NULL;
+    c_error_t *file_error = NULL;
+    char *contents;
+    size_t length;
+    size_t offset;
+    int i;
+
+    if (!c_file_get_contents(filename, &contents, &length, &file_error)) {
+        _cg_set_error(error,
+                      CG_SYSTEM_ERROR,
+                      CG_SYSTEM_ERROR_UNSUPPORTED,
+                      "Failed to read shader manifest %s: %s",
+                      filename,
+                      file_error->message);
+        c_error_free(file_error);
+        return NULL;
+    }
+
+    manifest = _cg_shader_manifest_new(dev);
+
+    if (length < sizeof(header))
+        goto corrupt;
+
+    memcpy(&header, contents, sizeof(header));
+    offset = sizeof(header);
+
+    if (header.magic != CG_SHADER_MANIFEST_MAGIC ||
+        header.version != CG_SHADER_MANIFEST_VERSION ||
+        header.n_shaders > length / sizeof(cg_manifest_shader_header_t))
+        goto corrupt;
+
+    shaders = c_new(cg_manifest_shader_t *, header.n_shaders);
+
+    for (i = 0; i < header.n_shaders; i++) {
+        cg_manifest_shader_header_t shader_header;
+
+        if (length - offset < sizeof(shader_header))
+            goto corrupt;
+
+        memcpy(&shader_header, contents + offset, sizeof(shader_header));
+        offset += sizeof(shader_header);
+
+        if (length - offset < shader_header.length ||
+            (shader_header.type != GL_VERTEX_SHADER &&
+             shader_header.type != GL_FRAGMENT_SHADER))
+            goto corrupt;
+
+        shaders[i] = add_shader(manifest,
+                                shader_header.hash,
+                                shader_header.type,
+                                contents + offset,
+                                shader_header.length);
+        offset += shader_header.length;
+    }
+
+    if ((length - offset) / (sizeof(uint32_t) * 2) != header.n_programs)
+        goto corrupt;
+
+    for (i = 0; i < header.n_programs; i++) {
+        uint32_t indices[2];
+
+        memcpy(indices, contents + offset, sizeof(indices));
+        offset += sizeof(indices);
+
+        if (indices[0] >= header.n_shaders ||
+            indices[1] >= header.n_shaders ||
+            shaders[indices[0]]->type != GL_VERTEX_SHADER ||
+            shaders[indices[1]]->type != GL_FRAGMENT_SHADER)
+            goto corrupt;
+
+        add_program(manifest, shaders[indices[0]], shaders[indices[1]]);
+    }
+
+    c_free(shaders);
+    c_free(contents);
+
+    return manifest;
+
+corrupt:
+    _cg_set_error(error,
+                  CG_SYSTEM_ERROR,
+                  CG_SYSTEM_ERROR_UNSUPPORTED,
+                  "Invalid shader manifest %s",
+                  filename);
+
+    _cg_shader_manifest_free(manifest);
+    c_free(shaders);
+    c_free(contents);
+
+    return NULL;
+}
+
+static GLuint
+get_gl_shader(cg_shader_manifest_t *manifest, cg_manifest_shader_t *shader)
+{
+    cg_device_t *dev = manifest->dev;
+
+    if (shader->gl_shader == 0) {
+        const char *source = shader->source;
+        GLint length = shader->length;
+
+        GE_RET(shader->gl_shader, dev, glCreateShader(shader->type));
+        /* The stored source already includes the boilerplate */
+        GE(dev, glShaderSource(shader->gl_shader, 1, &source, &length));
+        _cg_glsl_shader_compile(dev, shader->gl_shader);
+    }
+
+    return shader->gl_shader;
+}
+
+static void
+prewarm_program(cg_shader_manifest_t *manifest,
+                cg_manifest_program_t *program)
+{
+    cg_device_t *dev = manifest->dev;
+    cg_program_binary_cache_t *binary_cache = dev->program_binary_cache;
+    uint64_t binary_key = 0;
+    GLuint vertex_shader, fragment_shader;
+    GLint link_status;
+
+    GE_RET(program->gl_program, dev, glCreateProgram());
+
+    if (binary_cache) {
+        binary_key =
+            _cg_program_binary_cache_get_key(binary_cache,
+                                             program->vertex_shader->hash,
+                                             program->fragment_shader->hash);
+
+        if (_cg_program_binary_cache_load(binary_cache,
+                                          binary_key,
+                                          program->gl_program)) {
+            program->state = CG_MANIFEST_PROGRAM_STATE_LINKED;
+            return;
+        }
+    }
+
+    vertex_shader = get_gl_shader(manifest, program->vertex_shader);
+    fragment_shader = get_gl_shader(manifest, program->fragment_shader);
+
+    GE(dev, glAttachShader(program->gl_program, fragment_shader));
+    GE(dev, glAttachShader(program->gl_program, vertex_shader));
+
+    /* This needs to match the GLSL progend */
+    GE(dev, glBindAttribLocation(program->gl_program, 0, "cg_position_in"));
+
+    if (binary_cache)
+        _cg_program_binary_cache_set_retrievable(binary_cache,
+                                                 program->gl_program);
+
+    GE(dev, glLinkProgram(program->gl_program));
+    GE(dev, glGetProgramiv(program->gl_program, GL_LINK_STATUS, &link_status));
+
+    /* The shaders can be shared with other programs so they aren't
+     * deleted here */
+    GE(dev, glDetachShader(program->gl_program, fragment_shader));
+    GE(dev, glDetachShader(program->gl_program, vertex_shader));
+
+    if (link_status) {
+        program->state = CG_MANIFEST_PROGRAM_STATE_LINKED;
+
+        if (binary_cache)
+            _cg_program_binary_cache_store(binary_cache,
+                                           binary_key,
+                                           program->gl_program);
+    } else {
+        /* Leave it to the progend to link the program from source so
+         * that the error is reported where the pipeline is used */
+        program->state = CG_MANIFEST_PROGRAM_STATE_FAILED;
+        GE(dev, glDeleteProgram(program->gl_program));
+        program->gl_program = 0;
+    }
+}
+
+int
+_cg_shader_manifest_prewarm(cg_shader_manifest_t *manifest, int64_t budget)
+{
+    int64_t start = cg_get_clock_time(manifest->dev);
+
+    CG_STATIC_COUNTER(shader_manifest_prewarm_counter,
+                      "shader manifest prewarm counter",
+                      "Increments each time a program from a shader "
+                      "manifest is prewarmed",
+                      0 /* no application private data */);
+
+    while (manifest->next_prewarm < manifest->programs->len) {
+        cg_manifest_program_t *program =
+            c_ptr_array_index(manifest->programs, manifest->next_prewarm++);
+
+        if (program->state != CG_MANIFEST_PROGRAM_STATE_PENDING)
+            continue;
+
+        prewarm_program(manifest, program);
+        manifest->n_remaining--;
+
+        CG_COUNTER_INC(_cg_uprof_context, shader_manifest_prewarm_counter);
+
+        if (budget > 0 && cg_get_clock_time(manifest->dev) - start >= budget)
+            break;
+    }
+
+    if (manifest->n_remaining == 0)
+        free_gl_shaders(manifest);
+
+    return manifest->n_remaining;
+}
+
+GLuint
+_cg_shader_manifest_take_program(cg_shader_manifest_t *manifest,
+                                 uint64_t vertex_source_hash,
+                                 uint64_t fragment_source_hash)
+{
+    uint64_t key = get_program_key(vertex_source_hash, fragment_source_hash);
+    cg_manifest_program_t *program;
+    GLuint gl_program;
+
+    program = c_hash_table_lookup(manifest->program_table, &key);
+    if (program == NULL)
+        return 0;
+
+    switch (program->state) {
+    case CG_MANIFEST_PROGRAM_STATE_PENDING:
+        /* The caller is about to link it so there's no point in
+         * prewarming it any more */
+        program->state = CG_MANIFEST_PROGRAM_STATE_TAKEN;
+        if (--manifest->n_remaining == 0)
+            free_gl_shaders(manifest);
+        return 0;
+
+    case CG_MANIFEST_PROGRAM_STATE_LINKED:
+        program->state = CG_MANIFEST_PROGRAM_STATE_TAKEN;
+        gl_program = program->gl_program;
+        program->gl_program = 0;
+        return gl_program;
+
+    case CG_MANIFEST_PROGRAM_STATE_FAILED:
+    case CG_MANIFEST_PROGRAM_STATE_TAKEN:
+        break;
+    }
+
+    return 0;
+}
+
+#if defined(ENABLE_UNIT_TESTS) && defined(C_PLATFORM_UNIX)
+
+static char *
+test_get_tmp_filename(void)
+{
+    char *filename;
+    int fd = c_file_open_tmp("cg-shader-manifest-XXXXXX", &filename, NULL);
+
+    c_assert(fd != -1);
+    close(fd);
+
+    return filename;
+}
+
+/* Replaces @length bytes at @offset in the file (or truncates it if
+ * @data is NULL) and checks that it can no longer be loaded */
+static void
+test_check_corrupt(const char *filename,
+                   const char *contents,
+                   size_t length,
+                   size_t offset,
+                   const void *data,
+                   size_t data_length)
+{
+    char *corrupt = c_memdup(contents, length);
+    char *corrupt_filename = test_get_tmp_filename();
+    cg_error_t *error = NULL;
+
+    if (data)
+        memcpy(corrupt + offset, data, data_length);
+    else
+        length = offset;
+
+    c_assert(c_file_set_contents(corrupt_filename, corrupt, length, NULL));
+    c_assert(_cg_shader_manifest_load(NULL, corrupt_filename, &error) ==
+             NULL);
+    c_assert(error != NULL);
+    cg_error_free(error);
+
+    c_unlink(corrupt_filename);
+    c_free(corrupt_filename);
+    c_free(corrupt);
+}
+
+TEST(check_shader_manifest_file)
+{
+    static const uint32_t bad_magic = 0x12345678;
+    static const uint32_t bad_index = 100;
+    cg_shader_manifest_t *manifest, *loaded;
+    cg_manifest_shader_t *shader, *loaded_shader;
+    cg_error_t *error = NULL;
+    char *filename = test_get_tmp_filename();
+    char *contents;
+    size_t length;
+    size_t programs_offset;
+    uint32_t swapped[2];
+    int i;
+
+    manifest = _cg_shader_manifest_new(NULL);
+
+    /* Two programs sharing a vertex shader */
+    _cg_shader_manifest_add_program(manifest, 1, "vertex 1", 2, "fragment 2");
+    _cg_shader_manifest_add_program(manifest, 1, "vertex 1", 3, "fragment 3");
+    /* Recording the same program twice doesn't add it again */
+    _cg_shader_manifest_add_program(manifest, 1, "vertex 1", 3, "fragment 3");
+
+    c_assert_cmpint(manifest->shaders->len, ==, 3);
+    c_assert_cmpint(manifest->programs->len, ==, 2);
+
+    c_assert(_cg_shader_manifest_save(manifest, filename, &error));
+    c_assert(error == NULL);
+
+    loaded = _cg_shader_manifest_load(NULL, filename, &error);
+    c_assert(loaded != NULL);
+    c_assert(error == NULL);
+
+    c_assert_cmpint(loaded->shaders->len, ==, 3);
+    c_assert_cmpint(loaded->programs->len, ==, 2);
+    c_assert_cmpint(loaded->n_remaining, ==, 2);
+
+    for (i = 0; i < manifest->shaders->len; i++) {
+        shader = c_ptr_array_index(manifest->shaders, i);
+        loaded_shader = c_ptr_array_index(loaded->shaders, i);
+
+        c_assert(shader->hash == loaded_shader->hash);
+        c_assert_cmpint(shader->type, ==, loaded_shader->type);
+        c_assert_cmpint(shader->length, ==, loaded_shader->length);
+        c_assert_cmpstr(shader->source, ==, loaded_shader->source);
+    }
+
+    c_assert(_cg_shader_manifest_has_program(loaded, 1, 2));
+    c_assert(_cg_shader_manifest_has_program(loaded, 1, 3));
+    c_assert(!_cg_shader_manifest_has_program(loaded, 2, 1));
+
+    _cg_shader_manifest_free(loaded);
+
+    c_assert(c_file_get_contents(filename, &contents, &length, NULL));
+
+    programs_offset = length - sizeof(uint32_t) * 2 * 2;
+
+    /* Wrong magic number */
+    test_check_corrupt(filename, contents, length,
+                       0, &bad_magic, sizeof(bad_magic));
+    /* Truncated in the middle of the header, a shader and the
+     * program list */
+    test_check_corrupt(filename, contents, length,
+                       sizeof(cg_shader_manifest_header_t) / 2, NULL, 0);
+    test_check_corrupt(filename, contents, length,
+                       sizeof(cg_shader_manifest_header_t) +
+                       sizeof(cg_manifest_shader_header_t) + 2,
+                       NULL, 0);
+    test_check_corrupt(filename, contents, length,
+                       length - sizeof(uint32_t), NULL, 0);
+    /* A program referring to a shader that doesn't exist */
+    test_check_corrupt(filename, contents, length,
+                       programs_offset, &bad_index, sizeof(bad_index));
+    /* A program using a fragment shader as its vertex shader */
+    memcpy(swapped, contents + programs_offset, sizeof(swapped));
+    i = swapped[0];
+    swapped[0] = swapped[1];
+    swapped[1] = i;
+    test_check_corrupt(filename, contents, length,
+                       programs_offset, swapped, sizeof(swapped));
+
+    /* A missing file is also reported as an error */
+    c_unlink(filename);
+    c_assert(_cg_shader_manifest_load(NULL, filename, &error) == NULL);
+    c_assert(error != NULL);
+    cg_error_free(error);
+
+    c_free(contents);
+    c_free(filename);
+    _cg_shader_manifest_free(manifest);
+}
+
+TEST(check_shader_manifest_prewarm)
+{
+    cg_shader_manifest_t *manifest;
+    cg_error_t *error = NULL;
+    char *filename = test_get_tmp_filename();
+    int n_programs;
+    int i;
+
+    test_cg_init();
+
+    /* Record the programs for a few different pipelines */
+    cg_device_set_shader_manifest_recording(test_dev, true);
+
+    for (i = 0; i < 3; i++) {
+        cg_pipeline_t *pipeline = cg_pipeline_new(test_dev);
+        cg_snippet_t *snippet;
+        char *code = c_strdup_printf("cg_color_out.r = %i.0 / 3.0;", i);
+
+        snippet = cg_snippet_new(CG_SNIPPET_HOOK_FRAGMENT, NULL, code);
+        cg_pipeline_add_snippet(pipeline, snippet);
+        cg_object_unref(snippet);
+        c_free(code);
+
+        cg_framebuffer_draw_rectangle(test_fb, pipeline, 0, 0, 1, 1);
+        cg_object_unref(pipeline);
+    }
+
+    cg_framebuffer_finish(test_fb);
+    cg_device_set_shader_manifest_recording(test_dev, false);
+
+    c_assert(cg_device_save_shader_manifest(test_dev, filename, &error));
+
+    manifest = _cg_shader_manifest_load(test_dev, filename, &error);
+    c_assert(manifest != NULL);
+
+    n_programs = manifest->programs->len;
+    c_assert_cmpint(n_programs, >=, 3);
+
+    /* An exhausted budget still links one program each time */
+    c_assert_cmpint(_cg_shader_manifest_prewarm(manifest, 1),
+                    ==,
+                    n_programs - 1);
+    c_assert_cmpint(_cg_shader_manifest_prewarm(manifest, 1),
+                    ==,
+                    n_programs - 2);
+
+    /* No budget links the rest */
+    c_assert_cmpint(_cg_shader_manifest_prewarm(manifest, 0), ==, 0);
+    c_assert_cmpint(_cg_shader_manifest_prewarm(manifest, 0), ==, 0);
+
+    /* The linked programs can be taken exactly once */
+    for (i = 0; i < n_programs; i++) {
+        cg_manifest_program_t *program =
+            c_ptr_array_index(manifest->programs, i);
+        uint64_t vertex_hash = program->vertex_shader->hash;
+        uint64_t fragment_hash = program->fragment_shader->hash;
+        GLuint gl_program;
+
+        c_assert_cmpint(program->state, ==, CG_MANIFEST_PROGRAM_STATE_LINKED);
+
+        gl_program = _cg_shader_manifest_take_program(manifest,
+                                                      vertex_hash,
+                                                      fragment_hash);
+        c_assert(gl_program != 0);
+        GE(test_dev, glDeleteProgram(gl_program));
+
+        c_assert_cmpint(_cg_shader_manifest_take_program(manifest,
+                                                         vertex_hash,
+                                                         fragment_hash),
+                        ==,
+                        0);
+    }
+
+    _cg_shader_manifest_free(manifest);
+
+    c_unlink(filename);
+    c_free(filename);
+
+    test_cg_fini();
+}
+
+#endif /* ENABLE_UNIT_TESTS && C_PLATFORM_UNIX */
@@ -192,6 +192,9 @@ struct _cg_texture_t {
     cg_device_t *dev;
     cg_texture_loader_t *loader;
     c_llist_t *framebuffers;
+    /* The number of journal entries that will sample from this
+     * texture when they are flushed */
+    int journal_ref_count;
     int max_level;
     int width;
     int height;
@@ -121,6 +121,7 @@ _cg_texture_init(cg_texture_t *texture,
     texture->allocated = false;
     texture->vtable = vtable;
     texture->framebuffers = NULL;
+    texture->journal_ref_count = 0;
 
     texture->loader = loader;
 
@@ -361,6 +362,11 @@ cg_texture_set_region_from_bitmap(cg_texture_t *texture,
     if (!cg_texture_allocate(texture, error))
         return false;
 
+    /* If there is batched drawing that samples from this texture then
+     * it needs to be flushed before we change the contents */
+    if (texture->journal_ref_count)
+        _cg_flush(texture->dev);
+
     /* Note that we don't prepare the bitmap for upload here because
        some backends may be internally using a different format for the
        actual GL texture than that reported by
@@ -829,6 +835,11 @@ cg_texture_get_data(cg_texture_t *texture,
     if (data == NULL)
         return byte_size;
 
+    /* The texture may be the target of batched drawing in any number
+     * of framebuffers (possibly via a meta texture) so we need to make
+     * sure all the batched drawing has landed before reading back */
+    _cg_flush(dev);
+
     closest_format = dev->texture_driver->find_best_gl_get_data_format(dev,
                                                                        format,
                                                                        &closest_gl_format,
@@ -109,6 +109,26 @@ _cg_util_one_at_a_time_hash(unsigned int hash, const void *key, size_t bytes)
 
 unsigned int _cg_util_one_at_a_time_mix(unsigned int hash);
 
+/* 64-bit FNV-1a hash
+ *
+ * This is used where a hash is persisted between runs and so needs to
+ * be wide enough that collisions can be ignored.
+ */
+#define CG_UTIL_FNV1A_64_INIT 0xcbf29ce484222325ULL
+
+static inline uint64_t
+_cg_util_fnv1a_hash_64(uint64_t hash, const void *key, size_t bytes)
+{
+    const unsigned char *p = key;
+
+    for (size_t i = 0; i < bytes; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
 /* The 'ffs' function is part of C99 so it isn't always available */
 #ifdef CG_HAVE_FFS
 #define _cg_util_ffs ffs
@@ -0,0 +1,117 @@
+/*
+ * CGlib
+ *
+ * A Low-Level GPU Graphics and Utilities API
+ *
+ * Copyright (C) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+
+#ifndef __CG_VERTEX_RING_PRIVATE_H
+#define __CG_VERTEX_RING_PRIVATE_H
+
+#include <clib.h>
+
+#include "cg-attribute-buffer.h"
+#include "cg-fence-private.h"
+
+/* The vertex ring is a single large streaming buffer owned by the
+ * device which is used to upload transient vertex data, such as the
+ * vertices for the journal or for immediate mode rectangles, without
+ * having to create a new buffer object for every draw call.
+ *
+ * The buffer is split into a fixed number of segments. Data is always
+ * appended after the previous allocation so it can be mapped without
+ * synchronizing with the GPU. Once a segment has been filled and the
+ * ring moves on, a fence is inserted so that we can tell when the GPU
+ * has finished with it before it gets reused. If the GPU hasn't
+ * caught up by the time the ring wraps around then the buffer storage
+ * is orphaned instead of stalling.
+ */
+
+#define CG_VERTEX_RING_N_SEGMENTS 4
+
+typedef enum {
+    /* Nothing pending on the GPU reads the segment */
+    CG_VERTEX_RING_SEGMENT_FREE,
+    /* The segment contains data written since the ring last moved on
+     * and may still be referenced by commands that haven't been
+     * issued yet */
+    CG_VERTEX_RING_SEGMENT_ACTIVE,
+    /* The ring has moved on from the segment and the fence tells us
+     * when the GPU has finished with it */
+    CG_VERTEX_RING_SEGMENT_RETIRED
+} cg_vertex_ring_segment_state_t;
+
+typedef struct _cg_vertex_ring_segment_t {
+    cg_vertex_ring_segment_state_t state;
+    cg_fence_sync_t fence;
+} cg_vertex_ring_segment_t;
+
+typedef struct _cg_vertex_ring_t {
+    cg_device_t *dev;
+
+    /* Created lazily the first time the ring is mapped */
+    cg_attribute_buffer_t *buffer;
+    size_t size;
+    size_t write_offset;
+
+    cg_vertex_ring_segment_t segments[CG_VERTEX_RING_N_SEGMENTS];
+
+    bool mapped;
+    bool map_fallback;
+    size_t map_offset;
+    size_t map_size;
+
+    /* Used to fill the buffer with cg_buffer_set_data() if mapping
+     * fails */
+    c_byte_array_t *fallback_array;
+} cg_vertex_ring_t;
+
+cg_vertex_ring_t *_cg_vertex_ring_new(cg_device_t *dev);
+
+void _cg_vertex_ring_free(cg_vertex_ring_t *ring);
+
+/*
+ * _cg_vertex_ring_map:
+ * @ring: A #cg_vertex_ring_t
+ * @size: The number of bytes to allocate
+ * @buffer_out: Returns the buffer that the data will be stored in
+ * @offset_out: Returns the offset of the allocation in @buffer_out
+ *
+ * Allocates @size bytes from the ring and returns a write-only pointer
+ * that should be filled with the new data before calling
+ * _cg_vertex_ring_unmap(). The returned buffer is only guaranteed to
+ * be valid until the next time the ring is mapped so callers that
+ * need it for longer should take a reference. Any draw calls that use
+ * the data must be issued before the ring is mapped again.
+ */
+void *_cg_vertex_ring_map(cg_vertex_ring_t *ring,
+                          size_t size,
+                          cg_attribute_buffer_t **buffer_out,
+                          size_t *offset_out);
+
+void _cg_vertex_ring_unmap(cg_vertex_ring_t *ring);
+
+#endif /* __CG_VERTEX_RING_PRIVATE_H */
@@ -0,0 +1,317 @@
+/*
+ * CGlib
+ *
+ * A Low-Level GPU Graphics and Utilities API
+ *
+ * Copyright (C) 2015 Intel Corporation.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+
+#include <cglib-config.h>
+
+#include <test-fixtures/test-cg-fixtures.h>
+
+#include "cg-debug.h"
+#include "cg-device-private.h"
+#include "cg-buffer-private.h"
+#include "cg-vertex-ring-private.h"
+
+#define CG_VERTEX_RING_DEFAULT_SIZE (1024 * 1024)
+
+/* Allocations are aligned so that any attribute type can be read
+ * directly from the start of an allocation */
+#define CG_VERTEX_RING_ALIGNMENT 16
+
+cg_vertex_ring_t *
+_cg_vertex_ring_new(cg_device_t *dev)
+{
+    cg_vertex_ring_t *ring = c_slice_new0(cg_vertex_ring_t);
+    int i;
+
+    ring->dev = dev;
+    ring->size = CG_VERTEX_RING_DEFAULT_SIZE;
+
+    for (i = 0; i < CG_VERTEX_RING_N_SEGMENTS; i++)
+        ring->segments[i].state = CG_VERTEX_RING_SEGMENT_FREE;
+
+    ring->fallback_array = c_byte_array_new();
+
+    return ring;
+}
+
+static void
+reset_segments(cg_vertex_ring_t *ring)
+{
+    int i;
+
+    for (i = 0; i < CG_VERTEX_RING_N_SEGMENTS; i++) {
+        cg_vertex_ring_segment_t *segment = &ring->segments[i];
+
+        if (segment->state == CG_VERTEX_RING_SEGMENT_RETIRED)
+            _cg_fence_sync_destroy(ring->dev, &segment->fence);
+
+        segment->state = CG_VERTEX_RING_SEGMENT_FREE;
+    }
+}
+
+void
+_cg_vertex_ring_free(cg_vertex_ring_t *ring)
+{
+    c_warn_if_fail(!ring->mapped);
+
+    reset_segments(ring);
+
+    if (ring->buffer)
+        cg_object_unref(ring->buffer);
+
+    c_byte_array_free(ring->fallback_array, true);
+
+    c_slice_free(cg_vertex_ring_t, ring);
+}
+
+static bool
+is_buffer_object(cg_vertex_ring_t *ring)
+{
+    return !!(CG_BUFFER(ring->buffer)->flags & CG_BUFFER_FLAG_BUFFER_OBJECT);
+}
+
+static void
+retire_segment(cg_vertex_ring_t *ring, cg_vertex_ring_segment_t *segment)
+{
+    /* If the buffer is just malloc'd memory then GL will have copied
+     * the data out of it when the draw calls were issued so there's
+     * nothing to wait for */
+    if (!is_buffer_object(ring)) {
+        segment->state = CG_VERTEX_RING_SEGMENT_FREE;
+        return;
+    }
+
+    _cg_fence_sync_insert(ring->dev, &segment->fence);
+    segment->state = CG_VERTEX_RING_SEGMENT_RETIRED;
+}
+
+static bool
+check_segment_free(cg_vertex_ring_t *ring, cg_vertex_ring_segment_t *segment)
+{
+    if (segment->state != CG_VERTEX_RING_SEGMENT_RETIRED)
+        return true;
+
+    if (!_cg_fence_sync_is_complete(ring->dev, &segment->fence))
+        return false;
+
+    _cg_fence_sync_destroy(ring->dev, &segment->fence);
+    segment->state = CG_VERTEX_RING_SEGMENT_FREE;
+
+    return true;
+}
+
+static void
+ensure_buffer(cg_vertex_ring_t *ring, size_t size)
+{
+    if (ring->buffer && size <= ring->size)
+        return;
+
+    /* This also needs to happen before the first allocation in case
+     * the very first request is larger than the default size */
+    while (ring->size < size)
+        ring->size *= 2;
+
+    if (ring->buffer) {
+        /* Any attributes that are still using the old buffer will
+         * have their own reference and GL will keep the storage alive
+         * until any pending commands have finished with it */
+        cg_object_unref(ring->buffer);
+
+        CG_NOTE(DRAW, "Growing vertex ring to %u bytes",
+                (unsigned int)ring->size);
+    }
+
+    reset_segments(ring);
+    ring->write_offset = 0;
+
+    ring->buffer = cg_attribute_buffer_new_with_size(ring->dev, ring->size);
+    cg_buffer_set_update_hint(CG_BUFFER(ring->buffer),
+                              CG_BUFFER_UPDATE_HINT_STREAM);
+}
+
+void *
+_cg_vertex_ring_map(cg_vertex_ring_t *ring,
+                    size_t size,
+                    cg_attribute_buffer_t **buffer_out,
+                    size_t *offset_out)
+{
+    cg_buffer_map_hint_t hints;
+    size_t segment_size;
+    size_t offset;
+    int first_segment, last_segment;
+    bool orphan = false;
+    void *data = NULL;
+    int i;
+
+    CG_STATIC_COUNTER(vertex_ring_orphan_counter,
+                      "vertex ring orphan counter",
+                      "Increments each time the vertex ring wraps around "
+                      "before the GPU has finished with the old data",
+                      0 /* no application private data */);
+
+    c_return_val_if_fail(!ring->mapped, NULL);
+
+    if (size == 0)
+        size = 1;
+
+    ensure_buffer(ring, size);
+
+    offset = ((ring->write_offset + CG_VERTEX_RING_ALIGNMENT - 1) &
+              ~(size_t)(CG_VERTEX_RING_ALIGNMENT - 1));
+    if (offset + size > ring->size)
+        offset = 0;
+
+    segment_size = ring->size / CG_VERTEX_RING_N_SEGMENTS;
+    first_segment = offset / segment_size;
+    last_segment = (offset + size - 1) / segment_size;
+
+    /* All the commands using the segments that we are moving away from
+     * have now been issued so we can fence them */
+    for (i = 0; i < CG_VERTEX_RING_N_SEGMENTS; i++) {
+        cg_vertex_ring_segment_t *segment = &ring->segments[i];
+
+        if (segment->state == CG_VERTEX_RING_SEGMENT_ACTIVE &&
+            (i < first_segment || i > last_segment))
+            retire_segment(ring, segment);
+    }
+
+    for (i = first_segment; i <= last_segment; i++) {
+        if (!check_segment_free(ring, &ring->segments[i])) {
+            orphan = true;
+            break;
+        }
+    }
+
+    if (orphan) {
+        /* Rather than waiting for the GPU we discard the whole buffer
+         * so that the driver can give us new storage while the old
+         * storage is still in use */
+        CG_COUNTER_INC(_cg_uprof_context, vertex_ring_orphan_counter);
+        CG_NOTE(DRAW, "Orphaning vertex ring storage");
+
+        reset_segments(ring);
+        hints = CG_BUFFER_MAP_HINT_DISCARD;
+    } else {
+        hints = (CG_BUFFER_MAP_HINT_DISCARD_RANGE |
+                 CG_BUFFER_MAP_HINT_UNSYNCHRONIZED);
+    }
+
+    for (i = first_segment; i <= last_segment; i++)
+        ring->segments[i].state = CG_VERTEX_RING_SEGMENT_ACTIVE;
+
+    if (is_buffer_object(ring)) {
+        cg_error_t *ignore_error = NULL;
+
+        data = cg_buffer_map_range(CG_BUFFER(ring->buffer),
+                                   offset,
+                                   size,
+                                   CG_BUFFER_ACCESS_WRITE,
+                                   hints,
+                                   &ignore_error);
+        if (ignore_error)
+            cg_error_free(ignore_error);
+    }
+
+    if (data) {
+        ring->map_fallback = false;
+    } else {
+        c_byte_array_set_size(ring->fallback_array, size);
+        data = ring->fallback_array->data;
+        ring->map_fallback = true;
+    }
+
+    ring->mapped = true;
+    ring->map_offset = offset;
+    ring->map_size = size;
+
+    *buffer_out = ring->buffer;
+    *offset_out = offset;
+
+    return data;
+}
+
+void
+_cg_vertex_ring_unmap(cg_vertex_ring_t *ring)
+{
+    c_return_if_fail(ring->mapped);
+
+    if (ring->map_fallback) {
+        /* Note: we don't try to catch OOM errors here since there's
+         * nothing sensible the callers can do in response */
+        cg_buffer_set_data(CG_BUFFER(ring->buffer),
+                           ring->map_offset,
+                           ring->fallback_array->data,
+                           ring->map_size,
+                           NULL);
+    } else
+        cg_buffer_unmap(CG_BUFFER(ring->buffer));
+
+    ring->write_offset = ring->map_offset + ring->map_size;
+    ring->mapped = false;
+}
+
+#ifdef ENABLE_UNIT_TESTS
+
+TEST(check_vertex_ring_first_map_size)
+{
+    cg_vertex_ring_t *ring;
+    cg_attribute_buffer_t *buffer;
+    size_t size = CG_VERTEX_RING_DEFAULT_SIZE * 3 + 1;
+    size_t offset;
+    uint8_t *data;
+
+    test_cg_init();
+
+    ring = _cg_vertex_ring_new(test_dev);
+
+    /* The first map is bigger than the default size so the initial
+     * buffer must be allocated big enough to hold it */
+    data = _cg_vertex_ring_map(ring, size, &buffer, &offset);
+    c_assert(data != NULL);
+    c_assert_cmpint(offset, ==, 0);
+    c_assert_cmpint(ring->size, >=, size);
+    c_assert_cmpint(cg_buffer_get_size(CG_BUFFER(buffer)), >=, size);
+
+    data[0] = 0x42;
+    data[size - 1] = 0x42;
+    _cg_vertex_ring_unmap(ring);
+
+    /* A following small map should fit after it without wrapping */
+    data = _cg_vertex_ring_map(ring, 16, &buffer, &offset);
+    c_assert(data != NULL);
+    c_assert_cmpint(offset, >=, size);
+    c_assert_cmpint(offset + 16, <=, cg_buffer_get_size(CG_BUFFER(buffer)));
+    _cg_vertex_ring_unmap(ring);
+
+    _cg_vertex_ring_free(ring);
+
+    test_cg_fini();
+}
+
+#endif /* ENABLE_UNIT_TESTS */
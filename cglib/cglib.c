@@ -51,6 +51,7 @@
 #include "cg-config-private.h"
 #include "cg-private.h"
 #include "cg-offscreen.h"
+#include "cg-matrix-stack-private.h"
 
 bool
 _cg_check_extension(const char *name, char *const *ext)
@@ -99,10 +100,27 @@ cg_foreach_feature(cg_device_t *dev,
 void
 _cg_flush(cg_device_t *dev)
 {
+    c_llist_t *pending = NULL;
     c_llist_t *l;
 
-    for (l = dev->framebuffers; l; l = l->next)
+    /* Flushing a framebuffer drops the reference its journal holds
+     * which may free it and unlink it from the list so we keep our own
+     * reference on the framebuffers that have something to flush. */
+    for (l = dev->framebuffers; l; l = l->next) {
+        cg_framebuffer_t *framebuffer = l->data;
+
+        if (!_cg_journal_is_empty(framebuffer->journal))
+            pending = c_llist_prepend(pending, cg_object_ref(framebuffer));
+    }
+
+    pending = c_llist_reverse(pending);
+
+    for (l = pending; l; l = l->next) {
         _cg_framebuffer_flush(l->data);
+        cg_object_unref(l->data);
+    }
+
+    c_llist_free(pending);
 }
 
 uint32_t
@@ -168,6 +186,7 @@ _cg_init(void)
         bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
 #endif
 
+        _cg_matrix_stack_init_thread_tls();
         _cg_config_read();
         _cg_debug_check_environment();
         initialized = true;
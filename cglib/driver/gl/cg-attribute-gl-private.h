@@ -39,11 +39,28 @@
 #include "cg-attribute.h"
 #include "cg-attribute-private.h"
 
-void _cg_gl_flush_attributes_state(cg_framebuffer_t *framebuffer,
+bool _cg_gl_flush_attributes_state(cg_framebuffer_t *framebuffer,
                                    cg_pipeline_t *pipeline,
                                    cg_flush_layer_state_t *layers_state,
                                    cg_draw_flags_t flags,
+                                   cg_primitive_t *primitive,
                                    cg_attribute_t **attributes,
                                    int n_attributes);
 
+/*
+ * _cg_gl_bind_index_buffer:
+ * @dev: A #cg_device_t
+ * @buffer: The buffer containing the indices to draw with
+ *
+ * Binds @buffer for an indexed draw after the attributes have been
+ * flushed. The binding is skipped if the current vertex array already
+ * has @buffer bound. Each call must be paired with a call to
+ * _cg_gl_unbind_index_buffer().
+ *
+ * Return value: The base pointer to add to offsets into @buffer
+ */
+uint8_t *_cg_gl_bind_index_buffer(cg_device_t *dev, cg_buffer_t *buffer);
+
+void _cg_gl_unbind_index_buffer(cg_device_t *dev, cg_buffer_t *buffer);
+
 #endif /* _CG_ATTRIBUTE_GL_PRIVATE_H_ */
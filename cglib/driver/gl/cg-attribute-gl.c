@@ -34,6 +34,8 @@
 
 #include <cglib-config.h>
 
+#include <test-fixtures/test-cg-fixtures.h>
+
 #include <string.h>
 
 #include "cg-private.h"
@@ -44,9 +46,47 @@
 #include "cg-attribute.h"
 #include "cg-attribute-private.h"
 #include "cg-attribute-gl-private.h"
+#include "cg-primitive-private.h"
 #include "cg-pipeline-progend-glsl-private.h"
 #include "cg-buffer-gl-private.h"
 
+/* Primitives with more attributes than this don't get a cached
+ * vertex array. GL guarantees at least this many vertex attributes
+ * anyway. */
+#define VERTEX_ARRAY_MAX_ATTRIBUTES 16
+
+/* The number of vertex arrays that will be cached for each
+ * primitive. Each one is for a different mapping of the attributes
+ * to attribute locations so that a primitive drawn alternately with
+ * a few programs doesn't thrash the cache. */
+#define VERTEX_ARRAY_CACHE_SIZE 4
+
+typedef struct {
+    GLuint vertex_array;
+    int locations[VERTEX_ARRAY_MAX_ATTRIBUTES];
+} cg_vertex_array_entry_t;
+
+typedef struct {
+    cg_device_t *dev;
+
+    /* The age of the primitive and the sum of the ages of its
+     * attributes when the vertex arrays were created. The ages only
+     * ever increase so for the same set of attributes the sum will
+     * change if any one of them is modified. */
+    unsigned int primitive_age;
+    unsigned int attributes_age;
+
+    /* The index buffer that is bound in each of the vertex arrays or
+     * NULL if the primitive's indices can't be captured */
+    cg_buffer_t *index_buffer;
+
+    int n_entries;
+    int next_entry;
+    cg_vertex_array_entry_t entries[VERTEX_ARRAY_CACHE_SIZE];
+} cg_vertex_array_cache_t;
+
+static cg_user_data_key_t vertex_array_cache_key;
+
 typedef struct _foreach_changed_bit_state_t {
     cg_device_t *dev;
     const CGlibBitmask *new_bits;
@@ -89,6 +129,21 @@ foreach_changed_bit_and_save(cg_device_t *dev,
     _cg_bitmask_set_bits(current_bits, new_bits);
 }
 
+static void
+set_attribute_pointer(cg_device_t *dev,
+                      cg_attribute_t *attribute,
+                      int attrib_location,
+                      uint8_t *base)
+{
+    GE(dev,
+       glVertexAttribPointer(attrib_location,
+                             attribute->d.buffered.n_components,
+                             attribute->d.buffered.type,
+                             attribute->normalized,
+                             attribute->d.buffered.stride,
+                             base + attribute->d.buffered.offset));
+}
+
 static void
 setup_generic_buffered_attribute(cg_device_t *dev,
                                  cg_pipeline_t *pipeline,
@@ -103,17 +158,21 @@ setup_generic_buffered_attribute(cg_device_t *dev,
     if (attrib_location == -1)
         return;
 
-    GE(dev,
-       glVertexAttribPointer(attrib_location,
-                             attribute->d.buffered.n_components,
-                             attribute->d.buffered.type,
-                             attribute->normalized,
-                             attribute->d.buffered.stride,
-                             base + attribute->d.buffered.offset));
+    set_attribute_pointer(dev, attribute, attrib_location, base);
 
+    /* The divisor is part of the attribute location state so it needs
+     * to be reset if the location was last used for an instanced
+     * attribute */
     if (attribute->instance_stride) {
         GE(dev,
            glVertexAttribDivisor(attrib_location, attribute->instance_stride));
+        _cg_bitmask_set(&dev->instanced_custom_attributes,
+                        attrib_location, true);
+    } else if (_cg_bitmask_get(&dev->instanced_custom_attributes,
+                               attrib_location)) {
+        GE(dev, glVertexAttribDivisor(attrib_location, 0));
+        _cg_bitmask_set(&dev->instanced_custom_attributes,
+                        attrib_location, false);
     }
 
     _cg_bitmask_set(
@@ -189,11 +248,232 @@ apply_attribute_enable_updates(cg_device_t *dev,
                                  &changed_bits_state);
 }
 
+static void
+bind_vertex_array(cg_device_t *dev,
+                  GLuint vertex_array,
+                  cg_buffer_t *index_buffer)
+{
+    if (dev->current_vertex_array != vertex_array) {
+        GE(dev, glBindVertexArray(vertex_array));
+        dev->current_vertex_array = vertex_array;
+    }
+
+    dev->current_vertex_array_index_buffer = index_buffer;
+}
+
+static void
+delete_vertex_array(cg_device_t *dev, GLuint vertex_array)
+{
+    /* Deleting the bound vertex array reverts the binding to zero */
+    if (dev->current_vertex_array == vertex_array) {
+        dev->current_vertex_array = 0;
+        dev->current_vertex_array_index_buffer = NULL;
+    }
+
+    GE(dev, glDeleteVertexArrays(1, &vertex_array));
+}
+
+static void
+clear_vertex_array_cache(cg_vertex_array_cache_t *cache)
+{
+    int i;
+
+    for (i = 0; i < cache->n_entries; i++)
+        delete_vertex_array(cache->dev, cache->entries[i].vertex_array);
+
+    cache->n_entries = 0;
+    cache->next_entry = 0;
+}
+
+static void
+destroy_vertex_array_cache(void *user_data, void *instance)
+{
+    cg_vertex_array_cache_t *cache = user_data;
+
+    clear_vertex_array_cache(cache);
+
+    c_slice_free(cg_vertex_array_cache_t, cache);
+}
+
+/* Creates a vertex array with the state for all of the buffered
+ * attributes of the primitive and its index buffer if not NULL. The
+ * new vertex array is left bound. */
+static GLuint
+create_vertex_array(cg_device_t *dev,
+                    cg_primitive_t *primitive,
+                    const int *locations,
+                    cg_buffer_t *index_buffer)
+{
+    GLuint vertex_array;
+    int i;
+
+    GE(dev, glGenVertexArrays(1, &vertex_array));
+    bind_vertex_array(dev, vertex_array, index_buffer);
+
+    /* The element array binding is part of the vertex array state so
+     * it is left bound for indexed draws to use */
+    if (index_buffer)
+        GE(dev, glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer->gl_handle));
+
+    for (i = 0; i < primitive->n_attributes; i++) {
+        cg_attribute_t *attribute = primitive->attributes[i];
+        cg_buffer_t *buffer;
+        uint8_t *base;
+
+        if (!attribute->is_buffered || locations[i] == -1)
+            continue;
+
+        buffer = CG_BUFFER(attribute->d.buffered.attribute_buffer);
+        base = _cg_buffer_gl_bind(
+            buffer, CG_BUFFER_BIND_TARGET_ATTRIBUTE_BUFFER, NULL);
+
+        set_attribute_pointer(dev, attribute, locations[i], base);
+
+        /* A new vertex array starts with a divisor of zero and all of
+         * the arrays disabled */
+        if (attribute->instance_stride)
+            GE(dev,
+               glVertexAttribDivisor(locations[i],
+                                     attribute->instance_stride));
+        GE(dev, glEnableVertexAttribArray(locations[i]));
+
+        _cg_buffer_gl_unbind(buffer);
+    }
+
+    return vertex_array;
+}
+
+/* Binds a vertex array containing the state of the primitive's
+ * buffered attributes for the attribute locations of the pipeline's
+ * program, creating it if necessary. Returns false if the primitive
+ * can't be drawn with a cached vertex array in which case the
+ * attributes need to be set up individually. */
+static bool
+flush_cached_vertex_array(cg_device_t *dev,
+                          cg_pipeline_t *pipeline,
+                          cg_primitive_t *primitive)
+{
+    int locations[VERTEX_ARRAY_MAX_ATTRIBUTES];
+    unsigned int attributes_age = 0;
+    cg_buffer_t *index_buffer = NULL;
+    cg_vertex_array_cache_t *cache;
+    cg_vertex_array_entry_t *entry;
+    int i;
+
+    if (primitive->n_attributes > VERTEX_ARRAY_MAX_ATTRIBUTES)
+        return false;
+
+    for (i = 0; i < primitive->n_attributes; i++) {
+        cg_attribute_t *attribute = primitive->attributes[i];
+
+        if (attribute->is_buffered) {
+            cg_buffer_t *buffer =
+                CG_BUFFER(attribute->d.buffered.attribute_buffer);
+
+            /* Attributes in malloc'd fallback buffers are set up with
+             * client side pointers which can't be captured */
+            if (!(buffer->flags & CG_BUFFER_FLAG_BUFFER_OBJECT))
+                return false;
+
+            locations[i] = _cg_pipeline_progend_glsl_get_attrib_location(
+                dev, pipeline, attribute->name_state->name_index);
+        } else
+            locations[i] = -1;
+
+        attributes_age += attribute->age;
+    }
+
+    /* Capturing the index buffer saves binding and unbinding it for
+     * every indexed draw. Indices in a malloc'd fallback buffer are
+     * passed as a client side pointer instead. */
+    if (primitive->indices) {
+        cg_buffer_t *buffer =
+            CG_BUFFER(cg_indices_get_buffer(primitive->indices));
+
+        if ((buffer->flags & CG_BUFFER_FLAG_BUFFER_OBJECT) &&
+            buffer->store_created)
+            index_buffer = buffer;
+    }
+
+    cache = cg_object_get_user_data(CG_OBJECT(primitive),
+                                    &vertex_array_cache_key);
+
+    if (cache == NULL) {
+        cache = c_slice_new(cg_vertex_array_cache_t);
+        cache->dev = dev;
+        cache->n_entries = 0;
+        cache->next_entry = 0;
+
+        _cg_object_set_user_data(CG_OBJECT(primitive),
+                                 &vertex_array_cache_key,
+                                 cache,
+                                 destroy_vertex_array_cache);
+    } else if (cache->primitive_age != primitive->age ||
+               cache->attributes_age != attributes_age ||
+               cache->index_buffer != index_buffer)
+        clear_vertex_array_cache(cache);
+
+    cache->primitive_age = primitive->age;
+    cache->attributes_age = attributes_age;
+    cache->index_buffer = index_buffer;
+
+    for (i = 0; i < cache->n_entries; i++) {
+        entry = cache->entries + i;
+
+        if (!memcmp(entry->locations,
+                    locations,
+                    sizeof(int) * primitive->n_attributes)) {
+            bind_vertex_array(dev, entry->vertex_array, index_buffer);
+            return true;
+        }
+    }
+
+    if (cache->n_entries < VERTEX_ARRAY_CACHE_SIZE)
+        entry = cache->entries + cache->n_entries++;
+    else {
+        /* Replace the entries in the order they were created */
+        entry = cache->entries + cache->next_entry;
+        cache->next_entry = (cache->next_entry + 1) % VERTEX_ARRAY_CACHE_SIZE;
+        delete_vertex_array(dev, entry->vertex_array);
+    }
+
+    memcpy(entry->locations, locations, sizeof(int) * primitive->n_attributes);
+    entry->vertex_array =
+        create_vertex_array(dev, primitive, locations, index_buffer);
+
+    return true;
+}
+
+uint8_t *
+_cg_gl_bind_index_buffer(cg_device_t *dev, cg_buffer_t *buffer)
+{
+    /* The bound vertex array may already have the buffer captured in
+     * its element array binding in which case the indices are at an
+     * offset from zero */
+    if (dev->current_vertex_array_index_buffer == buffer)
+        return NULL;
+
+    /* Note: we don't try and catch errors with binding the index buffer
+     * here since OOM errors at this point indicate that nothing has yet
+     * been uploaded to the indices buffer which we consider to be a
+     * programmer error.
+     */
+    return _cg_buffer_gl_bind(buffer, CG_BUFFER_BIND_TARGET_INDEX_BUFFER, NULL);
+}
+
 void
+_cg_gl_unbind_index_buffer(cg_device_t *dev, cg_buffer_t *buffer)
+{
+    if (dev->current_vertex_array_index_buffer != buffer)
+        _cg_buffer_gl_unbind(buffer);
+}
+
+bool
 _cg_gl_flush_attributes_state(cg_framebuffer_t *framebuffer,
                               cg_pipeline_t *pipeline,
                               cg_flush_layer_state_t *layers_state,
                               cg_draw_flags_t flags,
+                              cg_primitive_t *primitive,
                               cg_attribute_t **attributes,
                               int n_attributes)
 {
@@ -228,8 +508,47 @@ _cg_gl_flush_attributes_state(cg_framebuffer_t *framebuffer,
         _cg_pipeline_apply_overrides(pipeline, &layers_state->options);
     }
 
-    _cg_pipeline_flush_gl_state(dev, pipeline, framebuffer,
-                                with_color_attrib, unknown_color_alpha);
+    if (!_cg_pipeline_flush_gl_state(dev, pipeline, framebuffer,
+                                     with_color_attrib, unknown_color_alpha,
+                                     true /* allow async */)) {
+        cg_pipeline_t *fallback = dev->async_shader_fallback_pipeline;
+
+        /* The program for the pipeline is still being compiled so
+         * either draw with the fallback pipeline instead or skip the
+         * draw entirely */
+        if (fallback == NULL || fallback == pipeline ||
+            !_cg_pipeline_flush_gl_state(dev, fallback, framebuffer,
+                                         with_color_attrib,
+                                         unknown_color_alpha,
+                                         true /* allow async */)) {
+            if (copy)
+                cg_object_unref(copy);
+            return false;
+        }
+
+        pipeline = fallback;
+    }
+
+    /* If the attributes belong to a primitive then the state of the
+     * buffered attributes can be rebound with a single vertex array.
+     * The constant attributes aren't part of the vertex array state
+     * so they still need to be flushed every time. */
+    if (primitive &&
+        _cg_has_private_feature(dev, CG_PRIVATE_FEATURE_VERTEX_ARRAY_OBJECTS) &&
+        flush_cached_vertex_array(dev, pipeline, primitive)) {
+        for (i = 0; i < n_attributes; i++)
+            if (!attributes[i]->is_buffered)
+                setup_generic_const_attribute(dev, pipeline, attributes[i]);
+
+        if (copy)
+            cg_object_unref(copy);
+
+        return true;
+    }
+
+    /* The attribute bitmasks in the device track the state of the
+     * default vertex array */
+    bind_vertex_array(dev, dev->default_vertex_array, NULL);
 
     _cg_bitmask_clear_all(&dev->enable_custom_attributes_tmp);
 
@@ -266,4 +585,297 @@ _cg_gl_flush_attributes_state(cg_framebuffer_t *framebuffer,
 
     if (copy)
         cg_object_unref(copy);
+
+    return true;
+}
+
+#ifdef ENABLE_UNIT_TESTS
+
+static cg_attribute_buffer_t *
+create_test_quad_buffer(int x)
+{
+    float verts[] = { x, 0, x, 1, x + 1, 0, x + 1, 1 };
+
+    return cg_attribute_buffer_new(test_dev, sizeof(verts), verts);
+}
+
+static cg_vertex_array_cache_t *
+get_test_vertex_array_cache(cg_primitive_t *primitive)
+{
+    return cg_object_get_user_data(CG_OBJECT(primitive),
+                                   &vertex_array_cache_key);
+}
+
+TEST(check_vertex_array_cache)
+{
+    cg_attribute_buffer_t *buffer;
+    cg_attribute_t *attribute;
+    cg_primitive_t *primitive;
+    cg_pipeline_t *red_pipeline, *green_pipeline;
+    cg_vertex_array_cache_t *cache;
+    cg_snippet_t *snippet;
+    GLuint vertex_array;
+    unsigned int attributes_age;
+
+    test_cg_init();
+
+    cg_framebuffer_orthographic(test_fb,
+                                0, 0,
+                                cg_framebuffer_get_width(test_fb),
+                                cg_framebuffer_get_height(test_fb),
+                                -1, 100);
+
+    red_pipeline = cg_pipeline_new(test_dev);
+    cg_pipeline_set_color4ub(red_pipeline, 0xff, 0, 0, 0xff);
+
+    /* The snippet gives this pipeline a different program */
+    green_pipeline = cg_pipeline_new(test_dev);
+    snippet = cg_snippet_new(CG_SNIPPET_HOOK_FRAGMENT,
+                             NULL,
+                             "cg_color_out = vec4(0.0, 1.0, 0.0, 1.0);");
+    cg_pipeline_add_snippet(green_pipeline, snippet);
+    cg_object_unref(snippet);
+
+    buffer = create_test_quad_buffer(0);
+    attribute = cg_attribute_new(buffer,
+                                 "cg_position_in",
+                                 sizeof(float) * 2, /* stride */
+                                 0, /* offset */
+                                 2, /* n_components */
+                                 CG_ATTRIBUTE_TYPE_FLOAT);
+    cg_object_unref(buffer);
+    primitive = cg_primitive_new_with_attributes(
+        CG_VERTICES_MODE_TRIANGLE_STRIP, 4, &attribute, 1);
+
+    cg_primitive_draw(primitive, test_fb, red_pipeline);
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0xff, 0, 0);
+
+    if (!_cg_has_private_feature(test_dev,
+                                 CG_PRIVATE_FEATURE_VERTEX_ARRAY_OBJECTS)) {
+        c_assert(get_test_vertex_array_cache(primitive) == NULL);
+        goto done;
+    }
+
+    cache = get_test_vertex_array_cache(primitive);
+    c_assert(cache != NULL);
+    c_assert_cmpint(cache->n_entries, ==, 1);
+    vertex_array = cache->entries[0].vertex_array;
+    c_assert_cmpint(test_dev->current_vertex_array, ==, vertex_array);
+    attributes_age = cache->attributes_age;
+
+    /* The position attribute has a fixed location so the same vertex
+     * array can be reused for a different program */
+    cg_primitive_draw(primitive, test_fb, green_pipeline);
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0, 0xff, 0);
+    c_assert_cmpint(cache->n_entries, ==, 1);
+    c_assert_cmpint(cache->entries[0].vertex_array, ==, vertex_array);
+    c_assert_cmpint(test_dev->current_vertex_array, ==, vertex_array);
+
+    /* Replacing the buffer of the attribute should invalidate the
+     * vertex array */
+    buffer = create_test_quad_buffer(1);
+    cg_attribute_set_buffer(attribute, buffer);
+    cg_object_unref(buffer);
+
+    cg_primitive_draw(primitive, test_fb, red_pipeline);
+    test_cg_check_pixel_rgb(test_fb, 1, 0, 0xff, 0, 0);
+    c_assert(cache == get_test_vertex_array_cache(primitive));
+    c_assert_cmpint(cache->n_entries, ==, 1);
+    c_assert_cmpint(cache->attributes_age, !=, attributes_age);
+    c_assert_cmpint(test_dev->current_vertex_array,
+                    ==,
+                    cache->entries[0].vertex_array);
+
+    cg_object_unref(attribute);
+
+    /* So should replacing the attributes of the primitive */
+    buffer = create_test_quad_buffer(2);
+    attribute = cg_attribute_new(buffer,
+                                 "cg_position_in",
+                                 sizeof(float) * 2, /* stride */
+                                 0, /* offset */
+                                 2, /* n_components */
+                                 CG_ATTRIBUTE_TYPE_FLOAT);
+    cg_object_unref(buffer);
+    cg_primitive_set_attributes(primitive, &attribute, 1);
+
+    cg_primitive_draw(primitive, test_fb, green_pipeline);
+    test_cg_check_pixel_rgb(test_fb, 2, 0, 0, 0xff, 0);
+    c_assert_cmpint(cache->n_entries, ==, 1);
+    c_assert_cmpint(cache->primitive_age, ==, primitive->age);
+    c_assert_cmpint(test_dev->current_vertex_array,
+                    ==,
+                    cache->entries[0].vertex_array);
+
+    /* The earlier quads should have been left alone */
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0, 0xff, 0);
+    test_cg_check_pixel_rgb(test_fb, 1, 0, 0xff, 0, 0);
+
+done:
+    cg_object_unref(primitive);
+    cg_object_unref(attribute);
+    cg_object_unref(green_pipeline);
+    cg_object_unref(red_pipeline);
+
+    test_cg_fini();
+}
+
+TEST(check_vertex_array_index_buffer)
+{
+    static const uint8_t quad_indices[] = { 0, 1, 2, 1, 3, 2 };
+    cg_attribute_buffer_t *buffer;
+    cg_attribute_t *attribute;
+    cg_primitive_t *primitive;
+    cg_indices_t *indices, *other_indices;
+    cg_pipeline_t *red_pipeline, *green_pipeline;
+    cg_vertex_array_cache_t *cache;
+    cg_buffer_t *index_buffer;
+    GLuint vertex_array;
+
+    test_cg_init();
+
+    cg_framebuffer_orthographic(test_fb,
+                                0, 0,
+                                cg_framebuffer_get_width(test_fb),
+                                cg_framebuffer_get_height(test_fb),
+                                -1, 100);
+
+    red_pipeline = cg_pipeline_new(test_dev);
+    cg_pipeline_set_color4ub(red_pipeline, 0xff, 0, 0, 0xff);
+    green_pipeline = cg_pipeline_new(test_dev);
+    cg_pipeline_set_color4ub(green_pipeline, 0, 0xff, 0, 0xff);
+
+    buffer = create_test_quad_buffer(0);
+    attribute = cg_attribute_new(buffer,
+                                 "cg_position_in",
+                                 sizeof(float) * 2, /* stride */
+                                 0, /* offset */
+                                 2, /* n_components */
+                                 CG_ATTRIBUTE_TYPE_FLOAT);
+    cg_object_unref(buffer);
+    primitive = cg_primitive_new_with_attributes(
+        CG_VERTICES_MODE_TRIANGLES, 4, &attribute, 1);
+    cg_object_unref(attribute);
+
+    indices = cg_indices_new(test_dev,
+                             CG_INDICES_TYPE_UNSIGNED_BYTE,
+                             quad_indices,
+                             C_N_ELEMENTS(quad_indices));
+    cg_primitive_set_indices(primitive, indices, C_N_ELEMENTS(quad_indices));
+
+    cg_primitive_draw(primitive, test_fb, red_pipeline);
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0xff, 0, 0);
+
+    if (!_cg_has_private_feature(test_dev,
+                                 CG_PRIVATE_FEATURE_VERTEX_ARRAY_OBJECTS))
+        goto done;
+
+    /* The vertex array should have captured the index buffer */
+    index_buffer = CG_BUFFER(cg_indices_get_buffer(indices));
+    cache = get_test_vertex_array_cache(primitive);
+    c_assert(cache != NULL);
+    c_assert(cache->index_buffer == index_buffer);
+    vertex_array = cache->entries[0].vertex_array;
+    c_assert_cmpint(test_dev->current_vertex_array, ==, vertex_array);
+    c_assert(test_dev->current_vertex_array_index_buffer == index_buffer);
+
+    /* Uploading another index buffer while the vertex array is still
+     * bound mustn't lose the captured binding */
+    other_indices = cg_indices_new(test_dev,
+                                   CG_INDICES_TYPE_UNSIGNED_BYTE,
+                                   quad_indices,
+                                   C_N_ELEMENTS(quad_indices));
+    c_assert_cmpint(test_dev->current_vertex_array, ==, vertex_array);
+
+    cg_framebuffer_translate(test_fb, 1, 0, 0);
+    cg_primitive_draw(primitive, test_fb, green_pipeline);
+    test_cg_check_pixel_rgb(test_fb, 1, 0, 0, 0xff, 0);
+    c_assert_cmpint(cache->n_entries, ==, 1);
+    c_assert_cmpint(cache->entries[0].vertex_array, ==, vertex_array);
+
+    /* Replacing the indices should invalidate the vertex array */
+    cg_primitive_set_indices(primitive,
+                             other_indices,
+                             C_N_ELEMENTS(quad_indices));
+    cg_object_unref(other_indices);
+
+    cg_framebuffer_translate(test_fb, 1, 0, 0);
+    cg_primitive_draw(primitive, test_fb, red_pipeline);
+    test_cg_check_pixel_rgb(test_fb, 2, 0, 0xff, 0, 0);
+    c_assert_cmpint(cache->n_entries, ==, 1);
+    c_assert(cache->index_buffer ==
+             CG_BUFFER(cg_indices_get_buffer(other_indices)));
+    c_assert(test_dev->current_vertex_array_index_buffer ==
+             cache->index_buffer);
+
+    /* The earlier quads should have been left alone */
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0xff, 0, 0);
+    test_cg_check_pixel_rgb(test_fb, 1, 0, 0, 0xff, 0);
+
+done:
+    cg_object_unref(indices);
+    cg_object_unref(primitive);
+    cg_object_unref(green_pipeline);
+    cg_object_unref(red_pipeline);
+
+    test_cg_fini();
 }
+
+TEST(check_vertex_arrays_disabled)
+{
+    cg_attribute_buffer_t *buffer;
+    cg_attribute_t *attribute;
+    cg_primitive_t *primitive;
+    cg_pipeline_t *pipeline;
+
+    CG_DEBUG_SET_FLAG(CG_DEBUG_DISABLE_VERTEX_ARRAYS);
+
+    test_cg_init();
+
+    c_assert(!_cg_has_private_feature(test_dev,
+                                      CG_PRIVATE_FEATURE_VERTEX_ARRAY_OBJECTS));
+
+    cg_framebuffer_orthographic(test_fb,
+                                0, 0,
+                                cg_framebuffer_get_width(test_fb),
+                                cg_framebuffer_get_height(test_fb),
+                                -1, 100);
+
+    pipeline = cg_pipeline_new(test_dev);
+    cg_pipeline_set_color4ub(pipeline, 0, 0, 0xff, 0xff);
+
+    buffer = create_test_quad_buffer(0);
+    attribute = cg_attribute_new(buffer,
+                                 "cg_position_in",
+                                 sizeof(float) * 2, /* stride */
+                                 0, /* offset */
+                                 2, /* n_components */
+                                 CG_ATTRIBUTE_TYPE_FLOAT);
+    cg_object_unref(buffer);
+    primitive = cg_primitive_new_with_attributes(
+        CG_VERTICES_MODE_TRIANGLE_STRIP, 4, &attribute, 1);
+    cg_object_unref(attribute);
+
+    /* Drawing twice makes sure the attribute state tracked for the
+     * default vertex array is still right when nothing has changed */
+    cg_primitive_draw(primitive, test_fb, pipeline);
+    cg_framebuffer_translate(test_fb, 1, 0, 0);
+    cg_primitive_draw(primitive, test_fb, pipeline);
+
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0, 0, 0xff);
+    test_cg_check_pixel_rgb(test_fb, 1, 0, 0, 0, 0xff);
+
+    c_assert(get_test_vertex_array_cache(primitive) == NULL);
+    c_assert_cmpint(test_dev->current_vertex_array,
+                    ==,
+                    test_dev->default_vertex_array);
+
+    cg_object_unref(primitive);
+    cg_object_unref(pipeline);
+
+    test_cg_fini();
+
+    CG_DEBUG_CLEAR_FLAG(CG_DEBUG_DISABLE_VERTEX_ARRAYS);
+}
+
+#endif /* ENABLE_UNIT_TESTS */
@@ -76,6 +76,9 @@
 #ifndef GL_MAP_INVALIDATE_BUFFER_BIT
 #define GL_MAP_INVALIDATE_BUFFER_BIT 0x0008
 #endif
+#ifndef GL_MAP_UNSYNCHRONIZED_BIT
+#define GL_MAP_UNSYNCHRONIZED_BIT 0x0020
+#endif
 
 void
 _cg_buffer_gl_create(cg_buffer_t *buffer)
@@ -88,7 +91,14 @@ _cg_buffer_gl_create(cg_buffer_t *buffer)
 void
 _cg_buffer_gl_destroy(cg_buffer_t *buffer)
 {
-    GE(buffer->dev, glDeleteBuffers(1, &buffer->gl_handle));
+    cg_device_t *dev = buffer->dev;
+
+    /* Deleting the buffer also removes it from the element array
+     * binding of the current vertex array */
+    if (dev->current_vertex_array_index_buffer == buffer)
+        dev->current_vertex_array_index_buffer = NULL;
+
+    GE(dev, glDeleteBuffers(1, &buffer->gl_handle));
 }
 
 static GLenum
@@ -252,6 +262,11 @@ _cg_buffer_gl_map_range(cg_buffer_t *buffer,
                    !(access & CG_BUFFER_ACCESS_READ))
             gl_access |= GL_MAP_INVALIDATE_RANGE_BIT;
 
+        /* GL doesn't allow an unsynchronized map for reading */
+        if ((hints & CG_BUFFER_MAP_HINT_UNSYNCHRONIZED) &&
+            !(access & CG_BUFFER_ACCESS_READ))
+            gl_access |= GL_MAP_UNSYNCHRONIZED_BIT;
+
         if (should_recreate_store) {
             if (!recreate_store(buffer, error)) {
                 _cg_buffer_gl_unbind(buffer);
@@ -400,7 +415,16 @@ _cg_buffer_gl_unbind(cg_buffer_t *buffer)
     if (buffer->flags & CG_BUFFER_FLAG_BUFFER_OBJECT) {
         GLenum gl_target =
             convert_bind_target_to_gl_target(buffer->last_target);
-        GE(dev, glBindBuffer(gl_target, 0));
+        GLuint handle = 0;
+
+        /* The element array binding is part of the vertex array state
+         * so binding an index buffer will have replaced the one that
+         * the current vertex array has captured */
+        if (buffer->last_target == CG_BUFFER_BIND_TARGET_INDEX_BUFFER &&
+            dev->current_vertex_array_index_buffer)
+            handle = dev->current_vertex_array_index_buffer->gl_handle;
+
+        GE(dev, glBindBuffer(gl_target, handle));
     }
 
     dev->current_buffer[buffer->last_target] = NULL;
@@ -125,8 +125,10 @@ add_stencil_clip_silhouette(cg_framebuffer_t *framebuffer,
     _cg_device_set_current_projection_entry(dev, projection_stack->last_entry);
     _cg_device_set_current_modelview_entry(dev, modelview_entry);
 
+    /* The stencil has to be drawn so we can't let the program be built
+     * asynchronously */
     _cg_pipeline_flush_gl_state(dev, dev->stencil_pipeline, framebuffer,
-                                false, false);
+                                false, false, false);
 
     GE(dev, glEnable(GL_STENCIL_TEST));
 
@@ -203,6 +205,7 @@ paint_primitive_silhouette(cg_framebuffer_t *framebuffer,
                        framebuffer,
                        pipeline,
                        1, /* n instances */
+                       CG_DRAW_SKIP_JOURNAL_FLUSH |
                        CG_DRAW_SKIP_FRAMEBUFFER_FLUSH);
 }
 
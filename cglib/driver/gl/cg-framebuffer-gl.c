@@ -35,6 +35,7 @@
 #include "cg-framebuffer-private.h"
 #include "cg-framebuffer-gl-private.h"
 #include "cg-buffer-gl-private.h"
+#include "cg-attribute-gl-private.h"
 #include "cg-error-private.h"
 #include "cg-texture-gl-private.h"
 #include "cg-texture-private.h"
@@ -284,22 +285,33 @@ _cg_framebuffer_gl_flush_state(cg_framebuffer_t *draw_buffer,
     unsigned long differences;
     int bit;
 
-    /* We can assume that any state that has changed for the current
-     * framebuffer is different to the currently flushed value. */
-    differences = dev->current_draw_buffer_changes;
+    /* We can assume that any state that has been modified with the
+     * framebuffer setters since it was last flushed is different to
+     * the currently flushed value. The device also tracks state that
+     * other parts of CGlib have disrupted behind the framebuffer's
+     * back, such as the journal flushing the matrices directly. */
+    differences = draw_buffer->changes_since_flush;
+    differences |= dev->current_draw_buffer_changes;
 
     /* Any state of the current framebuffer that hasn't already been
      * flushed is assumed to be unknown so we will always flush that
      * state if asked. */
     differences |= ~dev->current_draw_buffer_state_flushed;
 
+    /* The clip stack and the journal can set the current matrix
+     * entries directly so these are checked as well. This is just a
+     * pointer comparison so flushing the same framebuffer again with
+     * no intervening changes stays cheap */
+    if (dev->current_modelview_entry !=
+        _cg_framebuffer_get_modelview_entry(draw_buffer))
+        differences |= CG_FRAMEBUFFER_STATE_MODELVIEW;
+    if (dev->current_projection_entry !=
+        _cg_framebuffer_get_projection_entry(draw_buffer))
+        differences |= CG_FRAMEBUFFER_STATE_PROJECTION;
+
     /* We only need to consider the state we've been asked to flush */
     differences &= state;
 
-#warning "HACK - force flush all framebuffer state"
-    differences = CG_FRAMEBUFFER_STATE_ALL;
-    dev->current_draw_buffer = NULL;
-
     if (dev->current_draw_buffer != draw_buffer) {
         /* If the previous draw buffer is NULL then we'll assume
            everything has changed. This can happen if a framebuffer is
@@ -362,6 +374,13 @@ _cg_framebuffer_gl_flush_state(cg_framebuffer_t *draw_buffer,
         differences &= ~CG_FRAMEBUFFER_STATE_BIND;
     }
 
+    /* Flushing the clip stack may draw to the stencil buffer which
+     * replaces the current matrix entries so they need to be flushed
+     * again afterwards */
+    if (differences & CG_FRAMEBUFFER_STATE_CLIP)
+        differences |= state & (CG_FRAMEBUFFER_STATE_MODELVIEW |
+                                CG_FRAMEBUFFER_STATE_PROJECTION);
+
     CG_FLAGS_FOREACH_START(&differences, 1, bit)
     {
         /* XXX: We considered having an array of callbacks for each state index
@@ -403,6 +422,7 @@ _cg_framebuffer_gl_flush_state(cg_framebuffer_t *draw_buffer,
 
     dev->current_draw_buffer_state_flushed |= state;
     dev->current_draw_buffer_changes &= ~state;
+    draw_buffer->changes_since_flush &= ~state;
 }
 
 static cg_texture_t *
@@ -1081,13 +1101,15 @@ _cg_framebuffer_gl_draw_attributes(cg_framebuffer_t *framebuffer,
                                    cg_vertices_mode_t mode,
                                    int first_vertex,
                                    int n_vertices,
+                                   cg_primitive_t *primitive,
                                    cg_attribute_t **attributes,
                                    int n_attributes,
                                    int n_instances,
                                    cg_draw_flags_t flags)
 {
-    _cg_flush_attributes_state(
-        framebuffer, pipeline, flags, attributes, n_attributes);
+    if (!_cg_flush_attributes_state(
+            framebuffer, pipeline, flags, primitive, attributes, n_attributes))
+        return;
 
     if (framebuffer->dev->glDrawArraysInstanced) {
         GE(framebuffer->dev,
@@ -1120,6 +1142,7 @@ _cg_framebuffer_gl_draw_indexed_attributes(cg_framebuffer_t *framebuffer,
                                            int first_vertex,
                                            int n_vertices,
                                            cg_indices_t *indices,
+                                           cg_primitive_t *primitive,
                                            cg_attribute_t **attributes,
                                            int n_attributes,
                                            int n_instances,
@@ -1131,17 +1154,13 @@ _cg_framebuffer_gl_draw_indexed_attributes(cg_framebuffer_t *framebuffer,
     size_t index_size;
     GLenum indices_gl_type = 0;
 
-    _cg_flush_attributes_state(
-        framebuffer, pipeline, flags, attributes, n_attributes);
+    if (!_cg_flush_attributes_state(
+            framebuffer, pipeline, flags, primitive, attributes, n_attributes))
+        return;
 
     buffer = CG_BUFFER(cg_indices_get_buffer(indices));
 
-    /* Note: we don't try and catch errors with binding the index buffer
-     * here since OOM errors at this point indicate that nothing has yet
-     * been uploaded to the indices buffer which we consider to be a
-     * programmer error.
-     */
-    base = _cg_buffer_gl_bind(buffer, CG_BUFFER_BIND_TARGET_INDEX_BUFFER, NULL);
+    base = _cg_gl_bind_index_buffer(framebuffer->dev, buffer);
     buffer_offset = cg_indices_get_offset(indices);
     index_size = sizeof_index_type(cg_indices_get_type(indices));
 
@@ -1172,7 +1191,91 @@ _cg_framebuffer_gl_draw_indexed_attributes(cg_framebuffer_t *framebuffer,
                           base + buffer_offset + index_size * first_vertex));
     }
 
-    _cg_buffer_gl_unbind(buffer);
+    _cg_gl_unbind_index_buffer(framebuffer->dev, buffer);
+}
+
+void
+_cg_framebuffer_gl_multi_draw_attributes(cg_framebuffer_t *framebuffer,
+                                         cg_pipeline_t *pipeline,
+                                         cg_vertices_mode_t mode,
+                                         const int *first_vertices,
+                                         const int *n_vertices,
+                                         cg_indices_t **indices,
+                                         int n_draws,
+                                         cg_attribute_t **attributes,
+                                         int n_attributes,
+                                         cg_draw_flags_t flags)
+{
+    cg_device_t *dev = framebuffer->dev;
+    cg_buffer_t *buffer;
+    const GLvoid **offsets;
+    uint8_t *base;
+    size_t index_size;
+    GLenum indices_gl_type = 0;
+    int i;
+
+    if (!_cg_flush_attributes_state(
+            framebuffer, pipeline, flags, NULL, attributes, n_attributes))
+        return;
+
+    if (indices == NULL) {
+        if (dev->glMultiDrawArrays) {
+            GE(dev,
+               glMultiDrawArrays((GLenum)mode,
+                                 first_vertices,
+                                 n_vertices,
+                                 n_draws));
+        } else {
+            for (i = 0; i < n_draws; i++)
+                GE(dev,
+                   glDrawArrays((GLenum)mode,
+                                first_vertices[i],
+                                n_vertices[i]));
+        }
+        return;
+    }
+
+    buffer = CG_BUFFER(cg_indices_get_buffer(indices[0]));
+
+    base = _cg_gl_bind_index_buffer(dev, buffer);
+    index_size = sizeof_index_type(cg_indices_get_type(indices[0]));
+
+    switch (cg_indices_get_type(indices[0])) {
+    case CG_INDICES_TYPE_UNSIGNED_BYTE:
+        indices_gl_type = GL_UNSIGNED_BYTE;
+        break;
+    case CG_INDICES_TYPE_UNSIGNED_SHORT:
+        indices_gl_type = GL_UNSIGNED_SHORT;
+        break;
+    case CG_INDICES_TYPE_UNSIGNED_INT:
+        indices_gl_type = GL_UNSIGNED_INT;
+        break;
+    }
+
+    offsets = c_new(const GLvoid *, n_draws);
+    for (i = 0; i < n_draws; i++)
+        offsets[i] = (base + cg_indices_get_offset(indices[i]) +
+                      index_size * first_vertices[i]);
+
+    if (dev->glMultiDrawElements) {
+        GE(dev,
+           glMultiDrawElements((GLenum)mode,
+                               n_vertices,
+                               indices_gl_type,
+                               offsets,
+                               n_draws));
+    } else {
+        for (i = 0; i < n_draws; i++)
+            GE(dev,
+               glDrawElements((GLenum)mode,
+                              n_vertices[i],
+                              indices_gl_type,
+                              offsets[i]));
+    }
+
+    c_free(offsets);
+
+    _cg_gl_unbind_index_buffer(dev, buffer);
 }
 
 static bool
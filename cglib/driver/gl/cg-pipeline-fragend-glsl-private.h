@@ -40,4 +40,10 @@ extern const cg_pipeline_fragend_t _cg_pipeline_glsl_fragend;
 
 GLuint _cg_pipeline_fragend_glsl_get_shader(cg_pipeline_t *pipeline);
 
+uint64_t _cg_pipeline_fragend_glsl_get_source_hash(cg_pipeline_t *pipeline);
+
+/* Returns a newly allocated copy of the complete fragment shader source
+ * or %NULL if there is no shader */
+char *_cg_pipeline_fragend_glsl_get_source(cg_pipeline_t *pipeline);
+
 #endif /* __CG_PIPELINE_FRAGEND_GLSL_PRIVATE_H */
@@ -85,6 +85,10 @@ typedef struct {
     cg_device_t *dev;
 
     GLuint gl_shader;
+    /* The shader is only compiled once it's needed to link a program
+     * that couldn't be loaded from the program binary cache */
+    bool compiled;
+    uint64_t source_hash;
     c_string_t *header, *source;
     int last_layer_index;
 
@@ -120,7 +124,7 @@ destroy_shader_state(void *user_data, void *instance)
 
     if (shader_state->cache_entry &&
         shader_state->cache_entry->pipeline != instance)
-        shader_state->cache_entry->usage_count--;
+        _cg_pipeline_cache_entry_remove_usage(shader_state->cache_entry);
 
     if (--shader_state->ref_count == 0) {
         if (shader_state->gl_shader)
@@ -141,7 +145,7 @@ set_shader_state(cg_pipeline_t *pipeline,
          * mark it as a usage of the pipeline cache entry */
         if (shader_state->cache_entry &&
             shader_state->cache_entry->pipeline != pipeline)
-            shader_state->cache_entry->usage_count++;
+            _cg_pipeline_cache_entry_add_usage(shader_state->cache_entry);
     }
 
     _cg_object_set_user_data(CG_OBJECT(pipeline),
@@ -161,12 +165,49 @@ _cg_pipeline_fragend_glsl_get_shader(cg_pipeline_t *pipeline)
 {
     cg_pipeline_shader_state_t *shader_state = get_shader_state(pipeline);
 
+    if (shader_state == NULL)
+        return 0;
+
+    if (!shader_state->compiled && shader_state->gl_shader) {
+        CG_STATIC_COUNTER(fragend_glsl_compile_counter,
+                          "glsl fragment compile counter",
+                          "Increments each time a new GLSL "
+                          "fragment shader is compiled",
+                          0 /* no application private data */);
+        CG_COUNTER_INC(_cg_uprof_context, fragend_glsl_compile_counter);
+        _cg_pipeline_cache_count_compile(shader_state->dev->pipeline_cache,
+                                         CG_PIPELINE_CACHE_TABLE_FRAGMENT);
+
+        _cg_glsl_shader_compile(shader_state->dev, shader_state->gl_shader);
+        shader_state->compiled = true;
+    }
+
+    return shader_state->gl_shader;
+}
+
+uint64_t
+_cg_pipeline_fragend_glsl_get_source_hash(cg_pipeline_t *pipeline)
+{
+    cg_pipeline_shader_state_t *shader_state = get_shader_state(pipeline);
+
     if (shader_state)
-        return shader_state->gl_shader;
+        return shader_state->source_hash;
     else
         return 0;
 }
 
+char *
+_cg_pipeline_fragend_glsl_get_source(cg_pipeline_t *pipeline)
+{
+    cg_pipeline_shader_state_t *shader_state = get_shader_state(pipeline);
+
+    if (shader_state == NULL || shader_state->gl_shader == 0)
+        return NULL;
+
+    return _cg_glsl_shader_get_source(shader_state->dev,
+                                      shader_state->gl_shader);
+}
+
 static cg_pipeline_snippet_list_t *
 get_fragment_snippets(cg_pipeline_t *pipeline)
 {
@@ -554,17 +595,9 @@ _cg_pipeline_fragend_glsl_end(cg_device_t *dev,
     if (shader_state->source) {
         const char *source_strings[2];
         GLint lengths[2];
-        GLint compile_status;
         GLuint shader;
         cg_pipeline_snippet_data_t snippet_data;
 
-        CG_STATIC_COUNTER(fragend_glsl_compile_counter,
-                          "glsl fragment compile counter",
-                          "Increments each time a new GLSL "
-                          "fragment shader is compiled",
-                          0 /* no application private data */);
-        CG_COUNTER_INC(_cg_uprof_context, fragend_glsl_compile_counter);
-
         if (shader_state->last_layer_index >= 0) {
             c_string_append_printf(shader_state->source,
                                    "  cg_color_out = cg_layer%i;\n",
@@ -595,29 +628,18 @@ _cg_pipeline_fragend_glsl_end(cg_device_t *dev,
         lengths[1] = shader_state->source->len;
         source_strings[1] = shader_state->source->str;
 
-        _cg_glsl_shader_set_source_with_boilerplate(dev,
-                                                    shader,
-                                                    GL_FRAGMENT_SHADER,
-                                                    2, /* count */
-                                                    source_strings,
-                                                    lengths);
-
-        GE(dev, glCompileShader(shader));
-        GE(dev, glGetShaderiv(shader, GL_COMPILE_STATUS, &compile_status));
-
-        if (!compile_status) {
-            GLint len = 0;
-            char *shader_log;
-
-            GE(dev, glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &len));
-            shader_log = c_alloca(len);
-            GE(dev, glGetShaderInfoLog(shader, len, &len, shader_log));
-            c_warning("Shader compilation failed:\n%s", shader_log);
-        }
+        shader_state->source_hash =
+            _cg_glsl_shader_set_source_with_boilerplate(dev,
+                                                        shader,
+                                                        GL_FRAGMENT_SHADER,
+                                                        2, /* count */
+                                                        source_strings,
+                                                        lengths);
 
         shader_state->header = NULL;
         shader_state->source = NULL;
         shader_state->gl_shader = shader;
+        shader_state->compiled = false;
     }
 
     return true;
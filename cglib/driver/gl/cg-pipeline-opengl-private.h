@@ -127,6 +127,12 @@ typedef struct _cg_texture_unit_t {
      * state even if the pipeline hasn't changed. */
     bool texture_storage_changed;
 
+    /* The value of dev->texture_unit_age when a layer was last
+     * assigned to this texture unit. When a layer needs a texture unit
+     * that doesn't already have its texture bound then the least
+     * recently used one is picked. */
+    unsigned int last_used;
+
 } cg_texture_unit_t;
 
 cg_texture_unit_t *_cg_get_texture_unit(cg_device_t *dev, int index_);
@@ -140,11 +146,12 @@ void _cg_bind_gl_texture_transient(GLenum gl_target,
 void _cg_delete_gl_texture(cg_device_t *dev,
                            GLuint gl_texture);
 
-void _cg_pipeline_flush_gl_state(cg_device_t *dev,
+bool _cg_pipeline_flush_gl_state(cg_device_t *dev,
                                  cg_pipeline_t *pipeline,
                                  cg_framebuffer_t *framebuffer,
                                  bool skip_gl_state,
-                                 bool unknown_color_alpha);
+                                 bool unknown_color_alpha,
+                                 bool allow_async);
 
 void _cg_gl_use_program(cg_device_t *dev, GLuint gl_program);
 
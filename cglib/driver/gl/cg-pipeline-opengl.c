@@ -82,6 +82,7 @@ texture_unit_init(cg_device_t *dev, cg_texture_unit_t *unit, int index_)
     unit->layer = NULL;
     unit->layer_changes_since_flush = 0;
     unit->texture_storage_changed = false;
+    unit->last_used = 0;
 }
 
 static void
@@ -121,6 +122,7 @@ _cg_destroy_texture_units(cg_device_t *dev)
         texture_unit_free(unit);
     }
     c_array_free(dev->texture_units, true);
+    c_array_free(dev->texture_unit_map, true);
 }
 
 static void
@@ -336,6 +338,61 @@ TEST(check_gl_blend_enable)
     test_cg_fini();
 }
 
+TEST(check_async_shader_compile)
+{
+    cg_pipeline_t *fallback, *pipeline;
+    cg_snippet_t *snippet;
+    int fb_width, fb_height;
+
+    test_cg_init();
+
+    fb_width = cg_framebuffer_get_width(test_fb);
+    fb_height = cg_framebuffer_get_height(test_fb);
+
+    cg_framebuffer_orthographic(test_fb, 0, 0, fb_width, fb_height, -1, 100);
+
+    fallback = cg_pipeline_new(test_dev);
+    cg_pipeline_set_color4f(fallback, 0, 0, 1, 1);
+
+    /* Make sure the program for the fallback pipeline is ready before
+     * enabling asynchronous compiling */
+    cg_framebuffer_draw_rectangle(test_fb, fallback, 0, 0, 1, 1);
+    _cg_framebuffer_flush(test_fb);
+
+    cg_device_set_async_shader_compile(test_dev, true);
+    cg_device_set_async_shader_fallback_pipeline(test_dev, fallback);
+
+    pipeline = cg_pipeline_new(test_dev);
+    snippet = cg_snippet_new(CG_SNIPPET_HOOK_FRAGMENT,
+                             NULL,
+                             "cg_color_out = vec4(0.0, 1.0, 0.0, 1.0);");
+    cg_pipeline_add_snippet(pipeline, snippet);
+    cg_object_unref(snippet);
+
+    /* The link has only just been submitted for the first draw so it
+     * should always use the fallback pipeline. If the driver can't
+     * link in the background then the program is linked straight
+     * away instead */
+    cg_framebuffer_draw_rectangle(test_fb, pipeline, 1, 0, 2, 1);
+    if (_cg_device_use_async_shader_compile(test_dev))
+        test_cg_check_pixel_rgb(test_fb, 1, 0, 0, 0, 0xff);
+    else
+        test_cg_check_pixel_rgb(test_fb, 1, 0, 0, 0xff, 0);
+
+    /* Once asynchronous compiling is disabled again the draw should
+     * wait for the program */
+    cg_device_set_async_shader_compile(test_dev, false);
+    cg_device_set_async_shader_fallback_pipeline(test_dev, NULL);
+
+    cg_framebuffer_draw_rectangle(test_fb, pipeline, 2, 0, 3, 1);
+    test_cg_check_pixel_rgb(test_fb, 2, 0, 0, 0xff, 0);
+
+    cg_object_unref(pipeline);
+    cg_object_unref(fallback);
+
+    test_cg_fini();
+}
+
 static int
 get_max_activateable_texture_units(cg_device_t *dev)
 {
@@ -390,27 +447,47 @@ get_max_activateable_texture_units(cg_device_t *dev)
     return dev->max_activateable_texture_units;
 }
 
-typedef struct {
-    cg_device_t *dev;
-    int i;
-    unsigned long *layer_differences;
-} cg_pipeline_flush_layer_state_t;
+static cg_texture_t *
+get_layer_texture(cg_device_t *dev, cg_pipeline_layer_t *layer)
+{
+    cg_texture_t *texture = _cg_pipeline_layer_get_texture_real(layer);
 
-static bool
-flush_layers_common_gl_state_cb(cg_pipeline_layer_t *layer,
-                                void *user_data)
+    if (texture == NULL)
+        switch (_cg_pipeline_layer_get_texture_type(layer)) {
+        case CG_TEXTURE_TYPE_2D:
+            texture = CG_TEXTURE(dev->default_gl_texture_2d_tex);
+            break;
+        case CG_TEXTURE_TYPE_3D:
+            texture = CG_TEXTURE(dev->default_gl_texture_3d_tex);
+            break;
+        }
+
+    return texture;
+}
+
+/* Layers can be assigned to any of the first TEXTURE_UNIT_POOL_SIZE
+ * texture units so that a texture used by several pipelines in
+ * different layers can stay bound while drawing with each of them */
+#define TEXTURE_UNIT_POOL_SIZE 16
+
+/* Picks a texture unit for each layer of a pipeline given the
+ * textures of the layers in order and stores the result in
+ * dev->texture_unit_map. A layer is given a texture unit that already
+ * has its texture bound if there is one, otherwise it gets the texture
+ * unit that has gone the longest without being used. Returns the
+ * number of layers that could be given a texture unit. */
+static int
+assign_texture_units(cg_device_t *dev, cg_texture_t **textures, int n_layers)
 {
-    cg_pipeline_flush_layer_state_t *flush_state = user_data;
-    cg_device_t *dev = flush_state->dev;
-    int unit_index = flush_state->i;
-    cg_texture_unit_t *unit = _cg_get_texture_unit(dev, unit_index);
-    unsigned long layers_difference =
-        flush_state->layer_differences[unit_index];
+    int max_units = get_max_activateable_texture_units(dev);
+    int pool_size;
+    bool *claimed;
+    int *map;
+    int i, j;
 
-    /* There may not be enough texture units so we can bail out if
-     * that's the case...
-     */
-    if (C_UNLIKELY(unit_index >= get_max_activateable_texture_units(dev))) {
+    dev->texture_unit_age++;
+
+    if (C_UNLIKELY(n_layers > max_units)) {
         static bool shown_warning = false;
 
         if (!shown_warning) {
@@ -418,92 +495,321 @@ flush_layers_common_gl_state_cb(cg_pipeline_layer_t *layer,
                       "to handle this many texture layers");
             shown_warning = true;
         }
-        return false;
+        n_layers = max_units;
+    }
+
+    dev->texture_unit_map = c_array_set_size(dev->texture_unit_map, n_layers);
+    map = (int *)dev->texture_unit_map->data;
+
+    if (n_layers == 0)
+        return 0;
+
+    if (C_UNLIKELY(CG_DEBUG_ENABLED(CG_DEBUG_DISABLE_TEXTURE_UNIT_REMAP))) {
+        for (i = 0; i < n_layers; i++) {
+            map[i] = i;
+            _cg_get_texture_unit(dev, i)->last_used = dev->texture_unit_age;
+        }
+        return n_layers;
     }
 
-    if (layers_difference & CG_PIPELINE_LAYER_STATE_TEXTURE_DATA) {
-        cg_texture_t *texture = _cg_pipeline_layer_get_texture_real(layer);
+    pool_size = MIN(max_units, MAX(n_layers, TEXTURE_UNIT_POOL_SIZE));
+
+    /* Make sure all of the texture units in the pool exist */
+    _cg_get_texture_unit(dev, pool_size - 1);
+
+    claimed = c_alloca(sizeof(bool) * pool_size);
+    memset(claimed, 0, sizeof(bool) * pool_size);
+
+    /* First find the layers whose texture is already bound. NB: we
+     * can't trust the binding of a foreign texture because its name
+     * may have been recycled since (see flush_texture_unit_texture) */
+    for (i = 0; i < n_layers; i++) {
         GLuint gl_texture;
-        GLenum gl_target;
-
-        if (texture == NULL)
-            switch (_cg_pipeline_layer_get_texture_type(layer)) {
-            case CG_TEXTURE_TYPE_2D:
-                texture = CG_TEXTURE(dev->default_gl_texture_2d_tex);
-                break;
-            case CG_TEXTURE_TYPE_3D:
-                texture = CG_TEXTURE(dev->default_gl_texture_3d_tex);
-                break;
-            }
 
-        cg_texture_get_gl_texture(texture, &gl_texture, &gl_target);
+        cg_texture_get_gl_texture(textures[i], &gl_texture, NULL);
 
-        set_active_texture_unit(dev, unit_index);
+        map[i] = -1;
 
-        /* NB: There are several CGlib components and some code in
-         * Clutter that will temporarily bind arbitrary GL textures to
-         * query and modify texture object parameters. If you look at
-         * _cg_bind_gl_texture_transient() you can see we make sure
-         * that such code always binds to texture unit 1 which means we
-         * can't rely on the unit->gl_texture state if unit->index == 1.
-         *
-         * Because texture unit 1 is a bit special we actually defer any
-         * necessary glBindTexture for it until the end of
-         * _cg_pipeline_flush_gl_state().
-         *
-         * NB: we get notified whenever glDeleteTextures is used (see
-         * _cg_delete_gl_texture()) where we invalidate
-         * unit->gl_texture references to deleted textures so it's safe
-         * to compare unit->gl_texture with gl_texture.  (Without the
-         * hook it would be possible to delete a GL texture and create a
-         * new one with the same name and comparing unit->gl_texture and
-         * gl_texture wouldn't detect that.)
-         *
-         * NB: for foreign textures we don't know how the deletion of
-         * the GL texture objects correspond to the deletion of the
-         * cg_texture_ts so if there was previously a foreign texture
-         * associated with the texture unit then we can't assume that we
-         * aren't seeing a recycled texture name so we have to bind.
-         */
-        if (unit->gl_texture != gl_texture || unit->is_foreign) {
-            if (unit_index == 1)
-                unit->dirty_gl_texture = true;
-            else
-                GE(dev, glBindTexture(gl_target, gl_texture));
-            unit->gl_texture = gl_texture;
-            unit->gl_target = gl_target;
+        for (j = 0; j < pool_size; j++) {
+            cg_texture_unit_t *unit =
+                &c_array_index(dev->texture_units, cg_texture_unit_t, j);
+
+            if (claimed[j] || unit->gl_texture != gl_texture ||
+                unit->is_foreign)
+                continue;
+
+            /* Count the bind that would have been needed if the layer
+             * had been flushed to the texture unit matching its
+             * position */
+            if (j != i &&
+                c_array_index(dev->texture_units, cg_texture_unit_t, i)
+                .gl_texture != gl_texture)
+                dev->texture_unit_stats.binds_saved++;
+
+            map[i] = j;
+            claimed[j] = true;
+            break;
         }
+    }
+
+    /* The rest of the layers get the least recently used texture
+     * units */
+    for (i = 0; i < n_layers; i++) {
+        cg_texture_unit_t *lru = NULL;
+
+        if (map[i] != -1)
+            continue;
+
+        for (j = 0; j < pool_size; j++) {
+            cg_texture_unit_t *unit =
+                &c_array_index(dev->texture_units, cg_texture_unit_t, j);
 
-        unit->is_foreign = _cg_texture_is_foreign(texture);
+            if (claimed[j])
+                continue;
 
-        /* The texture_storage_changed boolean indicates if the
-         * cg_texture_t's underlying GL texture storage has changed since
-         * it was flushed to the texture unit. We've just flushed the
-         * latest state so we can reset this. */
-        unit->texture_storage_changed = false;
+            if (lru == NULL || unit->last_used < lru->last_used)
+                lru = unit;
+        }
+
+        map[i] = lru->index;
+        claimed[lru->index] = true;
     }
 
-    if ((layers_difference & CG_PIPELINE_LAYER_STATE_SAMPLER) &&
-        _cg_has_private_feature(dev, CG_PRIVATE_FEATURE_SAMPLER_OBJECTS)) {
-        const cg_sampler_cache_entry_t *sampler_state;
+    for (i = 0; i < n_layers; i++)
+        c_array_index(dev->texture_units, cg_texture_unit_t, map[i])
+        .last_used = dev->texture_unit_age;
 
-        sampler_state = _cg_pipeline_layer_get_sampler_state(layer);
+    return n_layers;
+}
 
-        GE(dev, glBindSampler(unit_index, sampler_state->sampler_object));
+static void
+flush_texture_unit_texture(cg_device_t *dev,
+                           cg_texture_unit_t *unit,
+                           cg_texture_t *texture)
+{
+    GLuint gl_texture;
+    GLenum gl_target;
+
+    cg_texture_get_gl_texture(texture, &gl_texture, &gl_target);
+
+    set_active_texture_unit(dev, unit->index);
+
+    /* NB: There are several CGlib components and some code in
+     * Clutter that will temporarily bind arbitrary GL textures to
+     * query and modify texture object parameters. If you look at
+     * _cg_bind_gl_texture_transient() you can see we make sure
+     * that such code always binds to texture unit 1 which means we
+     * can't rely on the unit->gl_texture state if unit->index == 1.
+     *
+     * Because texture unit 1 is a bit special we actually defer any
+     * necessary glBindTexture for it until the end of
+     * _cg_pipeline_flush_gl_state().
+     *
+     * NB: we get notified whenever glDeleteTextures is used (see
+     * _cg_delete_gl_texture()) where we invalidate
+     * unit->gl_texture references to deleted textures so it's safe
+     * to compare unit->gl_texture with gl_texture.  (Without the
+     * hook it would be possible to delete a GL texture and create a
+     * new one with the same name and comparing unit->gl_texture and
+     * gl_texture wouldn't detect that.)
+     *
+     * NB: for foreign textures we don't know how the deletion of
+     * the GL texture objects correspond to the deletion of the
+     * cg_texture_ts so if there was previously a foreign texture
+     * associated with the texture unit then we can't assume that we
+     * aren't seeing a recycled texture name so we have to bind.
+     */
+    if (unit->gl_texture != gl_texture || unit->is_foreign) {
+        dev->texture_unit_stats.binds++;
+        if (unit->index == 1)
+            unit->dirty_gl_texture = true;
+        else
+            GE(dev, glBindTexture(gl_target, gl_texture));
+        unit->gl_texture = gl_texture;
+        unit->gl_target = gl_target;
     }
 
+    unit->is_foreign = _cg_texture_is_foreign(texture);
+
+    /* The texture_storage_changed boolean indicates if the
+     * cg_texture_t's underlying GL texture storage has changed since
+     * it was flushed to the texture unit. We've just flushed the
+     * latest state so we can reset this. */
+    unit->texture_storage_changed = false;
+}
+
+static void
+set_texture_unit_layer(cg_texture_unit_t *unit, cg_pipeline_layer_t *layer)
+{
     cg_object_ref(layer);
     if (unit->layer != NULL)
         cg_object_unref(unit->layer);
 
     unit->layer = layer;
     unit->layer_changes_since_flush = 0;
+}
+
+typedef struct {
+    cg_device_t *dev;
+    int i;
+    unsigned long *layer_differences;
+} cg_pipeline_flush_layer_state_t;
+
+static bool
+flush_layers_common_gl_state_cb(cg_pipeline_layer_t *layer,
+                                void *user_data)
+{
+    cg_pipeline_flush_layer_state_t *flush_state = user_data;
+    cg_device_t *dev = flush_state->dev;
+    unsigned long layers_difference;
+    cg_texture_unit_t *unit;
+    int unit_index;
+
+    /* There may not be enough texture units so we can bail out if
+     * that's the case...
+     */
+    if (C_UNLIKELY(flush_state->i >= dev->texture_unit_map->len))
+        return false;
+
+    unit_index = c_array_index(dev->texture_unit_map, int, flush_state->i);
+    unit = _cg_get_texture_unit(dev, unit_index);
+    layers_difference = flush_state->layer_differences[flush_state->i];
+
+    if (layers_difference & CG_PIPELINE_LAYER_STATE_TEXTURE_DATA)
+        flush_texture_unit_texture(dev, unit, get_layer_texture(dev, layer));
+
+    if ((layers_difference & CG_PIPELINE_LAYER_STATE_SAMPLER) &&
+        _cg_has_private_feature(dev, CG_PRIVATE_FEATURE_SAMPLER_OBJECTS)) {
+        const cg_sampler_cache_entry_t *sampler_state;
+
+        sampler_state = _cg_pipeline_layer_get_sampler_state(layer);
+
+        GE(dev, glBindSampler(unit_index, sampler_state->sampler_object));
+    }
+
+    set_texture_unit_layer(unit, layer);
 
     flush_state->i++;
 
     return true;
 }
 
+static void
+flush_blend_state(cg_device_t *dev, cg_pipeline_blend_state_t *blend_state)
+{
+    if (blend_factor_uses_constant(blend_state->blend_src_factor_rgb) ||
+        blend_factor_uses_constant(blend_state->blend_src_factor_alpha) ||
+        blend_factor_uses_constant(blend_state->blend_dst_factor_rgb) ||
+        blend_factor_uses_constant(blend_state->blend_dst_factor_alpha)) {
+        float red = blend_state->blend_constant.red;
+        float green = blend_state->blend_constant.green;
+        float blue = blend_state->blend_constant.blue;
+        float alpha = blend_state->blend_constant.alpha;
+
+        GE(dev, glBlendColor(red, green, blue, alpha));
+    }
+
+    if (dev->glBlendEquationSeparate &&
+        blend_state->blend_equation_rgb != blend_state->blend_equation_alpha)
+        GE(dev,
+           glBlendEquationSeparate(blend_state->blend_equation_rgb,
+                                   blend_state->blend_equation_alpha));
+    else
+        GE(dev, glBlendEquation(blend_state->blend_equation_rgb));
+
+    if (dev->glBlendFuncSeparate &&
+        (blend_state->blend_src_factor_rgb !=
+         blend_state->blend_src_factor_alpha ||
+         (blend_state->blend_dst_factor_rgb !=
+          blend_state->blend_dst_factor_alpha)))
+        GE(dev,
+           glBlendFuncSeparate(blend_state->blend_src_factor_rgb,
+                               blend_state->blend_dst_factor_rgb,
+                               blend_state->blend_src_factor_alpha,
+                               blend_state->blend_dst_factor_alpha));
+    else
+        GE(dev,
+           glBlendFunc(blend_state->blend_src_factor_rgb,
+                       blend_state->blend_dst_factor_rgb));
+}
+
+static void
+flush_color_mask_state(cg_device_t *dev,
+                       cg_pipeline_logic_ops_state_t *logic_ops_state)
+{
+    cg_color_mask_t color_mask = logic_ops_state->color_mask;
+
+    if (dev->current_draw_buffer)
+        color_mask &= dev->current_draw_buffer->color_mask;
+
+    GE(dev,
+       glColorMask(!!(color_mask & CG_COLOR_MASK_RED),
+                   !!(color_mask & CG_COLOR_MASK_GREEN),
+                   !!(color_mask & CG_COLOR_MASK_BLUE),
+                   !!(color_mask & CG_COLOR_MASK_ALPHA)));
+    dev->current_gl_color_mask = color_mask;
+}
+
+static void
+flush_cull_face_state(cg_device_t *dev,
+                      cg_pipeline_cull_face_state_t *cull_face_state)
+{
+    bool invert_winding;
+
+    if (cull_face_state->mode == CG_PIPELINE_CULL_FACE_MODE_NONE) {
+        GE(dev, glDisable(GL_CULL_FACE));
+        return;
+    }
+
+    GE(dev, glEnable(GL_CULL_FACE));
+
+    switch (cull_face_state->mode) {
+    case CG_PIPELINE_CULL_FACE_MODE_NONE:
+        c_assert_not_reached();
+
+    case CG_PIPELINE_CULL_FACE_MODE_FRONT:
+        GE(dev, glCullFace(GL_FRONT));
+        break;
+
+    case CG_PIPELINE_CULL_FACE_MODE_BACK:
+        GE(dev, glCullFace(GL_BACK));
+        break;
+
+    case CG_PIPELINE_CULL_FACE_MODE_BOTH:
+        GE(dev, glCullFace(GL_FRONT_AND_BACK));
+        break;
+    }
+
+    /* If we are painting to an offscreen framebuffer then we
+       need to invert the winding of the front face because
+       everything is painted upside down */
+    invert_winding = cg_is_offscreen(dev->current_draw_buffer);
+
+    switch (cull_face_state->front_winding) {
+    case CG_WINDING_CLOCKWISE:
+        GE(dev, glFrontFace(invert_winding ? GL_CCW : GL_CW));
+        break;
+
+    case CG_WINDING_COUNTER_CLOCKWISE:
+        GE(dev, glFrontFace(invert_winding ? GL_CW : GL_CCW));
+        break;
+    }
+}
+
+static void
+flush_real_blend_enable(cg_device_t *dev, cg_pipeline_t *pipeline)
+{
+    if (pipeline->real_blend_enable != dev->gl_blend_enable_cache) {
+        if (pipeline->real_blend_enable)
+            GE(dev, glEnable(GL_BLEND));
+        else
+            GE(dev, glDisable(GL_BLEND));
+        /* XXX: we shouldn't update any other blend state if blending
+         * is disabled! */
+        dev->gl_blend_enable_cache = pipeline->real_blend_enable;
+    }
+}
+
 static void
 _cg_pipeline_flush_common_gl_state(cg_device_t *dev,
                                    cg_pipeline_t *pipeline,
@@ -516,44 +822,8 @@ _cg_pipeline_flush_common_gl_state(cg_device_t *dev,
     if (pipelines_difference & CG_PIPELINE_STATE_BLEND) {
         cg_pipeline_t *authority =
             _cg_pipeline_get_authority(pipeline, CG_PIPELINE_STATE_BLEND);
-        cg_pipeline_blend_state_t *blend_state =
-            &authority->big_state->blend_state;
-
-        if (blend_factor_uses_constant(blend_state->blend_src_factor_rgb) ||
-            blend_factor_uses_constant(blend_state->blend_src_factor_alpha) ||
-            blend_factor_uses_constant(blend_state->blend_dst_factor_rgb) ||
-            blend_factor_uses_constant(blend_state->blend_dst_factor_alpha)) {
-            float red = blend_state->blend_constant.red;
-            float green = blend_state->blend_constant.green;
-            float blue = blend_state->blend_constant.blue;
-            float alpha = blend_state->blend_constant.alpha;
-
-            GE(dev, glBlendColor(red, green, blue, alpha));
-        }
-
-        if (dev->glBlendEquationSeparate &&
-            blend_state->blend_equation_rgb !=
-            blend_state->blend_equation_alpha)
-            GE(dev,
-               glBlendEquationSeparate(blend_state->blend_equation_rgb,
-                                       blend_state->blend_equation_alpha));
-        else
-            GE(dev, glBlendEquation(blend_state->blend_equation_rgb));
 
-        if (dev->glBlendFuncSeparate &&
-            (blend_state->blend_src_factor_rgb !=
-             blend_state->blend_src_factor_alpha ||
-             (blend_state->blend_dst_factor_rgb !=
-              blend_state->blend_dst_factor_alpha)))
-            GE(dev,
-               glBlendFuncSeparate(blend_state->blend_src_factor_rgb,
-                                   blend_state->blend_dst_factor_rgb,
-                                   blend_state->blend_src_factor_alpha,
-                                   blend_state->blend_dst_factor_alpha));
-        else
-            GE(dev,
-               glBlendFunc(blend_state->blend_src_factor_rgb,
-                           blend_state->blend_dst_factor_rgb));
+        flush_blend_state(dev, &authority->big_state->blend_state);
     }
 
     if (pipelines_difference & CG_PIPELINE_STATE_DEPTH) {
@@ -567,66 +837,15 @@ _cg_pipeline_flush_common_gl_state(cg_device_t *dev,
     if (pipelines_difference & CG_PIPELINE_STATE_LOGIC_OPS) {
         cg_pipeline_t *authority =
             _cg_pipeline_get_authority(pipeline, CG_PIPELINE_STATE_LOGIC_OPS);
-        cg_pipeline_logic_ops_state_t *logic_ops_state =
-            &authority->big_state->logic_ops_state;
-        cg_color_mask_t color_mask = logic_ops_state->color_mask;
 
-        if (dev->current_draw_buffer)
-            color_mask &= dev->current_draw_buffer->color_mask;
-
-        GE(dev,
-           glColorMask(!!(color_mask & CG_COLOR_MASK_RED),
-                       !!(color_mask & CG_COLOR_MASK_GREEN),
-                       !!(color_mask & CG_COLOR_MASK_BLUE),
-                       !!(color_mask & CG_COLOR_MASK_ALPHA)));
-        dev->current_gl_color_mask = color_mask;
+        flush_color_mask_state(dev, &authority->big_state->logic_ops_state);
     }
 
     if (pipelines_difference & CG_PIPELINE_STATE_CULL_FACE) {
         cg_pipeline_t *authority =
             _cg_pipeline_get_authority(pipeline, CG_PIPELINE_STATE_CULL_FACE);
-        cg_pipeline_cull_face_state_t *cull_face_state =
-            &authority->big_state->cull_face_state;
 
-        if (cull_face_state->mode == CG_PIPELINE_CULL_FACE_MODE_NONE)
-            GE(dev, glDisable(GL_CULL_FACE));
-        else {
-            bool invert_winding;
-
-            GE(dev, glEnable(GL_CULL_FACE));
-
-            switch (cull_face_state->mode) {
-            case CG_PIPELINE_CULL_FACE_MODE_NONE:
-                c_assert_not_reached();
-
-            case CG_PIPELINE_CULL_FACE_MODE_FRONT:
-                GE(dev, glCullFace(GL_FRONT));
-                break;
-
-            case CG_PIPELINE_CULL_FACE_MODE_BACK:
-                GE(dev, glCullFace(GL_BACK));
-                break;
-
-            case CG_PIPELINE_CULL_FACE_MODE_BOTH:
-                GE(dev, glCullFace(GL_FRONT_AND_BACK));
-                break;
-            }
-
-            /* If we are painting to an offscreen framebuffer then we
-               need to invert the winding of the front face because
-               everything is painted upside down */
-            invert_winding = cg_is_offscreen(dev->current_draw_buffer);
-
-            switch (cull_face_state->front_winding) {
-            case CG_WINDING_CLOCKWISE:
-                GE(dev, glFrontFace(invert_winding ? GL_CCW : GL_CW));
-                break;
-
-            case CG_WINDING_COUNTER_CLOCKWISE:
-                GE(dev, glFrontFace(invert_winding ? GL_CW : GL_CCW));
-                break;
-            }
-        }
+        flush_cull_face_state(dev, &authority->big_state->cull_face_state);
     }
 
 #ifdef CG_HAS_GL_SUPPORT
@@ -643,15 +862,7 @@ _cg_pipeline_flush_common_gl_state(cg_device_t *dev,
     }
 #endif
 
-    if (pipeline->real_blend_enable != dev->gl_blend_enable_cache) {
-        if (pipeline->real_blend_enable)
-            GE(dev, glEnable(GL_BLEND));
-        else
-            GE(dev, glDisable(GL_BLEND));
-        /* XXX: we shouldn't update any other blend state if blending
-         * is disabled! */
-        dev->gl_blend_enable_cache = pipeline->real_blend_enable;
-    }
+    flush_real_blend_enable(dev, pipeline);
 
     state.dev = dev;
     state.i = 0;
@@ -660,6 +871,205 @@ _cg_pipeline_flush_common_gl_state(cg_device_t *dev,
         pipeline, flush_layers_common_gl_state_cb, &state);
 }
 
+/* The GL state of one texture unit in a flush record */
+typedef struct {
+    cg_pipeline_layer_t *layer;
+    /* The layer's texture or the default texture if it doesn't have
+     * one */
+    cg_texture_t *texture;
+    GLuint sampler_object;
+} cg_flush_record_unit_t;
+
+/* Once a pipeline has been frozen with cg_pipeline_freeze() we
+ * record the state that it resolves to the first time it is flushed
+ * so that re-flushing it can skip looking up the authorities of each
+ * state group and iterating the layers. The record is invalidated by
+ * comparing against the pipeline's ->age. None of the state here
+ * depends on the current framebuffer so anything derived from the
+ * framebuffer is still combined in when the record is flushed. */
+typedef struct {
+    unsigned int age;
+
+    cg_pipeline_blend_state_t blend_state;
+    cg_depth_state_t depth_state;
+    cg_pipeline_logic_ops_state_t logic_ops_state;
+    cg_pipeline_cull_face_state_t cull_face_state;
+    float point_size;
+    bool per_vertex_point_size;
+    cg_color_t color;
+
+    int n_units;
+    cg_flush_record_unit_t *units;
+} cg_pipeline_flush_record_t;
+
+static cg_user_data_key_t flush_record_key;
+
+static void
+destroy_flush_record(void *user_data, void *instance)
+{
+    cg_pipeline_flush_record_t *record = user_data;
+    int i;
+
+    for (i = 0; i < record->n_units; i++)
+        cg_object_unref(record->units[i].layer);
+
+    c_free(record->units);
+    c_slice_free(cg_pipeline_flush_record_t, record);
+}
+
+typedef struct {
+    cg_device_t *dev;
+    cg_pipeline_flush_record_t *record;
+} cg_pipeline_record_layer_state_t;
+
+static bool
+record_layer_cb(cg_pipeline_layer_t *layer, void *user_data)
+{
+    cg_pipeline_record_layer_state_t *state = user_data;
+    cg_device_t *dev = state->dev;
+    cg_pipeline_flush_record_t *record = state->record;
+    cg_flush_record_unit_t *unit;
+
+    if (record->n_units >= get_max_activateable_texture_units(dev))
+        return false;
+
+    unit = &record->units[record->n_units++];
+
+    unit->layer = cg_object_ref(layer);
+    unit->texture = get_layer_texture(dev, layer);
+
+    if (_cg_has_private_feature(dev, CG_PRIVATE_FEATURE_SAMPLER_OBJECTS))
+        unit->sampler_object =
+            _cg_pipeline_layer_get_sampler_state(layer)->sampler_object;
+    else
+        unit->sampler_object = 0;
+
+    return true;
+}
+
+static void
+record_flush_state(cg_device_t *dev, cg_pipeline_t *pipeline)
+{
+    cg_pipeline_flush_record_t *record;
+    cg_pipeline_record_layer_state_t state;
+    cg_pipeline_t *authority;
+
+    record = c_slice_new(cg_pipeline_flush_record_t);
+    record->age = pipeline->age;
+
+    authority = _cg_pipeline_get_authority(pipeline, CG_PIPELINE_STATE_BLEND);
+    record->blend_state = authority->big_state->blend_state;
+
+    authority = _cg_pipeline_get_authority(pipeline, CG_PIPELINE_STATE_DEPTH);
+    record->depth_state = authority->big_state->depth_state;
+
+    authority =
+        _cg_pipeline_get_authority(pipeline, CG_PIPELINE_STATE_LOGIC_OPS);
+    record->logic_ops_state = authority->big_state->logic_ops_state;
+
+    authority =
+        _cg_pipeline_get_authority(pipeline, CG_PIPELINE_STATE_CULL_FACE);
+    record->cull_face_state = authority->big_state->cull_face_state;
+
+    /* The point size is normally flushed by the vertend which is
+     * skipped when replaying the record */
+    authority =
+        _cg_pipeline_get_authority(pipeline, CG_PIPELINE_STATE_POINT_SIZE);
+    record->point_size = authority->big_state->point_size;
+
+    authority = _cg_pipeline_get_authority(
+        pipeline, CG_PIPELINE_STATE_PER_VERTEX_POINT_SIZE);
+    record->per_vertex_point_size =
+        authority->big_state->per_vertex_point_size;
+
+    authority = _cg_pipeline_get_authority(pipeline, CG_PIPELINE_STATE_COLOR);
+    record->color = authority->color;
+
+    record->n_units = 0;
+    record->units =
+        c_new(cg_flush_record_unit_t, cg_pipeline_get_n_layers(pipeline));
+
+    state.dev = dev;
+    state.record = record;
+    _cg_pipeline_foreach_layer_internal(pipeline, record_layer_cb, &state);
+
+    _cg_object_set_user_data(CG_OBJECT(pipeline),
+                             &flush_record_key,
+                             record,
+                             destroy_flush_record);
+}
+
+static cg_pipeline_flush_record_t *
+get_flush_record(cg_pipeline_t *pipeline)
+{
+    cg_pipeline_flush_record_t *record =
+        cg_object_get_user_data(CG_OBJECT(pipeline), &flush_record_key);
+
+    if (record && record->age == pipeline->age)
+        return record;
+
+    return NULL;
+}
+
+/* This is the equivalent of _cg_pipeline_flush_common_gl_state() for
+ * a frozen pipeline. The texture units are still compared with the
+ * layers they were last flushed with so that textures only get
+ * rebound if something else was drawn in between. */
+static void
+flush_record_common_gl_state(cg_device_t *dev,
+                             cg_pipeline_t *pipeline,
+                             cg_pipeline_flush_record_t *record)
+{
+    cg_texture_t **textures;
+    int i;
+
+    flush_blend_state(dev, &record->blend_state);
+    flush_depth_state(dev, &record->depth_state);
+    flush_color_mask_state(dev, &record->logic_ops_state);
+    flush_cull_face_state(dev, &record->cull_face_state);
+
+#ifdef CG_HAS_GL_SUPPORT
+    if (_cg_has_private_feature(
+            dev, CG_PRIVATE_FEATURE_BUILTIN_POINT_SIZE_UNIFORM) &&
+        record->point_size > 0.0f)
+        GE(dev, glPointSize(record->point_size));
+
+    if (_cg_has_private_feature(dev,
+                                CG_PRIVATE_FEATURE_ENABLE_PROGRAM_POINT_SIZE)) {
+        if (record->per_vertex_point_size)
+            GE(dev, glEnable(GL_PROGRAM_POINT_SIZE));
+        else
+            GE(dev, glDisable(GL_PROGRAM_POINT_SIZE));
+    }
+#endif
+
+    flush_real_blend_enable(dev, pipeline);
+
+    textures = c_alloca(sizeof(cg_texture_t *) * (record->n_units + 1));
+    for (i = 0; i < record->n_units; i++)
+        textures[i] = record->units[i].texture;
+
+    assign_texture_units(dev, textures, record->n_units);
+
+    for (i = 0; i < record->n_units; i++) {
+        cg_flush_record_unit_t *record_unit = &record->units[i];
+        int unit_index = c_array_index(dev->texture_unit_map, int, i);
+        cg_texture_unit_t *unit = _cg_get_texture_unit(dev, unit_index);
+
+        if (unit->layer == record_unit->layer &&
+            !unit->texture_storage_changed &&
+            unit->layer_changes_since_flush == 0)
+            continue;
+
+        flush_texture_unit_texture(dev, unit, record_unit->texture);
+
+        if (_cg_has_private_feature(dev, CG_PRIVATE_FEATURE_SAMPLER_OBJECTS))
+            GE(dev, glBindSampler(unit_index, record_unit->sampler_object));
+
+        set_texture_unit_layer(unit, record_unit->layer);
+    }
+}
+
 /* Re-assert the layer's wrap modes on the given cg_texture_t.
  *
  * Note: we don't simply forward the wrap modes to layer->texture
@@ -732,6 +1142,22 @@ foreach_texture_unit_update_filter_and_wrap_modes(cg_device_t *dev)
     }
 }
 
+typedef struct {
+    cg_device_t *dev;
+    int n_textures;
+    cg_texture_t **textures;
+} cg_pipeline_get_textures_state_t;
+
+static bool
+get_layer_textures_cb(cg_pipeline_layer_t *layer, void *user_data)
+{
+    cg_pipeline_get_textures_state_t *state = user_data;
+
+    state->textures[state->n_textures++] = get_layer_texture(state->dev, layer);
+
+    return true;
+}
+
 typedef struct {
     cg_device_t *dev;
     int i;
@@ -743,7 +1169,16 @@ compare_layer_differences_cb(cg_pipeline_layer_t *layer,
                              void *user_data)
 {
     cg_pipeline_compare_layers_state_t *state = user_data;
-    cg_texture_unit_t *unit = _cg_get_texture_unit(state->dev, state->i);
+    cg_device_t *dev = state->dev;
+    cg_texture_unit_t *unit;
+
+    if (state->i >= dev->texture_unit_map->len)
+        return false;
+
+    unit = _cg_get_texture_unit(dev,
+                                c_array_index(dev->texture_unit_map,
+                                              int,
+                                              state->i));
 
     if (unit->layer == layer)
         state->layer_differences[state->i] = unit->layer_changes_since_flush;
@@ -876,13 +1311,23 @@ fragend_add_layer_cb(cg_pipeline_layer_t *layer, void *user_data)
  *    Currently for textured rectangles we manually calculate the texture
  *    coords for each slice based on the users given coords, but this solution
  *    isn't ideal, and can't be used with CGlibVertexBuffers.
+ *
+ * If @allow_async is true and the device has asynchronous shader
+ * compilation enabled then this returns false if the program for the
+ * pipeline is still being built. In that case nothing should be drawn
+ * with the pipeline. Otherwise this always returns true.
+ *
+ * If the pipeline has been frozen then the state it resolves to is
+ * recorded the first time it is flushed and later flushes replay that
+ * record instead of going through the vertend, fragend and progend.
  */
-void
+bool
 _cg_pipeline_flush_gl_state(cg_device_t *dev,
                             cg_pipeline_t *pipeline,
                             cg_framebuffer_t *framebuffer,
                             bool with_color_attrib,
-                            bool unknown_color_alpha)
+                            bool unknown_color_alpha,
+                            bool allow_async)
 {
     cg_pipeline_t *current_pipeline = dev->current_pipeline;
     unsigned long pipelines_difference;
@@ -891,6 +1336,7 @@ _cg_pipeline_flush_gl_state(cg_device_t *dev,
     int i;
     cg_texture_unit_t *unit1;
     const cg_pipeline_progend_t *progend;
+    cg_pipeline_flush_record_t *record = NULL;
 
     CG_STATIC_TIMER(pipeline_flush_timer,
                     "Mainloop", /* parent */
@@ -903,6 +1349,24 @@ _cg_pipeline_flush_gl_state(cg_device_t *dev,
 #warning "HACK"
     current_pipeline = NULL;
 
+    /* A frozen pipeline that has already been flushed once has a
+     * linked program so all that the progend has left to do is to
+     * bind it and update any uniforms */
+    if (pipeline->frozen && (record = get_flush_record(pipeline))) {
+        progend = _cg_pipeline_progends[pipeline->progend];
+
+        _cg_pipeline_update_real_blend_enable(pipeline, unknown_color_alpha);
+
+        flush_record_common_gl_state(dev, pipeline, record);
+
+        if (progend->end == NULL ||
+            progend->end(dev, pipeline, CG_PIPELINE_STATE_ALL, allow_async))
+            goto flushed;
+
+        /* Fall back to a full flush which will deal with the failure */
+        record = NULL;
+    }
+
     /* Bail out asap if we've been asked to re-flush the already current
      * pipeline and we can see the pipeline hasn't changed */
     if (current_pipeline == pipeline &&
@@ -949,10 +1413,21 @@ _cg_pipeline_flush_gl_state(cg_device_t *dev,
         }
     }
 
-    /* Get a layer_differences mask for each layer to be flushed */
+    /* Pick a texture unit for each layer and then get a
+     * layer_differences mask for each layer to be flushed */
     n_layers = cg_pipeline_get_n_layers(pipeline);
     if (n_layers) {
         cg_pipeline_compare_layers_state_t state;
+        cg_pipeline_get_textures_state_t textures_state;
+
+        textures_state.dev = dev;
+        textures_state.n_textures = 0;
+        textures_state.textures = c_alloca(sizeof(cg_texture_t *) * n_layers);
+        _cg_pipeline_foreach_layer_internal(pipeline,
+                                            get_layer_textures_cb,
+                                            &textures_state);
+
+        assign_texture_units(dev, textures_state.textures, n_layers);
 
         layer_differences = c_alloca(sizeof(unsigned long) * n_layers);
         memset(layer_differences, 0, sizeof(unsigned long) * n_layers);
@@ -964,8 +1439,10 @@ _cg_pipeline_flush_gl_state(cg_device_t *dev,
         _cg_pipeline_foreach_layer_internal(pipeline,
                                             compare_layer_differences_cb,
                                             &state);
-    } else
+    } else {
+        assign_texture_units(dev, NULL, 0);
         layer_differences = NULL;
+    }
 
     /* First flush everything that's the same regardless of which
      * pipeline backend is being used...
@@ -1057,8 +1534,18 @@ _cg_pipeline_flush_gl_state(cg_device_t *dev,
         if (C_UNLIKELY(!fragend->end(dev, pipeline, pipelines_difference)))
             continue;
 
-        if (progend->end)
-            progend->end(dev, pipeline, pipelines_difference);
+        if (progend->end &&
+            !progend->end(dev, pipeline, pipelines_difference, allow_async)) {
+            /* Some of the state for the pipeline has already been
+             * flushed so make sure the next flush doesn't compare
+             * against the previous pipeline */
+            if (dev->current_pipeline != NULL) {
+                cg_object_unref(dev->current_pipeline);
+                dev->current_pipeline = NULL;
+            }
+            CG_TIMER_STOP(_cg_uprof_context, pipeline_flush_timer);
+            return false;
+        }
         break;
     }
 
@@ -1066,6 +1553,11 @@ _cg_pipeline_flush_gl_state(cg_device_t *dev,
      * never fall through without finding a suitable progend */
     c_assert(i != CG_PIPELINE_N_PROGENDS);
 
+    if (pipeline->frozen)
+        record_flush_state(dev, pipeline);
+
+flushed:
+
     /* FIXME: This reference is actually resulting in lots of
      * copy-on-write reparenting because one-shot pipelines end up
      * living for longer than necessary and so any later modification of
@@ -1093,20 +1585,27 @@ done:
      * overridden by any attribute changes in another program */
     if (pipeline->progend == CG_PIPELINE_PROGEND_GLSL && !with_color_attrib) {
         int attribute;
-        cg_pipeline_t *authority =
-            _cg_pipeline_get_authority(pipeline, CG_PIPELINE_STATE_COLOR);
+        const cg_color_t *color;
         int name_index = CG_ATTRIBUTE_COLOR_NAME_INDEX;
 
+        if (record)
+            color = &record->color;
+        else {
+            cg_pipeline_t *authority =
+                _cg_pipeline_get_authority(pipeline, CG_PIPELINE_STATE_COLOR);
+            color = &authority->color;
+        }
+
         attribute =
             _cg_pipeline_progend_glsl_get_attrib_location(dev, pipeline,
                                                           name_index);
         if (attribute != -1)
             GE(dev,
                glVertexAttrib4f(attribute,
-                                authority->color.red,
-                                authority->color.green,
-                                authority->color.blue,
-                                authority->color.alpha));
+                                color->red,
+                                color->green,
+                                color->blue,
+                                color->alpha));
     }
 
     /* Give the progend a chance to update any uniforms that might not
@@ -1120,8 +1619,8 @@ done:
     if (!_cg_has_private_feature(dev, CG_PRIVATE_FEATURE_SAMPLER_OBJECTS))
         foreach_texture_unit_update_filter_and_wrap_modes(dev);
 
-    /* If this pipeline has more than one layer then we always need
-     * to make sure we rebind the texture for unit 1.
+    /* If a layer of this pipeline was assigned to texture unit 1 then
+     * we always need to make sure we rebind its texture.
      *
      * NB: various components of CGlib may temporarily bind arbitrary
      * textures to texture unit 1 so they can query and modify texture
@@ -1129,11 +1628,181 @@ done:
      * _cg_bind_gl_texture_transient)
      */
     unit1 = _cg_get_texture_unit(dev, 1);
-    if (cg_pipeline_get_n_layers(pipeline) > 1 && unit1->dirty_gl_texture) {
+    if (unit1->last_used == dev->texture_unit_age && unit1->dirty_gl_texture) {
         set_active_texture_unit(dev, 1);
         GE(dev, glBindTexture(unit1->gl_target, unit1->gl_texture));
         unit1->dirty_gl_texture = false;
     }
 
     CG_TIMER_STOP(_cg_uprof_context, pipeline_flush_timer);
+
+    return true;
+}
+
+static void
+draw_test_point(cg_pipeline_t *pipeline, float x, float y)
+{
+    cg_vertex_p2_t vertex = { x, y };
+    cg_primitive_t *prim = cg_primitive_new_p2(test_dev,
+                                               CG_VERTICES_MODE_POINTS,
+                                               1,
+                                               &vertex);
+
+    cg_primitive_draw(prim, test_fb, pipeline);
+    cg_object_unref(prim);
+}
+
+TEST(check_frozen_pipeline)
+{
+    cg_pipeline_t *frozen, *other;
+    int fb_width, fb_height;
+    int i;
+
+    test_cg_init();
+
+    fb_width = cg_framebuffer_get_width(test_fb);
+    fb_height = cg_framebuffer_get_height(test_fb);
+
+    cg_framebuffer_orthographic(test_fb, 0, 0, fb_width, fb_height, -1, 100);
+
+    frozen = cg_pipeline_new(test_dev);
+    cg_pipeline_set_color4f(frozen, 1, 0, 0, 1);
+    cg_pipeline_set_point_size(frozen, 4.0f);
+    cg_pipeline_freeze(frozen);
+
+    /* Everything that is flushed from the frozen pipeline's record is
+     * different in this pipeline so that any state that isn't replayed
+     * would leak into the following draws */
+    other = cg_pipeline_new(test_dev);
+    cg_pipeline_set_color4f(other, 0, 1, 0, 1);
+    cg_pipeline_set_point_size(other, 8.0f);
+    cg_pipeline_set_color_mask(other, CG_COLOR_MASK_NONE);
+    cg_pipeline_set_blend(other, "RGBA = ADD(SRC_COLOR, DST_COLOR)", NULL);
+
+    for (i = 0; i < 3; i++) {
+        int y = i * 16 + 8;
+
+        cg_framebuffer_draw_rectangle(test_fb, frozen, 0, y, 8, y + 8);
+        draw_test_point(frozen, 24, y);
+        /* Nothing drawn with this should be written */
+        draw_test_point(other, 40, y);
+        cg_framebuffer_finish(test_fb);
+    }
+
+    /* The frozen pipeline should have recorded its state */
+    c_assert(get_flush_record(frozen) != NULL);
+
+    for (i = 0; i < 3; i++) {
+        int y = i * 16 + 8;
+
+        test_cg_check_pixel_rgb(test_fb, 4, y + 4, 0xff, 0, 0);
+
+        /* A 4 pixel point covers 22-25 whereas an 8 pixel point would
+         * cover 20-27 */
+        test_cg_check_pixel_rgb(test_fb, 23, y, 0xff, 0, 0);
+        test_cg_check_pixel_rgb(test_fb, 20, y, 0, 0, 0);
+        test_cg_check_pixel_rgb(test_fb, 27, y, 0, 0, 0);
+
+        test_cg_check_pixel_rgb(test_fb, 40, y, 0, 0, 0);
+    }
+
+    cg_object_unref(other);
+    cg_object_unref(frozen);
+
+    test_cg_fini();
+}
+
+static cg_pipeline_t *
+create_swapped_units_pipeline(cg_texture_t *tex0,
+                              cg_texture_t *tex1,
+                              cg_snippet_t *snippet)
+{
+    cg_pipeline_t *pipeline = cg_pipeline_new(test_dev);
+
+    cg_pipeline_set_layer_texture(pipeline, 0, tex0);
+    cg_pipeline_set_layer_texture(pipeline, 1, tex1);
+    cg_pipeline_add_snippet(pipeline, snippet);
+
+    return pipeline;
+}
+
+TEST(check_texture_unit_assignment)
+{
+    static const uint8_t red_data[] = { 0xff, 0, 0, 0xff };
+    static const uint8_t black_data[] = { 0, 0, 0, 0xff };
+    cg_texture_unit_stats_t before, after;
+    cg_texture_2d_t *red_tex, *black_tex;
+    cg_pipeline_t *pipelines[2];
+    cg_snippet_t *snippet;
+    int fb_width, fb_height;
+    int i;
+
+    test_cg_init();
+
+    fb_width = cg_framebuffer_get_width(test_fb);
+    fb_height = cg_framebuffer_get_height(test_fb);
+
+    cg_framebuffer_orthographic(test_fb, 0, 0, fb_width, fb_height, -1, 100);
+
+    red_tex = cg_texture_2d_new_from_data(test_dev,
+                                          1, 1, /* width, height */
+                                          CG_PIXEL_FORMAT_RGBA_8888_PRE,
+                                          4, /* rowstride */
+                                          red_data,
+                                          NULL);
+    black_tex = cg_texture_2d_new_from_data(test_dev,
+                                            1, 1, /* width, height */
+                                            CG_PIXEL_FORMAT_RGBA_8888_PRE,
+                                            4, /* rowstride */
+                                            black_data,
+                                            NULL);
+
+    /* The red channel shows which texture was sampled for the first
+     * layer and the green channel shows the second layer */
+    snippet = cg_snippet_new(CG_SNIPPET_HOOK_FRAGMENT, NULL, NULL);
+    cg_snippet_set_replace(snippet,
+                           "cg_color_out = "
+                           "vec4(texture2D(cg_sampler0, vec2(0.5)).r, "
+                           "texture2D(cg_sampler1, vec2(0.5)).r, "
+                           "0.0, 1.0);\n");
+
+    pipelines[0] = create_swapped_units_pipeline(CG_TEXTURE(red_tex),
+                                                 CG_TEXTURE(black_tex),
+                                                 snippet);
+    pipelines[1] = create_swapped_units_pipeline(CG_TEXTURE(black_tex),
+                                                 CG_TEXTURE(red_tex),
+                                                 snippet);
+
+    cg_object_unref(snippet);
+    cg_object_unref(black_tex);
+    cg_object_unref(red_tex);
+
+    cg_device_get_texture_unit_stats(test_dev, &before);
+
+    for (i = 0; i < 4; i++)
+        cg_framebuffer_draw_rectangle(test_fb, pipelines[i & 1],
+                                      i, 0, i + 1, 1);
+
+    /* Even though the layers end up on whichever unit already has
+     * their texture the samplers should still read the right one */
+    for (i = 0; i < 4; i++) {
+        if (i & 1)
+            test_cg_check_pixel_rgb(test_fb, i, 0, 0, 0xff, 0);
+        else
+            test_cg_check_pixel_rgb(test_fb, i, 0, 0xff, 0, 0);
+    }
+
+    cg_device_get_texture_unit_stats(test_dev, &after);
+
+    /* Only the first draw should have needed to bind the textures.
+     * Every later draw would have had to rebind both layers if they
+     * were always flushed to the unit matching their position. */
+    c_assert_cmpint(after.binds - before.binds, ==, 2);
+    c_assert_cmpint(after.binds_saved - before.binds_saved, ==, 6);
+    c_assert_cmpint(after.sampler_updates, >, before.sampler_updates);
+
+    cg_object_unref(pipelines[1]);
+    cg_object_unref(pipelines[0]);
+
+    test_cg_fini();
 }
@@ -43,4 +43,8 @@ int _cg_pipeline_progend_glsl_get_attrib_location(cg_device_t *dev,
                                                   cg_pipeline_t *pipeline,
                                                   int name_index);
 
+void _cg_pipeline_progend_glsl_cancel_pending_programs(cg_device_t *dev);
+
+void _cg_pipeline_progend_glsl_free_builtin_uniform_buffer(cg_device_t *dev);
+
 #endif /* __CG_PIPELINE_PROGEND_GLSL_PRIVATE_H */
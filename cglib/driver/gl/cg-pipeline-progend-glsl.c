@@ -53,6 +53,48 @@
 #include "cg-attribute-private.h"
 #include "cg-framebuffer-private.h"
 #include "cg-pipeline-progend-glsl-private.h"
+#include "cg-closure-list-private.h"
+#include "cg-loop-private.h"
+
+#include <test-fixtures/test-cg-fixtures.h>
+
+#ifdef C_PLATFORM_UNIX
+#include <stdlib.h>
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+/* How often to check whether the driver has finished building
+ * programs that are being compiled asynchronously */
+#define PENDING_PROGRAM_CHECK_TIMEOUT 5000 /* microseconds */
+
+#ifndef GL_UNIFORM_BUFFER
+#define GL_UNIFORM_BUFFER 0x8A11
+#endif
+#ifndef GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+#define GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT 0x8A34
+#endif
+#ifndef GL_INVALID_INDEX
+#define GL_INVALID_INDEX 0xFFFFFFFFu
+#endif
+
+/* The uniform buffer binding point used for the builtin matrices */
+#define BUILTIN_UNIFORM_BLOCK_BINDING 0
+
+/* The number of times the builtin matrices can be written to the
+ * uniform buffer before it gets orphaned and reused from the start */
+#define BUILTIN_UNIFORM_BUFFER_N_SLOTS 256
+
+/* This must match the layout of _CG_BUILTIN_UNIFORM_BLOCK_BOILERPLATE
+ * in cg-glsl-shader-boilerplate.h. With std140 packing each mat4 is
+ * just 16 consecutive floats. */
+typedef struct {
+    float modelview[16];
+    float projection[16];
+    float modelview_projection[16];
+} cg_builtin_uniform_block_t;
 
 /* These are used to generalise updating some uniforms that are
    required when building for drivers missing some fixed function
@@ -93,6 +135,13 @@ static builtin_uniform_data_t builtin_uniforms[] = {
 
 const cg_pipeline_progend_t _cg_pipeline_glsl_progend;
 
+/* The location of the sampler uniform for one layer and the texture
+ * unit it was last set to */
+typedef struct {
+    GLint location;
+    int unit;
+} cg_sampler_uniform_t;
+
 typedef struct {
     cg_device_t *dev;
 
@@ -124,6 +173,17 @@ typedef struct {
     /* Array of attribute locations. */
     c_array_t *attribute_locations;
 
+    /* Array of cg_sampler_uniform_t for each layer. The layers aren't
+     * always flushed to the texture unit matching their position so
+     * the sampler uniforms are updated whenever that changes */
+    c_array_t *sampler_uniforms;
+
+    /* The number of attribute names that had been registered when
+     * the program was linked with their fixed locations bound. This
+     * is zero if the program came from a binary because it may have
+     * been linked with different locations. */
+    int n_bound_attribute_names;
+
     /* The 'flip' uniform is used to flip the geometry upside-down when
        the framebuffer requires it only when there are vertex
        snippets. Otherwise this is acheived using the projection
@@ -132,8 +192,23 @@ typedef struct {
     int flushed_flip_state;
 
     cg_pipeline_cache_entry_t *cache_entry;
+
+    /* This is set while the program is being linked asynchronously.
+     * The binary cache key is kept so that the program can be stored
+     * once we know it linked successfully */
+    bool link_pending;
+    uint64_t binary_key;
 } cg_pipeline_program_state_t;
 
+/* An entry in dev->pending_programs used to notify the application
+ * when an asynchronously linked program is ready */
+typedef struct {
+    c_list_t link;
+    cg_pipeline_program_state_t *program_state;
+    /* The pipeline that caused the program to be built */
+    cg_pipeline_t *pipeline;
+} cg_pending_program_t;
+
 static cg_user_data_key_t program_state_key;
 
 static cg_pipeline_program_state_t *
@@ -169,6 +244,18 @@ _cg_pipeline_progend_glsl_get_attrib_location(cg_device_t *dev,
     c_return_val_if_fail(program_state != NULL, -1);
     c_return_val_if_fail(program_state->program != 0, -1);
 
+    /* Names that were bound to their fixed location before linking
+     * don't need to be queried */
+    if (name_index < program_state->n_bound_attribute_names) {
+        cg_attribute_name_state_t *name_state =
+            c_array_index(dev->attribute_name_index_map,
+                          cg_attribute_name_state_t *,
+                          name_index);
+
+        if (name_state->fixed_location != -1)
+            return name_state->fixed_location;
+    }
+
     if (C_UNLIKELY(program_state->attribute_locations == NULL))
         program_state->attribute_locations =
             c_array_new(false, false, sizeof(int));
@@ -199,6 +286,31 @@ _cg_pipeline_progend_glsl_get_attrib_location(cg_device_t *dev,
     return locations[name_index];
 }
 
+/* Binds every registered attribute name to its fixed location so
+ * that the program doesn't need to be queried for them. It doesn't
+ * matter if the program doesn't use some of the names. */
+static void
+bind_fixed_attribute_locations(cg_device_t *dev,
+                               cg_pipeline_program_state_t *program_state)
+{
+    int i;
+
+    for (i = 0; i < dev->n_attribute_names; i++) {
+        cg_attribute_name_state_t *name_state =
+            c_array_index(dev->attribute_name_index_map,
+                          cg_attribute_name_state_t *,
+                          i);
+
+        if (name_state->fixed_location != -1)
+            GE(dev,
+               glBindAttribLocation(program_state->program,
+                                    name_state->fixed_location,
+                                    name_state->name));
+    }
+
+    program_state->n_bound_attribute_names = dev->n_attribute_names;
+}
+
 static void
 clear_attribute_cache(cg_pipeline_program_state_t *program_state)
 {
@@ -229,30 +341,21 @@ program_state_new(cg_device_t *dev, int n_layers,
     program_state->program = 0;
     program_state->uniform_locations = NULL;
     program_state->attribute_locations = NULL;
+    program_state->sampler_uniforms =
+        c_array_sized_new(false, false, sizeof(cg_sampler_uniform_t), n_layers);
+    program_state->n_bound_attribute_names = 0;
     program_state->cache_entry = cache_entry;
     _cg_matrix_entry_cache_init(&program_state->modelview_cache);
     _cg_matrix_entry_cache_init(&program_state->projection_cache);
     program_state->projection_was_flipped = false;
+    program_state->link_pending = false;
 
     return program_state;
 }
 
 static void
-destroy_program_state(void *user_data, void *instance)
+program_state_unref(cg_pipeline_program_state_t *program_state)
 {
-    cg_pipeline_program_state_t *program_state = user_data;
-
-    /* If the program state was last used for this pipeline then clear
-       it so that if same address gets used again for a new pipeline
-       then we won't think it's the same pipeline and avoid updating the
-       uniforms */
-    if (program_state->last_used_for_pipeline == instance)
-        program_state->last_used_for_pipeline = NULL;
-
-    if (program_state->cache_entry &&
-        program_state->cache_entry->pipeline != instance)
-        program_state->cache_entry->usage_count--;
-
     if (--program_state->ref_count == 0) {
         cg_device_t *dev = program_state->dev;
 
@@ -267,10 +370,31 @@ destroy_program_state(void *user_data, void *instance)
         if (program_state->uniform_locations)
             c_array_free(program_state->uniform_locations, true);
 
+        c_array_free(program_state->sampler_uniforms, true);
+
         c_slice_free(cg_pipeline_program_state_t, program_state);
     }
 }
 
+static void
+destroy_program_state(void *user_data, void *instance)
+{
+    cg_pipeline_program_state_t *program_state = user_data;
+
+    /* If the program state was last used for this pipeline then clear
+       it so that if same address gets used again for a new pipeline
+       then we won't think it's the same pipeline and avoid updating the
+       uniforms */
+    if (program_state->last_used_for_pipeline == instance)
+        program_state->last_used_for_pipeline = NULL;
+
+    if (program_state->cache_entry &&
+        program_state->cache_entry->pipeline != instance)
+        _cg_pipeline_cache_entry_remove_usage(program_state->cache_entry);
+
+    program_state_unref(program_state);
+}
+
 static void
 set_program_state(cg_pipeline_t *pipeline,
                   cg_pipeline_program_state_t *program_state)
@@ -282,7 +406,7 @@ set_program_state(cg_pipeline_t *pipeline,
          * mark it as a usage of the pipeline cache entry */
         if (program_state->cache_entry &&
             program_state->cache_entry->pipeline != pipeline)
-            program_state->cache_entry->usage_count++;
+            _cg_pipeline_cache_entry_add_usage(program_state->cache_entry);
     }
 
     _cg_object_set_user_data(CG_OBJECT(pipeline),
@@ -298,13 +422,11 @@ dirty_program_state(cg_pipeline_t *pipeline)
         CG_OBJECT(pipeline), &program_state_key, NULL, NULL);
 }
 
-static void
-link_program(cg_device_t *dev, GLint gl_program)
+static bool
+check_link_status(cg_device_t *dev, GLint gl_program)
 {
     GLint link_status;
 
-    GE(dev, glLinkProgram(gl_program));
-
     GE(dev, glGetProgramiv(gl_program, GL_LINK_STATUS, &link_status));
 
     if (!link_status) {
@@ -323,11 +445,137 @@ link_program(cg_device_t *dev, GLint gl_program)
 
         c_free(log);
     }
+
+    return link_status;
+}
+
+static bool
+link_program(cg_device_t *dev, GLint gl_program)
+{
+    GE(dev, glLinkProgram(gl_program));
+
+    return check_link_status(dev, gl_program);
+}
+
+/* Checks whether the driver has finished an asynchronous link without
+ * blocking */
+static bool
+link_is_complete(cg_device_t *dev,
+                 cg_pipeline_program_state_t *program_state)
+{
+    GLint completed;
+
+    if (!program_state->link_pending)
+        return true;
+
+    /* Programs are only linked asynchronously when
+     * GL_KHR_parallel_shader_compile is available */
+    if (dev->glMaxShaderCompilerThreads == NULL)
+        return true;
+
+    GE(dev,
+       glGetProgramiv(program_state->program,
+                      GL_COMPLETION_STATUS_KHR,
+                      &completed));
+
+    return completed;
+}
+
+static void
+finish_link(cg_device_t *dev, cg_pipeline_program_state_t *program_state)
+{
+    program_state->link_pending = false;
+
+    if (check_link_status(dev, program_state->program) &&
+        dev->program_binary_cache)
+        _cg_program_binary_cache_store(dev->program_binary_cache,
+                                       program_state->binary_key,
+                                       program_state->program);
+}
+
+static void
+free_pending_program(cg_pending_program_t *pending)
+{
+    c_list_remove(&pending->link);
+    program_state_unref(pending->program_state);
+    cg_object_unref(pending->pipeline);
+    c_slice_free(cg_pending_program_t, pending);
+}
+
+/* Note that the link itself is finished the next time the program is
+ * used by _cg_pipeline_progend_glsl_end() so that the uniform state
+ * is set up at the same time. We only use the poll source to notify
+ * the application. */
+static void
+pending_programs_poll_dispatch(void *user_data, int revents)
+{
+    cg_device_t *dev = user_data;
+    cg_pending_program_t *pending, *tmp;
+
+    c_list_for_each_safe(pending, tmp, &dev->pending_programs, link)
+    {
+        if (!link_is_complete(dev, pending->program_state))
+            continue;
+
+        _cg_closure_list_invoke(&dev->program_ready_closures,
+                                cg_program_ready_callback_t,
+                                dev,
+                                pending->pipeline);
+
+        free_pending_program(pending);
+    }
+}
+
+static int64_t
+pending_programs_poll_prepare(void *user_data)
+{
+    cg_device_t *dev = user_data;
+
+    if (!c_list_empty(&dev->pending_programs))
+        return PENDING_PROGRAM_CHECK_TIMEOUT;
+    else
+        return -1;
+}
+
+static void
+add_pending_program(cg_device_t *dev,
+                    cg_pipeline_program_state_t *program_state,
+                    cg_pipeline_t *pipeline)
+{
+    cg_pending_program_t *pending = c_slice_new(cg_pending_program_t);
+
+    program_state->ref_count++;
+    pending->program_state = program_state;
+    pending->pipeline = cg_object_ref(pipeline);
+
+    c_list_insert(dev->pending_programs.prev, &pending->link);
+
+    if (!dev->pending_programs_poll_source) {
+        dev->pending_programs_poll_source =
+            _cg_loop_add_source(dev->display->renderer,
+                                pending_programs_poll_prepare,
+                                pending_programs_poll_dispatch,
+                                dev);
+    }
+}
+
+void
+_cg_pipeline_progend_glsl_cancel_pending_programs(cg_device_t *dev)
+{
+    cg_pending_program_t *pending, *tmp;
+
+    c_list_for_each_safe(pending, tmp, &dev->pending_programs, link)
+        free_pending_program(pending);
+
+    if (dev->pending_programs_poll_source) {
+        _cg_loop_remove_source(dev->display->renderer,
+                               dev->pending_programs_poll_source);
+        dev->pending_programs_poll_source = NULL;
+    }
 }
 
 typedef struct {
     cg_device_t *dev;
-    int unit;
     GLuint gl_program;
     bool update_all;
     cg_pipeline_program_state_t *program_state;
@@ -338,7 +586,7 @@ get_uniform_cb(cg_pipeline_t *pipeline, int layer_index, void *user_data)
 {
     update_uniforms_state_t *state = user_data;
     cg_device_t *dev = state->dev;
-    GLint uniform_location;
+    cg_sampler_uniform_t sampler_uniform;
 
     /* We can reuse the source buffer to create the uniform name because
        the program has now been linked */
@@ -346,23 +594,54 @@ get_uniform_cb(cg_pipeline_t *pipeline, int layer_index, void *user_data)
     c_string_append_printf(dev->codegen_source_buffer, "cg_sampler%i",
                            layer_index);
 
-    GE_RET(uniform_location,
+    GE_RET(sampler_uniform.location,
            dev,
            glGetUniformLocation(state->gl_program,
                                 dev->codegen_source_buffer->str));
 
-    /* We can set the uniform immediately because the samplers are the
-       unit index not the texture object number so it will never
-       change. Unfortunately GL won't let us use a constant instead of a
-       uniform */
-    if (uniform_location != -1)
-        GE(dev, glUniform1i(uniform_location, state->unit));
+    /* The texture unit is set by flush_sampler_uniforms() once we know
+     * which unit the layer was flushed to */
+    sampler_uniform.unit = -1;
 
-    state->unit++;
+    c_array_append_val(state->program_state->sampler_uniforms,
+                       sampler_uniform);
 
     return true;
 }
 
+/* Points the sampler uniform of each layer at the texture unit that
+ * the layer was assigned to by _cg_pipeline_flush_gl_state(). This is
+ * usually the same as the last time the program was used so nothing
+ * needs to be done. Unfortunately GL won't let us use a constant
+ * instead of a uniform */
+static void
+flush_sampler_uniforms(cg_device_t *dev,
+                       cg_pipeline_program_state_t *program_state)
+{
+    int n_layers = MIN(program_state->sampler_uniforms->len,
+                       dev->texture_unit_map->len);
+    int i;
+
+    for (i = 0; i < n_layers; i++) {
+        cg_sampler_uniform_t *sampler_uniform =
+            &c_array_index(program_state->sampler_uniforms,
+                           cg_sampler_uniform_t,
+                           i);
+        int unit = c_array_index(dev->texture_unit_map, int, i);
+
+        if (sampler_uniform->location == -1 || sampler_uniform->unit == unit)
+            continue;
+
+        /* Only count the updates that wouldn't have been needed if the
+         * layer had been flushed to the unit matching its position */
+        if (sampler_uniform->unit != -1 || unit != i)
+            dev->texture_unit_stats.sampler_updates++;
+
+        GE(dev, glUniform1i(sampler_uniform->location, unit));
+        sampler_uniform->unit = unit;
+    }
+}
+
 static void
 update_builtin_uniforms(cg_device_t *dev,
                         cg_pipeline_t *pipeline,
@@ -492,6 +771,25 @@ _cg_pipeline_progend_glsl_flush_uniforms(cg_device_t *dev,
                0xff,
                n_uniform_longs * sizeof(unsigned long));
         data.n_differences = INT_MAX;
+    } else if (program_state->last_used_for_pipeline == pipeline) {
+        int i;
+
+        /* Only the uniforms that have been set since the last flush can
+           differ so there's no need to compare the ancestry */
+        if (uniforms_state == NULL)
+            return;
+
+        memset(data.uniform_differences,
+               0,
+               n_uniform_longs * sizeof(unsigned long));
+        _cg_bitmask_set_flags(&uniforms_state->changed_mask,
+                              data.uniform_differences);
+
+        data.n_differences = 0;
+
+        for (i = 0; i < n_uniform_longs; i++)
+            data.n_differences +=
+                _cg_util_popcountl(data.uniform_differences[i]);
     } else if (program_state->last_used_for_pipeline) {
         int i;
 
@@ -537,6 +835,36 @@ _cg_pipeline_progend_glsl_flush_uniforms(cg_device_t *dev,
         _cg_bitmask_clear_all(&uniforms_state->changed_mask);
 }
 
+static void
+record_shader_manifest_program(cg_device_t *dev,
+                               cg_pipeline_t *pipeline,
+                               uint64_t vertex_source_hash,
+                               uint64_t fragment_source_hash)
+{
+    cg_shader_manifest_t *manifest = dev->recorded_shader_manifest;
+    char *vertex_source, *fragment_source;
+
+    /* Avoid fetching the source back from GL if we've already seen
+     * this program */
+    if (_cg_shader_manifest_has_program(manifest,
+                                        vertex_source_hash,
+                                        fragment_source_hash))
+        return;
+
+    vertex_source = _cg_pipeline_vertend_glsl_get_source(pipeline);
+    fragment_source = _cg_pipeline_fragend_glsl_get_source(pipeline);
+
+    if (vertex_source && fragment_source)
+        _cg_shader_manifest_add_program(manifest,
+                                        vertex_source_hash,
+                                        vertex_source,
+                                        fragment_source_hash,
+                                        fragment_source);
+
+    c_free(vertex_source);
+    c_free(fragment_source);
+}
+
 static bool
 _cg_pipeline_progend_glsl_start(cg_device_t *dev, cg_pipeline_t *pipeline)
 {
@@ -546,16 +874,18 @@ _cg_pipeline_progend_glsl_start(cg_device_t *dev, cg_pipeline_t *pipeline)
     return true;
 }
 
-static void
+static bool
 _cg_pipeline_progend_glsl_end(cg_device_t *dev,
                               cg_pipeline_t *pipeline,
-                              unsigned long pipelines_difference)
+                              unsigned long pipelines_difference,
+                              bool allow_async)
 {
     cg_pipeline_program_state_t *program_state;
     GLuint gl_program;
     bool program_changed = false;
     update_uniforms_state_t state;
     cg_pipeline_cache_entry_t *cache_entry = NULL;
+    bool async = allow_async && _cg_device_use_async_shader_compile(dev);
 
     program_state = get_program_state(pipeline);
 
@@ -605,38 +935,114 @@ _cg_pipeline_progend_glsl_end(cg_device_t *dev,
     }
 
     if (program_state->program == 0) {
+        cg_program_binary_cache_t *binary_cache = dev->program_binary_cache;
+        uint64_t vertex_source_hash =
+            _cg_pipeline_vertend_glsl_get_source_hash(pipeline);
+        uint64_t fragment_source_hash =
+            _cg_pipeline_fragend_glsl_get_source_hash(pipeline);
+        uint64_t binary_key = 0;
+        bool linked = false;
         GLuint backend_shader;
 
-        GE_RET(program_state->program, dev, glCreateProgram());
+        if (dev->record_shader_manifest)
+            record_shader_manifest_program(dev,
+                                           pipeline,
+                                           vertex_source_hash,
+                                           fragment_source_hash);
 
-        /* Attach any shaders from the GLSL backends */
-        if ((backend_shader = _cg_pipeline_fragend_glsl_get_shader(pipeline)))
-            GE(dev, glAttachShader(program_state->program, backend_shader));
-        if ((backend_shader = _cg_pipeline_vertend_glsl_get_shader(pipeline)))
-            GE(dev, glAttachShader(program_state->program, backend_shader));
+        /* The program may have already been linked while prewarming */
+        if (dev->prewarm_shader_manifest)
+            program_state->program =
+                _cg_shader_manifest_take_program(dev->prewarm_shader_manifest,
+                                                 vertex_source_hash,
+                                                 fragment_source_hash);
 
-        /* XXX: OpenGL as a special case requires the vertex position to
-         * be bound to generic attribute 0 so for simplicity we
-         * unconditionally bind the cg_position_in attribute here...
-         */
-        GE(dev,
-           glBindAttribLocation(program_state->program, 0, "cg_position_in"));
+        if (program_state->program)
+            linked = true;
+        else
+            GE_RET(program_state->program, dev, glCreateProgram());
+
+        /* If we've linked the same source before we may be able to skip
+         * compiling and linking altogether */
+        if (!linked && binary_cache) {
+            binary_key = _cg_program_binary_cache_get_key(binary_cache,
+                                                          vertex_source_hash,
+                                                          fragment_source_hash);
+
+            linked = _cg_program_binary_cache_load(binary_cache,
+                                                   binary_key,
+                                                   program_state->program);
+        }
 
-        link_program(dev, program_state->program);
+        if (!linked) {
+            _cg_pipeline_cache_count_compile(dev->pipeline_cache,
+                                             CG_PIPELINE_CACHE_TABLE_COMBINED);
+
+            /* Attach any shaders from the GLSL backends */
+            if ((backend_shader =
+                     _cg_pipeline_fragend_glsl_get_shader(pipeline)))
+                GE(dev,
+                   glAttachShader(program_state->program, backend_shader));
+            if ((backend_shader =
+                     _cg_pipeline_vertend_glsl_get_shader(pipeline)))
+                GE(dev,
+                   glAttachShader(program_state->program, backend_shader));
+
+            /* XXX: OpenGL as a special case requires the vertex position
+             * to be bound to generic attribute 0 so for simplicity we
+             * unconditionally bind the cg_position_in attribute here...
+             */
+            GE(dev,
+               glBindAttribLocation(
+                   program_state->program, 0, "cg_position_in"));
+
+            bind_fixed_attribute_locations(dev, program_state);
+
+            if (binary_cache)
+                _cg_program_binary_cache_set_retrievable(
+                    binary_cache, program_state->program);
+
+            if (async) {
+                /* Start the link but don't wait for the result */
+                GE(dev, glLinkProgram(program_state->program));
+                program_state->binary_key = binary_key;
+                program_state->link_pending = true;
+                add_pending_program(dev, program_state, pipeline);
+
+                /* Give the driver some time to work on it before
+                 * checking whether it's ready */
+                return false;
+            } else if (link_program(dev, program_state->program) &&
+                       binary_cache)
+                _cg_program_binary_cache_store(binary_cache,
+                                               binary_key,
+                                               program_state->program);
+        }
 
         program_changed = true;
     }
 
+    if (program_state->link_pending) {
+        if (async && !link_is_complete(dev, program_state))
+            return false;
+
+        finish_link(dev, program_state);
+
+        /* None of the uniform state could be set up until the link
+         * was finished */
+        program_changed = true;
+    }
+
     gl_program = program_state->program;
 
     _cg_gl_use_program(dev, gl_program);
 
     state.dev = dev;
-    state.unit = 0;
     state.gl_program = gl_program;
     state.program_state = program_state;
 
     if (program_changed) {
+        c_array_set_size(program_state->sampler_uniforms, 0);
         cg_pipeline_foreach_layer(pipeline, get_uniform_cb, &state);
         clear_attribute_cache(program_state);
 
@@ -646,7 +1052,8 @@ _cg_pipeline_progend_glsl_end(cg_device_t *dev,
         program_state->flushed_flip_state = -1;
     }
 
-    state.unit = 0;
+    flush_sampler_uniforms(dev, program_state);
+
     state.update_all =
         (program_changed || program_state->last_used_for_pipeline != pipeline);
 
@@ -675,6 +1082,23 @@ _cg_pipeline_progend_glsl_end(cg_device_t *dev,
             program_state->mvp_uniform,
             dev,
             glGetUniformLocation(gl_program, "cg_modelview_projection_matrix"));
+
+        /* The matrices will be in the shared uniform block instead so
+         * the locations above will all be -1 */
+        if (_cg_has_private_feature(dev,
+                                    CG_PRIVATE_FEATURE_UNIFORM_BUFFER_OBJECTS)) {
+            GLuint block_index;
+
+            GE_RET(block_index,
+                   dev,
+                   glGetUniformBlockIndex(gl_program, "cg_builtin_uniforms"));
+
+            if (block_index != GL_INVALID_INDEX)
+                GE(dev,
+                   glUniformBlockBinding(gl_program,
+                                         block_index,
+                                         BUILTIN_UNIFORM_BLOCK_BINDING));
+        }
     }
 
     if (program_changed || program_state->last_used_for_pipeline != pipeline)
@@ -688,6 +1112,8 @@ _cg_pipeline_progend_glsl_end(cg_device_t *dev,
     /* We need to track the last pipeline that the program was used with
      * so know if we need to update all of the uniforms */
     program_state->last_used_for_pipeline = pipeline;
+
+    return true;
 }
 
 static void
@@ -735,6 +1161,109 @@ _cg_pipeline_progend_glsl_layer_pre_change_notify(cg_device_t *dev,
     }
 }
 
+/* Writes the builtin matrices to the next slot of the uniform buffer
+ * that is shared by all of the programs. Unlike the per-program
+ * uniforms this doesn't need to do anything when only the program
+ * changes because the buffer range stays bound to the block. */
+static void
+flush_builtin_uniform_block(cg_device_t *dev,
+                            cg_matrix_entry_t *projection_entry,
+                            cg_matrix_entry_t *modelview_entry,
+                            bool flip_projection)
+{
+    cg_builtin_uniform_block_t block;
+    c_matrix_t modelview, projection, combined;
+    GLsizeiptr buffer_size;
+    bool changed;
+
+    changed = dev->builtin_flushed_flip != flip_projection;
+    changed |= _cg_matrix_entry_cache_maybe_update(
+        &dev->builtin_flushed_projection, projection_entry);
+    changed |= _cg_matrix_entry_cache_maybe_update(
+        &dev->builtin_flushed_modelview, modelview_entry);
+
+    if (!changed && dev->builtin_uniform_buffer)
+        return;
+
+    if (dev->builtin_uniform_buffer == 0) {
+        GLint alignment;
+
+        GE(dev, glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment));
+        if (alignment < 1)
+            alignment = 1;
+
+        dev->builtin_uniform_buffer_stride =
+            (sizeof(block) + alignment - 1) / alignment * alignment;
+        buffer_size = (dev->builtin_uniform_buffer_stride *
+                       BUILTIN_UNIFORM_BUFFER_N_SLOTS);
+
+        GE(dev, glGenBuffers(1, &dev->builtin_uniform_buffer));
+        GE(dev, glBindBuffer(GL_UNIFORM_BUFFER, dev->builtin_uniform_buffer));
+        GE(dev,
+           glBufferData(GL_UNIFORM_BUFFER, buffer_size, NULL, GL_STREAM_DRAW));
+        dev->builtin_uniform_buffer_offset = 0;
+    } else {
+        buffer_size = (dev->builtin_uniform_buffer_stride *
+                       BUILTIN_UNIFORM_BUFFER_N_SLOTS);
+
+        GE(dev, glBindBuffer(GL_UNIFORM_BUFFER, dev->builtin_uniform_buffer));
+
+        dev->builtin_uniform_buffer_offset +=
+            dev->builtin_uniform_buffer_stride;
+
+        /* Once every slot has been used we orphan the storage so that
+         * we don't have to wait for draws still reading from it */
+        if (dev->builtin_uniform_buffer_offset >= buffer_size) {
+            GE(dev,
+               glBufferData(
+                   GL_UNIFORM_BUFFER, buffer_size, NULL, GL_STREAM_DRAW));
+            dev->builtin_uniform_buffer_offset = 0;
+        }
+    }
+
+    cg_matrix_entry_get(modelview_entry, &modelview);
+    if (flip_projection) {
+        c_matrix_t tmp_matrix;
+        cg_matrix_entry_get(projection_entry, &tmp_matrix);
+        c_matrix_multiply(&projection, &dev->y_flip_matrix, &tmp_matrix);
+    } else
+        cg_matrix_entry_get(projection_entry, &projection);
+    c_matrix_multiply(&combined, &projection, &modelview);
+
+    memcpy(block.modelview,
+           c_matrix_get_array(&modelview),
+           sizeof(block.modelview));
+    memcpy(block.projection,
+           c_matrix_get_array(&projection),
+           sizeof(block.projection));
+    memcpy(block.modelview_projection,
+           c_matrix_get_array(&combined),
+           sizeof(block.modelview_projection));
+
+    GE(dev,
+       glBufferSubData(GL_UNIFORM_BUFFER,
+                       dev->builtin_uniform_buffer_offset,
+                       sizeof(block),
+                       &block));
+    GE(dev,
+       glBindBufferRange(GL_UNIFORM_BUFFER,
+                         BUILTIN_UNIFORM_BLOCK_BINDING,
+                         dev->builtin_uniform_buffer,
+                         dev->builtin_uniform_buffer_offset,
+                         sizeof(block)));
+
+    dev->builtin_flushed_flip = flip_projection;
+}
+
+void
+_cg_pipeline_progend_glsl_free_builtin_uniform_buffer(cg_device_t *dev)
+{
+    if (dev->builtin_uniform_buffer) {
+        GE(dev, glDeleteBuffers(1, &dev->builtin_uniform_buffer));
+        dev->builtin_uniform_buffer = 0;
+    }
+}
+
 static void
 _cg_pipeline_progend_glsl_pre_paint(cg_device_t *dev,
                                     cg_pipeline_t *pipeline,
@@ -763,6 +1292,27 @@ _cg_pipeline_progend_glsl_pre_paint(cg_device_t *dev,
 
     needs_flip = cg_is_offscreen(dev->current_draw_buffer);
 
+    if (program_state->flip_uniform != -1 &&
+        program_state->flushed_flip_state != needs_flip) {
+        static const float do_flip[4] = { 1.0f, -1.0f, 1.0f, 1.0f };
+        static const float dont_flip[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        GE(dev,
+           glUniform4fv(program_state->flip_uniform,
+                        1, /* count */
+                        needs_flip ? do_flip : dont_flip));
+        program_state->flushed_flip_state = needs_flip;
+    }
+
+    if (_cg_has_private_feature(dev,
+                                CG_PRIVATE_FEATURE_UNIFORM_BUFFER_OBJECTS)) {
+        flush_builtin_uniform_block(dev,
+                                    projection_entry,
+                                    modelview_entry,
+                                    needs_flip &&
+                                    program_state->flip_uniform == -1);
+        return;
+    }
+
     projection_changed = (program_state->flip_uniform == -1 &&
                           program_state->projection_was_flipped == needs_flip);
 
@@ -821,17 +1371,6 @@ _cg_pipeline_progend_glsl_pre_paint(cg_device_t *dev,
                                   c_matrix_get_array(&combined)));
         }
     }
-
-    if (program_state->flip_uniform != -1 &&
-        program_state->flushed_flip_state != needs_flip) {
-        static const float do_flip[4] = { 1.0f, -1.0f, 1.0f, 1.0f };
-        static const float dont_flip[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
-        GE(dev,
-           glUniform4fv(program_state->flip_uniform,
-                        1, /* count */
-                        needs_flip ? do_flip : dont_flip));
-        program_state->flushed_flip_state = needs_flip;
-    }
 }
 
 static void
@@ -857,4 +1396,384 @@ const cg_pipeline_progend_t _cg_pipeline_glsl_progend = {
     _cg_pipeline_progend_glsl_pre_paint
 };
 
+#ifdef ENABLE_UNIT_TESTS
+
+static void
+draw_test_tex_coord_rectangle(cg_pipeline_t *pipeline,
+                              const char *name,
+                              int x,
+                              float s)
+{
+    float verts[] = {
+        x, 0, s, 0.5f,
+        x, 1, s, 0.5f,
+        x + 1, 0, s, 0.5f,
+        x + 1, 1, s, 0.5f
+    };
+    cg_attribute_buffer_t *buffer;
+    cg_attribute_t *attributes[2];
+    cg_primitive_t *primitive;
+
+    buffer = cg_attribute_buffer_new(test_dev, sizeof(verts), verts);
+    attributes[0] = cg_attribute_new(buffer,
+                                     "cg_position_in",
+                                     sizeof(float) * 4, /* stride */
+                                     0, /* offset */
+                                     2, /* n_components */
+                                     CG_ATTRIBUTE_TYPE_FLOAT);
+    attributes[1] = cg_attribute_new(buffer,
+                                     name,
+                                     sizeof(float) * 4, /* stride */
+                                     sizeof(float) * 2, /* offset */
+                                     2, /* n_components */
+                                     CG_ATTRIBUTE_TYPE_FLOAT);
+    primitive = cg_primitive_new_with_attributes(
+        CG_VERTICES_MODE_TRIANGLE_STRIP, 4, attributes, 2);
+
+    cg_primitive_draw(primitive, test_fb, pipeline);
+
+    cg_object_unref(primitive);
+    cg_object_unref(attributes[1]);
+    cg_object_unref(attributes[0]);
+    cg_object_unref(buffer);
+}
+
+static int
+get_test_attribute_name_index(const char *name)
+{
+    cg_attribute_name_state_t *name_state =
+        c_hash_table_lookup(test_dev->attribute_name_states_hash, name);
+
+    c_assert(name_state != NULL);
+
+    return name_state->name_index;
+}
+
+TEST(check_aliased_attribute_locations)
+{
+    static const uint8_t tex_data[] = { 0xff, 0, 0, 0xff, 0, 0xff, 0, 0xff };
+    cg_pipeline_program_state_t *program_state;
+    cg_attribute_name_state_t *alias_state, *real_state;
+    cg_texture_2d_t *tex;
+    cg_pipeline_t *pipeline;
+    int alias_index, real_index;
+    GLint gl_location;
+
+    test_cg_init();
+
+    cg_framebuffer_orthographic(test_fb,
+                                0, 0,
+                                cg_framebuffer_get_width(test_fb),
+                                cg_framebuffer_get_height(test_fb),
+                                -1, 100);
+
+    tex = cg_texture_2d_new_from_data(test_dev,
+                                      2, 1, /* width, height */
+                                      CG_PIXEL_FORMAT_RGBA_8888_PRE,
+                                      8, /* rowstride */
+                                      tex_data,
+                                      NULL);
+    pipeline = cg_pipeline_new(test_dev);
+    cg_pipeline_set_layer_texture(pipeline, 0, CG_TEXTURE(tex));
+    cg_pipeline_set_layer_filters(pipeline,
+                                  0,
+                                  CG_PIPELINE_FILTER_NEAREST,
+                                  CG_PIPELINE_FILTER_NEAREST);
+    cg_object_unref(tex);
+
+    /* Both names refer to the texture coordinates of the first layer
+     * so either one should sample the texture correctly with the same
+     * program */
+    draw_test_tex_coord_rectangle(pipeline, "cg_tex_coord_in", 0, 0.75f);
+    draw_test_tex_coord_rectangle(pipeline, "cg_tex_coord0_in", 1, 0.25f);
+
+    test_cg_check_pixel_rgb(test_fb, 0, 0, 0, 0xff, 0);
+    test_cg_check_pixel_rgb(test_fb, 1, 0, 0xff, 0, 0);
+
+    alias_index = get_test_attribute_name_index("cg_tex_coord_in");
+    real_index = get_test_attribute_name_index("cg_tex_coord0_in");
+    c_assert_cmpint(alias_index, !=, real_index);
+
+    alias_state = c_array_index(test_dev->attribute_name_index_map,
+                                cg_attribute_name_state_t *,
+                                alias_index);
+    real_state = c_array_index(test_dev->attribute_name_index_map,
+                               cg_attribute_name_state_t *,
+                               real_index);
+    c_assert_cmpint(alias_state->fixed_location, !=, -1);
+    c_assert_cmpint(alias_state->fixed_location,
+                    ==,
+                    real_state->fixed_location);
+
+    /* The program was linked after both names were registered so
+     * neither location should need to be queried */
+    program_state = get_program_state(pipeline);
+    c_assert(program_state != NULL);
+    c_assert_cmpint(program_state->n_bound_attribute_names, >, real_index);
+
+    GE_RET(gl_location,
+           test_dev,
+           glGetAttribLocation(program_state->program, "cg_tex_coord0_in"));
+    c_assert_cmpint(gl_location, ==, real_state->fixed_location);
+    c_assert_cmpint(_cg_pipeline_progend_glsl_get_attrib_location(
+                        test_dev, pipeline, alias_index),
+                    ==,
+                    gl_location);
+    c_assert_cmpint(_cg_pipeline_progend_glsl_get_attrib_location(
+                        test_dev, pipeline, real_index),
+                    ==,
+                    gl_location);
+
+    cg_object_unref(pipeline);
+
+    test_cg_fini();
+}
+
+/* Enough matrix changes to use up every slot of the builtin uniform
+ * buffer and wrap around into the orphaned storage */
+#define N_TEST_MATRIX_CHANGES (BUILTIN_UNIFORM_BUFFER_N_SLOTS + 44)
+#define TEST_MATRIX_COLUMNS 20
+#define TEST_MATRIX_ROWS \
+    ((N_TEST_MATRIX_CHANGES + TEST_MATRIX_COLUMNS - 1) / TEST_MATRIX_COLUMNS)
+
+static void
+get_test_matrix_quad_color(int quad, uint8_t *color)
+{
+    color[0] = quad & 0xff;
+    color[1] = quad >> 8 ? 0xff : 0;
+    color[2] = 0x80;
+    color[3] = 0xff;
+}
+
+/* Draws a quad with its own modelview matrix for each matrix change
+ * and reads back the result */
+static void
+draw_test_matrix_quads(uint8_t *pixels)
+{
+    static const cg_vertex_p2_t quad[] = {
+        { 0, 0 }, { 0, 1 }, { 1, 0 }, { 1, 1 }
+    };
+    cg_primitive_t *primitive;
+    cg_pipeline_t *pipeline;
+    int i;
+
+    cg_framebuffer_orthographic(test_fb,
+                                0, 0,
+                                cg_framebuffer_get_width(test_fb),
+                                cg_framebuffer_get_height(test_fb),
+                                -1, 100);
+
+    primitive = cg_primitive_new_p2(test_dev,
+                                    CG_VERTICES_MODE_TRIANGLE_STRIP,
+                                    C_N_ELEMENTS(quad),
+                                    quad);
+    pipeline = cg_pipeline_new(test_dev);
+
+    for (i = 0; i < N_TEST_MATRIX_CHANGES; i++) {
+        uint8_t color[4];
+
+        get_test_matrix_quad_color(i, color);
+        cg_pipeline_set_color4ub(pipeline,
+                                 color[0], color[1], color[2], color[3]);
+
+        cg_framebuffer_push_matrix(test_fb);
+        cg_framebuffer_translate(test_fb,
+                                 i % TEST_MATRIX_COLUMNS,
+                                 i / TEST_MATRIX_COLUMNS,
+                                 0);
+        cg_primitive_draw(primitive, test_fb, pipeline);
+        cg_framebuffer_pop_matrix(test_fb);
+    }
+
+    cg_framebuffer_read_pixels(test_fb,
+                               0, 0,
+                               TEST_MATRIX_COLUMNS, TEST_MATRIX_ROWS,
+                               CG_PIXEL_FORMAT_RGBA_8888_PRE,
+                               pixels);
+
+    cg_object_unref(pipeline);
+    cg_object_unref(primitive);
+}
+
+TEST(check_builtin_uniform_buffer_wrap)
+{
+    size_t size = TEST_MATRIX_COLUMNS * TEST_MATRIX_ROWS * 4;
+    uint8_t *block_pixels = c_malloc(size);
+    uint8_t *uniform_pixels = c_malloc(size);
+    int i;
+
+    /* First draw with the uniform buffer if it is available */
+    test_cg_init();
+
+    draw_test_matrix_quads(block_pixels);
+
+    if (_cg_has_private_feature(test_dev,
+                                CG_PRIVATE_FEATURE_UNIFORM_BUFFER_OBJECTS))
+        c_assert(test_dev->builtin_uniform_buffer != 0);
+
+    test_cg_fini();
+
+    for (i = 0; i < N_TEST_MATRIX_CHANGES; i++) {
+        uint8_t color[4];
+
+        get_test_matrix_quad_color(i, color);
+        c_assert(memcmp(block_pixels + i * 4, color, 4) == 0);
+    }
+
+    /* Then again with the matrices as separate uniforms which should
+     * give exactly the same result */
+    CG_DEBUG_SET_FLAG(CG_DEBUG_DISABLE_UNIFORM_BUFFERS);
+
+    test_cg_init();
+
+    c_assert(!_cg_has_private_feature(test_dev,
+                                      CG_PRIVATE_FEATURE_UNIFORM_BUFFER_OBJECTS));
+    draw_test_matrix_quads(uniform_pixels);
+
+    test_cg_fini();
+
+    CG_DEBUG_CLEAR_FLAG(CG_DEBUG_DISABLE_UNIFORM_BUFFERS);
+
+    c_assert(memcmp(block_pixels, uniform_pixels, size) == 0);
+
+    c_free(uniform_pixels);
+    c_free(block_pixels);
+}
+
+#ifdef C_PLATFORM_UNIX
+
+static void
+draw_test_color_attribute_rectangle(cg_pipeline_t *pipeline)
+{
+    static const float verts[] = {
+        0, 0, 0, 0, 1, 1,
+        0, 1, 0, 0, 1, 1,
+        1, 0, 0, 0, 1, 1,
+        1, 1, 0, 0, 1, 1
+    };
+    cg_attribute_buffer_t *buffer;
+    cg_attribute_t *attributes[2];
+    cg_primitive_t *primitive;
+
+    buffer = cg_attribute_buffer_new(test_dev, sizeof(verts), verts);
+    attributes[0] = cg_attribute_new(buffer,
+                                     "cg_position_in",
+                                     sizeof(float) * 6, /* stride */
+                                     0, /* offset */
+                                     2, /* n_components */
+                                     CG_ATTRIBUTE_TYPE_FLOAT);
+    attributes[1] = cg_attribute_new(buffer,
+                                     "binary_test_color",
+                                     sizeof(float) * 6, /* stride */
+                                     sizeof(float) * 2, /* offset */
+                                     4, /* n_components */
+                                     CG_ATTRIBUTE_TYPE_FLOAT);
+    primitive = cg_primitive_new_with_attributes(
+        CG_VERTICES_MODE_TRIANGLE_STRIP, 4, attributes, 2);
+
+    cg_primitive_draw(primitive, test_fb, pipeline);
+
+    cg_object_unref(primitive);
+    cg_object_unref(attributes[1]);
+    cg_object_unref(attributes[0]);
+    cg_object_unref(buffer);
+}
+
+TEST(check_binary_program_attribute_locations)
+{
+    char template[] = "/tmp/cg-binary-attributes-XXXXXX";
+    bool binary_cache_supported = true;
+    const char *name;
+    c_dir_t *dir;
+    int pass;
+
+    c_assert(mkdtemp(template) != NULL);
+    c_setenv("CG_PROGRAM_CACHE_DIR", template, true);
+
+    /* The first pass links the program and stores it in the binary
+     * cache. The second pass loads it back after registering another
+     * attribute name first so that the fixed location of the custom
+     * attribute no longer matches the one the binary was linked with */
+    for (pass = 0; pass < 2 && binary_cache_supported; pass++) {
+        cg_pipeline_program_state_t *program_state;
+        cg_attribute_t *dummy_attribute = NULL;
+        cg_attribute_name_state_t *name_state;
+        cg_pipeline_t *pipeline;
+        cg_snippet_t *snippet;
+        GLint gl_location;
+
+        test_cg_init();
+
+        if (test_dev->program_binary_cache == NULL) {
+            binary_cache_supported = false;
+            test_cg_fini();
+            break;
+        }
+
+        cg_framebuffer_orthographic(test_fb,
+                                    0, 0,
+                                    cg_framebuffer_get_width(test_fb),
+                                    cg_framebuffer_get_height(test_fb),
+                                    -1, 100);
+
+        if (pass == 1)
+            dummy_attribute =
+                cg_attribute_new_const_1f(test_dev, "binary_test_dummy", 0);
+
+        pipeline = cg_pipeline_new(test_dev);
+        snippet = cg_snippet_new(CG_SNIPPET_HOOK_VERTEX,
+                                 "in vec4 binary_test_color;\n",
+                                 "cg_color_out = binary_test_color;\n");
+        cg_pipeline_add_snippet(pipeline, snippet);
+        cg_object_unref(snippet);
+
+        draw_test_color_attribute_rectangle(pipeline);
+        test_cg_check_pixel_rgb(test_fb, 0, 0, 0, 0, 0xff);
+
+        program_state = get_program_state(pipeline);
+        c_assert(program_state != NULL);
+
+        name_state = c_hash_table_lookup(test_dev->attribute_name_states_hash,
+                                         "binary_test_color");
+        c_assert(name_state != NULL);
+
+        GE_RET(gl_location,
+               test_dev,
+               glGetAttribLocation(program_state->program,
+                                   "binary_test_color"));
+        c_assert_cmpint(_cg_pipeline_progend_glsl_get_attrib_location(
+                            test_dev, pipeline, name_state->name_index),
+                        ==,
+                        gl_location);
+
+        if (pass == 1) {
+            /* A program loaded from a binary has to be queried */
+            c_assert_cmpint(program_state->n_bound_attribute_names, ==, 0);
+            c_assert_cmpint(name_state->fixed_location, !=, gl_location);
+            cg_object_unref(dummy_attribute);
+        } else
+            c_assert_cmpint(name_state->fixed_location, ==, gl_location);
+
+        cg_object_unref(pipeline);
+
+        test_cg_fini();
+    }
+
+    c_unsetenv("CG_PROGRAM_CACHE_DIR");
+
+    dir = c_dir_open(template, 0, NULL);
+    c_assert(dir != NULL);
+    while ((name = c_dir_read_name(dir))) {
+        char *filename = c_build_filename(template, name, NULL);
+        c_unlink(filename);
+        c_free(filename);
+    }
+    c_dir_close(dir);
+    c_rmdir(template);
+}
+
+#endif /* C_PLATFORM_UNIX */
+
+#endif /* ENABLE_UNIT_TESTS */
+
 #endif /* CG_PIPELINE_PROGEND_GLSL */
@@ -61,6 +61,10 @@ typedef struct {
     cg_device_t *dev;
 
     GLuint gl_shader;
+    /* The shader is only compiled once it's needed to link a program
+     * that couldn't be loaded from the program binary cache */
+    bool compiled;
+    uint64_t source_hash;
     c_string_t *header, *source;
 
     cg_pipeline_cache_entry_t *cache_entry;
@@ -94,7 +98,7 @@ destroy_shader_state(void *user_data, void *instance)
 
     if (shader_state->cache_entry &&
         shader_state->cache_entry->pipeline != instance)
-        shader_state->cache_entry->usage_count--;
+        _cg_pipeline_cache_entry_remove_usage(shader_state->cache_entry);
 
     if (--shader_state->ref_count == 0) {
         if (shader_state->gl_shader)
@@ -115,7 +119,7 @@ set_shader_state(cg_pipeline_t *pipeline,
          * mark it as a usage of the pipeline cache entry */
         if (shader_state->cache_entry &&
             shader_state->cache_entry->pipeline != pipeline)
-            shader_state->cache_entry->usage_count++;
+            _cg_pipeline_cache_entry_add_usage(shader_state->cache_entry);
     }
 
     _cg_object_set_user_data(CG_OBJECT(pipeline),
@@ -135,12 +139,49 @@ _cg_pipeline_vertend_glsl_get_shader(cg_pipeline_t *pipeline)
 {
     cg_pipeline_shader_state_t *shader_state = get_shader_state(pipeline);
 
+    if (shader_state == NULL)
+        return 0;
+
+    if (!shader_state->compiled && shader_state->gl_shader) {
+        CG_STATIC_COUNTER(vertend_glsl_compile_counter,
+                          "glsl vertex compile counter",
+                          "Increments each time a new GLSL "
+                          "vertex shader is compiled",
+                          0 /* no application private data */);
+        CG_COUNTER_INC(_cg_uprof_context, vertend_glsl_compile_counter);
+        _cg_pipeline_cache_count_compile(shader_state->dev->pipeline_cache,
+                                         CG_PIPELINE_CACHE_TABLE_VERTEX);
+
+        _cg_glsl_shader_compile(shader_state->dev, shader_state->gl_shader);
+        shader_state->compiled = true;
+    }
+
+    return shader_state->gl_shader;
+}
+
+uint64_t
+_cg_pipeline_vertend_glsl_get_source_hash(cg_pipeline_t *pipeline)
+{
+    cg_pipeline_shader_state_t *shader_state = get_shader_state(pipeline);
+
     if (shader_state)
-        return shader_state->gl_shader;
+        return shader_state->source_hash;
     else
         return 0;
 }
 
+char *
+_cg_pipeline_vertend_glsl_get_source(cg_pipeline_t *pipeline)
+{
+    cg_pipeline_shader_state_t *shader_state = get_shader_state(pipeline);
+
+    if (shader_state == NULL || shader_state->gl_shader == 0)
+        return NULL;
+
+    return _cg_glsl_shader_get_source(shader_state->dev,
+                                      shader_state->gl_shader);
+}
+
 static cg_pipeline_snippet_list_t *
 get_vertex_snippets(cg_pipeline_t *pipeline)
 {
@@ -381,20 +422,19 @@ _cg_pipeline_vertend_glsl_end(cg_device_t *dev,
     if (shader_state->source) {
         const char *source_strings[2];
         GLint lengths[2];
-        GLint compile_status;
         GLuint shader;
         cg_pipeline_snippet_data_t snippet_data;
         cg_pipeline_snippet_list_t *vertex_snippets;
         bool has_per_vertex_point_size =
             cg_pipeline_get_per_vertex_point_size(pipeline);
 
-        CG_STATIC_COUNTER(vertend_glsl_compile_counter,
-                          "glsl vertex compile counter",
-                          "Increments each time a new GLSL "
-                          "vertex shader is compiled",
-                          0 /* no application private data */);
-        CG_COUNTER_INC(_cg_uprof_context, vertend_glsl_compile_counter);
-
+        /* TODO: when the combined matrix is a 2D affine transform
+         * (see c_matrix_is_2d_affine()) this could use a variant that
+         * only takes the six values of a mat3x2 to reduce the uniform
+         * bandwidth. That needs non-square matrices which GLSL ES 1.00
+         * doesn't have, a separate program per variant and a way to
+         * keep cg_modelview_projection_matrix working for snippets
+         * that read it. */
         c_string_append(shader_state->header,
                         "void\n"
                         "_cg_default_vertex_transform ()\n"
@@ -478,29 +518,18 @@ _cg_pipeline_vertend_glsl_end(cg_device_t *dev,
         lengths[1] = shader_state->source->len;
         source_strings[1] = shader_state->source->str;
 
-        _cg_glsl_shader_set_source_with_boilerplate(dev,
-                                                    shader,
-                                                    GL_VERTEX_SHADER,
-                                                    2, /* count */
-                                                    source_strings,
-                                                    lengths);
-
-        GE(dev, glCompileShader(shader));
-        GE(dev, glGetShaderiv(shader, GL_COMPILE_STATUS, &compile_status));
-
-        if (!compile_status) {
-            GLint len = 0;
-            char *shader_log;
-
-            GE(dev, glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &len));
-            shader_log = c_alloca(len);
-            GE(dev, glGetShaderInfoLog(shader, len, &len, shader_log));
-            c_warning("Shader compilation failed:\n%s", shader_log);
-        }
+        shader_state->source_hash =
+            _cg_glsl_shader_set_source_with_boilerplate(dev,
+                                                        shader,
+                                                        GL_VERTEX_SHADER,
+                                                        2, /* count */
+                                                        source_strings,
+                                                        lengths);
 
         shader_state->header = NULL;
         shader_state->source = NULL;
         shader_state->gl_shader = shader;
+        shader_state->compiled = false;
     }
 
 #ifdef CG_HAS_GL_SUPPORT
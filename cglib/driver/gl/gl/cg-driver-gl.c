@@ -766,6 +766,29 @@ _cg_driver_update_features(cg_device_t *dev, cg_error_t **error)
                      true);
     }
 
+    /* The builtin matrices can be shared between all of the programs
+     * with a uniform block. Declaring the block needs GLSL 1.40 which
+     * is available with the 3.1 core profile */
+    if (gl_major >= 3 && dev->glGetUniformBlockIndex &&
+        CG_CHECK_GL_VERSION(dev->glsl_major, dev->glsl_minor, 1, 4) &&
+        !CG_DEBUG_ENABLED(CG_DEBUG_DISABLE_UNIFORM_BUFFERS)) {
+        dev->glsl_version_to_use = 140;
+        CG_FLAGS_SET(private_features,
+                     CG_PRIVATE_FEATURE_UNIFORM_BUFFER_OBJECTS,
+                     true);
+    }
+
+    /* Used to assign fixed locations to attribute names */
+    GE(dev, glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &dev->max_vertex_attribs));
+
+    /* Vertex array objects let the attribute state of a primitive be
+     * captured once and rebound with a single call */
+    if (dev->glGenVertexArrays &&
+        !CG_DEBUG_ENABLED(CG_DEBUG_DISABLE_VERTEX_ARRAYS))
+        CG_FLAGS_SET(private_features,
+                     CG_PRIVATE_FEATURE_VERTEX_ARRAY_OBJECTS,
+                     true);
+
     if (dev->driver == CG_DRIVER_GL) {
         /* Not available in GL 3 */
         CG_FLAGS_SET(private_features, CG_PRIVATE_FEATURE_QUADS, true);
@@ -821,6 +844,7 @@ const cg_driver_vtable_t _cg_driver_gl = {
     _cg_framebuffer_gl_discard_buffers,
     _cg_framebuffer_gl_draw_attributes,
     _cg_framebuffer_gl_draw_indexed_attributes,
+    _cg_framebuffer_gl_multi_draw_attributes,
     _cg_framebuffer_gl_read_pixels_into_bitmap,
     _cg_texture_2d_gl_free,
     _cg_texture_2d_gl_can_create,
@@ -772,6 +772,17 @@ _cg_driver_update_features(cg_device_t *dev,
     if (dev->glDrawArraysInstanced)
         CG_FLAGS_SET(dev->features, CG_FEATURE_ID_INSTANCES, true);
 
+    /* Used to assign fixed locations to attribute names */
+    GE(dev, glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &dev->max_vertex_attribs));
+
+    /* Vertex array objects let the attribute state of a primitive be
+     * captured once and rebound with a single call */
+    if (dev->glGenVertexArrays &&
+        !CG_DEBUG_ENABLED(CG_DEBUG_DISABLE_VERTEX_ARRAYS))
+        CG_FLAGS_SET(private_features,
+                     CG_PRIVATE_FEATURE_VERTEX_ARRAY_OBJECTS,
+                     true);
+
     /* Cache features */
     for (i = 0; i < C_N_ELEMENTS(private_features); i++)
         dev->private_features[i] |= private_features[i];
@@ -794,6 +805,7 @@ const cg_driver_vtable_t _cg_driver_gles = {
     _cg_framebuffer_gl_discard_buffers,
     _cg_framebuffer_gl_draw_attributes,
     _cg_framebuffer_gl_draw_indexed_attributes,
+    _cg_framebuffer_gl_multi_draw_attributes,
     _cg_framebuffer_gl_read_pixels_into_bitmap,
     _cg_texture_2d_gl_free,
     _cg_texture_2d_gl_can_create,
@@ -37,10 +37,11 @@
 #include "cg-types.h"
 #include "cg-device-private.h"
 
-void _cg_nop_flush_attributes_state(cg_framebuffer_t *framebuffer,
+bool _cg_nop_flush_attributes_state(cg_framebuffer_t *framebuffer,
                                     cg_pipeline_t *pipeline,
                                     cg_flush_layer_state_t *layers_state,
                                     cg_draw_flags_t flags,
+                                    cg_primitive_t *primitive,
                                     cg_attribute_t **attributes,
                                     int n_attributes);
 
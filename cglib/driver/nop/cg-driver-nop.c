@@ -65,6 +65,7 @@ const cg_driver_vtable_t _cg_driver_nop = {
     _cg_framebuffer_nop_discard_buffers,
     _cg_framebuffer_nop_draw_attributes,
     _cg_framebuffer_nop_draw_indexed_attributes,
+    _cg_framebuffer_nop_multi_draw_attributes,
     _cg_framebuffer_nop_read_pixels_into_bitmap,
     _cg_texture_2d_nop_free,
     _cg_texture_2d_nop_can_create,
@@ -87,6 +87,7 @@ _cg_framebuffer_nop_draw_attributes(cg_framebuffer_t *framebuffer,
                                     cg_vertices_mode_t mode,
                                     int first_vertex,
                                     int n_vertices,
+                                    cg_primitive_t *primitive,
                                     cg_attribute_t **attributes,
                                     int n_attributes,
                                     int n_instances,
@@ -101,6 +102,7 @@ _cg_framebuffer_nop_draw_indexed_attributes(cg_framebuffer_t *framebuffer,
                                             int first_vertex,
                                             int n_vertices,
                                             cg_indices_t *indices,
+                                            cg_primitive_t *primitive,
                                             cg_attribute_t **attributes,
                                             int n_attributes,
                                             int n_instances,
@@ -108,6 +110,20 @@ _cg_framebuffer_nop_draw_indexed_attributes(cg_framebuffer_t *framebuffer,
 {
 }
 
+void
+_cg_framebuffer_nop_multi_draw_attributes(cg_framebuffer_t *framebuffer,
+                                          cg_pipeline_t *pipeline,
+                                          cg_vertices_mode_t mode,
+                                          const int *first_vertices,
+                                          const int *n_vertices,
+                                          cg_indices_t **indices,
+                                          int n_draws,
+                                          cg_attribute_t **attributes,
+                                          int n_attributes,
+                                          cg_draw_flags_t flags)
+{
+}
+
 bool
 _cg_framebuffer_nop_read_pixels_into_bitmap(cg_framebuffer_t *framebuffer,
                                             int x,
@@ -258,7 +258,7 @@ CG_EXT_END()
 CG_EXT_BEGIN(vertex_array_object,
              3,
              0,
-             0, /* not in GLES */
+             CG_EXT_IN_GLES3,
              "ARB\0OES\0",
              "vertex_array_object\0")
 CG_EXT_FUNCTION(void, glBindVertexArray, (GLuint array))
@@ -311,6 +311,52 @@ CG_EXT_FUNCTION(void, glDrawBuffers, (GLsizei n, const GLenum *bufs))
 CG_EXT_END()
 
 
+CG_EXT_BEGIN(multi_draw_arrays, 1, 4, 0, "EXT\0", "multi_draw_arrays\0")
+CG_EXT_FUNCTION(void, glMultiDrawArrays,
+                (GLenum mode,
+                 const GLint *first,
+                 const GLsizei *count,
+                 GLsizei drawcount))
+CG_EXT_FUNCTION(void, glMultiDrawElements,
+                (GLenum mode,
+                 const GLsizei *count,
+                 GLenum type,
+                 const GLvoid *const *indices,
+                 GLsizei drawcount))
+CG_EXT_END()
+
+CG_EXT_BEGIN(get_program_binary, 4, 1, CG_EXT_IN_GLES3, "ARB:\0OES\0", "get_program_binary\0")
+CG_EXT_FUNCTION(void, glGetProgramBinary,
+                (GLuint program,
+                 GLsizei bufSize,
+                 GLsizei *length,
+                 GLenum *binaryFormat,
+                 GLvoid *binary))
+CG_EXT_FUNCTION(void, glProgramBinary,
+                (GLuint program,
+                 GLenum binaryFormat,
+                 const GLvoid *binary,
+                 GLint length))
+CG_EXT_END()
+
+/* OES_get_program_binary doesn't have glProgramParameteri so it is
+ * kept separate so the rest of the feature is still available there */
+CG_EXT_BEGIN(program_parameteri, 4, 1, CG_EXT_IN_GLES3, "ARB:\0", "get_program_binary\0")
+CG_EXT_FUNCTION(void, glProgramParameteri,
+                (GLuint program,
+                 GLenum pname,
+                 GLint value))
+CG_EXT_END()
+
+CG_EXT_BEGIN(parallel_shader_compile,
+             255,
+             255,
+             0, /* not in GLES */
+             "KHR\0ARB\0",
+             "parallel_shader_compile\0")
+CG_EXT_FUNCTION(void, glMaxShaderCompilerThreads, (GLuint count))
+CG_EXT_END()
+
 CG_EXT_BEGIN(instanced_arrays, 3, 1, CG_EXT_IN_GLES3, "ANGLE\0ARB\0EXT\0", "instanced_arrays\0")
 CG_EXT_FUNCTION(void, glVertexAttribDivisor, (GLuint index, GLuint divisor))
 CG_EXT_FUNCTION(void, glDrawArraysInstanced,
@@ -322,3 +368,26 @@ CG_EXT_FUNCTION(void, glDrawElementsInstanced,
                  const GLvoid *indices,
                  GLsizei primcount))
 CG_EXT_END()
+
+CG_EXT_BEGIN(uniform_buffer_object,
+             3,
+             1,
+             CG_EXT_IN_GLES3,
+             "ARB:\0",
+             "uniform_buffer_object\0")
+CG_EXT_FUNCTION(GLuint,
+                glGetUniformBlockIndex,
+                (GLuint program, const GLchar *uniformBlockName))
+CG_EXT_FUNCTION(void,
+                glUniformBlockBinding,
+                (GLuint program,
+                 GLuint uniformBlockIndex,
+                 GLuint uniformBlockBinding))
+CG_EXT_FUNCTION(void,
+                glBindBufferRange,
+                (GLenum target,
+                 GLuint index,
+                 GLuint buffer,
+                 GLintptr offset,
+                 GLsizeiptr size))
+CG_EXT_END()
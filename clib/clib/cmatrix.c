@@ -66,8 +66,25 @@
 
 #include <clib.h>
 
+#include <test-fixtures/test.h>
+
 #include "cquaternion-private.h"
 
+/* Use vector instructions for the multiplication and point
+ * transformation kernels when the compiler targets a CPU that is
+ * guaranteed to have them. SSE2 is part of the x86-64 baseline and
+ * NEON is part of the AArch64 baseline so in practice this covers
+ * most builds without needing any runtime checks. */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define C_MATRIX_USE_SSE2
+#define C_MATRIX_USE_SIMD
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define C_MATRIX_USE_NEON
+#define C_MATRIX_USE_SIMD
+#endif
+
 #define _MATRIX_DEBUG_PRINT(MATRIX) do {} while(0)
 #if 0
 #define _MATRIX_DEBUG_PRINT(MATRIX)                         \
@@ -203,6 +220,10 @@ static float identity[16] = { 1.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0,
 #define B(row, col) b[(col << 2) + row]
 #define R(row, col) result[(col << 2) + row]
 
+/* The scalar kernels are only needed as a reference for the unit
+ * tests when the vector kernels are in use */
+#if !defined(C_MATRIX_USE_SIMD) || defined(ENABLE_UNIT_TESTS)
+
 /*
  * Perform a full 4x4 matrix multiplication.
  *
@@ -248,10 +269,196 @@ matrix_multiply3x4(float *result, const float *a, const float *b)
     R(3, 3) = 1;
 }
 
+/*
+ * Multiply two 2D affine matrices, ie, matrices where only the x and y
+ * rows of columns 0, 1 and 3 differ from the identity matrix. The rest
+ * of the result is the identity.
+ *
+ * <note>12 multiplications instead of the 36 of
+ * matrix_multiply3x4()</note>
+ */
+static void
+matrix_multiply2d(float *result, const float *a, const float *b)
+{
+    const float a00 = A(0, 0), a01 = A(0, 1), a03 = A(0, 3);
+    const float a10 = A(1, 0), a11 = A(1, 1), a13 = A(1, 3);
+
+    R(0, 0) = a00 * B(0, 0) + a01 * B(1, 0);
+    R(1, 0) = a10 * B(0, 0) + a11 * B(1, 0);
+    R(0, 1) = a00 * B(0, 1) + a01 * B(1, 1);
+    R(1, 1) = a10 * B(0, 1) + a11 * B(1, 1);
+    R(0, 3) = a00 * B(0, 3) + a01 * B(1, 3) + a03;
+    R(1, 3) = a10 * B(0, 3) + a11 * B(1, 3) + a13;
+
+    R(2, 0) = R(3, 0) = 0;
+    R(2, 1) = R(3, 1) = 0;
+    R(0, 2) = R(1, 2) = R(3, 2) = 0;
+    R(2, 2) = 1;
+    R(2, 3) = 0;
+    R(3, 3) = 1;
+}
+
+#endif /* !C_MATRIX_USE_SIMD || ENABLE_UNIT_TESTS */
+
+/*
+ * Checks the values of a matrix that is already known to have a bottom
+ * row of (0, 0, 0, 1) to see whether it only affects x and y.
+ */
+static bool
+matrix_is_2d(const float *m)
+{
+    return (m[2] == 0.0f && m[6] == 0.0f && m[8] == 0.0f && m[9] == 0.0f &&
+            m[10] == 1.0f && m[14] == 0.0f);
+}
+
 #undef A
 #undef B
 #undef R
 
+#ifdef C_MATRIX_USE_SIMD
+
+/* The vector kernels below work on whole columns of a matrix at a
+ * time. They perform the same multiplications and additions in the
+ * same order as the scalar versions so the results are the same,
+ * they just compute four rows at once. */
+
+#ifdef C_MATRIX_USE_SSE2
+
+typedef __m128 simd_float4_t;
+
+#define simd_load(p) _mm_loadu_ps(p)
+#define simd_splat(f) _mm_set1_ps(f)
+#define simd_mul(a, b) _mm_mul_ps(a, b)
+#define simd_add(a, b) _mm_add_ps(a, b)
+#define simd_store(p, v) _mm_storeu_ps(p, v)
+
+static inline void
+simd_store3(float *p, simd_float4_t v)
+{
+    _mm_storel_pi((__m64 *)p, v);
+    _mm_store_ss(p + 2, _mm_movehl_ps(v, v));
+}
+
+#else /* C_MATRIX_USE_SSE2 */
+
+typedef float32x4_t simd_float4_t;
+
+#define simd_load(p) vld1q_f32(p)
+#define simd_splat(f) vdupq_n_f32(f)
+#define simd_mul(a, b) vmulq_f32(a, b)
+#define simd_add(a, b) vaddq_f32(a, b)
+#define simd_store(p, v) vst1q_f32(p, v)
+
+static inline void
+simd_store3(float *p, simd_float4_t v)
+{
+    vst1_f32(p, vget_low_f32(v));
+    vst1q_lane_f32(p + 2, v, 2);
+}
+
+#endif /* C_MATRIX_USE_SSE2 */
+
+/*
+ * Vector version of matrix_multiply4x4().
+ *
+ * <note>All of @a is loaded before anything is written so @result == @a
+ * is allowed but @result != @b is still assumed.</note>
+ */
+static void
+matrix_multiply4x4_simd(float *result, const float *a, const float *b)
+{
+    simd_float4_t a0 = simd_load(a);
+    simd_float4_t a1 = simd_load(a + 4);
+    simd_float4_t a2 = simd_load(a + 8);
+    simd_float4_t a3 = simd_load(a + 12);
+    int j;
+
+    for (j = 0; j < 4; j++) {
+        const float *bj = b + j * 4;
+        simd_float4_t r;
+
+        r = simd_mul(a0, simd_splat(bj[0]));
+        r = simd_add(r, simd_mul(a1, simd_splat(bj[1])));
+        r = simd_add(r, simd_mul(a2, simd_splat(bj[2])));
+        r = simd_add(r, simd_mul(a3, simd_splat(bj[3])));
+
+        simd_store(result + j * 4, r);
+    }
+}
+
+/*
+ * Vector version of matrix_multiply3x4().
+ */
+static void
+matrix_multiply3x4_simd(float *result, const float *a, const float *b)
+{
+    simd_float4_t a0 = simd_load(a);
+    simd_float4_t a1 = simd_load(a + 4);
+    simd_float4_t a2 = simd_load(a + 8);
+    simd_float4_t a3 = simd_load(a + 12);
+    int j;
+
+    for (j = 0; j < 4; j++) {
+        const float *bj = b + j * 4;
+        simd_float4_t r;
+
+        r = simd_mul(a0, simd_splat(bj[0]));
+        r = simd_add(r, simd_mul(a1, simd_splat(bj[1])));
+        r = simd_add(r, simd_mul(a2, simd_splat(bj[2])));
+        if (j == 3)
+            r = simd_add(r, a3);
+
+        simd_store(result + j * 4, r);
+    }
+
+    /* The bottom row is assumed rather than calculated */
+    result[3] = 0;
+    result[7] = 0;
+    result[11] = 0;
+    result[15] = 1;
+}
+
+/*
+ * Vector version of matrix_multiply2d().
+ */
+static void
+matrix_multiply2d_simd(float *result, const float *a, const float *b)
+{
+    static const float z_column[4] = { 0.0f, 0.0f, 1.0f, 0.0f };
+    simd_float4_t a0 = simd_load(a);
+    simd_float4_t a1 = simd_load(a + 4);
+    simd_float4_t a3 = simd_load(a + 12);
+    simd_float4_t r0, r1, r3;
+
+    /* The z and w rows of the columns of @a are (0, 0) except for the
+     * last column where they are (0, 1) so these also produce the
+     * right values for the bottom two rows of the result */
+    r0 = simd_mul(a0, simd_splat(b[0]));
+    r0 = simd_add(r0, simd_mul(a1, simd_splat(b[1])));
+    r1 = simd_mul(a0, simd_splat(b[4]));
+    r1 = simd_add(r1, simd_mul(a1, simd_splat(b[5])));
+    r3 = simd_mul(a0, simd_splat(b[12]));
+    r3 = simd_add(r3, simd_mul(a1, simd_splat(b[13])));
+    r3 = simd_add(r3, a3);
+
+    simd_store(result, r0);
+    simd_store(result + 4, r1);
+    simd_store(result + 8, simd_load(z_column));
+    simd_store(result + 12, r3);
+}
+
+#define MATRIX_MULTIPLY_4X4 matrix_multiply4x4_simd
+#define MATRIX_MULTIPLY_3X4 matrix_multiply3x4_simd
+#define MATRIX_MULTIPLY_2D matrix_multiply2d_simd
+
+#else /* C_MATRIX_USE_SIMD */
+
+#define MATRIX_MULTIPLY_4X4 matrix_multiply4x4
+#define MATRIX_MULTIPLY_3X4 matrix_multiply3x4
+#define MATRIX_MULTIPLY_2D matrix_multiply2d
+
+#endif /* C_MATRIX_USE_SIMD */
+
 /*
  * Multiply a matrix by an array of floats with known properties.
  *
@@ -271,10 +478,13 @@ matrix_multiply_array_with_flags(c_matrix_t *result,
 {
     result->flags |= (flags | MAT_DIRTY_TYPE);
 
-    if (TEST_MAT_FLAGS(result, MAT_FLAGS_3D))
-        matrix_multiply3x4((float *)result, (float *)result, array);
-    else
-        matrix_multiply4x4((float *)result, (float *)result, array);
+    if (TEST_MAT_FLAGS(result, MAT_FLAGS_3D)) {
+        if (matrix_is_2d((float *)result) && matrix_is_2d(array))
+            MATRIX_MULTIPLY_2D((float *)result, (float *)result, array);
+        else
+            MATRIX_MULTIPLY_3X4((float *)result, (float *)result, array);
+    } else
+        MATRIX_MULTIPLY_4X4((float *)result, (float *)result, array);
 }
 
 /* Joins both flags and marks the type and inverse as dirty.  Calls
@@ -288,10 +498,13 @@ _c_matrix_multiply(c_matrix_t *result,
 {
     result->flags = (a->flags | b->flags | MAT_DIRTY_TYPE);
 
-    if (TEST_MAT_FLAGS(result, MAT_FLAGS_3D))
-        matrix_multiply3x4((float *)result, (float *)a, (float *)b);
-    else
-        matrix_multiply4x4((float *)result, (float *)a, (float *)b);
+    if (TEST_MAT_FLAGS(result, MAT_FLAGS_3D)) {
+        if (matrix_is_2d((float *)a) && matrix_is_2d((float *)b))
+            MATRIX_MULTIPLY_2D((float *)result, (float *)a, (float *)b);
+        else
+            MATRIX_MULTIPLY_3X4((float *)result, (float *)a, (float *)b);
+    } else
+        MATRIX_MULTIPLY_4X4((float *)result, (float *)a, (float *)b);
 }
 
 void
@@ -1938,6 +2151,8 @@ typedef struct _point4f_t {
     float w;
 } point4f_t;
 
+#if !defined(C_MATRIX_USE_SIMD) || defined(ENABLE_UNIT_TESTS)
+
 static void
 _c_matrix_transform_points_f2(const c_matrix_t *matrix,
                                size_t stride_in,
@@ -2052,6 +2267,167 @@ _c_matrix_project_points_f4(const c_matrix_t *matrix,
     }
 }
 
+#endif /* !C_MATRIX_USE_SIMD || ENABLE_UNIT_TESTS */
+
+#ifdef C_MATRIX_USE_SIMD
+
+static void
+_c_matrix_transform_points_f2_simd(const c_matrix_t *matrix,
+                                    size_t stride_in,
+                                    const void *points_in,
+                                    size_t stride_out,
+                                    void *points_out,
+                                    int n_points)
+{
+    const float *m = (const float *)matrix;
+    simd_float4_t c0 = simd_load(m);
+    simd_float4_t c1 = simd_load(m + 4);
+    simd_float4_t c3 = simd_load(m + 12);
+    int i;
+
+    for (i = 0; i < n_points; i++) {
+        point2f_t p = *(point2f_t *)((uint8_t *)points_in + i * stride_in);
+        point3f_t *o = (point3f_t *)((uint8_t *)points_out + i * stride_out);
+        simd_float4_t r;
+
+        r = simd_mul(c0, simd_splat(p.x));
+        r = simd_add(r, simd_mul(c1, simd_splat(p.y)));
+        r = simd_add(r, c3);
+
+        simd_store3(&o->x, r);
+    }
+}
+
+static void
+_c_matrix_project_points_f2_simd(const c_matrix_t *matrix,
+                                  size_t stride_in,
+                                  const void *points_in,
+                                  size_t stride_out,
+                                  void *points_out,
+                                  int n_points)
+{
+    const float *m = (const float *)matrix;
+    simd_float4_t c0 = simd_load(m);
+    simd_float4_t c1 = simd_load(m + 4);
+    simd_float4_t c3 = simd_load(m + 12);
+    int i;
+
+    for (i = 0; i < n_points; i++) {
+        point2f_t p = *(point2f_t *)((uint8_t *)points_in + i * stride_in);
+        point4f_t *o = (point4f_t *)((uint8_t *)points_out + i * stride_out);
+        simd_float4_t r;
+
+        r = simd_mul(c0, simd_splat(p.x));
+        r = simd_add(r, simd_mul(c1, simd_splat(p.y)));
+        r = simd_add(r, c3);
+
+        simd_store(&o->x, r);
+    }
+}
+
+static void
+_c_matrix_transform_points_f3_simd(const c_matrix_t *matrix,
+                                    size_t stride_in,
+                                    const void *points_in,
+                                    size_t stride_out,
+                                    void *points_out,
+                                    int n_points)
+{
+    const float *m = (const float *)matrix;
+    simd_float4_t c0 = simd_load(m);
+    simd_float4_t c1 = simd_load(m + 4);
+    simd_float4_t c2 = simd_load(m + 8);
+    simd_float4_t c3 = simd_load(m + 12);
+    int i;
+
+    for (i = 0; i < n_points; i++) {
+        point3f_t p = *(point3f_t *)((uint8_t *)points_in + i * stride_in);
+        point3f_t *o = (point3f_t *)((uint8_t *)points_out + i * stride_out);
+        simd_float4_t r;
+
+        r = simd_mul(c0, simd_splat(p.x));
+        r = simd_add(r, simd_mul(c1, simd_splat(p.y)));
+        r = simd_add(r, simd_mul(c2, simd_splat(p.z)));
+        r = simd_add(r, c3);
+
+        simd_store3(&o->x, r);
+    }
+}
+
+static void
+_c_matrix_project_points_f3_simd(const c_matrix_t *matrix,
+                                  size_t stride_in,
+                                  const void *points_in,
+                                  size_t stride_out,
+                                  void *points_out,
+                                  int n_points)
+{
+    const float *m = (const float *)matrix;
+    simd_float4_t c0 = simd_load(m);
+    simd_float4_t c1 = simd_load(m + 4);
+    simd_float4_t c2 = simd_load(m + 8);
+    simd_float4_t c3 = simd_load(m + 12);
+    int i;
+
+    for (i = 0; i < n_points; i++) {
+        point3f_t p = *(point3f_t *)((uint8_t *)points_in + i * stride_in);
+        point4f_t *o = (point4f_t *)((uint8_t *)points_out + i * stride_out);
+        simd_float4_t r;
+
+        r = simd_mul(c0, simd_splat(p.x));
+        r = simd_add(r, simd_mul(c1, simd_splat(p.y)));
+        r = simd_add(r, simd_mul(c2, simd_splat(p.z)));
+        r = simd_add(r, c3);
+
+        simd_store(&o->x, r);
+    }
+}
+
+static void
+_c_matrix_project_points_f4_simd(const c_matrix_t *matrix,
+                                  size_t stride_in,
+                                  const void *points_in,
+                                  size_t stride_out,
+                                  void *points_out,
+                                  int n_points)
+{
+    const float *m = (const float *)matrix;
+    simd_float4_t c0 = simd_load(m);
+    simd_float4_t c1 = simd_load(m + 4);
+    simd_float4_t c2 = simd_load(m + 8);
+    simd_float4_t c3 = simd_load(m + 12);
+    int i;
+
+    for (i = 0; i < n_points; i++) {
+        point4f_t p = *(point4f_t *)((uint8_t *)points_in + i * stride_in);
+        point4f_t *o = (point4f_t *)((uint8_t *)points_out + i * stride_out);
+        simd_float4_t r;
+
+        r = simd_mul(c0, simd_splat(p.x));
+        r = simd_add(r, simd_mul(c1, simd_splat(p.y)));
+        r = simd_add(r, simd_mul(c2, simd_splat(p.z)));
+        r = simd_add(r, simd_mul(c3, simd_splat(p.w)));
+
+        simd_store(&o->x, r);
+    }
+}
+
+#define TRANSFORM_POINTS_F2 _c_matrix_transform_points_f2_simd
+#define PROJECT_POINTS_F2 _c_matrix_project_points_f2_simd
+#define TRANSFORM_POINTS_F3 _c_matrix_transform_points_f3_simd
+#define PROJECT_POINTS_F3 _c_matrix_project_points_f3_simd
+#define PROJECT_POINTS_F4 _c_matrix_project_points_f4_simd
+
+#else /* C_MATRIX_USE_SIMD */
+
+#define TRANSFORM_POINTS_F2 _c_matrix_transform_points_f2
+#define PROJECT_POINTS_F2 _c_matrix_project_points_f2
+#define TRANSFORM_POINTS_F3 _c_matrix_transform_points_f3
+#define PROJECT_POINTS_F3 _c_matrix_project_points_f3
+#define PROJECT_POINTS_F4 _c_matrix_project_points_f4
+
+#endif /* C_MATRIX_USE_SIMD */
+
 void
 c_matrix_transform_points(const c_matrix_t *matrix,
                            int n_components,
@@ -2065,12 +2441,12 @@ c_matrix_transform_points(const c_matrix_t *matrix,
     c_return_if_fail(stride_out >= sizeof(point3f_t));
 
     if (n_components == 2)
-        _c_matrix_transform_points_f2(
+        TRANSFORM_POINTS_F2(
             matrix, stride_in, points_in, stride_out, points_out, n_points);
     else {
         c_return_if_fail(n_components == 3);
 
-        _c_matrix_transform_points_f3(
+        TRANSFORM_POINTS_F3(
             matrix, stride_in, points_in, stride_out, points_out, n_points);
     }
 }
@@ -2085,15 +2461,15 @@ c_matrix_project_points(const c_matrix_t *matrix,
                          int n_points)
 {
     if (n_components == 2)
-        _c_matrix_project_points_f2(
+        PROJECT_POINTS_F2(
             matrix, stride_in, points_in, stride_out, points_out, n_points);
     else if (n_components == 3)
-        _c_matrix_project_points_f3(
+        PROJECT_POINTS_F3(
             matrix, stride_in, points_in, stride_out, points_out, n_points);
     else {
         c_return_if_fail(n_components == 4);
 
-        _c_matrix_project_points_f4(
+        PROJECT_POINTS_F4(
             matrix, stride_in, points_in, stride_out, points_out, n_points);
     }
 }
@@ -2108,6 +2484,29 @@ c_matrix_is_identity(const c_matrix_t *matrix)
         return memcmp(matrix, identity, sizeof(float) * 16) == 0;
 }
 
+bool
+c_matrix_is_2d_affine(const c_matrix_t *matrix)
+{
+    const float *m = (const float *)matrix;
+
+    if (!(matrix->flags & MAT_DIRTY_TYPE)) {
+        switch (matrix->type) {
+        case C_MATRIX_TYPE_IDENTITY:
+        case C_MATRIX_TYPE_2D:
+        case C_MATRIX_TYPE_2D_NO_ROT:
+            return true;
+        case C_MATRIX_TYPE_GENERAL:
+        case C_MATRIX_TYPE_PERSPECTIVE:
+            return false;
+        default:
+            break;
+        }
+    }
+
+    return (matrix_is_2d(m) && m[3] == 0.0f && m[7] == 0.0f &&
+            m[11] == 0.0f && m[15] == 1.0f);
+}
+
 void
 c_matrix_look_at(c_matrix_t *matrix,
                   float eye_position_x,
@@ -2185,3 +2584,148 @@ c_matrix_transpose(c_matrix_t *matrix)
 
     c_matrix_init_from_array(matrix, new_values);
 }
+
+#ifdef ENABLE_UNIT_TESTS
+
+static void
+assert_floats_close(const float *expected, const float *actual, int n)
+{
+    int i;
+
+    /* The vector kernels use the same order of operations so on most
+     * targets the results are identical, but allow for a little error
+     * in case the scalar code was compiled to use extended precision */
+    for (i = 0; i < n; i++)
+        c_assert(fabsf(expected[i] - actual[i]) <=
+                 1e-5f * MAX(1.0f, fabsf(expected[i])));
+}
+
+TEST(check_matrix_kernels)
+{
+    float a[16], b[16], expected[16], result[16];
+    c_matrix_t matrix;
+    float points_in[64 * 4];
+    float expected_out[64 * 4], points_out[64 * 4];
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        a[i] = sinf(i + 1) * 10.0f;
+        b[i] = cosf(i * 3 + 1) * 5.0f;
+    }
+    for (i = 0; i < C_N_ELEMENTS(points_in); i++)
+        points_in[i] = sinf(i * 0.37f) * 100.0f;
+
+    matrix_multiply4x4(expected, a, b);
+    MATRIX_MULTIPLY_4X4(result, a, b);
+    assert_floats_close(expected, result, 16);
+
+    /* Multiplying in place is allowed for the left hand matrix */
+    memcpy(result, a, sizeof(result));
+    MATRIX_MULTIPLY_4X4(result, result, b);
+    assert_floats_close(expected, result, 16);
+
+    a[3] = a[7] = a[11] = b[3] = b[7] = b[11] = 0.0f;
+    a[15] = b[15] = 1.0f;
+
+    matrix_multiply3x4(expected, a, b);
+    MATRIX_MULTIPLY_3X4(result, a, b);
+    assert_floats_close(expected, result, 16);
+
+    memcpy(result, a, sizeof(result));
+    MATRIX_MULTIPLY_3X4(result, result, b);
+    assert_floats_close(expected, result, 16);
+
+    c_matrix_init_from_array(&matrix, b);
+
+    /* Transformed points are written with a tight stride of three
+     * floats so this also checks that nothing is written past the end
+     * of each point */
+    memset(expected_out, 0, sizeof(expected_out));
+    memset(points_out, 0, sizeof(points_out));
+    _c_matrix_transform_points_f2(&matrix,
+                                   sizeof(float) * 4, points_in,
+                                   sizeof(point3f_t), expected_out,
+                                   64);
+    TRANSFORM_POINTS_F2(&matrix,
+                        sizeof(float) * 4, points_in,
+                        sizeof(point3f_t), points_out,
+                        64);
+    assert_floats_close(expected_out, points_out, C_N_ELEMENTS(points_out));
+
+    _c_matrix_transform_points_f3(&matrix,
+                                   sizeof(float) * 4, points_in,
+                                   sizeof(point3f_t), expected_out,
+                                   64);
+    TRANSFORM_POINTS_F3(&matrix,
+                        sizeof(float) * 4, points_in,
+                        sizeof(point3f_t), points_out,
+                        64);
+    assert_floats_close(expected_out, points_out, C_N_ELEMENTS(points_out));
+
+    _c_matrix_project_points_f2(&matrix,
+                                 sizeof(float) * 4, points_in,
+                                 sizeof(point4f_t), expected_out,
+                                 64);
+    PROJECT_POINTS_F2(&matrix,
+                      sizeof(float) * 4, points_in,
+                      sizeof(point4f_t), points_out,
+                      64);
+    assert_floats_close(expected_out, points_out, C_N_ELEMENTS(points_out));
+
+    _c_matrix_project_points_f3(&matrix,
+                                 sizeof(float) * 4, points_in,
+                                 sizeof(point4f_t), expected_out,
+                                 64);
+    PROJECT_POINTS_F3(&matrix,
+                      sizeof(float) * 4, points_in,
+                      sizeof(point4f_t), points_out,
+                      64);
+    assert_floats_close(expected_out, points_out, C_N_ELEMENTS(points_out));
+
+    _c_matrix_project_points_f4(&matrix,
+                                 sizeof(float) * 4, points_in,
+                                 sizeof(point4f_t), expected_out,
+                                 64);
+    PROJECT_POINTS_F4(&matrix,
+                      sizeof(float) * 4, points_in,
+                      sizeof(point4f_t), points_out,
+                      64);
+    assert_floats_close(expected_out, points_out, C_N_ELEMENTS(points_out));
+
+    /* 2D affine matrices should give the same result as the 3x4
+     * multiplication */
+    memcpy(a, identity, sizeof(a));
+    memcpy(b, identity, sizeof(b));
+    for (i = 0; i < 2; i++) {
+        a[i] = sinf(i + 1) * 10.0f;
+        a[i + 4] = sinf(i + 5) * 10.0f;
+        a[i + 12] = sinf(i + 13) * 10.0f;
+        b[i] = cosf(i * 3 + 1) * 5.0f;
+        b[i + 4] = cosf(i * 3 + 13) * 5.0f;
+        b[i + 12] = cosf(i * 3 + 37) * 5.0f;
+    }
+
+    matrix_multiply3x4(expected, a, b);
+    matrix_multiply2d(result, a, b);
+    assert_floats_close(expected, result, 16);
+    MATRIX_MULTIPLY_2D(result, a, b);
+    assert_floats_close(expected, result, 16);
+
+    memcpy(result, a, sizeof(result));
+    MATRIX_MULTIPLY_2D(result, result, b);
+    assert_floats_close(expected, result, 16);
+
+    c_matrix_init_identity(&matrix);
+    c_assert(c_matrix_is_2d_affine(&matrix));
+    c_matrix_translate(&matrix, 5.0f, 6.0f, 0.0f);
+    c_matrix_rotate(&matrix, 30.0f, 0.0f, 0.0f, 1.0f);
+    c_matrix_scale(&matrix, 2.0f, 3.0f, 1.0f);
+    c_assert(c_matrix_is_2d_affine(&matrix));
+    c_matrix_rotate(&matrix, 30.0f, 1.0f, 0.0f, 0.0f);
+    c_assert(!c_matrix_is_2d_affine(&matrix));
+    c_matrix_init_identity(&matrix);
+    c_matrix_orthographic(&matrix, 0, 0, 100, 100, -1, 1);
+    c_assert(!c_matrix_is_2d_affine(&matrix));
+}
+
+#endif /* ENABLE_UNIT_TESTS */
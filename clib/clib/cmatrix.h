@@ -636,6 +636,22 @@ void c_matrix_project_points(const c_matrix_t *matrix,
  */
 bool c_matrix_is_identity(const c_matrix_t *matrix);
 
+/**
+ * c_matrix_is_2d_affine:
+ * @matrix: A #c_matrix_t
+ *
+ * Determines if the given matrix only transforms the x and y axes.
+ * That is, the matrix can be any combination of 2D translation,
+ * scaling, shearing and rotation around the z axis and it leaves z and
+ * w unchanged. Such a matrix is fully described by the six values of
+ * a 3x2 affine transform.
+ *
+ * Returns: %true if @matrix is a 2D affine transform else %false
+ *
+ * Stability: unstable
+ */
+bool c_matrix_is_2d_affine(const c_matrix_t *matrix);
+
 /**
  * c_matrix_transpose:
  * @matrix: A #c_matrix_t